@@ -0,0 +1,478 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "arena.h"
+
+#include <sys/mman.h>
+
+// how a buffer was allocated 
+#define RUNFS_ARENA_KIND_HEAP           1
+#define RUNFS_ARENA_KIND_MAP            2
+#define RUNFS_ARENA_KIND_HUGETLB        3
+
+// precedes every buffer.  16 bytes, so the buffer keeps malloc's alignment.
+struct runfs_arena_header {
+   
+   uint64_t len;                        // length of the mapping (for mapped buffers), or of the buffer (for heap ones)
+   uint32_t kind;                       // RUNFS_ARENA_KIND_*
+   uint32_t reserved;
+};
+
+// a freed large buffer, waiting to be reclaimed, or a reclaimed mapping, waiting to be reused.
+// lives at the start of the buffer itself (over its header).
+struct runfs_arena_free_map {
+   
+   uint64_t len;                        // same as the header's 
+   uint32_t kind;                       // same as the header's 
+   uint32_t scrub;                      // if nonzero, zero it before giving it back 
+   struct runfs_arena_free_map* next;
+};
+
+// global allocator state.  Buffers are freed through the epoch, which only knows the pointer.
+struct runfs_arena {
+   
+   int huge_mode;
+   
+   pthread_mutex_t cache_lock;          // governs cache 
+   struct runfs_arena_free_map* cache;
+   
+   // background reclaimer, so freeing (and zeroing) a huge file doesn't stall whichever request thread frees it
+   pthread_t reclaimer;
+   bool reclaimer_running;
+   pthread_mutex_t pending_lock;        // governs pending and stop 
+   pthread_cond_t pending_cond;
+   struct runfs_arena_free_map* pending;
+   bool stop;
+   
+   atomic_uint_fast64_t pending_bytes;
+   atomic_uint_fast64_t reclaimed_bytes;
+   
+   atomic_uint_fast64_t mapped_bytes;
+   atomic_uint_fast64_t cached_bytes;
+   atomic_uint_fast64_t num_hugetlb;
+   atomic_uint_fast64_t num_fallbacks;
+};
+
+static struct runfs_arena runfs_arena;
+
+#define RUNFS_ARENA_HEADER( ptr )       ((struct runfs_arena_header*)((char*)(ptr) - sizeof(struct runfs_arena_header)))
+
+static void* runfs_arena_reclaimer_main( void* arg );
+
+// set up the allocator, and start its reclaimer 
+// return 0 on success 
+// return -errno on failure to start the reclaimer thread
+int runfs_arena_init( int huge_mode ) {
+   
+   int rc = 0;
+   
+   memset( &runfs_arena, 0, sizeof(runfs_arena) );
+   
+   runfs_arena.huge_mode = huge_mode;
+   pthread_mutex_init( &runfs_arena.cache_lock, NULL );
+   pthread_mutex_init( &runfs_arena.pending_lock, NULL );
+   pthread_cond_init( &runfs_arena.pending_cond, NULL );
+   
+   atomic_init( &runfs_arena.pending_bytes, 0 );
+   atomic_init( &runfs_arena.reclaimed_bytes, 0 );
+   atomic_init( &runfs_arena.mapped_bytes, 0 );
+   atomic_init( &runfs_arena.cached_bytes, 0 );
+   atomic_init( &runfs_arena.num_hugetlb, 0 );
+   atomic_init( &runfs_arena.num_fallbacks, 0 );
+   
+   rc = pthread_create( &runfs_arena.reclaimer, NULL, runfs_arena_reclaimer_main, NULL );
+   if( rc != 0 ) {
+      return -rc;
+   }
+   
+   runfs_arena.reclaimer_running = true;
+   return 0;
+}
+
+// stop the reclaimer (once it has reclaimed everything pending), and give back the cached mappings.
+// buffers still in use are the caller's problem.
+void runfs_arena_shutdown( void ) {
+   
+   if( runfs_arena.reclaimer_running ) {
+      
+      pthread_mutex_lock( &runfs_arena.pending_lock );
+      
+      runfs_arena.stop = true;
+      pthread_cond_signal( &runfs_arena.pending_cond );
+      
+      pthread_mutex_unlock( &runfs_arena.pending_lock );
+      
+      pthread_join( runfs_arena.reclaimer, NULL );
+      runfs_arena.reclaimer_running = false;
+   }
+   
+   pthread_mutex_destroy( &runfs_arena.pending_lock );
+   pthread_cond_destroy( &runfs_arena.pending_cond );
+   
+   pthread_mutex_lock( &runfs_arena.cache_lock );
+   
+   while( runfs_arena.cache != NULL ) {
+      
+      struct runfs_arena_free_map* map = runfs_arena.cache;
+      runfs_arena.cache = map->next;
+      
+      munmap( map, map->len );
+   }
+   
+   atomic_store( &runfs_arena.cached_bytes, 0 );
+   
+   pthread_mutex_unlock( &runfs_arena.cache_lock );
+   pthread_mutex_destroy( &runfs_arena.cache_lock );
+}
+
+// parse a huge page mode 
+// return RUNFS_ARENA_HUGE_* on success 
+// return -EINVAL if unrecognized 
+int runfs_arena_mode_parse( char const* mode_str ) {
+   
+   if( strcmp( mode_str, "none" ) == 0 ) {
+      return RUNFS_ARENA_HUGE_NONE;
+   }
+   
+   if( strcmp( mode_str, "thp" ) == 0 ) {
+      return RUNFS_ARENA_HUGE_THP;
+   }
+   
+   if( strcmp( mode_str, "hugetlb" ) == 0 ) {
+      return RUNFS_ARENA_HUGE_HUGETLB;
+   }
+   
+   return -EINVAL;
+}
+
+// map len bytes, aligned to a huge page so transparent huge pages can back all of it 
+// return the mapping on success 
+// return NULL on failure 
+static void* runfs_arena_map_thp( size_t len ) {
+   
+   // over-map, and trim to alignment
+   size_t over_len = len + RUNFS_ARENA_HUGE_PAGE_LEN;
+   
+   char* base = (char*)mmap( NULL, over_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   if( base == MAP_FAILED ) {
+      return NULL;
+   }
+   
+   char* aligned = (char*)(((uintptr_t)base + RUNFS_ARENA_HUGE_PAGE_LEN - 1) & ~((uintptr_t)RUNFS_ARENA_HUGE_PAGE_LEN - 1));
+   
+   if( aligned > base ) {
+      munmap( base, aligned - base );
+   }
+   
+   if( aligned + len < base + over_len ) {
+      munmap( aligned + len, (base + over_len) - (aligned + len) );
+   }
+   
+   madvise( aligned, len, MADV_HUGEPAGE );
+   
+   return aligned;
+}
+
+// take a cached mapping of exactly len bytes 
+// return it on success, with *kind set 
+// return NULL if there isn't one 
+static void* runfs_arena_cache_take( size_t len, uint32_t* kind ) {
+   
+   struct runfs_arena_free_map** itr = NULL;
+   struct runfs_arena_free_map* map = NULL;
+   
+   pthread_mutex_lock( &runfs_arena.cache_lock );
+   
+   for( itr = &runfs_arena.cache; *itr != NULL; itr = &(*itr)->next ) {
+      
+      if( (*itr)->len == len ) {
+         
+         map = *itr;
+         *itr = map->next;
+         
+         *kind = map->kind;
+         atomic_fetch_sub( &runfs_arena.cached_bytes, len );
+         break;
+      }
+   }
+   
+   pthread_mutex_unlock( &runfs_arena.cache_lock );
+   
+   return map;
+}
+
+// allocate a large buffer from huge pages 
+// return the mapping (header included) on success, with *kind set 
+// return NULL on OOM 
+static void* runfs_arena_map( size_t map_len, uint32_t* kind ) {
+   
+   void* map = runfs_arena_cache_take( map_len, kind );
+   if( map != NULL ) {
+      return map;
+   }
+   
+   if( runfs_arena.huge_mode == RUNFS_ARENA_HUGE_HUGETLB ) {
+      
+      map = mmap( NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+      if( map != MAP_FAILED ) {
+         
+         *kind = RUNFS_ARENA_KIND_HUGETLB;
+         atomic_fetch_add( &runfs_arena.num_hugetlb, 1 );
+         return map;
+      }
+      
+      // none reserved, or all in use 
+      atomic_fetch_add( &runfs_arena.num_fallbacks, 1 );
+   }
+   
+   *kind = RUNFS_ARENA_KIND_MAP;
+   return runfs_arena_map_thp( map_len );
+}
+
+// allocate a contents buffer of len bytes 
+// return the buffer on success 
+// return NULL on OOM 
+void* runfs_arena_alloc( size_t len ) {
+   
+   struct runfs_arena_header* header = NULL;
+   size_t total_len = len + sizeof(struct runfs_arena_header);
+   
+   if( len >= RUNFS_ARENA_LARGE_MIN_LEN && runfs_arena.huge_mode != RUNFS_ARENA_HUGE_NONE ) {
+      
+      uint32_t kind = 0;
+      size_t map_len = (total_len + RUNFS_ARENA_HUGE_PAGE_LEN - 1) & ~((size_t)RUNFS_ARENA_HUGE_PAGE_LEN - 1);
+      
+      header = (struct runfs_arena_header*)runfs_arena_map( map_len, &kind );
+      if( header != NULL ) {
+         
+         header->len = map_len;
+         header->kind = kind;
+         
+         atomic_fetch_add( &runfs_arena.mapped_bytes, map_len );
+         return header + 1;
+      }
+      
+      // fall back to the heap
+   }
+   
+   header = (struct runfs_arena_header*)malloc( total_len );
+   if( header == NULL ) {
+      return NULL;
+   }
+   
+   header->len = len;
+   header->kind = RUNFS_ARENA_KIND_HEAP;
+   
+   return header + 1;
+}
+
+// give a batch of large buffers back: zero each if asked, free heap buffers, and drop the pages of mapped ones.
+// then keep as many mappings for reuse as the cache has room for, and unmap the rest.
+// dropped pages read back as zeros, so a cached mapping never hands one file's bytes to the next.
+// this is the slow part, so it's done on the reclaimer thread.
+static void runfs_arena_reclaim( struct runfs_arena_free_map* batch ) {
+   
+   struct runfs_arena_free_map* to_cache = NULL;
+   struct runfs_arena_free_map* to_unmap = NULL;
+   uint64_t released_len = 0;
+   
+   while( batch != NULL ) {
+      
+      struct runfs_arena_free_map* map = batch;
+      uint64_t len = map->len;
+      char* data = (char*)map + sizeof(struct runfs_arena_header);
+      
+      batch = map->next;
+      
+      if( map->kind == RUNFS_ARENA_KIND_HEAP ) {
+         
+         if( map->scrub ) {
+            explicit_bzero( data, len );
+         }
+         
+         free( map );
+         continue;
+      }
+      
+      if( map->scrub ) {
+         explicit_bzero( data, len - sizeof(struct runfs_arena_header) );
+      }
+      
+      map->scrub = 0;
+      released_len += len;
+      
+      // hugetlb pages can't be dropped before Linux 5.18, so such mappings are unmapped instead 
+      if( madvise( data, len - sizeof(struct runfs_arena_header), MADV_DONTNEED ) == 0 ) {
+         
+         map->next = to_cache;
+         to_cache = map;
+      }
+      else {
+         
+         map->next = to_unmap;
+         to_unmap = map;
+      }
+   }
+   
+   atomic_fetch_sub( &runfs_arena.mapped_bytes, released_len );
+   
+   // keep them for the next large files, if there's room 
+   pthread_mutex_lock( &runfs_arena.cache_lock );
+   
+   while( to_cache != NULL ) {
+      
+      struct runfs_arena_free_map* map = to_cache;
+      to_cache = map->next;
+      
+      if( atomic_load( &runfs_arena.cached_bytes ) + map->len <= RUNFS_ARENA_CACHE_MAX_LEN ) {
+         
+         map->next = runfs_arena.cache;
+         runfs_arena.cache = map;
+         
+         atomic_fetch_add( &runfs_arena.cached_bytes, map->len );
+      }
+      else {
+         
+         map->next = to_unmap;
+         to_unmap = map;
+      }
+   }
+   
+   pthread_mutex_unlock( &runfs_arena.cache_lock );
+   
+   while( to_unmap != NULL ) {
+      
+      struct runfs_arena_free_map* map = to_unmap;
+      to_unmap = map->next;
+      
+      munmap( map, map->len );
+   }
+}
+
+// reclaimer thread: reclaim whatever's pending, a batch at a time, until stopped.
+// stops only once nothing is pending.
+static void* runfs_arena_reclaimer_main( void* arg ) {
+   
+   pthread_mutex_lock( &runfs_arena.pending_lock );
+   
+   while( true ) {
+      
+      while( runfs_arena.pending == NULL && !runfs_arena.stop ) {
+         pthread_cond_wait( &runfs_arena.pending_cond, &runfs_arena.pending_lock );
+      }
+      
+      if( runfs_arena.pending == NULL ) {
+         
+         // stopped, and drained 
+         break;
+      }
+      
+      struct runfs_arena_free_map* batch = runfs_arena.pending;
+      runfs_arena.pending = NULL;
+      
+      pthread_mutex_unlock( &runfs_arena.pending_lock );
+      
+      uint64_t batch_len = 0;
+      
+      for( struct runfs_arena_free_map* map = batch; map != NULL; map = map->next ) {
+         batch_len += map->len;
+      }
+      
+      runfs_arena_reclaim( batch );
+      
+      atomic_fetch_sub( &runfs_arena.pending_bytes, batch_len );
+      atomic_fetch_add( &runfs_arena.reclaimed_bytes, batch_len );
+      
+      pthread_mutex_lock( &runfs_arena.pending_lock );
+   }
+   
+   pthread_mutex_unlock( &runfs_arena.pending_lock );
+   
+   return NULL;
+}
+
+// free a buffer, wiping it first if scrub is set.
+// large buffers are handed off to the reclaimer, so this takes the same time whatever the buffer's size.
+static void runfs_arena_release( void* ptr, bool scrub ) {
+   
+   struct runfs_arena_header* header = NULL;
+   struct runfs_arena_free_map* map = NULL;
+   
+   if( ptr == NULL ) {
+      return;
+   }
+   
+   header = RUNFS_ARENA_HEADER( ptr );
+   
+   if( header->kind == RUNFS_ARENA_KIND_HEAP && header->len < RUNFS_ARENA_LARGE_MIN_LEN ) {
+      
+      // small; not worth a trip to the reclaimer
+      if( scrub ) {
+         explicit_bzero( ptr, header->len );
+      }
+      
+      free( header );
+      return;
+   }
+   
+   map = (struct runfs_arena_free_map*)header;
+   map->scrub = scrub;
+   
+   if( !runfs_arena.reclaimer_running ) {
+      
+      map->next = NULL;
+      runfs_arena_reclaim( map );
+      return;
+   }
+   
+   atomic_fetch_add( &runfs_arena.pending_bytes, map->len );
+   
+   pthread_mutex_lock( &runfs_arena.pending_lock );
+   
+   map->next = runfs_arena.pending;
+   runfs_arena.pending = map;
+   pthread_cond_signal( &runfs_arena.pending_cond );
+   
+   pthread_mutex_unlock( &runfs_arena.pending_lock );
+}
+
+// free a contents buffer 
+void runfs_arena_free( void* ptr ) {
+   
+   runfs_arena_release( ptr, false );
+}
+
+// zero a contents buffer, then free it 
+void runfs_arena_scrub_free( void* ptr ) {
+   
+   runfs_arena_release( ptr, true );
+}
+
+// get the allocator's counters 
+void runfs_arena_get_stats( struct runfs_arena_stats* stats ) {
+   
+   stats->pending_bytes = atomic_load( &runfs_arena.pending_bytes );
+   stats->reclaimed_bytes = atomic_load( &runfs_arena.reclaimed_bytes );
+   stats->mapped_bytes = atomic_load( &runfs_arena.mapped_bytes );
+   stats->cached_bytes = atomic_load( &runfs_arena.cached_bytes );
+   stats->num_hugetlb = atomic_load( &runfs_arena.num_hugetlb );
+   stats->num_fallbacks = atomic_load( &runfs_arena.num_fallbacks );
+}
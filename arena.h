@@ -0,0 +1,68 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// allocator for file contents buffers.
+// small buffers come from malloc.  Large ones can be backed by 2MiB huge pages (transparent or hugetlbfs),
+// to spare big files TLB misses and per-page faults, and freed ones are cached for reuse.
+// every buffer carries a small header, so the free functions can tell how it was allocated.
+// freeing a large buffer just queues it; a background reclaimer zeroes it (if its profile asks),
+// and then frees, unmaps or caches it, so freeing takes the same time whatever the size.
+
+#ifndef _RUNFS_ARENA_H_
+#define _RUNFS_ARENA_H_
+
+#include "os.h"
+#include "util.h"
+
+// huge page modes (--hugepages=)
+#define RUNFS_ARENA_HUGE_NONE           0       // large buffers come from malloc, like small ones
+#define RUNFS_ARENA_HUGE_THP            1       // large buffers are 2MiB-aligned mappings, madvise()'d for transparent huge pages (the default)
+#define RUNFS_ARENA_HUGE_HUGETLB        2       // large buffers come from reserved hugetlbfs pages, or THP mappings if none are left
+
+#define RUNFS_ARENA_HUGE_PAGE_LEN       (2 * 1024 * 1024)
+
+// buffers of at least this many bytes are large 
+#define RUNFS_ARENA_LARGE_MIN_LEN       (4 * 1024 * 1024)
+
+// keep at most this many bytes of freed large mappings around for reuse 
+#define RUNFS_ARENA_CACHE_MAX_LEN       (64 * 1024 * 1024)
+
+struct runfs_arena_stats {
+   
+   uint64_t pending_bytes;              // bytes of freed large buffers the reclaimer hasn't gotten to yet 
+   uint64_t reclaimed_bytes;            // bytes of large buffers the reclaimer has given back, ever 
+   uint64_t mapped_bytes;               // bytes of large mappings in use 
+   uint64_t cached_bytes;               // bytes of freed large mappings kept for reuse 
+   uint64_t num_hugetlb;                // large buffers allocated from hugetlbfs 
+   uint64_t num_fallbacks;              // large buffers that wanted hugetlbfs pages, but didn't get them 
+};
+
+int runfs_arena_init( int huge_mode );
+void runfs_arena_shutdown( void );
+int runfs_arena_mode_parse( char const* mode_str );
+
+void* runfs_arena_alloc( size_t len );
+void runfs_arena_free( void* ptr );
+void runfs_arena_scrub_free( void* ptr );
+
+void runfs_arena_get_stats( struct runfs_arena_stats* stats );
+
+#endif
@@ -0,0 +1,87 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// wire format of runfs's batch control file, shared with client programs.
+
+#ifndef _RUNFS_BATCH_PROTO_H_
+#define _RUNFS_BATCH_PROTO_H_
+
+#include <stdint.h>
+
+// control directory and batch file, relative to the mountpoint
+#define RUNFS_CTL_DIR                   "/.runfs"
+#define RUNFS_CTL_BATCH                 "/.runfs/batch"
+#define RUNFS_CTL_EVENTS                "/.runfs/events"
+#define RUNFS_CTL_STATS                 "/.runfs/stats"
+
+#define RUNFS_BATCH_MAGIC               0x52464231      // "RFB1"
+
+// largest batch a client should send in one write().  Larger writes may be split up by the kernel,
+// and each piece would be taken as a batch on its own.
+#define RUNFS_BATCH_MAX_LEN             4096
+
+// batch operations
+#define RUNFS_BATCH_OP_CREATE           1               // create a file (with optional initial contents)
+#define RUNFS_BATCH_OP_MKDIR            2               // create a directory
+#define RUNFS_BATCH_OP_RELEASE          3               // reap everything the owner created
+#define RUNFS_BATCH_OP_CLONE            4               // create a file sharing another file's contents (copy-on-write).  The source path takes the place of the contents.
+
+// records are aligned to this many bytes
+#define RUNFS_BATCH_ALIGN               8
+
+// A batch is one pwrite() to the batch file at offset 0:
+//   a header, then num_records records.  Each record is followed by path_len bytes of
+//   absolute path (no trailing NUL), then contents_len bytes of file contents, then padding to RUNFS_BATCH_ALIGN.
+// Records are carried out in order, and every record is attempted even if an earlier one fails.
+// The write returns the length of the batch, or fails if the batch is malformed (EINVAL) or runfs is out of memory.
+// Then a pread() at offset 0 through the same file descriptor (opened O_RDWR) returns a runfs_batch_status with
+// each record's result, so the client knows exactly which records took effect.
+// A release only queues the owner's entries for reaping; they go away shortly after the write returns.
+struct runfs_batch_header {
+   
+   uint32_t magic;
+   uint32_t num_records;
+};
+
+struct runfs_batch_record {
+   
+   uint16_t op;                 // RUNFS_BATCH_OP_*
+   uint16_t path_len;           // length of the path that follows
+   uint32_t mode;               // permission bits of the new entry
+   int32_t owner;               // PID whose lifetime (or group's lifetime) the entry is tied to, or to release.  0 means the writer.
+   uint32_t contents_len;       // length of the initial contents that follow the path
+};
+
+#define RUNFS_BATCH_RECORD_LEN( path_len, contents_len ) \
+   ((sizeof(struct runfs_batch_record) + (path_len) + (contents_len) + RUNFS_BATCH_ALIGN - 1) & ~((size_t)RUNFS_BATCH_ALIGN - 1))
+
+// results of the last batch written through a file descriptor 
+struct runfs_batch_status {
+   
+   uint32_t magic;              // RUNFS_BATCH_MAGIC
+   uint32_t num_records;
+   int32_t results[];           // 0 or -errno for each record, in order 
+};
+
+#define RUNFS_BATCH_STATUS_LEN( num_records ) \
+   (sizeof(struct runfs_batch_status) + sizeof(int32_t) * (size_t)(num_records))
+
+#endif
@@ -0,0 +1,952 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "checkpoint.h"
+#include "runfs.h"
+
+// number of buckets in the owner cache used while restoring 
+#define RUNFS_CHECKPOINT_OWNER_BUCKETS  4096
+
+// snapshot being written 
+struct runfs_checkpoint_writer {
+   
+   FILE* f;
+   uint64_t num_records;
+   uint64_t len;
+   
+   char buf[ BUFSIZ ];                  // stdio buffer, so file contents that pass through it can be wiped afterwards
+};
+
+// an owner we've already checked while restoring, so each one is only checked once
+struct runfs_checkpoint_owner {
+   
+   int type;
+   pid_t id;
+   uint64_t starttime;
+   char const* cgroup;                  // points into the snapshot
+   uint16_t cgroup_len;
+   
+   pid_t pid;                           // live process to create its entries as, or 0 if the owner is dead
+   
+   struct runfs_checkpoint_owner* next;
+};
+
+// the checkpointer the signal handler wakes up 
+static struct runfs_checkpointer* runfs_checkpointer_self = NULL;
+
+// takes snapshots on SIGUSR2, once we've restored
+static struct runfs_checkpointer runfs_checkpointer;
+
+static int runfs_checkpointer_start( struct runfs_checkpointer* cp, struct runfs_state* runfs, char const* path );
+static int runfs_checkpointer_stop( struct runfs_checkpointer* cp );
+
+// what to restore once FUSE starts up
+static struct runfs_state* runfs_checkpoint_runfs = NULL;
+static char const* runfs_checkpoint_restore_path = NULL;
+static void* (*runfs_checkpoint_next_init)( struct fuse_conn_info* ) = NULL;
+
+// milliseconds since some point in the past
+static uint64_t runfs_checkpoint_now_ms(void) {
+   
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// append a record and its payloads to a snapshot 
+// return 0 on success 
+// return -EIO on write error
+static int runfs_checkpoint_write_record( struct runfs_checkpoint_writer* w, struct runfs_checkpoint_record* rec, char const* path, char const* cgroup, char const* contents ) {
+   
+   static char const zeros[ RUNFS_CHECKPOINT_ALIGN ] = { 0 };
+   
+   uint64_t rec_len = RUNFS_CHECKPOINT_RECORD_LEN( rec->path_len, rec->cgroup_len, rec->size );
+   uint64_t pad = rec_len - (sizeof(struct runfs_checkpoint_record) + rec->path_len + rec->cgroup_len + rec->size);
+   
+   if( fwrite( rec, sizeof(struct runfs_checkpoint_record), 1, w->f ) != 1 ||
+       fwrite( path, 1, rec->path_len, w->f ) != rec->path_len ||
+       (rec->cgroup_len > 0 && fwrite( cgroup, 1, rec->cgroup_len, w->f ) != rec->cgroup_len) ||
+       (rec->size > 0 && fwrite( contents, 1, rec->size, w->f ) != rec->size) ||
+       (pad > 0 && fwrite( zeros, 1, pad, w->f ) != pad) ) {
+      
+      return -EIO;
+   }
+   
+   w->num_records++;
+   w->len += rec_len;
+   
+   return 0;
+}
+
+// snapshot one entry, if its owner is still alive.
+// return 0 if it was written 
+// return 1 if it was skipped (dead, not a runfs entry, or with a path or cgroup too long to record)
+// return -ENOMEM if we couldn't decompress a compressed file
+// return -EIO on write error
+static int runfs_checkpoint_save_entry( struct runfs_state* runfs, struct runfs_checkpoint_writer* w, char const* path, struct fskit_dir_entry* dirent ) {
+   
+   int rc = 0;
+   struct runfs_checkpoint_record rec;
+   char const* cgroup = NULL;
+   char const* contents = NULL;
+   char* inflated = NULL;
+   void (*free_func)( void* ) = NULL;
+   
+   struct fskit_entry* fent = fskit_entry_resolve_path( runfs->core, path, 0, 0, false, &rc );
+   if( fent == NULL ) {
+      
+      // reaped underneath us 
+      return 1;
+   }
+   
+   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   
+   if( inode == NULL || runfs_inode_is_deleted( inode ) || runfs_inode_is_valid( inode ) <= 0 ) {
+      
+      fskit_entry_unlock( fent );
+      return 1;
+   }
+   
+   if( strlen( path ) > PATH_MAX ) {
+      
+      fskit_entry_unlock( fent );
+      return 1;
+   }
+   
+   memset( &rec, 0, sizeof(rec) );
+   
+   rec.type = (dirent->type == FSKIT_ENTRY_TYPE_DIR ? RUNFS_CHECKPOINT_TYPE_DIR : RUNFS_CHECKPOINT_TYPE_FILE);
+   rec.path_len = strlen( path );
+   rec.mode = dirent->mode & 07777;
+   rec.uid = dirent->owner;
+   rec.gid = dirent->group;
+   
+   if( inode->owner != NULL ) {
+      
+      rec.owner_type = inode->owner->type;
+      rec.owner_id = inode->owner->id;
+      
+      if( inode->owner->leader != NULL ) {
+         rec.starttime = pstat_get_starttime( inode->owner->leader );
+      }
+      
+      if( inode->owner->cgroup != NULL ) {
+         
+         cgroup = inode->owner->cgroup;
+         
+         if( strlen( cgroup ) > PATH_MAX ) {
+            
+            runfs_error("cgroup of '%s' is too long to checkpoint\n", path );
+            fskit_entry_unlock( fent );
+            return 1;
+         }
+         
+         rec.cgroup_len = strlen( cgroup );
+      }
+   }
+   else {
+      
+      rec.owner_type = RUNFS_OWNER_PID;
+      rec.owner_id = runfs_inode_get_pid( inode );
+      rec.starttime = pstat_get_starttime( inode->ps );
+   }
+   
+   if( rec.type == RUNFS_CHECKPOINT_TYPE_FILE ) {
+      
+      // we hold the read lock, so no writer can change it underneath us
+      rec.size = inode->size;
+      contents = atomic_load( &inode->contents );
+      
+      if( inode->packed != NULL ) {
+         
+         // save it uncompressed, but leave it compressed 
+         // storage=scrub profiles wipe their contents when they free them, so the copy gets the same treatment
+         free_func = runfs_policy_get_free_func( inode->policy );
+         
+         inflated = runfs_compact_inflate( inode->packed, free_func );
+         if( inflated == NULL ) {
+            
+            fskit_entry_unlock( fent );
+            return -ENOMEM;
+         }
+         
+         contents = inflated;
+      }
+   }
+   
+   rc = runfs_checkpoint_write_record( w, &rec, path, cgroup, contents );
+   
+   fskit_entry_unlock( fent );
+   
+   if( inflated != NULL ) {
+      (*free_func)( inflated );
+   }
+   
+   return rc;
+}
+
+// snapshot everything under a directory, parents before children
+// return 0 on success 
+// return -ENOMEM on OOM 
+// return -EIO on write error
+static int runfs_checkpoint_save_dir( struct runfs_state* runfs, struct runfs_checkpoint_writer* w, char const* dir_path ) {
+   
+   int rc = 0;
+   uint64_t num_dirents = 0;
+   
+   struct fskit_dir_handle* dirh = fskit_opendir( runfs->core, dir_path, 0, 0, &rc );
+   if( dirh == NULL ) {
+      
+      // reaped underneath us 
+      return 0;
+   }
+   
+   struct fskit_dir_entry** dirents = fskit_listdir( runfs->core, dirh, &num_dirents, &rc );
+   fskit_closedir( runfs->core, dirh );
+   
+   if( dirents == NULL ) {
+      return (rc == -ENOMEM ? rc : 0);
+   }
+   
+   for( uint64_t i = 0; i < num_dirents && rc == 0; i++ ) {
+      
+      if( strcmp( dirents[i]->name, "." ) == 0 || strcmp( dirents[i]->name, ".." ) == 0 ) {
+         continue;
+      }
+      
+      if( dirents[i]->type != FSKIT_ENTRY_TYPE_FILE && dirents[i]->type != FSKIT_ENTRY_TYPE_DIR ) {
+         continue;
+      }
+      
+      char* child_path = fskit_fullpath( dir_path, dirents[i]->name, NULL );
+      if( child_path == NULL ) {
+         
+         rc = -ENOMEM;
+         break;
+      }
+      
+      // the control directory gets recreated at startup
+      if( strcmp( child_path, RUNFS_CTL_DIR ) == 0 || strlen( child_path ) > UINT16_MAX ) {
+         
+         free( child_path );
+         continue;
+      }
+      
+      rc = runfs_checkpoint_save_entry( runfs, w, child_path, dirents[i] );
+      
+      if( rc == 0 && dirents[i]->type == FSKIT_ENTRY_TYPE_DIR ) {
+         rc = runfs_checkpoint_save_dir( runfs, w, child_path );
+      }
+      else if( rc > 0 ) {
+         
+         // skipped (along with its children)
+         rc = 0;
+      }
+      
+      free( child_path );
+   }
+   
+   fskit_dir_entry_free_list( dirents );
+   
+   return rc;
+}
+
+// flush a file's directory entry changes (e.g. a rename into it) to disk 
+// return 0 on success 
+// return -errno on failure
+static int runfs_checkpoint_sync_dir( char const* path ) {
+   
+   int rc = 0;
+   char dir_buf[PATH_MAX+1];
+   
+   snprintf( dir_buf, PATH_MAX, "%s", path );
+   
+   int dirfd = open( dirname( dir_buf ), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+   if( dirfd < 0 ) {
+      return -errno;
+   }
+   
+   if( fsync( dirfd ) != 0 ) {
+      rc = -errno;
+   }
+   
+   close( dirfd );
+   return rc;
+}
+
+// snapshot every live entry (paths, modes, contents and owners) to a file.
+// the snapshot is written next to it and renamed into place, so a crash mid-way leaves the old one intact.
+// it may hold secrets, so it's only readable by us, and it's never written through a symlink or a file someone else made.
+// return 0 on success 
+// return -ENOMEM on OOM 
+// return -errno on failure to write the snapshot
+int runfs_checkpoint_save( struct runfs_state* runfs, char const* path ) {
+   
+   int rc = 0;
+   int fd = -1;
+   struct runfs_checkpoint_writer* w = NULL;
+   struct runfs_checkpoint_header header;
+   char tmp_path[PATH_MAX+1];
+   uint64_t start_ms = runfs_checkpoint_now_ms();
+   
+   memset( &header, 0, sizeof(header) );
+   
+   w = RUNFS_CALLOC( struct runfs_checkpoint_writer, 1 );
+   if( w == NULL ) {
+      return -ENOMEM;
+   }
+   
+   snprintf( tmp_path, PATH_MAX, "%s.tmp", path );
+   
+   // clear out a leftover from a crash.  unlink() doesn't follow symlinks, and if someone puts one back, O_EXCL catches it.
+   if( unlink( tmp_path ) != 0 && errno != ENOENT ) {
+      
+      rc = -errno;
+      runfs_error("unlink('%s') rc = %d\n", tmp_path, rc );
+      runfs_safe_free( w );
+      return rc;
+   }
+   
+   fd = open( tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600 );
+   if( fd < 0 ) {
+      
+      rc = -errno;
+      runfs_error("open('%s') rc = %d\n", tmp_path, rc );
+      runfs_safe_free( w );
+      return rc;
+   }
+   
+   w->f = fdopen( fd, "w" );
+   if( w->f == NULL ) {
+      
+      rc = -errno;
+      runfs_error("fdopen('%s') rc = %d\n", tmp_path, rc );
+      close( fd );
+      unlink( tmp_path );
+      runfs_safe_free( w );
+      return rc;
+   }
+   
+   setvbuf( w->f, w->buf, _IOFBF, sizeof(w->buf) );
+   
+   // fill in the header once we know what's in the snapshot 
+   w->len = sizeof(header);
+   if( fwrite( &header, sizeof(header), 1, w->f ) != 1 ) {
+      rc = -EIO;
+   }
+   
+   if( rc == 0 ) {
+      rc = runfs_checkpoint_save_dir( runfs, w, "/" );
+   }
+   
+   if( rc == 0 ) {
+      
+      header.magic = RUNFS_CHECKPOINT_MAGIC;
+      header.version = RUNFS_CHECKPOINT_VERSION;
+      header.num_records = w->num_records;
+      header.len = w->len;
+      
+      if( fseek( w->f, 0, SEEK_SET ) != 0 || fwrite( &header, sizeof(header), 1, w->f ) != 1 || fflush( w->f ) != 0 ) {
+         rc = -EIO;
+      }
+   }
+   
+   // make sure the snapshot is on disk before it replaces the old one 
+   if( rc == 0 && fsync( fileno( w->f ) ) != 0 ) {
+      rc = -errno;
+   }
+   
+   if( fclose( w->f ) != 0 && rc == 0 ) {
+      rc = -EIO;
+   }
+   
+   if( rc == 0 && rename( tmp_path, path ) != 0 ) {
+      rc = -errno;
+   }
+   
+   if( rc == 0 ) {
+      rc = runfs_checkpoint_sync_dir( path );
+      if( rc != 0 ) {
+         
+         // it's in place; it just might not survive a power loss
+         runfs_error("runfs_checkpoint_sync_dir('%s') rc = %d\n", path, rc );
+         rc = 0;
+      }
+   }
+   else {
+      
+      runfs_error("Failed to checkpoint to '%s', rc = %d\n", path, rc );
+      unlink( tmp_path );
+   }
+   
+   uint64_t num_records = w->num_records;
+   uint64_t len = w->len;
+   
+   // file contents passed through the stdio buffer 
+   explicit_bzero( w, sizeof(struct runfs_checkpoint_writer) );
+   runfs_safe_free( w );
+   
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   runfs_debug("Checkpointed %" PRIu64 " entries (%" PRIu64 " bytes) to '%s' in %" PRIu64 " ms\n", num_records, len, path, runfs_checkpoint_now_ms() - start_ms );
+   
+   return 0;
+}
+
+// find a live member of a process group whose leader is gone, by looking through /proc.
+// return the member's PID 
+// return 0 if there are none
+static pid_t runfs_checkpoint_find_pgrp_member( pid_t pgid ) {
+   
+   pid_t member = 0;
+   struct dirent* dent = NULL;
+   char stat_path[64];
+   char buf[1024];
+   
+   DIR* proc = opendir( "/proc" );
+   if( proc == NULL ) {
+      return 0;
+   }
+   
+   while( member == 0 && (dent = readdir( proc )) != NULL ) {
+      
+      if( !isdigit( dent->d_name[0] ) ) {
+         continue;
+      }
+      
+      snprintf( stat_path, sizeof(stat_path), "/proc/%s/stat", dent->d_name );
+      
+      int fd = open( stat_path, O_RDONLY | O_CLOEXEC );
+      if( fd < 0 ) {
+         continue;
+      }
+      
+      ssize_t nr = read( fd, buf, sizeof(buf) - 1 );
+      close( fd );
+      
+      if( nr <= 0 ) {
+         continue;
+      }
+      
+      buf[ nr ] = '\0';
+      
+      // fields after the command name: state ppid pgrp
+      char state = 0;
+      int ppid = 0;
+      int pgrp = 0;
+      char* fields = strrchr( buf, ')' );
+      
+      if( fields != NULL && sscanf( fields + 1, " %c %d %d", &state, &ppid, &pgrp ) == 3 && pgrp == pgid && state != 'Z' ) {
+         member = atoi( dent->d_name );
+      }
+   }
+   
+   closedir( proc );
+   return member;
+}
+
+// find a live process in a cgroup 
+// return its PID 
+// return 0 if there are none (or the cgroup is gone)
+static pid_t runfs_checkpoint_find_cgroup_member( char const* cgroup_root, char const* cgroup, size_t cgroup_len ) {
+   
+   char procs_path[PATH_MAX+1];
+   char buf[64];
+   
+   snprintf( procs_path, PATH_MAX, "%s%.*s/cgroup.procs", cgroup_root, (int)cgroup_len, cgroup );
+   
+   int fd = open( procs_path, O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
+      return 0;
+   }
+   
+   ssize_t nr = read( fd, buf, sizeof(buf) - 1 );
+   close( fd );
+   
+   if( nr <= 0 ) {
+      return 0;
+   }
+   
+   buf[ nr ] = '\0';
+   return atoi( buf );
+}
+
+// is this process running, and is it the same one we snapshotted?
+static bool runfs_checkpoint_is_same_process( pid_t pid, uint64_t starttime ) {
+   
+   struct runfs_scratch* scratch = runfs_scratch_get();
+   if( scratch == NULL ) {
+      return false;
+   }
+   
+   if( pstat( pid, scratch->ps, 0 ) != 0 ) {
+      return false;
+   }
+   
+   return pstat_is_running( scratch->ps ) && pstat_get_starttime( scratch->ps ) == starttime;
+}
+
+// check a record's owner, once per owner.
+// return the PID of a live process to create the record's entry as
+// return 0 if the owner is dead 
+// return -ENOMEM on OOM
+static pid_t runfs_checkpoint_resolve_owner( struct runfs_state* runfs, struct runfs_checkpoint_owner** cache, struct runfs_checkpoint_record* rec, char const* cgroup ) {
+   
+   uint64_t hash = ((uint64_t)rec->owner_type << 32) ^ (uint32_t)rec->owner_id ^ rec->starttime;
+   
+   for( size_t i = 0; i < rec->cgroup_len; i++ ) {
+      hash = hash * 31 + (unsigned char)cgroup[i];
+   }
+   
+   struct runfs_checkpoint_owner** bucket = &cache[ hash % RUNFS_CHECKPOINT_OWNER_BUCKETS ];
+   
+   for( struct runfs_checkpoint_owner* owner = *bucket; owner != NULL; owner = owner->next ) {
+      
+      if( owner->type == rec->owner_type && owner->id == rec->owner_id && owner->starttime == rec->starttime &&
+          owner->cgroup_len == rec->cgroup_len && memcmp( owner->cgroup, cgroup, rec->cgroup_len ) == 0 ) {
+         
+         return owner->pid;
+      }
+   }
+   
+   struct runfs_checkpoint_owner* owner = RUNFS_CALLOC( struct runfs_checkpoint_owner, 1 );
+   if( owner == NULL ) {
+      return -ENOMEM;
+   }
+   
+   owner->type = rec->owner_type;
+   owner->id = rec->owner_id;
+   owner->starttime = rec->starttime;
+   owner->cgroup = cgroup;
+   owner->cgroup_len = rec->cgroup_len;
+   
+   switch( rec->owner_type ) {
+      
+      case RUNFS_OWNER_PID:
+      case RUNFS_OWNER_SESSION:
+         
+         // the process (or session leader) must be the very same one
+         owner->pid = (runfs_checkpoint_is_same_process( rec->owner_id, rec->starttime ) ? rec->owner_id : 0);
+         break;
+         
+      case RUNFS_OWNER_PGRP:
+         
+         // any live member will do 
+         if( getpgid( rec->owner_id ) == rec->owner_id ) {
+            owner->pid = rec->owner_id;
+         }
+         else if( kill( -rec->owner_id, 0 ) == 0 || errno == EPERM ) {
+            owner->pid = runfs_checkpoint_find_pgrp_member( rec->owner_id );
+         }
+         
+         break;
+         
+      case RUNFS_OWNER_CGROUP:
+         
+         owner->pid = runfs_checkpoint_find_cgroup_member( runfs->owners.cgroup_root, cgroup, rec->cgroup_len );
+         break;
+   }
+   
+   owner->next = *bucket;
+   *bucket = owner;
+   
+   return owner->pid;
+}
+
+// recreate one entry from a snapshot record, as its owner
+// return 0 on success 
+// return negative on error
+static int runfs_checkpoint_restore_entry( struct runfs_state* runfs, struct runfs_checkpoint_record* rec, char const* path, char const* contents, pid_t owner ) {
+   
+   int rc = 0;
+   
+   runfs_ctl_set_owner( owner );
+   
+   if( rec->type == RUNFS_CHECKPOINT_TYPE_DIR ) {
+      
+      rc = fskit_mkdir( runfs->core, path, rec->mode, 0, 0 );
+      runfs_publish_create( runfs, path, rc );
+   }
+   else {
+      
+      struct fskit_file_handle* fh = fskit_create( runfs->core, path, 0, 0, rec->mode, &rc );
+      runfs_publish_create( runfs, path, (fh != NULL ? 0 : rc) );
+      
+      if( fh != NULL ) {
+         
+         if( rec->size > 0 ) {
+            
+            ssize_t num_written = fskit_write( runfs->core, fh, contents, rec->size, 0 );
+            if( num_written < 0 ) {
+               rc = (int)num_written;
+            }
+            else if( (uint64_t)num_written != rec->size ) {
+               rc = -EIO;
+            }
+         }
+         
+         fskit_close( runfs->core, fh );
+         
+         if( rc != 0 ) {
+            fskit_unlink( runfs->core, path, 0, 0 );
+         }
+      }
+   }
+   
+   runfs_ctl_set_owner( 0 );
+   
+   if( rc == 0 ) {
+      fskit_chown( runfs->core, path, 0, 0, rec->uid, rec->gid );
+   }
+   
+   return rc;
+}
+
+// restore the entries in a snapshot whose owners are still alive.
+// each owner is checked once, no matter how many entries it has; entries of dead owners (and everything under them) are dropped.
+// call before the filesystem serves any requests (see runfs_checkpoint_wrap_opers()).
+// return 0 on success (even if some entries couldn't be restored)
+// return -ENOENT if there's no snapshot 
+// return -EINVAL if the snapshot is malformed 
+// return -ENOMEM on OOM 
+// return -errno on failure to map the snapshot
+int runfs_checkpoint_restore( struct runfs_state* runfs, char const* path ) {
+   
+   int rc = 0;
+   struct stat sb;
+   uint64_t start_ms = runfs_checkpoint_now_ms();
+   uint64_t num_restored = 0;
+   uint64_t num_dropped = 0;
+   uint64_t num_failed = 0;
+   char entry_path[PATH_MAX+1];
+   
+   int fd = open( path, O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
+      return -errno;
+   }
+   
+   if( fstat( fd, &sb ) != 0 ) {
+      
+      rc = -errno;
+      close( fd );
+      return rc;
+   }
+   
+   if( (size_t)sb.st_size < sizeof(struct runfs_checkpoint_header) ) {
+      
+      close( fd );
+      return -EINVAL;
+   }
+   
+   char* snapshot = (char*)mmap( NULL, sb.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+   close( fd );
+   
+   if( snapshot == MAP_FAILED ) {
+      return -errno;
+   }
+   
+   struct runfs_checkpoint_header* header = (struct runfs_checkpoint_header*)snapshot;
+   
+   if( header->magic != RUNFS_CHECKPOINT_MAGIC || header->version != RUNFS_CHECKPOINT_VERSION || header->len > (uint64_t)sb.st_size ) {
+      
+      munmap( snapshot, sb.st_size );
+      return -EINVAL;
+   }
+   
+   struct runfs_checkpoint_owner** cache = RUNFS_CALLOC( struct runfs_checkpoint_owner*, RUNFS_CHECKPOINT_OWNER_BUCKETS );
+   if( cache == NULL ) {
+      
+      munmap( snapshot, sb.st_size );
+      return -ENOMEM;
+   }
+   
+   uint64_t off = sizeof(struct runfs_checkpoint_header);
+   
+   for( uint64_t i = 0; i < header->num_records; i++ ) {
+      
+      if( off + sizeof(struct runfs_checkpoint_record) > header->len ) {
+         
+         rc = -EINVAL;
+         break;
+      }
+      
+      struct runfs_checkpoint_record* rec = (struct runfs_checkpoint_record*)(snapshot + off);
+      uint64_t left = header->len - off - sizeof(struct runfs_checkpoint_record);
+      
+      // check each length against what's left before adding them up, so a corrupt record can't wrap rec_len
+      if( rec->path_len == 0 || rec->path_len > PATH_MAX || rec->path_len > left ) {
+         
+         rc = -EINVAL;
+         break;
+      }
+      
+      left -= rec->path_len;
+      
+      if( rec->cgroup_len > PATH_MAX || rec->cgroup_len > left ) {
+         
+         rc = -EINVAL;
+         break;
+      }
+      
+      left -= rec->cgroup_len;
+      
+      if( rec->size > left ) {
+         
+         rc = -EINVAL;
+         break;
+      }
+      
+      uint64_t rec_len = RUNFS_CHECKPOINT_RECORD_LEN( rec->path_len, rec->cgroup_len, rec->size );
+      
+      if( rec_len > header->len - off ) {
+         
+         // the last record's padding is missing 
+         rc = -EINVAL;
+         break;
+      }
+      
+      char const* rec_path = snapshot + off + sizeof(struct runfs_checkpoint_record);
+      char const* cgroup = rec_path + rec->path_len;
+      char const* contents = cgroup + rec->cgroup_len;
+      
+      off += rec_len;
+      
+      memcpy( entry_path, rec_path, rec->path_len );
+      entry_path[ rec->path_len ] = '\0';
+      
+      pid_t owner = runfs_checkpoint_resolve_owner( runfs, cache, rec, cgroup );
+      if( owner < 0 ) {
+         
+         rc = owner;
+         break;
+      }
+      
+      if( owner == 0 ) {
+         
+         runfs_debug("Dropping '%s': owner %d is gone\n", entry_path, rec->owner_id );
+         num_dropped++;
+         continue;
+      }
+      
+      rc = runfs_checkpoint_restore_entry( runfs, rec, entry_path, contents, owner );
+      if( rc == 0 ) {
+         num_restored++;
+      }
+      else {
+         
+         // e.g. its parent was dropped
+         runfs_debug("Failed to restore '%s', rc = %d\n", entry_path, rc );
+         num_failed++;
+         rc = 0;
+      }
+   }
+   
+   for( int i = 0; i < RUNFS_CHECKPOINT_OWNER_BUCKETS; i++ ) {
+      
+      struct runfs_checkpoint_owner* owner = cache[i];
+      while( owner != NULL ) {
+         
+         struct runfs_checkpoint_owner* next = owner->next;
+         free( owner );
+         owner = next;
+      }
+   }
+   
+   free( cache );
+   munmap( snapshot, sb.st_size );
+   
+   if( rc != 0 ) {
+      
+      runfs_error("Malformed snapshot '%s' (rc = %d); restored %" PRIu64 " entries before giving up\n", path, rc, num_restored );
+      return rc;
+   }
+   
+   runfs_debug("Restored %" PRIu64 " entries from '%s' (%" PRIu64 " dropped, %" PRIu64 " failed) in %" PRIu64 " ms\n", num_restored, path, num_dropped, num_failed, runfs_checkpoint_now_ms() - start_ms );
+   
+   return 0;
+}
+
+// FUSE init: restore the snapshot before the kernel sends us any requests 
+static void* runfs_checkpoint_fuse_init( struct fuse_conn_info* conn ) {
+   
+   void* user_data = NULL;
+   
+   if( runfs_checkpoint_next_init != NULL ) {
+      user_data = (*runfs_checkpoint_next_init)( conn );
+   }
+   else {
+      user_data = fuse_get_context()->private_data;
+   }
+   
+   int rc = runfs_checkpoint_restore( runfs_checkpoint_runfs, runfs_checkpoint_restore_path );
+   if( rc == -ENOENT ) {
+      runfs_debug("No snapshot at '%s'; starting empty\n", runfs_checkpoint_restore_path );
+   }
+   else if( rc != 0 ) {
+      runfs_error("runfs_checkpoint_restore('%s') rc = %d\n", runfs_checkpoint_restore_path, rc );
+   }
+   
+   // only now is it safe to overwrite the snapshot 
+   rc = runfs_checkpointer_start( &runfs_checkpointer, runfs_checkpoint_runfs, runfs_checkpoint_restore_path );
+   if( rc != 0 ) {
+      runfs_error("runfs_checkpointer_start rc = %d\n", rc );
+   }
+   
+   return user_data;
+}
+
+// restore the snapshot at path when FUSE starts.
+// this happens while the kernel waits for us to finish initializing, so nothing sees a half-restored tree,
+// and the entries are created in a FUSE thread, like any other.
+void runfs_checkpoint_wrap_opers( struct runfs_state* runfs, struct fuse_operations* opers, char const* path ) {
+   
+   runfs_checkpoint_runfs = runfs;
+   runfs_checkpoint_restore_path = path;
+   runfs_checkpoint_next_init = opers->init;
+   
+   opers->init = runfs_checkpoint_fuse_init;
+}
+
+// SIGUSR2 handler: wake up the checkpoint thread
+static void runfs_checkpoint_sigusr2( int sig ) {
+   
+   if( runfs_checkpointer_self != NULL ) {
+      sem_post( &runfs_checkpointer_self->wakeup );
+   }
+}
+
+// checkpoint thread: take a snapshot each time we're signaled
+static void* runfs_checkpointer_main( void* arg ) {
+   
+   struct runfs_checkpointer* cp = (struct runfs_checkpointer*)arg;
+   
+   while( true ) {
+      
+      if( sem_wait( &cp->wakeup ) != 0 ) {
+         continue;
+      }
+      
+      if( atomic_load( &cp->stop ) ) {
+         break;
+      }
+      
+      runfs_checkpoint_save( cp->runfs, cp->path );
+   }
+   
+   return NULL;
+}
+
+// start taking snapshots to the given path whenever we get SIGUSR2.
+// return 0 on success 
+// return -ENOMEM on OOM 
+// return -errno on failure to start the thread or install the signal handler
+static int runfs_checkpointer_start( struct runfs_checkpointer* cp, struct runfs_state* runfs, char const* path ) {
+   
+   int rc = 0;
+   struct sigaction sa;
+   
+   memset( cp, 0, sizeof(struct runfs_checkpointer) );
+   
+   cp->path = strdup( path );
+   if( cp->path == NULL ) {
+      return -ENOMEM;
+   }
+   
+   cp->runfs = runfs;
+   atomic_init( &cp->stop, false );
+   sem_init( &cp->wakeup, 0, 0 );
+   
+   rc = pthread_create( &cp->thread, NULL, runfs_checkpointer_main, cp );
+   if( rc != 0 ) {
+      
+      sem_destroy( &cp->wakeup );
+      runfs_safe_free( cp->path );
+      return -rc;
+   }
+   
+   cp->running = true;
+   runfs_checkpointer_self = cp;
+   
+   memset( &sa, 0, sizeof(sa) );
+   sa.sa_handler = runfs_checkpoint_sigusr2;
+   sa.sa_flags = SA_RESTART;
+   sigemptyset( &sa.sa_mask );
+   
+   if( sigaction( SIGUSR2, &sa, NULL ) != 0 ) {
+      
+      rc = -errno;
+      runfs_checkpointer_stop( cp );
+      return rc;
+   }
+   
+   return 0;
+}
+
+// stop the checkpoint thread.  Doesn't take a final snapshot.
+// always succeeds
+static int runfs_checkpointer_stop( struct runfs_checkpointer* cp ) {
+   
+   if( !cp->running ) {
+      return 0;
+   }
+   
+   signal( SIGUSR2, SIG_IGN );
+   runfs_checkpointer_self = NULL;
+   
+   atomic_store( &cp->stop, true );
+   sem_post( &cp->wakeup );
+   pthread_join( cp->thread, NULL );
+   
+   sem_destroy( &cp->wakeup );
+   runfs_safe_free( cp->path );
+   cp->running = false;
+   
+   return 0;
+}
+
+// stop taking snapshots on SIGUSR2, and take a final one.
+// does nothing if we never restored (e.g. FUSE failed to start), so a good snapshot isn't replaced by an empty tree.
+// call after FUSE stops, but before fskit shuts down.
+// return 0 on success 
+// return negative on failure to take the snapshot
+int runfs_checkpoint_shutdown( void ) {
+   
+   if( !runfs_checkpointer.running ) {
+      return 0;
+   }
+   
+   struct runfs_state* runfs = runfs_checkpointer.runfs;
+   char* path = strdup( runfs_checkpointer.path );
+   
+   runfs_checkpointer_stop( &runfs_checkpointer );
+   
+   if( path == NULL ) {
+      return -ENOMEM;
+   }
+   
+   int rc = runfs_checkpoint_save( runfs, path );
+   free( path );
+   
+   return rc;
+}
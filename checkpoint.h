@@ -0,0 +1,87 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_CHECKPOINT_H_
+#define _RUNFS_CHECKPOINT_H_
+
+#include "os.h"
+#include "util.h"
+
+#include <fskit/fuse/fskit_fuse.h>
+
+// snapshot file format.  A header, followed by one record per entry in depth-first (parents-first) order.
+// each record is followed by its path, its cgroup path (if any), and its contents, padded to RUNFS_CHECKPOINT_ALIGN bytes.
+// integers are in host byte order; a snapshot is only meant to be restored on the host that took it.
+#define RUNFS_CHECKPOINT_MAGIC          0x52464331      // "RFC1"
+#define RUNFS_CHECKPOINT_VERSION        1
+#define RUNFS_CHECKPOINT_ALIGN          8
+
+#define RUNFS_CHECKPOINT_TYPE_FILE      1
+#define RUNFS_CHECKPOINT_TYPE_DIR       2
+
+struct runfs_checkpoint_header {
+   
+   uint32_t magic;
+   uint32_t version;
+   uint64_t num_records;
+   uint64_t len;                        // total length of the snapshot, including this header
+};
+
+struct runfs_checkpoint_record {
+   
+   uint8_t type;                        // RUNFS_CHECKPOINT_TYPE_*
+   uint8_t owner_type;                  // RUNFS_OWNER_*
+   uint16_t path_len;                   // length of the path, without a NUL
+   uint16_t cgroup_len;                 // length of the owning cgroup's path (0 unless owned by a cgroup)
+   uint16_t reserved;
+   uint32_t mode;
+   uint32_t uid;
+   uint32_t gid;
+   int32_t owner_id;                    // PID, process group ID or session ID
+   uint64_t starttime;                  // start time of the owning process (or session leader), so a reused PID isn't mistaken for it
+   uint64_t size;                       // length of the contents
+};
+
+#define RUNFS_CHECKPOINT_RECORD_LEN( path_len, cgroup_len, size ) \
+   ((sizeof(struct runfs_checkpoint_record) + (path_len) + (cgroup_len) + (size) + RUNFS_CHECKPOINT_ALIGN - 1) & ~((uint64_t)RUNFS_CHECKPOINT_ALIGN - 1))
+
+struct runfs_state;
+
+// takes snapshots on SIGUSR2
+struct runfs_checkpointer {
+   
+   char* path;                          // where the snapshot lives (ideally on a tmpfs)
+   struct runfs_state* runfs;
+   
+   pthread_t thread;
+   bool running;
+   sem_t wakeup;                        // posted by the signal handler
+   atomic_bool stop;
+};
+
+int runfs_checkpoint_save( struct runfs_state* runfs, char const* path );
+int runfs_checkpoint_restore( struct runfs_state* runfs, char const* path );
+
+void runfs_checkpoint_wrap_opers( struct runfs_state* runfs, struct fuse_operations* opers, char const* path );
+
+int runfs_checkpoint_shutdown( void );
+
+#endif
@@ -0,0 +1,165 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// benchmark: create many small files in runfs with one open/write/close per file, then with batches.
+// usage: bench_batch /path/to/mountpoint [num files] [file size]
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "runfs_client.h"
+
+// current time in seconds 
+static double now( void ) {
+   
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report( char const* name, int num_files, double elapsed ) {
+   
+   printf("%-10s %8d files  %10.3f s  %10.1f files/s  %8.2f us/file\n", name, num_files, elapsed, num_files / elapsed, elapsed * 1e6 / num_files );
+}
+
+int main( int argc, char** argv ) {
+   
+   char const* mountpoint = NULL;
+   int num_files = 1000;
+   size_t file_size = 16;
+   char dir[PATH_MAX+1];
+   char path[PATH_MAX+32];
+   char* contents = NULL;
+   double start = 0;
+   int rc = 0;
+   
+   if( argc < 2 ) {
+      fprintf(stderr, "Usage: %s /path/to/mountpoint [num files] [file size]\n", argv[0] );
+      exit(1);
+   }
+   
+   mountpoint = argv[1];
+   
+   if( argc > 2 ) {
+      num_files = atoi( argv[2] );
+   }
+   
+   if( argc > 3 ) {
+      file_size = atol( argv[3] );
+   }
+   
+   contents = (char*)malloc( file_size + 1 );
+   if( contents == NULL ) {
+      exit(1);
+   }
+   
+   memset( contents, 'x', file_size );
+   
+   // per-file system calls 
+   snprintf( dir, PATH_MAX, "%s/bench-syscall-%d", mountpoint, getpid() );
+   if( mkdir( dir, 0755 ) != 0 ) {
+      perror("mkdir");
+      exit(1);
+   }
+   
+   start = now();
+   
+   for( int i = 0; i < num_files; i++ ) {
+      
+      snprintf( path, sizeof(path), "%s/%d", dir, i );
+      
+      int fd = open( path, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+      if( fd < 0 ) {
+         perror("open");
+         exit(1);
+      }
+      
+      if( write( fd, contents, file_size ) != (ssize_t)file_size ) {
+         perror("write");
+         exit(1);
+      }
+      
+      close( fd );
+   }
+   
+   report( "syscall", num_files, now() - start );
+   
+   // batches 
+   struct runfs_batch* batch = runfs_batch_new( mountpoint );
+   if( batch == NULL ) {
+      perror("runfs_batch_new");
+      exit(1);
+   }
+   
+   snprintf( dir, PATH_MAX, "/bench-batch-%d", getpid() );
+   
+   start = now();
+   
+   runfs_batch_mkdir( batch, dir, 0755, 0 );
+   
+   for( int i = 0; i < num_files; i++ ) {
+      
+      snprintf( path, sizeof(path), "%s/%d", dir, i );
+      
+      rc = runfs_batch_create( batch, path, 0644, contents, file_size, 0 );
+      if( rc != 0 ) {
+         fprintf(stderr, "runfs_batch_create rc = %d\n", rc );
+         exit(1);
+      }
+   }
+   
+   rc = runfs_batch_commit( batch, NULL );
+   
+   report( "batch", num_files, now() - start );
+   
+   if( rc != 0 ) {
+      fprintf(stderr, "%d batch operations failed\n", rc );
+   }
+   
+   // clean up everything we made, in one go 
+   start = now();
+   
+   runfs_batch_release( batch, 0 );
+   rc = runfs_batch_commit( batch, NULL );
+   
+   report( "release", 2 * num_files, now() - start );
+   
+   if( rc != 0 ) {
+      fprintf(stderr, "release failed\n");
+   }
+   
+   runfs_batch_free( batch );
+   free( contents );
+   
+   return 0;
+}
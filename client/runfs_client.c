@@ -0,0 +1,402 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "runfs_client.h"
+#include "batch_proto.h"
+
+// a queued batch operation 
+struct runfs_batch_op {
+   
+   int op;                      // RUNFS_BATCH_OP_*
+   char* path;                  // path within runfs (NULL for releases)
+   mode_t mode;
+   char* contents;
+   size_t contents_len;
+   pid_t owner;
+};
+
+// a batch of operations, and the batch file to send them to 
+struct runfs_batch {
+   
+   int fd;                      // open batch file 
+   char* mountpoint;
+   
+   struct runfs_batch_op* ops;
+   size_t num_ops;
+   size_t max_ops;
+};
+
+// start a batch for the runfs mounted at mountpoint 
+// return the batch on success
+// return NULL on error, and set errno
+struct runfs_batch* runfs_batch_new( char const* mountpoint ) {
+   
+   char batch_path[PATH_MAX+1];
+   struct runfs_batch* batch = (struct runfs_batch*)calloc( 1, sizeof(struct runfs_batch) );
+   
+   if( batch == NULL ) {
+      return NULL;
+   }
+   
+   batch->mountpoint = strdup( mountpoint );
+   if( batch->mountpoint == NULL ) {
+      
+      free( batch );
+      errno = ENOMEM;
+      return NULL;
+   }
+   
+   snprintf( batch_path, PATH_MAX, "%s%s", mountpoint, RUNFS_CTL_BATCH );
+   
+   // read-write, so we can read back each record's result
+   batch->fd = open( batch_path, O_RDWR | O_CLOEXEC );
+   if( batch->fd < 0 ) {
+      
+      int errsv = errno;
+      free( batch->mountpoint );
+      free( batch );
+      errno = errsv;
+      return NULL;
+   }
+   
+   return batch;
+}
+
+// forget queued operations 
+static void runfs_batch_clear( struct runfs_batch* batch ) {
+   
+   for( size_t i = 0; i < batch->num_ops; i++ ) {
+      
+      free( batch->ops[i].path );
+      free( batch->ops[i].contents );
+   }
+   
+   batch->num_ops = 0;
+}
+
+// free a batch, discarding anything not committed 
+void runfs_batch_free( struct runfs_batch* batch ) {
+   
+   if( batch == NULL ) {
+      return;
+   }
+   
+   runfs_batch_clear( batch );
+   
+   if( batch->fd >= 0 ) {
+      close( batch->fd );
+   }
+   
+   free( batch->ops );
+   free( batch->mountpoint );
+   free( batch );
+}
+
+// queue an operation 
+// return 0 on success
+// return -ENOMEM on OOM
+// return -ENAMETOOLONG if the path is too long
+static int runfs_batch_add( struct runfs_batch* batch, int op, char const* path, mode_t mode, char const* contents, size_t contents_len, pid_t owner ) {
+   
+   struct runfs_batch_op* new_op = NULL;
+   
+   if( path != NULL && strlen( path ) > UINT16_MAX ) {
+      return -ENAMETOOLONG;
+   }
+   
+   if( batch->num_ops >= batch->max_ops ) {
+      
+      size_t new_max = (batch->max_ops == 0 ? 16 : batch->max_ops * 2);
+      struct runfs_batch_op* tmp = (struct runfs_batch_op*)realloc( batch->ops, sizeof(struct runfs_batch_op) * new_max );
+      
+      if( tmp == NULL ) {
+         return -ENOMEM;
+      }
+      
+      batch->ops = tmp;
+      batch->max_ops = new_max;
+   }
+   
+   new_op = &batch->ops[ batch->num_ops ];
+   memset( new_op, 0, sizeof(struct runfs_batch_op) );
+   
+   if( path != NULL ) {
+      
+      new_op->path = strdup( path );
+      if( new_op->path == NULL ) {
+         return -ENOMEM;
+      }
+   }
+   
+   if( contents_len > 0 ) {
+      
+      new_op->contents = (char*)malloc( contents_len );
+      if( new_op->contents == NULL ) {
+         
+         free( new_op->path );
+         return -ENOMEM;
+      }
+      
+      memcpy( new_op->contents, contents, contents_len );
+   }
+   
+   new_op->op = op;
+   new_op->mode = mode;
+   new_op->contents_len = contents_len;
+   new_op->owner = owner;
+   
+   batch->num_ops++;
+   return 0;
+}
+
+// queue up a file to create, with the given initial contents.
+// path is relative to the mountpoint, and must start with '/'.
+// owner is the PID the file shares fate with (0 for the caller).
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_batch_create( struct runfs_batch* batch, char const* path, mode_t mode, char const* contents, size_t contents_len, pid_t owner ) {
+   
+   return runfs_batch_add( batch, RUNFS_BATCH_OP_CREATE, path, mode, contents, contents_len, owner );
+}
+
+// queue up a file to create as a copy-on-write clone of src_path: the two share memory until either changes.
+// both paths are relative to the mountpoint, and must start with '/'.
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_batch_clone( struct runfs_batch* batch, char const* path, mode_t mode, char const* src_path, pid_t owner ) {
+   
+   return runfs_batch_add( batch, RUNFS_BATCH_OP_CLONE, path, mode, src_path, strlen( src_path ), owner );
+}
+
+// queue up a directory to create 
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_batch_mkdir( struct runfs_batch* batch, char const* path, mode_t mode, pid_t owner ) {
+   
+   return runfs_batch_add( batch, RUNFS_BATCH_OP_MKDIR, path, mode, NULL, 0, owner );
+}
+
+// queue up a release of everything owner created (0 for the caller)
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_batch_release( struct runfs_batch* batch, pid_t owner ) {
+   
+   return runfs_batch_add( batch, RUNFS_BATCH_OP_RELEASE, NULL, 0, NULL, 0, owner );
+}
+
+// how many operations are queued?
+size_t runfs_batch_count( struct runfs_batch* batch ) {
+   
+   return batch->num_ops;
+}
+
+// how many bytes does an operation take up in a batch?
+static size_t runfs_batch_op_len( struct runfs_batch_op* op ) {
+   
+   return RUNFS_BATCH_RECORD_LEN( (op->path != NULL ? strlen( op->path ) : 0), op->contents_len );
+}
+
+// carry out an operation that's too big for a batch with ordinary system calls 
+// return 0 on success
+// return -E2BIG if it names an owner or is a clone, since only batches can do that
+// return -errno on failure 
+static int runfs_batch_fallback( struct runfs_batch* batch, struct runfs_batch_op* op ) {
+   
+   char path[PATH_MAX+1];
+   int fd = 0;
+   int rc = 0;
+   
+   if( op->owner != 0 || op->op == RUNFS_BATCH_OP_CLONE ) {
+      return -E2BIG;
+   }
+   
+   snprintf( path, PATH_MAX, "%s%s", batch->mountpoint, op->path );
+   
+   if( op->op == RUNFS_BATCH_OP_MKDIR ) {
+      
+      if( mkdir( path, op->mode ) != 0 ) {
+         return -errno;
+      }
+      
+      return 0;
+   }
+   
+   fd = open( path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, op->mode );
+   if( fd < 0 ) {
+      return -errno;
+   }
+   
+   for( size_t off = 0; off < op->contents_len; ) {
+      
+      ssize_t nw = write( fd, op->contents + off, op->contents_len - off );
+      if( nw < 0 ) {
+         
+         rc = -errno;
+         break;
+      }
+      
+      off += nw;
+   }
+   
+   close( fd );
+   return rc;
+}
+
+// serialize ops[start..] into buf, as many as fit
+// return the number of ops packed, and set *buf_len
+static size_t runfs_batch_pack( struct runfs_batch* batch, size_t start, char* buf, size_t* buf_len ) {
+   
+   struct runfs_batch_header header;
+   size_t off = sizeof(struct runfs_batch_header);
+   size_t i = 0;
+   
+   for( i = start; i < batch->num_ops; i++ ) {
+      
+      struct runfs_batch_op* op = &batch->ops[i];
+      struct runfs_batch_record record;
+      size_t path_len = (op->path != NULL ? strlen( op->path ) : 0);
+      size_t len = runfs_batch_op_len( op );
+      
+      if( off + len > RUNFS_BATCH_MAX_LEN ) {
+         break;
+      }
+      
+      memset( &record, 0, sizeof(struct runfs_batch_record) );
+      record.op = op->op;
+      record.path_len = path_len;
+      record.mode = op->mode;
+      record.owner = op->owner;
+      record.contents_len = op->contents_len;
+      
+      memset( buf + off, 0, len );
+      memcpy( buf + off, &record, sizeof(struct runfs_batch_record) );
+      memcpy( buf + off + sizeof(struct runfs_batch_record), op->path, path_len );
+      
+      if( op->contents_len > 0 ) {
+         memcpy( buf + off + sizeof(struct runfs_batch_record) + path_len, op->contents, op->contents_len );
+      }
+      
+      off += len;
+   }
+   
+   header.magic = RUNFS_BATCH_MAGIC;
+   header.num_records = i - start;
+   memcpy( buf, &header, sizeof(struct runfs_batch_header) );
+   
+   *buf_len = off;
+   return i - start;
+}
+
+// send all queued operations, in order, in as few writes as possible, and clear the queue.
+// every operation is attempted, even if an earlier one fails, and none is attempted twice.
+// if results is not NULL, it must have room for runfs_batch_count() ints, and gets each operation's result (0 or -errno).
+// operations too big for a batch are carried out with ordinary system calls.
+// return the number of operations that failed
+int runfs_batch_commit( struct runfs_batch* batch, int* results ) {
+   
+   char buf[ RUNFS_BATCH_MAX_LEN ];
+   size_t buf_len = 0;
+   size_t i = 0;
+   int num_failed = 0;
+   int rc = 0;
+   
+   // a batch has at most one record per record header's worth of space 
+   uint32_t status_buf[ RUNFS_BATCH_STATUS_LEN( RUNFS_BATCH_MAX_LEN / sizeof(struct runfs_batch_record) ) / sizeof(uint32_t) ];
+   struct runfs_batch_status* status = (struct runfs_batch_status*)status_buf;
+   
+   while( i < batch->num_ops ) {
+      
+      size_t num_packed = runfs_batch_pack( batch, i, buf, &buf_len );
+      
+      if( num_packed == 0 ) {
+         
+         // too big for a batch 
+         rc = runfs_batch_fallback( batch, &batch->ops[i] );
+         
+         if( results != NULL ) {
+            results[i] = rc;
+         }
+         
+         if( rc != 0 ) {
+            num_failed++;
+         }
+         
+         i++;
+         continue;
+      }
+      
+      ssize_t nw = pwrite( batch->fd, buf, buf_len, 0 );
+      ssize_t nr = 0;
+      
+      if( nw >= 0 ) {
+         nr = pread( batch->fd, status_buf, RUNFS_BATCH_STATUS_LEN( num_packed ), 0 );
+      }
+      
+      if( nw < 0 || nr < 0 || (size_t)nr < RUNFS_BATCH_STATUS_LEN( num_packed ) || status->magic != RUNFS_BATCH_MAGIC || status->num_records != num_packed ) {
+         
+         // the batch as a whole failed, or we can't tell what happened to its records.
+         // either way, don't send them again.
+         rc = (nw < 0 || nr < 0 ? -errno : -EIO);
+         
+         for( size_t j = i; j < i + num_packed; j++ ) {
+            
+            if( results != NULL ) {
+               results[j] = rc;
+            }
+         }
+         
+         num_failed += num_packed;
+         i += num_packed;
+         continue;
+      }
+      
+      for( size_t j = 0; j < num_packed; j++ ) {
+         
+         if( results != NULL ) {
+            results[i + j] = status->results[j];
+         }
+         
+         if( status->results[j] != 0 ) {
+            num_failed++;
+         }
+      }
+      
+      i += num_packed;
+   }
+   
+   runfs_batch_clear( batch );
+   
+   return num_failed;
+}
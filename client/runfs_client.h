@@ -0,0 +1,44 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// client library for runfs's batch control file.
+// queue up entries to create (or owners to release), then commit them all with as few requests as possible.
+
+#ifndef _RUNFS_CLIENT_H_
+#define _RUNFS_CLIENT_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+
+struct runfs_batch;
+
+struct runfs_batch* runfs_batch_new( char const* mountpoint );
+void runfs_batch_free( struct runfs_batch* batch );
+
+int runfs_batch_create( struct runfs_batch* batch, char const* path, mode_t mode, char const* contents, size_t contents_len, pid_t owner );
+int runfs_batch_clone( struct runfs_batch* batch, char const* path, mode_t mode, char const* src_path, pid_t owner );
+int runfs_batch_mkdir( struct runfs_batch* batch, char const* path, mode_t mode, pid_t owner );
+int runfs_batch_release( struct runfs_batch* batch, pid_t owner );
+
+size_t runfs_batch_count( struct runfs_batch* batch );
+int runfs_batch_commit( struct runfs_batch* batch, int* results );
+
+#endif
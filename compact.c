@@ -0,0 +1,476 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "compact.h"
+#include "runfs.h"
+
+#ifdef RUNFS_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+// note that a file was just read or written, so it isn't compressed while it's in use 
+void runfs_compact_touch( struct runfs_compactor* compactor, struct runfs_inode* inode ) {
+   
+   if( compactor->cold_ms > 0 ) {
+      atomic_store_explicit( &inode->access_ms, runfs_stale_now_ms(), memory_order_relaxed );
+   }
+}
+
+// free compressed contents, the way the file's profile frees contents 
+void runfs_packed_free( struct runfs_packed* packed, void (*free_func)( void* ) ) {
+   
+   if( packed->compactor != NULL ) {
+      
+      atomic_fetch_sub( &packed->compactor->raw_bytes, packed->raw_len );
+      atomic_fetch_sub( &packed->compactor->packed_bytes, packed->len );
+   }
+   
+   (*free_func)( packed->data );
+   runfs_safe_free( packed );
+}
+
+// decompress compressed contents into raw, which must have room for packed->raw_len bytes 
+// return 0 on success 
+// return -EIO if the data is corrupt 
+// return -ENOTSUP if runfs was built without LZ4
+static int runfs_compact_decompress( struct runfs_packed* packed, char* raw ) {
+   
+#ifdef RUNFS_HAVE_LZ4
+   
+   int len = LZ4_decompress_safe( packed->data, raw, (int)packed->len, (int)packed->raw_len );
+   if( len < 0 || (size_t)len != packed->raw_len ) {
+      
+      runfs_error("LZ4_decompress_safe rc = %d (expected %zu)\n", len, packed->raw_len );
+      return -EIO;
+   }
+   
+   return 0;
+   
+#else
+   
+   return -ENOTSUP;
+   
+#endif
+}
+
+// decompress a copy of compressed contents.
+// free_func is how the file's profile frees contents; it frees the copy if the data turns out to be corrupt.
+// return a buffer of packed->raw_len bytes from runfs_arena_alloc() on success, which the caller frees with free_func 
+// return NULL on OOM, or if the data is corrupt
+char* runfs_compact_inflate( struct runfs_packed* packed, void (*free_func)( void* ) ) {
+   
+   char* raw = (char*)runfs_arena_alloc( packed->raw_len );
+   if( raw == NULL ) {
+      return NULL;
+   }
+   
+   if( runfs_compact_decompress( packed, raw ) != 0 ) {
+      
+      (*free_func)( raw );
+      return NULL;
+   }
+   
+   return raw;
+}
+
+// compress a file's contents, if it's big enough and it's worth it.
+// the caller must hold the entry's write lock.
+// lock-free readers may still be copying out of the old contents, so they're retired through the epoch.
+// return 0 on success, or if the file was left alone 
+// return -ENOMEM on OOM 
+// return -ENOTSUP if runfs was built without LZ4
+int runfs_compact_pack( struct runfs_compactor* compactor, struct runfs_inode* inode ) {
+   
+#ifdef RUNFS_HAVE_LZ4
+   
+   char* contents = atomic_load( &inode->contents );
+   size_t size = inode->size;
+   char* buf = NULL;
+   char* old_contents = NULL;
+   int bound = 0;
+   int len = 0;
+   struct runfs_packed* packed = NULL;
+   void (*free_func)( void* ) = NULL;
+   
+   // clones share their contents, and must leave them be 
+   if( contents == NULL || inode->packed != NULL || inode->shared != NULL ) {
+      return 0;
+   }
+   
+   if( size < RUNFS_COMPACT_MIN_LEN || size > LZ4_MAX_INPUT_SIZE ) {
+      return 0;
+   }
+   
+   bound = LZ4_compressBound( (int)size );
+   free_func = runfs_policy_get_free_func( inode->policy );
+   
+   // the scratch buffer holds the file's contents too (compressed), so it's freed the way they are 
+   buf = (char*)runfs_arena_alloc( bound );
+   packed = RUNFS_CALLOC( struct runfs_packed, 1 );
+   
+   if( buf == NULL || packed == NULL ) {
+      
+      if( buf != NULL ) {
+         (*free_func)( buf );
+      }
+      
+      runfs_safe_free( packed );
+      return -ENOMEM;
+   }
+   
+   len = LZ4_compress_default( contents, buf, (int)size, bound );
+   if( len <= 0 || (size_t)len > (size / 8) * RUNFS_COMPACT_MAX_RATIO_8THS ) {
+      
+      // incompressible.  Don't try again until it's been touched and gone cold again.
+      runfs_compact_touch( compactor, inode );
+      
+      (*free_func)( buf );
+      free( packed );
+      return 0;
+   }
+   
+   // keep just what we need, from the same allocator as contents buffers 
+   packed->data = (char*)runfs_arena_alloc( len );
+   if( packed->data == NULL ) {
+      
+      (*free_func)( buf );
+      free( packed );
+      return -ENOMEM;
+   }
+   
+   memcpy( packed->data, buf, len );
+   (*free_func)( buf );
+   
+   packed->len = len;
+   packed->raw_len = size;
+   packed->compactor = compactor;
+   
+   // the buffer's length stays charged to the profile, since decompressing brings it back 
+   runfs_inode_write_begin( inode );
+   
+   old_contents = runfs_inode_replace_contents( inode, NULL, inode->contents_len );
+   inode->packed = packed;
+   
+   runfs_inode_write_end( inode );
+   
+   runfs_epoch_retire( old_contents, free_func );
+   
+   atomic_fetch_add( &compactor->raw_bytes, packed->raw_len );
+   atomic_fetch_add( &compactor->packed_bytes, packed->len );
+   atomic_fetch_add( &compactor->num_packed, 1 );
+   
+   return 0;
+   
+#else
+   
+   return -ENOTSUP;
+   
+#endif
+}
+
+// decompress a file's contents back into a contents buffer, so it can be read or changed.
+// the caller must hold the entry's write lock.
+// return 0 on success, or if the file wasn't compressed 
+// return -ENOMEM on OOM 
+// return -EIO if the compressed data is corrupt
+int runfs_compact_unpack( struct runfs_inode* inode ) {
+   
+   struct runfs_packed* packed = inode->packed;
+   struct runfs_compactor* compactor = NULL;
+   char* contents = NULL;
+   uint64_t start_ns = 0;
+   int rc = 0;
+   
+   if( packed == NULL ) {
+      return 0;
+   }
+   
+   compactor = packed->compactor;
+   start_ns = runfs_trace_now_ns();
+   
+   // the file keeps its old capacity 
+   contents = (char*)runfs_arena_alloc( inode->contents_len );
+   if( contents == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rc = runfs_compact_decompress( packed, contents );
+   if( rc != 0 ) {
+      
+      (*runfs_policy_get_free_func( inode->policy ))( contents );
+      return rc;
+   }
+   
+   runfs_inode_write_begin( inode );
+   
+   runfs_inode_replace_contents( inode, contents, inode->contents_len );
+   inode->packed = NULL;
+   
+   runfs_inode_write_end( inode );
+   
+   // lock-free readers never look at the compressed data 
+   runfs_packed_free( packed, runfs_policy_get_free_func( inode->policy ) );
+   
+   if( compactor != NULL ) {
+      
+      atomic_fetch_add( &compactor->num_unpacked, 1 );
+      atomic_fetch_add( &compactor->unpack_ns, runfs_trace_now_ns() - start_ns );
+   }
+   
+   return 0;
+}
+
+// compress one file, if it's gone cold 
+// return 0 on success, or if it was left alone
+// return -ENOMEM on OOM
+static int runfs_compactor_visit_file( struct runfs_compactor* compactor, char const* path ) {
+   
+   int rc = 0;
+   struct runfs_inode* inode = NULL;
+   uint64_t now_ms = runfs_stale_now_ms();
+   
+   struct fskit_entry* fent = fskit_entry_resolve_path( compactor->runfs->core, path, 0, 0, true, &rc );
+   if( fent == NULL ) {
+      
+      // gone 
+      return 0;
+   }
+   
+   inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   
+   if( inode != NULL && fskit_entry_get_type( fent ) == FSKIT_ENTRY_TYPE_FILE && !runfs_inode_is_deleted( inode ) ) {
+      
+      uint64_t access_ms = atomic_load_explicit( &inode->access_ms, memory_order_relaxed );
+      
+      if( access_ms == 0 ) {
+         
+         // not touched since it was created; start the clock 
+         runfs_compact_touch( compactor, inode );
+      }
+      else if( now_ms - access_ms >= compactor->cold_ms ) {
+         
+         rc = runfs_compact_pack( compactor, inode );
+      }
+   }
+   
+   fskit_entry_unlock( fent );
+   
+   return rc;
+}
+
+// compress every cold file under a directory 
+// return 0 on success 
+// return -ENOMEM on OOM, or if we were asked to stop
+static int runfs_compactor_visit_dir( struct runfs_compactor* compactor, char const* dir_path ) {
+   
+   int rc = 0;
+   uint64_t num_dirents = 0;
+   struct fskit_core* core = compactor->runfs->core;
+   
+   struct fskit_dir_handle* dirh = fskit_opendir( core, dir_path, 0, 0, &rc );
+   if( dirh == NULL ) {
+      
+      // reaped underneath us 
+      return 0;
+   }
+   
+   struct fskit_dir_entry** dirents = fskit_listdir( core, dirh, &num_dirents, &rc );
+   fskit_closedir( core, dirh );
+   
+   if( dirents == NULL ) {
+      return (rc == -ENOMEM ? rc : 0);
+   }
+   
+   for( uint64_t i = 0; i < num_dirents && rc == 0; i++ ) {
+      
+      if( strcmp( dirents[i]->name, "." ) == 0 || strcmp( dirents[i]->name, ".." ) == 0 ) {
+         continue;
+      }
+      
+      if( dirents[i]->type != FSKIT_ENTRY_TYPE_FILE && dirents[i]->type != FSKIT_ENTRY_TYPE_DIR ) {
+         continue;
+      }
+      
+      if( dirents[i]->type == FSKIT_ENTRY_TYPE_FILE && (size_t)dirents[i]->size < RUNFS_COMPACT_MIN_LEN ) {
+         continue;
+      }
+      
+      char* child_path = fskit_fullpath( dir_path, dirents[i]->name, NULL );
+      if( child_path == NULL ) {
+         
+         rc = -ENOMEM;
+         break;
+      }
+      
+      if( strcmp( child_path, RUNFS_CTL_DIR ) != 0 ) {
+         
+         if( dirents[i]->type == FSKIT_ENTRY_TYPE_DIR ) {
+            rc = runfs_compactor_visit_dir( compactor, child_path );
+         }
+         else {
+            rc = runfs_compactor_visit_file( compactor, child_path );
+         }
+      }
+      
+      free( child_path );
+      
+      pthread_mutex_lock( &compactor->lock );
+      
+      if( compactor->stop ) {
+         rc = -ECANCELED;
+      }
+      
+      pthread_mutex_unlock( &compactor->lock );
+   }
+   
+   fskit_dir_entry_free_list( dirents );
+   
+   return rc;
+}
+
+// compactor thread: walk the tree every half cold period, until stopped 
+static void* runfs_compactor_main( void* arg ) {
+   
+   struct runfs_compactor* compactor = (struct runfs_compactor*)arg;
+   uint64_t period_ms = compactor->cold_ms / 2;
+   
+   if( period_ms < RUNFS_COMPACT_MIN_PERIOD_MS ) {
+      period_ms = RUNFS_COMPACT_MIN_PERIOD_MS;
+   }
+   
+   pthread_mutex_lock( &compactor->lock );
+   
+   while( !compactor->stop ) {
+      
+      struct timespec deadline;
+      
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      deadline.tv_sec += period_ms / 1000;
+      deadline.tv_nsec += (period_ms % 1000) * 1000000;
+      
+      if( deadline.tv_nsec >= 1000000000 ) {
+         
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000;
+      }
+      
+      pthread_cond_timedwait( &compactor->cond, &compactor->lock, &deadline );
+      
+      if( compactor->stop ) {
+         break;
+      }
+      
+      pthread_mutex_unlock( &compactor->lock );
+      
+      int rc = runfs_compactor_visit_dir( compactor, "/" );
+      if( rc != 0 && rc != -ECANCELED ) {
+         runfs_error("runfs_compactor_visit_dir rc = %d\n", rc );
+      }
+      
+      pthread_mutex_lock( &compactor->lock );
+   }
+   
+   pthread_mutex_unlock( &compactor->lock );
+   
+   return NULL;
+}
+
+// set up the compactor.  It compresses nothing until started.
+// return 0 on success 
+// return -ENOTSUP if asked to compress, but runfs was built without LZ4
+int runfs_compactor_init( struct runfs_compactor* compactor, struct runfs_state* runfs, uint64_t cold_ms ) {
+   
+   memset( compactor, 0, sizeof(struct runfs_compactor) );
+   
+#ifndef RUNFS_HAVE_LZ4
+   if( cold_ms > 0 ) {
+      
+      runfs_error("%s\n", "runfs was built without LZ4, so it can't compress files");
+      return -ENOTSUP;
+   }
+#endif
+   
+   compactor->runfs = runfs;
+   compactor->cold_ms = cold_ms;
+   
+   pthread_mutex_init( &compactor->lock, NULL );
+   pthread_cond_init( &compactor->cond, NULL );
+   
+   atomic_init( &compactor->raw_bytes, 0 );
+   atomic_init( &compactor->packed_bytes, 0 );
+   atomic_init( &compactor->num_packed, 0 );
+   atomic_init( &compactor->num_unpacked, 0 );
+   atomic_init( &compactor->unpack_ns, 0 );
+   
+   return 0;
+}
+
+// start compressing cold files in the background, if asked to 
+// return 0 on success 
+// return -errno on failure to start the thread
+int runfs_compactor_start( struct runfs_compactor* compactor ) {
+   
+   int rc = 0;
+   
+   if( compactor->cold_ms == 0 ) {
+      return 0;
+   }
+   
+   rc = pthread_create( &compactor->thread, NULL, runfs_compactor_main, compactor );
+   if( rc != 0 ) {
+      return -rc;
+   }
+   
+   compactor->running = true;
+   return 0;
+}
+
+// stop compressing files.  Files that are compressed stay that way.
+// call before fskit shuts down.
+// always succeeds
+int runfs_compactor_stop( struct runfs_compactor* compactor ) {
+   
+   if( !compactor->running ) {
+      return 0;
+   }
+   
+   pthread_mutex_lock( &compactor->lock );
+   
+   compactor->stop = true;
+   pthread_cond_signal( &compactor->cond );
+   
+   pthread_mutex_unlock( &compactor->lock );
+   
+   pthread_join( compactor->thread, NULL );
+   compactor->running = false;
+   
+   return 0;
+}
+
+// free up the compactor.  It must be stopped.
+// always succeeds
+int runfs_compactor_free( struct runfs_compactor* compactor ) {
+   
+   pthread_mutex_destroy( &compactor->lock );
+   pthread_cond_destroy( &compactor->cond );
+   
+   return 0;
+}
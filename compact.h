@@ -0,0 +1,86 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// transparent compression of cold files.
+// a background thread walks the tree every so often, and compresses the contents of large files that
+// nobody has read or written for a while.  The first read, write or truncate decompresses them again.
+// compression needs LZ4 (build with RUNFS_HAVE_LZ4 defined, which the Makefile does if lz4.h is installed).
+
+#ifndef _RUNFS_COMPACT_H_
+#define _RUNFS_COMPACT_H_
+
+#include "os.h"
+#include "util.h"
+
+// files smaller than this aren't worth compressing 
+#define RUNFS_COMPACT_MIN_LEN           (1024 * 1024)
+
+// keep the compressed copy only if it's at most this fraction (in eighths) of the original 
+#define RUNFS_COMPACT_MAX_RATIO_8THS    7
+
+// shortest time between passes over the tree 
+#define RUNFS_COMPACT_MIN_PERIOD_MS     1000
+
+struct runfs_state;
+struct runfs_inode;
+struct runfs_compactor;
+
+// a file's compressed contents.  While an inode has these, its contents buffer is NULL.
+struct runfs_packed {
+   
+   char* data;
+   size_t len;                          // length of data 
+   size_t raw_len;                      // length of the contents it decompresses to (the file's size when it was compressed)
+   
+   struct runfs_compactor* compactor;   // whose stats to update when it goes away 
+};
+
+// background compressor 
+struct runfs_compactor {
+   
+   struct runfs_state* runfs;
+   uint64_t cold_ms;                    // compress files nobody has touched for this long (--compact-after=MS), or 0 to never compress
+   
+   pthread_t thread;
+   bool running;
+   pthread_mutex_t lock;                // governs stop, and lets stop() wake the thread up 
+   pthread_cond_t cond;
+   bool stop;
+   
+   atomic_uint_fast64_t raw_bytes;      // uncompressed length of everything that's compressed right now 
+   atomic_uint_fast64_t packed_bytes;   // compressed length of the same 
+   atomic_uint_fast64_t num_packed;     // files compressed, ever 
+   atomic_uint_fast64_t num_unpacked;   // files decompressed, ever 
+   atomic_uint_fast64_t unpack_ns;      // total time spent decompressing 
+};
+
+int runfs_compactor_init( struct runfs_compactor* compactor, struct runfs_state* runfs, uint64_t cold_ms );
+int runfs_compactor_start( struct runfs_compactor* compactor );
+int runfs_compactor_stop( struct runfs_compactor* compactor );
+int runfs_compactor_free( struct runfs_compactor* compactor );
+
+void runfs_compact_touch( struct runfs_compactor* compactor, struct runfs_inode* inode );
+int runfs_compact_pack( struct runfs_compactor* compactor, struct runfs_inode* inode );
+int runfs_compact_unpack( struct runfs_inode* inode );
+char* runfs_compact_inflate( struct runfs_packed* packed, void (*free_func)( void* ) );
+void runfs_packed_free( struct runfs_packed* packed, void (*free_func)( void* ) );
+
+#endif
@@ -0,0 +1,69 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "content.h"
+
+// start sharing a contents buffer.  The caller's inode holds the first reference.
+// return the shared contents on success
+// return NULL on OOM
+struct runfs_content* runfs_content_new( char* contents, runfs_epoch_free_func_t free_func ) {
+   
+   struct runfs_content* content = RUNFS_CALLOC( struct runfs_content, 1 );
+   if( content == NULL ) {
+      return NULL;
+   }
+   
+   atomic_init( &content->refcount, 1 );
+   content->contents = contents;
+   content->free_func = free_func;
+   
+   return content;
+}
+
+// add an inode to the contents' users 
+void runfs_content_ref( struct runfs_content* content ) {
+   
+   atomic_fetch_add( &content->refcount, 1 );
+}
+
+// is anyone else using these contents?
+// the answer is only stable if the caller holds a reference, since that's the only way anyone else can get one.
+bool runfs_content_is_shared( struct runfs_content* content ) {
+   
+   return atomic_load( &content->refcount ) > 1;
+}
+
+// drop an inode's reference.  The caller must have stopped publishing content->contents.
+// the last one out retires the buffer through the epoch, since other inodes' lock-free readers may still be copying out of it.
+void runfs_content_unref( struct runfs_content* content ) {
+   
+   if( atomic_fetch_sub( &content->refcount, 1 ) == 1 ) {
+      
+      runfs_epoch_retire( content->contents, content->free_func );
+      runfs_safe_free( content );
+   }
+}
+
+// stop sharing contents that only the caller's inode uses; the inode keeps the buffer as its own.
+void runfs_content_disown( struct runfs_content* content ) {
+   
+   runfs_safe_free( content );
+}
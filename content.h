@@ -0,0 +1,47 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// contents buffers shared between cloned files.
+// A clone shares its source's contents buffer instead of copying it.  Shared contents are never changed:
+// whichever file is written to first gets its own copy, and the buffer is freed once no file uses it.
+
+#ifndef _RUNFS_CONTENT_H_
+#define _RUNFS_CONTENT_H_
+
+#include "os.h"
+#include "util.h"
+#include "epoch.h"
+
+// a contents buffer shared by one or more inodes
+struct runfs_content {
+   
+   atomic_int refcount;                 // number of inodes using contents
+   char* contents;
+   runfs_epoch_free_func_t free_func;   // how to free contents once the last inode lets go
+};
+
+struct runfs_content* runfs_content_new( char* contents, runfs_epoch_free_func_t free_func );
+void runfs_content_ref( struct runfs_content* content );
+bool runfs_content_is_shared( struct runfs_content* content );
+void runfs_content_unref( struct runfs_content* content );
+void runfs_content_disown( struct runfs_content* content );
+
+#endif
@@ -0,0 +1,1012 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "ctl.h"
+#include "runfs.h"
+
+// set once the control directory is in place.  After that, nothing else can be created in it.
+static atomic_bool runfs_ctl_ready = false;
+
+// PID that owns the entries this thread is creating for a batch (0 if we're not in a batch)
+static __thread pid_t runfs_ctl_owner = 0;
+
+// PID whose entries this thread is releasing (0 if we're not releasing anything)
+static __thread pid_t runfs_ctl_release_pid = 0;
+
+// who should own an entry being created by this thread?
+// this is the calling process, unless a batch record says otherwise.
+pid_t runfs_ctl_get_owner( void ) {
+   
+   if( runfs_ctl_owner != 0 ) {
+      return runfs_ctl_owner;
+   }
+   
+   return fskit_fuse_get_pid();
+}
+
+// make the given process own the entries this thread creates from now on, instead of the caller
+// (e.g. when restoring a checkpoint).  Pass 0 to go back to the caller.
+void runfs_ctl_set_owner( pid_t pid ) {
+   
+   runfs_ctl_owner = pid;
+}
+
+// is this thread releasing this inode's owner?
+// used by runfs_readdir to treat such inodes as orphaned.
+// cheap if we're not releasing anything.
+bool runfs_ctl_is_released( struct runfs_inode* inode ) {
+   
+   if( runfs_ctl_release_pid == 0 ) {
+      return false;
+   }
+   
+   if( inode->owner != NULL ) {
+      
+      // group owners get marked dead directly
+      return false;
+   }
+   
+   return pstat_get_pid( inode->ps ) == runfs_ctl_release_pid;
+}
+
+// may a user tie entries to (or release the entries of) the given process?
+// only if it's root, or it owns the process.
+// return 0 if so
+// return -EPERM if not 
+// return -ESRCH if there is no such process
+static int runfs_ctl_check_owner( pid_t owner, uid_t caller_uid ) {
+   
+   char proc_path[PATH_MAX+1];
+   struct stat sb;
+   
+   snprintf( proc_path, PATH_MAX, "/proc/%d", owner );
+   
+   if( stat( proc_path, &sb ) != 0 ) {
+      return -ESRCH;
+   }
+   
+   if( caller_uid != 0 && sb.st_uid != caller_uid ) {
+      return -EPERM;
+   }
+   
+   return 0;
+}
+
+// may a user release the entries of a whole process group, session or cgroup?
+// only if it's root, or it owns the group: the process group or session leader, or the (delegated) cgroup directory.
+// owning one member isn't enough, since a user's process can sit in root's session (e.g. under su).
+// return 0 if so 
+// return -EPERM if not (including if the group's leader is gone)
+static int runfs_ctl_check_group_owner( struct runfs_owner* owner, uid_t caller_uid ) {
+   
+   struct stat sb;
+   
+   if( caller_uid == 0 ) {
+      return 0;
+   }
+   
+   if( owner->dirfd >= 0 ) {
+      
+      // /proc/$SID or the cgroup directory 
+      if( fstat( owner->dirfd, &sb ) != 0 ) {
+         return -EPERM;
+      }
+      
+      return (sb.st_uid == caller_uid ? 0 : -EPERM);
+   }
+   
+   if( owner->type == RUNFS_OWNER_PGRP ) {
+      return (runfs_ctl_check_owner( owner->id, caller_uid ) == 0 ? 0 : -EPERM);
+   }
+   
+   return -EPERM;
+}
+
+// a release, waiting for its sweep 
+struct runfs_ctl_release_ctx {
+   
+   struct runfs_state* runfs;
+   pid_t pid;
+};
+
+// deferred release: sweep the filesystem so runfs_readdir reaps the released process's entries.
+// runs on the deferred unlink queue, so the sweep's listing is this thread's own.
+static int runfs_ctl_release_cb( struct runfs_wreq* wreq, void* cls ) {
+   
+   struct runfs_ctl_release_ctx* ctx = (struct runfs_ctl_release_ctx*)cls;
+   int rc = 0;
+   
+   runfs_ctl_release_pid = ctx->pid;
+   
+   rc = runfs_sweep( ctx->runfs, INT_MAX );
+   
+   runfs_ctl_release_pid = 0;
+   
+   if( rc < 0 ) {
+      runfs_error("runfs_sweep rc = %d\n", rc );
+   }
+   
+   runfs_safe_free( ctx );
+   return 0;
+}
+
+// reap everything a process (or, under group ownership, its group) created.
+// the caller (caller_uid) must already be allowed to release pid (see runfs_ctl_check_owner()).
+// under group ownership, the group is only marked dead if the caller owns the group (see runfs_ctl_check_group_owner());
+// otherwise only the entries pid owns by itself are released.
+// then queues a sweep of the filesystem on the deferred unlink queue's background lane,
+// so runfs_readdir reaps its entries without holding up the writer.
+// return 0 on success 
+// return -ENOMEM on OOM
+// return -EAGAIN if the deferred unlink backlog is full
+static int runfs_ctl_release( struct runfs_state* runfs, pid_t pid, uid_t caller_uid ) {
+   
+   int rc = 0;
+   struct runfs_owner* owner = NULL;
+   struct runfs_ctl_release_ctx* ctx = NULL;
+   struct runfs_wreq* work = NULL;
+   
+   if( runfs->owners.type != RUNFS_OWNER_PID ) {
+      
+      rc = runfs_owner_get( &runfs->owners, pid, &owner );
+      if( rc == 0 ) {
+         
+         if( runfs_ctl_check_group_owner( owner, caller_uid ) == 0 ) {
+            atomic_store( &owner->dead, true );
+         }
+         else {
+            runfs_debug("uid %d may not release the %s of PID %d; releasing only the entries it owns alone\n", (int)caller_uid, runfs_owner_type_name( owner->type ), (int)pid );
+         }
+         
+         runfs_owner_unref( owner );
+      }
+      else if( rc == -ENOMEM ) {
+         
+         return rc;
+      }
+      
+      // otherwise, its entries are owned by PID
+   }
+   
+   ctx = RUNFS_CALLOC( struct runfs_ctl_release_ctx, 1 );
+   if( ctx == NULL ) {
+      return -ENOMEM;
+   }
+   
+   work = RUNFS_CALLOC( struct runfs_wreq, 1 );
+   if( work == NULL ) {
+      
+      runfs_safe_free( ctx );
+      return -ENOMEM;
+   }
+   
+   ctx->runfs = runfs;
+   ctx->pid = pid;
+   
+   runfs_wreq_init( work, runfs_ctl_release_cb, ctx );
+   runfs_wreq_set_lane( work, RUNFS_WQ_LANE_BACKGROUND );
+   
+   rc = runfs_wq_add( runfs->deferred_unlink_wq, work );
+   if( rc != 0 ) {
+      
+      runfs_safe_free( work );
+      runfs_safe_free( ctx );
+      return rc;
+   }
+   
+   return 0;
+}
+
+// create a file with the given initial contents 
+// return 0 on success 
+// return negative on error
+static int runfs_ctl_create( struct runfs_state* runfs, char const* path, mode_t mode, char const* contents, size_t contents_len, uid_t uid, gid_t gid ) {
+   
+   int rc = 0;
+   ssize_t num_written = 0;
+   
+   struct fskit_file_handle* fh = fskit_create( runfs->core, path, uid, gid, mode, &rc );
+   
+   runfs_publish_create( runfs, path, (fh != NULL ? 0 : rc) );
+   
+   if( fh == NULL ) {
+      return rc;
+   }
+   
+   if( contents_len > 0 ) {
+      
+      num_written = fskit_write( runfs->core, fh, contents, contents_len, 0 );
+      if( num_written < 0 ) {
+         rc = (int)num_written;
+      }
+      else if( (size_t)num_written != contents_len ) {
+         rc = -EIO;
+      }
+   }
+   
+   fskit_close( runfs->core, fh );
+   
+   if( rc != 0 ) {
+      
+      // don't leave half-made files behind
+      fskit_unlink( runfs->core, path, uid, gid );
+   }
+   
+   return rc;
+}
+
+// create a file that shares another file's contents, copy-on-write (see runfs_clone()).
+// the writer must be able to read the source.
+// return 0 on success 
+// return -EINVAL if the source path is missing or too long 
+// return negative on error
+static int runfs_ctl_clone( struct runfs_state* runfs, char const* path, mode_t mode, char const* src_path_buf, size_t src_path_len, uid_t uid, gid_t gid ) {
+   
+   int rc = 0;
+   char src_path[PATH_MAX+1];
+   struct fskit_file_handle* fh = NULL;
+   
+   if( src_path_len == 0 || src_path_len > PATH_MAX ) {
+      return -EINVAL;
+   }
+   
+   memcpy( src_path, src_path_buf, src_path_len );
+   src_path[ src_path_len ] = '\0';
+   
+   // check read permission on the source 
+   fh = fskit_open( runfs->core, src_path, uid, gid, O_RDONLY, 0, &rc );
+   if( fh == NULL ) {
+      return rc;
+   }
+   
+   fskit_close( runfs->core, fh );
+   
+   rc = runfs_ctl_create( runfs, path, mode, NULL, 0, uid, gid );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   rc = runfs_clone( runfs, src_path, path, uid, gid );
+   if( rc != 0 ) {
+      
+      // don't leave half-made files behind
+      fskit_unlink( runfs->core, path, uid, gid );
+   }
+   
+   return rc;
+}
+
+// carry out one batch record 
+// return 0 on success
+// return negative on error
+static int runfs_ctl_batch_record( struct runfs_state* runfs, struct runfs_batch_record* record, char const* path, char const* contents, uid_t uid, gid_t gid, pid_t owner ) {
+   
+   int rc = 0;
+   mode_t mode = record->mode & 07777;
+   
+   switch( record->op ) {
+      
+      case RUNFS_BATCH_OP_CREATE:
+         
+         runfs_ctl_owner = owner;
+         rc = runfs_ctl_create( runfs, path, mode, contents, record->contents_len, uid, gid );
+         runfs_ctl_owner = 0;
+         break;
+         
+      case RUNFS_BATCH_OP_MKDIR:
+         
+         runfs_ctl_owner = owner;
+         rc = fskit_mkdir( runfs->core, path, mode, uid, gid );
+         runfs_ctl_owner = 0;
+         
+         runfs_publish_create( runfs, path, rc );
+         break;
+         
+      case RUNFS_BATCH_OP_RELEASE:
+         
+         rc = runfs_ctl_release( runfs, owner, uid );
+         break;
+         
+      case RUNFS_BATCH_OP_CLONE:
+         
+         runfs_ctl_owner = owner;
+         rc = runfs_ctl_clone( runfs, path, mode, contents, record->contents_len, uid, gid );
+         runfs_ctl_owner = 0;
+         break;
+         
+      default:
+         
+         rc = -EINVAL;
+   }
+   
+   return rc;
+}
+
+// results of the last batch written through an open batch file 
+struct runfs_ctl_batch_handle {
+   
+   pthread_mutex_t lock;                // governs status
+   struct runfs_batch_status* status;   // NULL until a batch is written
+};
+
+// carry out a batch of records written to the batch file (see batch_proto.h), and remember each record's result in the handle.
+// every record is attempted, even if an earlier one fails.
+// return the length of the batch on success (even if records failed)
+// return -EINVAL if the batch is malformed, or not written at offset 0
+// return -ENOMEM on OOM
+static int runfs_ctl_batch_write( struct runfs_state* runfs, struct runfs_ctl_batch_handle* handle, char const* buf, size_t buflen, off_t offset ) {
+   
+   int rc = 0;
+   struct fuse_context* ctx = fuse_get_context();
+   struct runfs_batch_header header;
+   struct runfs_batch_record record;
+   char path[PATH_MAX+1];
+   size_t off = sizeof(struct runfs_batch_header);
+   struct runfs_batch_status* status = NULL;
+   int32_t* results = NULL;
+   uint32_t i = 0;
+   
+   if( offset != 0 || buflen < sizeof(struct runfs_batch_header) ) {
+      return -EINVAL;
+   }
+   
+   memcpy( &header, buf, sizeof(struct runfs_batch_header) );
+   
+   // every record takes up at least its header
+   if( header.magic != RUNFS_BATCH_MAGIC || header.num_records > (buflen - sizeof(struct runfs_batch_header)) / sizeof(struct runfs_batch_record) ) {
+      return -EINVAL;
+   }
+   
+   runfs_debug("runfs_ctl_batch_write(%u records, %zu bytes) from %d\n", header.num_records, buflen, ctx->pid );
+   
+   status = (struct runfs_batch_status*)calloc( 1, RUNFS_BATCH_STATUS_LEN( header.num_records ) );
+   if( status == NULL ) {
+      return -ENOMEM;
+   }
+   
+   status->magic = RUNFS_BATCH_MAGIC;
+   status->num_records = header.num_records;
+   results = status->results;
+   
+   for( i = 0; i < header.num_records; i++ ) {
+      
+      pid_t owner = ctx->pid;
+      
+      if( off + sizeof(struct runfs_batch_record) > buflen ) {
+         break;
+      }
+      
+      memcpy( &record, buf + off, sizeof(struct runfs_batch_record) );
+      
+      if( off + sizeof(struct runfs_batch_record) + record.path_len + record.contents_len > buflen || record.path_len > PATH_MAX ) {
+         break;
+      }
+      
+      // from here on, we know where the next record starts 
+      char const* record_path = buf + off + sizeof(struct runfs_batch_record);
+      char const* contents = record_path + record.path_len;
+      
+      off += RUNFS_BATCH_RECORD_LEN( record.path_len, record.contents_len );
+      
+      if( record.op != RUNFS_BATCH_OP_RELEASE && record.path_len == 0 ) {
+         
+         results[i] = -EINVAL;
+         continue;
+      }
+      
+      memcpy( path, record_path, record.path_len );
+      path[ record.path_len ] = '\0';
+      
+      if( record.owner != 0 ) {
+         
+         rc = runfs_ctl_check_owner( record.owner, ctx->uid );
+         if( rc != 0 ) {
+            
+            results[i] = rc;
+            continue;
+         }
+         
+         owner = record.owner;
+      }
+      
+      rc = runfs_ctl_batch_record( runfs, &record, path, contents, ctx->uid, ctx->gid, owner );
+      if( rc != 0 ) {
+         
+         runfs_debug("batch record %u ('%s') rc = %d\n", i, path, rc );
+      }
+      
+      results[i] = rc;
+   }
+   
+   // we lost track of where records start, so the rest can't be carried out 
+   for( ; i < header.num_records; i++ ) {
+      results[i] = -EINVAL;
+   }
+   
+   pthread_mutex_lock( &handle->lock );
+   
+   runfs_safe_free( handle->status );
+   handle->status = status;
+   
+   pthread_mutex_unlock( &handle->lock );
+   
+   return (int)buflen;
+}
+
+// read back the results of the last batch written through this handle (see batch_proto.h)
+// return the number of bytes read (0 if no batch has been written yet)
+static int runfs_ctl_batch_read( struct runfs_ctl_batch_handle* handle, char* buf, size_t size, off_t offset ) {
+   
+   size_t len = 0;
+   
+   pthread_mutex_lock( &handle->lock );
+   
+   if( handle->status != NULL ) {
+      len = RUNFS_BATCH_STATUS_LEN( handle->status->num_records );
+   }
+   
+   if( (size_t)offset >= len ) {
+      
+      pthread_mutex_unlock( &handle->lock );
+      return 0;
+   }
+   
+   if( size > len - offset ) {
+      size = len - offset;
+   }
+   
+   memcpy( buf, (char*)handle->status + offset, size );
+   
+   pthread_mutex_unlock( &handle->lock );
+   
+   return (int)size;
+}
+
+// create an entry in the control directory.
+// only runfs itself can, while setting up.
+// return 0 on success
+// return -EPERM once the control directory is set up 
+static int runfs_ctl_create_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, void** inode_data, void** handle_data ) {
+   
+   if( atomic_load( &runfs_ctl_ready ) ) {
+      return -EPERM;
+   }
+   
+   *inode_data = NULL;
+   return 0;
+}
+
+// make a directory in the control directory (or the control directory itself)
+// return 0 on success
+// return -EPERM once the control directory is set up 
+static int runfs_ctl_mkdir_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* dent, mode_t mode, void** inode_data ) {
+   
+   if( atomic_load( &runfs_ctl_ready ) ) {
+      return -EPERM;
+   }
+   
+   *inode_data = NULL;
+   return 0;
+}
+
+// no device files, FIFOs or sockets in the control directory 
+// return -EPERM 
+static int runfs_ctl_mknod_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, dev_t dev, void** inode_data ) {
+   
+   return -EPERM;
+}
+
+// control entries don't have inodes, and never go stale 
+// return 0
+static int runfs_ctl_stat_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, struct stat* sb ) {
+   
+   return 0;
+}
+
+// nothing to read from control files 
+// return 0 (EOF)
+static int runfs_ctl_read_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
+   
+   return 0;
+}
+
+// control files are written through FUSE (see runfs_ctl_fuse_write()), never through fskit 
+// return -EBADF
+static int runfs_ctl_write_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
+   
+   return -EBADF;
+}
+
+// control files have no contents to truncate 
+// return 0 
+static int runfs_ctl_trunc_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, off_t new_size, void* inode_data ) {
+   
+   return 0;
+}
+
+// control files have no inodes to free 
+// return 0
+static int runfs_ctl_destroy_route( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, void* inode_data ) {
+   
+   return 0;
+}
+
+// register the control directory's routes.
+// these must be added before the FSKIT_ROUTE_ANY routes, so they match first.
+// return 0 on success
+// return negative on failure to add a route
+int runfs_ctl_add_routes( struct fskit_core* core ) {
+   
+   int rh = 0;
+   
+   rh = fskit_route_create( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_create_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_create(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_mkdir( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_mkdir_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_mkdir(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_mknod( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_mknod_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_mknod(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_stat( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_stat_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_stat(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_read( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_read_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_read(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_write( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_write_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_write(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_trunc( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_trunc_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_trunc(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   rh = fskit_route_destroy( core, RUNFS_CTL_ROUTE_ALL, runfs_ctl_destroy_route, FSKIT_CONCURRENT );
+   if( rh < 0 ) {
+      runfs_error("fskit_route_destroy(%s) rc = %d\n", RUNFS_CTL_ROUTE_ALL, rh );
+      return rh;
+   }
+   
+   return 0;
+}
+
+// create the control directory and its files.
+// call after the routes are in place, and the root is owned by the user.
+// return 0 on success
+// return negative on failure to create them
+int runfs_ctl_init( struct runfs_state* runfs ) {
+   
+   int rc = 0;
+   struct fskit_file_handle* fh = NULL;
+   
+   rc = fskit_mkdir( runfs->core, RUNFS_CTL_DIR, 0755, geteuid(), getegid() );
+   if( rc != 0 ) {
+      
+      runfs_error("fskit_mkdir('%s') rc = %d\n", RUNFS_CTL_DIR, rc );
+      return rc;
+   }
+   
+   // anyone can send batches; records can only name processes the sender owns
+   fh = fskit_create( runfs->core, RUNFS_CTL_BATCH, geteuid(), getegid(), 0666, &rc );
+   if( fh == NULL ) {
+      
+      runfs_error("fskit_create('%s') rc = %d\n", RUNFS_CTL_BATCH, rc );
+      return rc;
+   }
+   
+   fskit_close( runfs->core, fh );
+   
+   // anyone can watch the event stream and stats.  reads and writes of control files are served by runfs_ctl_fuse_*(), not fskit.
+   char const* read_only_files[] = { RUNFS_CTL_EVENTS, RUNFS_CTL_STATS, NULL };
+   
+   for( int i = 0; read_only_files[i] != NULL; i++ ) {
+      
+      fh = fskit_create( runfs->core, read_only_files[i], geteuid(), getegid(), 0444, &rc );
+      if( fh == NULL ) {
+         
+         runfs_error("fskit_create('%s') rc = %d\n", read_only_files[i], rc );
+         return rc;
+      }
+      
+      fskit_close( runfs->core, fh );
+   }
+   
+   atomic_store( &runfs_ctl_ready, true );
+   
+   return 0;
+}
+
+
+// control files served directly through FUSE, instead of through fskit's routes
+#define RUNFS_CTL_FILE_NONE     0       // not one of ours; pass it through to fskit
+#define RUNFS_CTL_FILE_EVENTS   1
+#define RUNFS_CTL_FILE_STATS    2
+#define RUNFS_CTL_FILE_BATCH    3
+
+// fskit's FUSE operations, which handle everything else 
+static struct fuse_operations runfs_ctl_next_opers;
+
+// runfs state, for the FUSE operations 
+static struct runfs_state* runfs_ctl_runfs = NULL;
+
+// a snapshot of the stats file, taken when it's opened 
+struct runfs_ctl_snapshot {
+   
+   size_t len;
+   char text[];
+};
+
+// which control file is this?
+static int runfs_ctl_file_type( char const* path ) {
+   
+   if( path == NULL ) {
+      return RUNFS_CTL_FILE_NONE;
+   }
+   
+   if( strcmp( path, RUNFS_CTL_EVENTS ) == 0 ) {
+      return RUNFS_CTL_FILE_EVENTS;
+   }
+   
+   if( strcmp( path, RUNFS_CTL_STATS ) == 0 ) {
+      return RUNFS_CTL_FILE_STATS;
+   }
+   
+   if( strcmp( path, RUNFS_CTL_BATCH ) == 0 ) {
+      return RUNFS_CTL_FILE_BATCH;
+   }
+   
+   return RUNFS_CTL_FILE_NONE;
+}
+
+// format runfs's statistics, one "name value" per line 
+// return a malloc'ed snapshot on success
+// return NULL on OOM
+static struct runfs_ctl_snapshot* runfs_ctl_stats_snapshot( struct runfs_state* runfs ) {
+   
+   char* text = NULL;
+   size_t len = 0;
+   struct runfs_ctl_snapshot* snapshot = NULL;
+   struct runfs_arena_stats arena_stats;
+   
+   FILE* f = open_memstream( &text, &len );
+   if( f == NULL ) {
+      return NULL;
+   }
+   
+   fprintf( f, "bytes_reclaimed %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->bytes_reclaimed ) );
+   fprintf( f, "entries_reclaimed %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->entries_reclaimed ) );
+   runfs_reclaim_report( &runfs->reclaim, f );
+   fprintf( f, "stale_ttl_ms %" PRIu32 "\n", runfs->stale.default_ttl_ms );
+   fprintf( f, "stale_hits %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->stale.hits ) );
+   fprintf( f, "stale_misses %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->stale.misses ) );
+   runfs_arena_get_stats( &arena_stats );
+   
+   fprintf( f, "arena_pending_free_bytes %" PRIu64 "\n", arena_stats.pending_bytes );
+   fprintf( f, "arena_reclaimed_bytes %" PRIu64 "\n", arena_stats.reclaimed_bytes );
+   fprintf( f, "arena_mapped_bytes %" PRIu64 "\n", arena_stats.mapped_bytes );
+   fprintf( f, "arena_cached_bytes %" PRIu64 "\n", arena_stats.cached_bytes );
+   fprintf( f, "arena_hugetlb_allocs %" PRIu64 "\n", arena_stats.num_hugetlb );
+   fprintf( f, "arena_hugetlb_fallbacks %" PRIu64 "\n", arena_stats.num_fallbacks );
+   fprintf( f, "compact_raw_bytes %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->compactor.raw_bytes ) );
+   fprintf( f, "compact_packed_bytes %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->compactor.packed_bytes ) );
+   fprintf( f, "compact_files_packed %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->compactor.num_packed ) );
+   fprintf( f, "compact_files_unpacked %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->compactor.num_unpacked ) );
+   fprintf( f, "compact_unpack_ns %" PRIu64 "\n", (uint64_t)atomic_load( &runfs->compactor.unpack_ns ) );
+   
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      struct runfs_wq_stats wq_stats;
+      runfs_wq_get_stats( runfs->deferred_unlink_wq, i, &wq_stats );
+      
+      fprintf( f, "wq%d_depth %" PRIu64 "\n", i, wq_stats.depth );
+      fprintf( f, "wq%d_max_depth %" PRIu64 "\n", i, wq_stats.max_depth );
+      fprintf( f, "wq%d_reserved %" PRIu64 "\n", i, wq_stats.reserved );
+      fprintf( f, "wq%d_completed %" PRIu64 "\n", i, wq_stats.num_completed );
+      fprintf( f, "wq%d_retried %" PRIu64 "\n", i, wq_stats.num_retried );
+      fprintf( f, "wq%d_rejected %" PRIu64 "\n", i, wq_stats.num_rejected );
+      fprintf( f, "wq%d_oldest_age_ms %" PRIu64 "\n", i, wq_stats.oldest_age_ms );
+   }
+   
+   if( fclose( f ) != 0 ) {
+      
+      runfs_safe_free( text );
+      return NULL;
+   }
+   
+   snapshot = (struct runfs_ctl_snapshot*)malloc( sizeof(struct runfs_ctl_snapshot) + len );
+   if( snapshot != NULL ) {
+      
+      memcpy( snapshot->text, text, len );
+      snapshot->len = len;
+   }
+   
+   runfs_safe_free( text );
+   return snapshot;
+}
+
+// FUSE open.  Control files bypass the page cache: each open of the event stream is its own reader,
+// each open of the stats file gets a fresh snapshot, and each open of the batch file keeps its own batch results.
+static int runfs_ctl_fuse_open( const char* path, struct fuse_file_info* fi ) {
+   
+   int type = runfs_ctl_file_type( path );
+   
+   if( type == RUNFS_CTL_FILE_NONE ) {
+      return (*runfs_ctl_next_opers.open)( path, fi );
+   }
+   
+   if( type == RUNFS_CTL_FILE_BATCH ) {
+      
+      struct runfs_ctl_batch_handle* handle = RUNFS_CALLOC( struct runfs_ctl_batch_handle, 1 );
+      if( handle == NULL ) {
+         return -ENOMEM;
+      }
+      
+      pthread_mutex_init( &handle->lock, NULL );
+      
+      fi->fh = (uintptr_t)handle;
+      fi->direct_io = 1;
+      return 0;
+   }
+   
+   if( (fi->flags & O_ACCMODE) != O_RDONLY ) {
+      return -EACCES;
+   }
+   
+   if( type == RUNFS_CTL_FILE_EVENTS ) {
+      
+      struct runfs_events_reader* reader = runfs_events_reader_new( &runfs_ctl_runfs->events );
+      if( reader == NULL ) {
+         return -ENOMEM;
+      }
+      
+      fi->fh = (uintptr_t)reader;
+      fi->nonseekable = 1;
+   }
+   else {
+      
+      struct runfs_ctl_snapshot* snapshot = runfs_ctl_stats_snapshot( runfs_ctl_runfs );
+      if( snapshot == NULL ) {
+         return -ENOMEM;
+      }
+      
+      fi->fh = (uintptr_t)snapshot;
+   }
+   
+   fi->direct_io = 1;
+   return 0;
+}
+
+// FUSE read 
+static int runfs_ctl_fuse_read( const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi ) {
+   
+   int type = runfs_ctl_file_type( path );
+   
+   if( type == RUNFS_CTL_FILE_NONE ) {
+      return (*runfs_ctl_next_opers.read)( path, buf, size, offset, fi );
+   }
+   
+   if( type == RUNFS_CTL_FILE_EVENTS ) {
+      return runfs_events_read( &runfs_ctl_runfs->events, (struct runfs_events_reader*)(uintptr_t)fi->fh, buf, size, (fi->flags & O_NONBLOCK) != 0 );
+   }
+   
+   if( type == RUNFS_CTL_FILE_BATCH ) {
+      return runfs_ctl_batch_read( (struct runfs_ctl_batch_handle*)(uintptr_t)fi->fh, buf, size, offset );
+   }
+   
+   struct runfs_ctl_snapshot* snapshot = (struct runfs_ctl_snapshot*)(uintptr_t)fi->fh;
+   
+   if( (size_t)offset >= snapshot->len ) {
+      return 0;
+   }
+   
+   if( size > snapshot->len - offset ) {
+      size = snapshot->len - offset;
+   }
+   
+   memcpy( buf, snapshot->text + offset, size );
+   return (int)size;
+}
+
+// FUSE write 
+static int runfs_ctl_fuse_write( const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi ) {
+   
+   int type = runfs_ctl_file_type( path );
+   
+   if( type == RUNFS_CTL_FILE_NONE ) {
+      return (*runfs_ctl_next_opers.write)( path, buf, size, offset, fi );
+   }
+   
+   // batches from different writers can run at once
+   if( type == RUNFS_CTL_FILE_BATCH ) {
+      return runfs_ctl_batch_write( runfs_ctl_runfs, (struct runfs_ctl_batch_handle*)(uintptr_t)fi->fh, buf, size, offset );
+   }
+   
+   return -EBADF;
+}
+
+// FUSE flush
+static int runfs_ctl_fuse_flush( const char* path, struct fuse_file_info* fi ) {
+   
+   if( runfs_ctl_file_type( path ) == RUNFS_CTL_FILE_NONE && runfs_ctl_next_opers.flush != NULL ) {
+      return (*runfs_ctl_next_opers.flush)( path, fi );
+   }
+   
+   return 0;
+}
+
+// FUSE release 
+static int runfs_ctl_fuse_release( const char* path, struct fuse_file_info* fi ) {
+   
+   int type = runfs_ctl_file_type( path );
+   
+   if( type == RUNFS_CTL_FILE_NONE ) {
+      return (*runfs_ctl_next_opers.release)( path, fi );
+   }
+   
+   if( type == RUNFS_CTL_FILE_EVENTS ) {
+      runfs_events_reader_free( &runfs_ctl_runfs->events, (struct runfs_events_reader*)(uintptr_t)fi->fh );
+   }
+   else if( type == RUNFS_CTL_FILE_BATCH ) {
+      
+      struct runfs_ctl_batch_handle* handle = (struct runfs_ctl_batch_handle*)(uintptr_t)fi->fh;
+      
+      pthread_mutex_destroy( &handle->lock );
+      runfs_safe_free( handle->status );
+      runfs_safe_free( handle );
+   }
+   else {
+      free( (struct runfs_ctl_snapshot*)(uintptr_t)fi->fh );
+   }
+   
+   return 0;
+}
+
+// FUSE fsync 
+static int runfs_ctl_fuse_fsync( const char* path, int datasync, struct fuse_file_info* fi ) {
+   
+   if( runfs_ctl_file_type( path ) == RUNFS_CTL_FILE_NONE && runfs_ctl_next_opers.fsync != NULL ) {
+      return (*runfs_ctl_next_opers.fsync)( path, datasync, fi );
+   }
+   
+   return 0;
+}
+
+// FUSE ftruncate 
+static int runfs_ctl_fuse_ftruncate( const char* path, off_t new_size, struct fuse_file_info* fi ) {
+   
+   if( runfs_ctl_file_type( path ) != RUNFS_CTL_FILE_NONE ) {
+      return -EINVAL;
+   }
+   
+   if( runfs_ctl_next_opers.ftruncate == NULL ) {
+      return -ENOSYS;
+   }
+   
+   return (*runfs_ctl_next_opers.ftruncate)( path, new_size, fi );
+}
+
+// FUSE fgetattr: control files have no fskit handle, so look them up by path 
+static int runfs_ctl_fuse_fgetattr( const char* path, struct stat* sb, struct fuse_file_info* fi ) {
+   
+   if( runfs_ctl_file_type( path ) == RUNFS_CTL_FILE_NONE && runfs_ctl_next_opers.fgetattr != NULL ) {
+      return (*runfs_ctl_next_opers.fgetattr)( path, sb, fi );
+   }
+   
+   return (*runfs_ctl_next_opers.getattr)( path, sb );
+}
+
+// FUSE create: publish the create event once fskit has linked the new entry in 
+static int runfs_ctl_fuse_create( const char* path, mode_t mode, struct fuse_file_info* fi ) {
+   
+   int rc = (*runfs_ctl_next_opers.create)( path, mode, fi );
+   
+   runfs_publish_create( runfs_ctl_runfs, path, rc );
+   return rc;
+}
+
+// FUSE mknod: publish the create event once fskit has linked the new entry in 
+static int runfs_ctl_fuse_mknod( const char* path, mode_t mode, dev_t dev ) {
+   
+   int rc = (*runfs_ctl_next_opers.mknod)( path, mode, dev );
+   
+   runfs_publish_create( runfs_ctl_runfs, path, rc );
+   return rc;
+}
+
+// FUSE mkdir: publish the create event once fskit has linked the new directory in 
+static int runfs_ctl_fuse_mkdir( const char* path, mode_t mode ) {
+   
+   int rc = (*runfs_ctl_next_opers.mkdir)( path, mode );
+   
+   runfs_publish_create( runfs_ctl_runfs, path, rc );
+   return rc;
+}
+
+// FUSE poll.  Only the event stream ever blocks; everything else is always ready.
+static int runfs_ctl_fuse_poll( const char* path, struct fuse_file_info* fi, struct fuse_pollhandle* ph, unsigned* reventsp ) {
+   
+   int type = runfs_ctl_file_type( path );
+   
+   if( type == RUNFS_CTL_FILE_EVENTS ) {
+      
+      runfs_events_poll( &runfs_ctl_runfs->events, (struct runfs_events_reader*)(uintptr_t)fi->fh, ph, reventsp );
+      return 0;
+   }
+   
+   if( type == RUNFS_CTL_FILE_NONE && runfs_ctl_next_opers.poll != NULL ) {
+      return (*runfs_ctl_next_opers.poll)( path, fi, ph, reventsp );
+   }
+   
+   // don't fail, or the kernel stops asking us about the event stream too
+   *reventsp = POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM;
+   
+   if( ph != NULL ) {
+      fuse_pollhandle_destroy( ph );
+   }
+   
+   return 0;
+}
+
+// serve the event stream, stats file and batch file through FUSE, by interposing on fskit's file operations.
+// creates are interposed on too, so create events go out only once the new entry can be looked up.
+// their entries in the control directory are still fskit's, so they can be looked up and stat'ed as usual.
+void runfs_ctl_wrap_opers( struct runfs_state* runfs, struct fuse_operations* opers ) {
+   
+   runfs_ctl_runfs = runfs;
+   runfs_ctl_next_opers = *opers;
+   
+   opers->open = runfs_ctl_fuse_open;
+   opers->read = runfs_ctl_fuse_read;
+   opers->write = runfs_ctl_fuse_write;
+   opers->flush = runfs_ctl_fuse_flush;
+   opers->release = runfs_ctl_fuse_release;
+   opers->fsync = runfs_ctl_fuse_fsync;
+   opers->ftruncate = runfs_ctl_fuse_ftruncate;
+   opers->fgetattr = runfs_ctl_fuse_fgetattr;
+   opers->poll = runfs_ctl_fuse_poll;
+   opers->create = runfs_ctl_fuse_create;
+   opers->mknod = runfs_ctl_fuse_mknod;
+   opers->mkdir = runfs_ctl_fuse_mkdir;
+   
+   // we need paths to tell control files apart
+   opers->flag_nullpath_ok = 0;
+   opers->flag_nopath = 0;
+}
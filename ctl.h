@@ -0,0 +1,47 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_CTL_H_
+#define _RUNFS_CTL_H_
+
+#include "os.h"
+#include "util.h"
+#include "batch_proto.h"
+
+#include <fskit/fskit.h>
+#include <fskit/fuse/fskit_fuse.h>
+
+// routes for everything under the control directory 
+#define RUNFS_CTL_ROUTE_ALL     "/\\.runfs(/[^/]+)?"
+
+struct runfs_state;
+struct runfs_inode;
+
+int runfs_ctl_add_routes( struct fskit_core* core );
+int runfs_ctl_init( struct runfs_state* runfs );
+
+void runfs_ctl_wrap_opers( struct runfs_state* runfs, struct fuse_operations* opers );
+
+pid_t runfs_ctl_get_owner( void );
+void runfs_ctl_set_owner( pid_t pid );
+bool runfs_ctl_is_released( struct runfs_inode* inode );
+
+#endif
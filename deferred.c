@@ -28,50 +28,73 @@ struct runfs_deferred_remove_ctx {
    struct fskit_core* core;
    char* fs_path;               // path to the entry to remove
    fskit_entry_set* children;   // the (optional) children to remove (not yet garbage-collected)
+   
+   struct runfs_detach_job job; // parallel detach state for the children, once set up
+   bool job_ready;              // has job been set up?
+   int retries;                 // number of times we've run out of memory so far
+   int reason;                  // why it's being reaped (RUNFS_EVENT_REASON_*)
 };
 
 
+// how long to wait before retrying a deferred remove that has run out of memory this many times
+static int64_t runfs_deferred_backoff_ms( int retries ) {
+   
+   int64_t delay_ms = RUNFS_DEFERRED_BACKOFF_MIN_MS;
+   
+   for( int i = 0; i < retries && delay_ms < RUNFS_DEFERRED_BACKOFF_MAX_MS; i++ ) {
+      delay_ms *= 2;
+   }
+   
+   if( delay_ms > RUNFS_DEFERRED_BACKOFF_MAX_MS ) {
+      delay_ms = RUNFS_DEFERRED_BACKOFF_MAX_MS;
+   }
+   
+   return delay_ms;
+}
+
+
 // helper to asynchronously try to unlink an inode and its children
 static int runfs_deferred_remove_cb( struct runfs_wreq* wreq, void* cls ) {
 
    struct runfs_deferred_remove_ctx* ctx = (struct runfs_deferred_remove_ctx*)cls;
-   struct fskit_detach_ctx* dctx = NULL;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( ctx->core );
    int rc = 0;
    
    runfs_debug("DEFERRED: remove '%s'\n", ctx->fs_path );
    
    // remove the children 
-   if( ctx->children != NULL ) {
-       
-      dctx = fskit_detach_ctx_new();
-      if( dctx == NULL ) {
-         return -ENOMEM;
-      }
-
-      rc = fskit_detach_ctx_init( dctx );
-      if( rc != 0 ) {
-         return rc;
-      }
-
-      // proceed to detach
-      while( true ) {
-         
-         rc = fskit_detach_all_ex( ctx->core, ctx->fs_path, &ctx->children, dctx );
-         if( rc == 0 ) {
-             break;
-         }
-         else if( rc == -ENOMEM ) {
-             continue;
-         }
-         else {
-             break;
-         }
+   if( ctx->children != NULL && !ctx->job_ready ) {
+      
+      rc = runfs_detach_job_init( &ctx->job, ctx->core, ctx->fs_path, &ctx->children, runfs->detach_threads, ctx->reason );
+      if( rc == 0 ) {
+         ctx->job_ready = true;
       }
+   }
+   
+   if( ctx->job_ready ) {
+      
+      rc = runfs_detach_job_run( &ctx->job );
+   }
+   
+   if( rc == -ENOMEM ) {
+      
+      // back off and let the rest of the queue (and the rest of the system) free up some memory.
+      // the job keeps track of what's left, so we pick up where we left off.
+      int64_t delay_ms = runfs_deferred_backoff_ms( ctx->retries );
+      ctx->retries++;
       
-      fskit_detach_ctx_free( dctx );
-      runfs_safe_free( dctx );
+      runfs_error("DEFERRED: out of memory removing '%s' (attempt %d); retrying in %" PRId64 " ms\n", ctx->fs_path, ctx->retries, delay_ms );
       
-      fskit_entry_set_free( ctx->children );
+      runfs_wreq_retry( wreq, delay_ms );
+      return 0;
+   }
+   
+   if( rc != 0 ) {
+      runfs_error("runfs_detach_job_run('%s') rc = %d\n", ctx->fs_path, rc );
+   }
+   
+   if( ctx->job_ready ) {
+      runfs_detach_job_free( &ctx->job );
    }
 
    runfs_safe_free( ctx->fs_path );
@@ -83,19 +106,40 @@ static int runfs_deferred_remove_cb( struct runfs_wreq* wreq, void* cls ) {
 
 // Garbage-collect the given inode, and queue it for unlinkage.
 // If the inode is a directory, recursively garbage-collect its children as well, and queue them and their descendents for unlinkage
+// Small garbage sets are queued in the fast lane, so pidfiles disappear promptly even while big directories are being torn down.
+// reason (RUNFS_EVENT_REASON_*) goes into the reap events of its descendants as they are destroyed.
 // return 0 on success
+// return -EAGAIN if the deferred unlink backlog is full (nothing was garbage-collected; try again later)
+// return -EEXIST if the inode is already queued for unlinkage
+// return -ENOMEM on OOM
 // NOTE: child must be write-locked
-int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, struct fskit_entry* child ) {
+int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, struct fskit_entry* child, int reason ) {
 
    struct runfs_deferred_remove_ctx* ctx = NULL;
    struct fskit_core* core = runfs->core;
    struct runfs_wreq* work = NULL;
    fskit_entry_set* children = NULL;
+   int lane = RUNFS_WQ_LANE_FAST;
    int rc = 0;
+   
+   // make sure we can queue it before we garbage-collect it.
+   // every reap starts out in the fast lane, since we don't know how big it is until it's garbage-collected;
+   // so a full backlog refuses it there, and a big one moves its reservation to the background lane below.
+   // the write-lock on child keeps anyone else from reserving for it concurrently.
+   // key on the inode number, not the entry's address: a request can sit in the delayed list
+   // across retries, and the address may be reused by a new entry by then.
+   uint64_t key = fskit_entry_get_file_id( child );
+   
+   rc = runfs_wq_reserve( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST, key );
+   if( rc != 0 ) {
+       return rc;
+   }
 
    // asynchronously unlink it and its children
    ctx = RUNFS_CALLOC( struct runfs_deferred_remove_ctx, 1 );
    if( ctx == NULL ) {
+       
+       runfs_wq_unreserve( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST );
        return -ENOMEM;
    }
    
@@ -103,17 +147,20 @@ int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, st
    if( work == NULL ) {
        
        runfs_safe_free( ctx );
+       runfs_wq_unreserve( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST );
        return -ENOMEM;
    }
    
    // set up the deferred unlink request 
    ctx->core = core;
+   ctx->reason = reason;
    ctx->fs_path = strdup( child_path );
    
    if( ctx->fs_path == NULL ) {
        
        runfs_safe_free( work );
        runfs_safe_free( ctx );
+       runfs_wq_unreserve( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST );
        return -ENOMEM;
    }
    
@@ -121,8 +168,10 @@ int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, st
    rc = fskit_entry_tag_garbage( child, &children );
    if( rc != 0 ) {
        
+       runfs_safe_free( ctx->fs_path );
        runfs_safe_free( ctx );
        runfs_safe_free( work );
+       runfs_wq_unreserve( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST );
        
        runfs_error("fskit_entry_garbage_collect('%s') rc = %d\n", child_path, rc );
        return rc;
@@ -130,10 +179,21 @@ int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, st
    
    ctx->children = children;
    
+   if( children != NULL && fskit_entry_set_count( children ) > RUNFS_DEFERRED_SMALL_MAX ) {
+       
+       // big subtree; don't hold up the small stuff
+       lane = RUNFS_WQ_LANE_BACKGROUND;
+       runfs_wq_reserve_move( runfs->deferred_unlink_wq, RUNFS_WQ_LANE_FAST, lane );
+   }
+   
    // deferred removal 
    runfs_wreq_init( work, runfs_deferred_remove_cb, ctx );
+   runfs_wreq_set_lane( work, lane );
+   runfs_wreq_set_key( work, key );
+   work->reserved = true;
+   
+   // space is reserved, so this can't fail
    runfs_wq_add( runfs->deferred_unlink_wq, work );
    
    return 0;
 }
-
@@ -26,8 +26,16 @@
 #include "wq.h"
 #include "util.h"
 
+// exponential backoff bounds for retrying a deferred remove that ran out of memory
+#define RUNFS_DEFERRED_BACKOFF_MIN_MS   1
+#define RUNFS_DEFERRED_BACKOFF_MAX_MS   1000
+
+// garbage sets with at most this many entries are reaped in the work queue's fast lane;
+// bigger ones go in the background lane
+#define RUNFS_DEFERRED_SMALL_MAX        16
+
 struct runfs_state;
 
-int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, struct fskit_entry* child );
+int runfs_deferred_remove( struct runfs_state* runfs, char const* child_path, struct fskit_entry* child, int reason );
 
 #endif
@@ -0,0 +1,863 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "detach.h"
+#include "runfs.h"
+
+// why the entries this thread is detaching are being reaped (RUNFS_EVENT_REASON_NONE if it isn't detaching any)
+static __thread int runfs_detach_reason = RUNFS_EVENT_REASON_NONE;
+
+// why is the entry being destroyed on this thread being reaped?
+// runfs_destroy uses this to publish reap events for every entry in a reaped subtree.
+// return RUNFS_EVENT_REASON_NONE if this thread isn't detaching a reaped subtree
+int runfs_detach_get_reason( void ) {
+
+   return runfs_detach_reason;
+}
+
+// make sure a detach job has room for at least count more work units
+// return 0 on success
+// return -ENOMEM on OOM
+static int runfs_detach_job_reserve( struct runfs_detach_job* job, size_t count ) {
+
+   if( job->num_units + count > job->max_units ) {
+
+      size_t new_max_units = job->max_units * 2;
+      if( new_max_units == 0 ) {
+         new_max_units = 16;
+      }
+
+      while( job->num_units + count > new_max_units ) {
+         new_max_units *= 2;
+      }
+
+      struct runfs_detach_unit* tmp = (struct runfs_detach_unit*)realloc( job->units, new_max_units * sizeof(struct runfs_detach_unit) );
+      if( tmp == NULL ) {
+         return -ENOMEM;
+      }
+
+      job->units = tmp;
+      job->max_units = new_max_units;
+   }
+
+   return 0;
+}
+
+
+// add a work unit to a detach job.
+// takes ownership of fs_path and children on success
+// return 0 on success
+// return -ENOMEM on OOM
+static int runfs_detach_job_add( struct runfs_detach_job* job, char* fs_path, fskit_entry_set* children, int level ) {
+
+   int rc = runfs_detach_job_reserve( job, 1 );
+   if( rc != 0 ) {
+      return rc;
+   }
+
+   job->units[ job->num_units ].fs_path = fs_path;
+   job->units[ job->num_units ].children = children;
+   job->units[ job->num_units ].level = level;
+
+   job->num_units++;
+
+   return 0;
+}
+
+
+// is this entry in a garbage set a real child (i.e. not "." or "..")?
+static bool runfs_detach_is_child( fskit_entry_set* itr, long dot_hash, long dotdot_hash ) {
+
+   long hash = fskit_entry_set_name_hash( itr );
+
+   return fskit_entry_set_get( itr ) != NULL && hash != dot_hash && hash != dotdot_hash;
+}
+
+
+// descend into the directories of a unit: garbage-collect each directory's children into a unit of their own,
+// so the directory itself becomes empty and cheap to detach once its children are gone.
+// stops early (without error) if we run out of memory--whatever we didn't expand just gets detached by its parent's unit.
+// return 0 on success
+static int runfs_detach_job_expand( struct runfs_detach_job* job, size_t unit_idx ) {
+
+   int rc = 0;
+   fskit_entry_set_itr itr;
+   fskit_entry_set* dp = NULL;
+   long dot_hash = fskit_entry_name_hash( "." );
+   long dotdot_hash = fskit_entry_name_hash( ".." );
+
+   // NOTE: job->units may be reallocated below, so don't hold a pointer to the unit
+   fskit_entry_set* children = job->units[ unit_idx ].children;
+   int level = job->units[ unit_idx ].level;
+
+   for( dp = fskit_entry_set_begin( &itr, children ); dp != NULL; dp = fskit_entry_set_next( &itr ) ) {
+
+      if( !runfs_detach_is_child( dp, dot_hash, dotdot_hash ) ) {
+         continue;
+      }
+
+      struct fskit_entry* child = fskit_entry_set_get( dp );
+      fskit_entry_set* grandchildren = NULL;
+
+      if( fskit_entry_get_type( child ) != FSKIT_ENTRY_TYPE_DIR ) {
+         continue;
+      }
+
+      char* name = fskit_entry_get_name( child );
+      if( name == NULL ) {
+         break;
+      }
+
+      char* child_path = fskit_fullpath( job->units[ unit_idx ].fs_path, name, NULL );
+      runfs_safe_free( name );
+
+      if( child_path == NULL ) {
+         break;
+      }
+
+      // make sure we'll have room for the new unit before we garbage-collect anything
+      rc = runfs_detach_job_reserve( job, 1 );
+      if( rc != 0 ) {
+
+         runfs_safe_free( child_path );
+         break;
+      }
+
+      fskit_entry_wlock( child );
+      rc = fskit_entry_tag_garbage( child, &grandchildren );
+      fskit_entry_unlock( child );
+
+      if( rc != 0 ) {
+
+         runfs_error("fskit_entry_tag_garbage('%s') rc = %d\n", child_path, rc );
+         runfs_safe_free( child_path );
+         rc = 0;
+         continue;
+      }
+
+      // space is reserved, so this can't fail
+      runfs_detach_job_add( job, child_path, grandchildren, level + 1 );
+   }
+
+   return 0;
+}
+
+
+// split a large unit into several smaller ones at the same level, dealing its entries out round-robin.
+// leaves the unit untouched (without error) if we run out of memory.
+// return 0 on success
+static int runfs_detach_job_split( struct runfs_detach_job* job, size_t unit_idx ) {
+
+   int rc = 0;
+   fskit_entry_set_itr itr;
+   fskit_entry_set* dp = NULL;
+   long dot_hash = fskit_entry_name_hash( "." );
+   long dotdot_hash = fskit_entry_name_hash( ".." );
+
+   size_t num_pieces = fskit_entry_set_count( job->units[ unit_idx ].children ) / RUNFS_DETACH_SPLIT_MIN;
+   size_t max_pieces = (size_t)job->num_threads * RUNFS_DETACH_UNITS_PER_THREAD;
+   size_t next_piece = 0;
+
+   if( num_pieces > max_pieces ) {
+      num_pieces = max_pieces;
+   }
+
+   if( num_pieces <= 1 ) {
+      return 0;
+   }
+
+   fskit_entry_set** pieces = RUNFS_CALLOC( fskit_entry_set*, num_pieces );
+   char** piece_paths = RUNFS_CALLOC( char*, num_pieces );
+
+   if( pieces == NULL || piece_paths == NULL ) {
+
+      runfs_safe_free( pieces );
+      runfs_safe_free( piece_paths );
+      return 0;
+   }
+
+   for( dp = fskit_entry_set_begin( &itr, job->units[ unit_idx ].children ); dp != NULL; dp = fskit_entry_set_next( &itr ) ) {
+
+      if( !runfs_detach_is_child( dp, dot_hash, dotdot_hash ) ) {
+         continue;
+      }
+
+      rc = fskit_entry_set_insert_hash( &pieces[ next_piece ], fskit_entry_set_name_hash( dp ), fskit_entry_set_get( dp ) );
+      if( rc != 0 ) {
+         break;
+      }
+
+      next_piece = (next_piece + 1) % num_pieces;
+   }
+
+   // piece 0 stays with the original unit
+   for( size_t i = 1; rc == 0 && i < num_pieces; i++ ) {
+
+      piece_paths[i] = strdup( job->units[ unit_idx ].fs_path );
+      if( piece_paths[i] == NULL ) {
+         rc = -ENOMEM;
+      }
+   }
+
+   if( rc == 0 ) {
+      rc = runfs_detach_job_reserve( job, num_pieces - 1 );
+   }
+
+   if( rc != 0 ) {
+
+      // can't split.  leave the original set alone
+      for( size_t i = 0; i < num_pieces; i++ ) {
+
+         fskit_entry_set_free( pieces[i] );
+         runfs_safe_free( piece_paths[i] );
+      }
+
+      runfs_safe_free( pieces );
+      runfs_safe_free( piece_paths );
+      return 0;
+   }
+
+   // the original set is now partitioned across the pieces
+   fskit_entry_set_free( job->units[ unit_idx ].children );
+   job->units[ unit_idx ].children = pieces[0];
+
+   for( size_t i = 1; i < num_pieces; i++ ) {
+
+      // space is reserved, so this can't fail
+      runfs_detach_job_add( job, piece_paths[i], pieces[i], job->units[ unit_idx ].level );
+   }
+
+   runfs_safe_free( pieces );
+   runfs_safe_free( piece_paths );
+
+   return 0;
+}
+
+
+// order work units by level, deepest last
+static int runfs_detach_unit_cmp( const void* a, const void* b ) {
+
+   struct runfs_detach_unit const* u1 = (struct runfs_detach_unit const*)a;
+   struct runfs_detach_unit const* u2 = (struct runfs_detach_unit const*)b;
+
+   return u1->level - u2->level;
+}
+
+
+// set up a pool of pre-allocated detach contexts, so we can keep reclaiming memory when we can't allocate any more
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_detach_pool_init( struct runfs_detach_pool* pool, size_t count ) {
+
+   int rc = 0;
+
+   memset( pool, 0, sizeof(struct runfs_detach_pool) );
+
+   pool->ctxs = RUNFS_CALLOC( struct fskit_detach_ctx*, count );
+   if( pool->ctxs == NULL ) {
+      return -ENOMEM;
+   }
+
+   pool->capacity = count;
+
+   for( size_t i = 0; i < count; i++ ) {
+
+      struct fskit_detach_ctx* dctx = fskit_detach_ctx_new();
+      if( dctx == NULL ) {
+
+         runfs_detach_pool_free( pool );
+         return -ENOMEM;
+      }
+
+      rc = fskit_detach_ctx_init( dctx );
+      if( rc != 0 ) {
+
+         runfs_safe_free( dctx );
+         runfs_detach_pool_free( pool );
+         return rc;
+      }
+
+      pool->ctxs[ pool->num_free ] = dctx;
+      pool->num_free++;
+   }
+
+   rc = pthread_mutex_init( &pool->lock, NULL );
+   if( rc != 0 ) {
+
+      runfs_detach_pool_free( pool );
+      return -abs(rc);
+   }
+
+   pool->initialized = true;
+   return 0;
+}
+
+
+// free up a detach context pool
+// return 0 on success
+int runfs_detach_pool_free( struct runfs_detach_pool* pool ) {
+
+   for( size_t i = 0; i < pool->num_free; i++ ) {
+
+      fskit_detach_ctx_free( pool->ctxs[i] );
+      runfs_safe_free( pool->ctxs[i] );
+   }
+
+   runfs_safe_free( pool->ctxs );
+
+   if( pool->initialized ) {
+      pthread_mutex_destroy( &pool->lock );
+   }
+
+   memset( pool, 0, sizeof(struct runfs_detach_pool) );
+   return 0;
+}
+
+
+// get a detach context.  Try to allocate a new one first, and dip into the reserve only if that fails.
+// return the context on success
+// return NULL if we're out of memory and the reserve is exhausted
+static struct fskit_detach_ctx* runfs_detach_ctx_get( struct runfs_detach_pool* pool ) {
+
+   struct fskit_detach_ctx* dctx = fskit_detach_ctx_new();
+
+   if( dctx != NULL ) {
+
+      if( fskit_detach_ctx_init( dctx ) == 0 ) {
+         return dctx;
+      }
+
+      runfs_safe_free( dctx );
+   }
+
+   // emergency
+   pthread_mutex_lock( &pool->lock );
+
+   if( pool->num_free > 0 ) {
+
+      pool->num_free--;
+      dctx = pool->ctxs[ pool->num_free ];
+      pool->ctxs[ pool->num_free ] = NULL;
+   }
+
+   pthread_mutex_unlock( &pool->lock );
+
+   if( dctx != NULL ) {
+      runfs_debug("DEFERRED: using reserved detach context %p\n", dctx );
+   }
+
+   return dctx;
+}
+
+
+// give back a detach context that has finished its detach.  Use it to refill the reserve if it's running low.
+static void runfs_detach_ctx_put( struct runfs_detach_pool* pool, struct fskit_detach_ctx* dctx ) {
+
+   pthread_mutex_lock( &pool->lock );
+
+   if( pool->num_free < pool->capacity ) {
+
+      pool->ctxs[ pool->num_free ] = dctx;
+      pool->num_free++;
+      dctx = NULL;
+   }
+
+   pthread_mutex_unlock( &pool->lock );
+
+   if( dctx != NULL ) {
+
+      fskit_detach_ctx_free( dctx );
+      runfs_safe_free( dctx );
+   }
+}
+
+
+// detach all of a unit's entries, and free its garbage set.
+// on OOM, the unit keeps its garbage set and detach context so it can be resumed later.
+// return 0 on success
+// return -ENOMEM on OOM
+static int runfs_detach_unit_run( struct runfs_detach_job* job, struct runfs_detach_unit* unit ) {
+
+   int rc = 0;
+   struct fskit_core* core = job->core;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+
+   if( unit->dctx == NULL ) {
+
+      unit->dctx = runfs_detach_ctx_get( &runfs->detach_pool );
+      if( unit->dctx == NULL ) {
+         return -ENOMEM;
+      }
+   }
+
+   // fskit calls runfs_destroy for each entry it detaches
+   runfs_detach_reason = job->reason;
+   
+   rc = fskit_detach_all_ex( core, unit->fs_path, &unit->children, unit->dctx );
+   
+   runfs_detach_reason = RUNFS_EVENT_REASON_NONE;
+   
+   if( rc == -ENOMEM ) {
+
+      // try again later
+      return rc;
+   }
+
+   runfs_detach_ctx_put( &runfs->detach_pool, unit->dctx );
+   unit->dctx = NULL;
+
+   fskit_entry_set_free( unit->children );
+   unit->children = NULL;
+
+   return rc;
+}
+
+
+// detach thread main: claim and detach units in the current level until there are none left
+static void* runfs_detach_worker( void* cls ) {
+
+   struct runfs_detach_job* job = (struct runfs_detach_job*)cls;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( job->core );
+   int rc = 0;
+
+   while( true ) {
+
+      size_t i = job->level_begin + atomic_fetch_add( &job->next_unit, 1 );
+      if( i >= job->level_end ) {
+         break;
+      }
+
+      rc = runfs_detach_unit_run( job, &job->units[i] );
+      if( rc == -ENOMEM ) {
+
+         // will retry
+         runfs_debug("DEFERRED: out of memory detaching under '%s'\n", job->units[i].fs_path );
+         continue;
+      }
+
+      if( rc != 0 ) {
+
+         runfs_error("runfs_detach_unit_run('%s') rc = %d\n", job->units[i].fs_path, rc );
+
+         int no_error = 0;
+         atomic_compare_exchange_strong( &job->rc, &no_error, rc );
+      }
+
+      runfs_debug("DEFERRED: detached under '%s' (%" PRIu64 " bytes reclaimed so far)\n", job->units[i].fs_path, atomic_load( &runfs->bytes_reclaimed ) - job->bytes_reclaimed_start );
+   }
+
+   return NULL;
+}
+
+
+// helper thread main: join each level handed out, until stopped
+static void* runfs_detach_helper_main( void* cls ) {
+
+   struct runfs_detach_workers* workers = (struct runfs_detach_workers*)cls;
+   struct runfs_detach_job* job = NULL;
+
+   pthread_mutex_lock( &workers->lock );
+
+   while( true ) {
+
+      while( workers->running && (workers->job == NULL || workers->num_wanted == 0) ) {
+         pthread_cond_wait( &workers->work_cond, &workers->lock );
+      }
+
+      if( !workers->running ) {
+         break;
+      }
+
+      job = workers->job;
+      workers->num_wanted--;
+      workers->num_busy++;
+
+      pthread_mutex_unlock( &workers->lock );
+
+      runfs_detach_worker( job );
+
+      pthread_mutex_lock( &workers->lock );
+
+      workers->num_busy--;
+      if( workers->num_busy == 0 ) {
+         pthread_cond_broadcast( &workers->done_cond );
+      }
+   }
+
+   pthread_mutex_unlock( &workers->lock );
+   return NULL;
+}
+
+
+// set up (but don't start) a job's helper threads 
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_detach_workers_init( struct runfs_detach_workers* workers, int num_threads ) {
+
+   memset( workers, 0, sizeof(struct runfs_detach_workers) );
+
+   if( num_threads > 0 ) {
+
+      workers->threads = RUNFS_CALLOC( pthread_t, num_threads );
+      if( workers->threads == NULL ) {
+         return -ENOMEM;
+      }
+   }
+
+   workers->num_threads = num_threads;
+
+   pthread_mutex_init( &workers->lock, NULL );
+   pthread_cond_init( &workers->work_cond, NULL );
+   pthread_cond_init( &workers->done_cond, NULL );
+
+   workers->initialized = true;
+   return 0;
+}
+
+
+// start the helper threads.  If some can't be started, make do with the ones that were.
+// return 0 on success
+// return -EINVAL if already running
+int runfs_detach_workers_start( struct runfs_detach_workers* workers ) {
+
+   int rc = 0;
+
+   if( workers->running ) {
+      return -EINVAL;
+   }
+
+   workers->running = true;
+
+   for( workers->num_started = 0; workers->num_started < workers->num_threads; workers->num_started++ ) {
+
+      rc = pthread_create( &workers->threads[ workers->num_started ], NULL, runfs_detach_helper_main, workers );
+      if( rc != 0 ) {
+
+         // make do with what we have
+         runfs_error("pthread_create rc = %d\n", rc );
+         break;
+      }
+   }
+
+   return 0;
+}
+
+
+// stop the helper threads.  No job may be running (i.e. stop the work queue first).
+// return 0 on success
+// return -EINVAL if not running
+int runfs_detach_workers_stop( struct runfs_detach_workers* workers ) {
+
+   if( !workers->running ) {
+      return -EINVAL;
+   }
+
+   pthread_mutex_lock( &workers->lock );
+
+   workers->running = false;
+   pthread_cond_broadcast( &workers->work_cond );
+
+   pthread_mutex_unlock( &workers->lock );
+
+   for( int i = 0; i < workers->num_started; i++ ) {
+      pthread_join( workers->threads[i], NULL );
+   }
+
+   workers->num_started = 0;
+   return 0;
+}
+
+
+// free up stopped helper threads
+// return 0 on success
+int runfs_detach_workers_free( struct runfs_detach_workers* workers ) {
+
+   runfs_safe_free( workers->threads );
+
+   if( workers->initialized ) {
+
+      pthread_cond_destroy( &workers->done_cond );
+      pthread_cond_destroy( &workers->work_cond );
+      pthread_mutex_destroy( &workers->lock );
+   }
+
+   memset( workers, 0, sizeof(struct runfs_detach_workers) );
+   return 0;
+}
+
+
+// detach one level's worth of units, using up to job->num_threads threads (including this one).
+// the other threads come from runfs's detach helpers, if no other job is using them.
+static void runfs_detach_job_run_level( struct runfs_detach_job* job, size_t level_begin, size_t level_end ) {
+
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( job->core );
+   struct runfs_detach_workers* workers = &runfs->detach_workers;
+   size_t num_helpers = job->num_threads - 1;
+   bool shared = false;
+   int cancel_state = 0;
+
+   job->level_begin = level_begin;
+   job->level_end = level_end;
+   atomic_store( &job->next_unit, 0 );
+
+   if( num_helpers > level_end - level_begin - 1 ) {
+      num_helpers = level_end - level_begin - 1;
+   }
+
+   if( num_helpers > (size_t)workers->num_started ) {
+      num_helpers = workers->num_started;
+   }
+
+   if( num_helpers > 0 ) {
+
+      pthread_mutex_lock( &workers->lock );
+
+      if( workers->running && workers->job == NULL ) {
+
+         workers->job = job;
+         workers->num_wanted = (int)num_helpers;
+         pthread_cond_broadcast( &workers->work_cond );
+
+         shared = true;
+      }
+
+      pthread_mutex_unlock( &workers->lock );
+   }
+
+   if( shared ) {
+
+      // the helpers work on the job until we take it back; don't get cancelled (e.g. by runfs_wq_stop) in between
+      pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, &cancel_state );
+   }
+
+   runfs_detach_worker( job );
+
+   if( shared ) {
+
+      pthread_mutex_lock( &workers->lock );
+
+      // no more joiners; wait for the ones that did to finish their units
+      workers->job = NULL;
+      workers->num_wanted = 0;
+
+      while( workers->num_busy > 0 ) {
+         pthread_cond_wait( &workers->done_cond, &workers->lock );
+      }
+
+      pthread_mutex_unlock( &workers->lock );
+
+      pthread_setcancelstate( cancel_state, NULL );
+   }
+}
+
+
+// set up a parallel detach job for a garbage-tagged set of entries, reaped for the given reason (RUNFS_EVENT_REASON_*).
+// takes ownership of *children on success, and sets it to NULL
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_detach_job_init( struct runfs_detach_job* job, struct fskit_core* core, char const* fs_path, fskit_entry_set** children, int num_threads, int reason ) {
+
+   int rc = 0;
+
+   memset( job, 0, sizeof(struct runfs_detach_job) );
+
+   if( num_threads < 1 ) {
+      num_threads = 1;
+   }
+
+   job->core = core;
+   job->num_threads = num_threads;
+   job->reason = reason;
+   atomic_init( &job->next_unit, 0 );
+   atomic_init( &job->rc, 0 );
+
+   char* root_path = strdup( fs_path );
+   if( root_path == NULL ) {
+      return -ENOMEM;
+   }
+
+   rc = runfs_detach_job_add( job, root_path, *children, 0 );
+   if( rc != 0 ) {
+
+      runfs_safe_free( root_path );
+      return rc;
+   }
+
+   *children = NULL;
+   return 0;
+}
+
+
+// free up a detach job's units, detaching whatever is left of them synchronously.
+// only call this if the job can't be finished any other way (e.g. on shutdown)
+int runfs_detach_job_free( struct runfs_detach_job* job ) {
+
+   struct runfs_state* runfs = NULL;
+
+   if( job->core != NULL ) {
+      runfs = (struct runfs_state*)fskit_core_get_user_data( job->core );
+   }
+
+   for( size_t i = 0; i < job->num_units; i++ ) {
+
+      if( job->units[i].children != NULL ) {
+
+         struct fskit_detach_ctx* dctx = job->units[i].dctx;
+         if( dctx == NULL && runfs != NULL ) {
+            dctx = runfs_detach_ctx_get( &runfs->detach_pool );
+         }
+
+         if( dctx != NULL ) {
+            
+            runfs_detach_reason = job->reason;
+            fskit_detach_all_ex( job->core, job->units[i].fs_path, &job->units[i].children, dctx );
+            runfs_detach_reason = RUNFS_EVENT_REASON_NONE;
+         }
+
+         job->units[i].dctx = dctx;
+         fskit_entry_set_free( job->units[i].children );
+      }
+
+      if( job->units[i].dctx != NULL ) {
+
+         fskit_detach_ctx_free( job->units[i].dctx );
+         runfs_safe_free( job->units[i].dctx );
+      }
+
+      runfs_safe_free( job->units[i].fs_path );
+   }
+
+   runfs_safe_free( job->units );
+   memset( job, 0, sizeof(struct runfs_detach_job) );
+
+   return 0;
+}
+
+
+// how many garbage-tagged entries are in a job's units (not counting their descendants)
+static size_t runfs_detach_job_num_children( struct runfs_detach_job* job ) {
+
+   size_t count = 0;
+
+   for( size_t i = 0; i < job->num_units; i++ ) {
+
+      if( job->units[i].children != NULL ) {
+         count += fskit_entry_set_count( job->units[i].children );
+      }
+   }
+
+   return count;
+}
+
+
+// detach a job's garbage-tagged entries (and all of their descendants), spreading the work across its threads.
+// on the first run, a set of at least RUNFS_DETACH_SPLIT_MIN entries is broken up into independent subtrees by garbage-collecting the directories in its first few levels,
+// and the subtrees are detached level by level, deepest first, so each directory is empty by the time it gets detached.
+// units that run out of memory are kept, so the job can be run again later to finish them.
+// return 0 if the job is finished
+// return -ENOMEM if some units could not be detached for lack of memory (run the job again later)
+// return the first detach error otherwise
+int runfs_detach_job_run( struct runfs_detach_job* job ) {
+
+   int rc = 0;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( job->core );
+   size_t frontier_begin = 0;
+   size_t frontier_end = 0;
+   size_t target_units = 0;
+
+   job->bytes_reclaimed_start = atomic_load( &runfs->bytes_reclaimed );
+   atomic_store( &job->rc, 0 );
+
+   if( !job->expanded && job->num_threads > 1 && runfs_detach_job_num_children( job ) < RUNFS_DETACH_SPLIT_MIN ) {
+
+      // small; not worth spreading across threads.  Detach it in one go.
+      job->expanded = true;
+   }
+
+   if( !job->expanded && job->num_threads > 1 ) {
+
+      // find independent subtrees
+      target_units = (size_t)job->num_threads * RUNFS_DETACH_UNITS_PER_THREAD;
+      frontier_end = job->num_units;
+
+      for( int level = 0; level < RUNFS_DETACH_MAX_LEVELS && job->num_units < target_units && frontier_begin < frontier_end; level++ ) {
+
+         for( size_t i = frontier_begin; i < frontier_end; i++ ) {
+
+            runfs_detach_job_expand( job, i );
+         }
+
+         frontier_begin = frontier_end;
+         frontier_end = job->num_units;
+      }
+
+      // break up big flat directories
+      size_t num_units = job->num_units;
+      for( size_t i = 0; i < num_units; i++ ) {
+
+         runfs_detach_job_split( job, i );
+      }
+
+      qsort( job->units, job->num_units, sizeof(struct runfs_detach_unit), runfs_detach_unit_cmp );
+   }
+
+   job->expanded = true;
+
+   runfs_debug("DEFERRED: detach %zu unit(s) across up to %d thread(s)\n", job->num_units, job->num_threads );
+
+   // detach deepest level first
+   size_t level_end = job->num_units;
+   while( level_end > 0 ) {
+
+      size_t level_begin = level_end - 1;
+      while( level_begin > 0 && job->units[ level_begin - 1 ].level == job->units[ level_end - 1 ].level ) {
+         level_begin--;
+      }
+
+      runfs_detach_job_run_level( job, level_begin, level_end );
+
+      level_end = level_begin;
+   }
+
+   // keep only the units we have yet to finish
+   size_t num_left = 0;
+   for( size_t i = 0; i < job->num_units; i++ ) {
+
+      if( job->units[i].children != NULL ) {
+
+         job->units[ num_left ] = job->units[i];
+         num_left++;
+      }
+      else {
+
+         runfs_safe_free( job->units[i].fs_path );
+      }
+   }
+
+   job->num_units = num_left;
+
+   rc = atomic_load( &job->rc );
+   if( rc == 0 && num_left > 0 ) {
+      rc = -ENOMEM;
+   }
+
+   return rc;
+}
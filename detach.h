@@ -0,0 +1,124 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_DETACH_H_
+#define _RUNFS_DETACH_H_
+
+#include "os.h"
+#include "util.h"
+
+// split garbage sets with at least this many entries into several work units.
+// a reaped directory with fewer direct children than this is detached by one thread.
+#define RUNFS_DETACH_SPLIT_MIN          256
+
+// how many levels of directories to descend into when looking for independent subtrees
+#define RUNFS_DETACH_MAX_LEVELS         3
+
+// try to find at least this many work units per detach thread
+#define RUNFS_DETACH_UNITS_PER_THREAD   4
+
+// number of detach contexts to keep in reserve per detach thread
+#define RUNFS_DETACH_RESERVE_PER_THREAD 2
+
+// a set of garbage-tagged entries that can be detached independently of other units at the same level
+struct runfs_detach_unit {
+
+   char* fs_path;               // path to the directory that held these entries
+   fskit_entry_set* children;   // garbage-tagged entries to detach
+   int level;                   // depth of fs_path below the root of the reaped subtree
+   
+   struct fskit_detach_ctx* dctx;       // detach state, kept across retries if we run out of memory
+};
+
+// reserve of pre-allocated detach contexts, for when we're out of memory.
+// this only covers the contexts: whatever fskit_detach_all_ex() allocates internally still comes from malloc,
+// so a detach that can't get that memory fails with -ENOMEM, keeps its context, and gets retried.
+struct runfs_detach_pool {
+
+   pthread_mutex_t lock;
+   bool initialized;
+
+   struct fskit_detach_ctx** ctxs;
+   size_t num_free;
+   size_t capacity;
+};
+
+// helper threads that detach jobs' levels alongside the work queue thread running the job.
+// they're started with the work queue and live until it stops, so a job doesn't start and join threads for every level.
+// only one level at a time gets helpers; a job that finds them busy detaches its level by itself.
+struct runfs_detach_workers {
+
+   pthread_mutex_t lock;
+   pthread_cond_t work_cond;    // signaled when a level is handed out, or on stop
+   pthread_cond_t done_cond;    // signaled when the last busy helper leaves a level
+   bool initialized;
+
+   pthread_t* threads;
+   int num_threads;
+   int num_started;
+   bool running;
+
+   // governed by lock
+   struct runfs_detach_job* job;        // job whose current level the helpers are working on, or NULL if none
+   int num_wanted;                      // number of helpers still to join the current level
+   int num_busy;                        // number of helpers working on it
+};
+
+// parallel detach job
+struct runfs_detach_job {
+
+   struct fskit_core* core;
+
+   struct runfs_detach_unit* units;
+   size_t num_units;
+   size_t max_units;
+
+   int num_threads;             // number of threads to detach with
+
+   // range of units in the level currently being detached
+   size_t level_begin;
+   size_t level_end;
+   atomic_size_t next_unit;     // next unit in the level to claim
+
+   atomic_int rc;               // first error encountered, if any
+
+   bool expanded;               // have we broken the job up into independent subtrees yet?
+   
+   int reason;                  // why the subtree is being reaped (RUNFS_EVENT_REASON_*), for the reap events of the entries it destroys
+
+   uint64_t bytes_reclaimed_start;      // value of the reclaimed-bytes counter when we started, for progress reports
+};
+
+int runfs_detach_pool_init( struct runfs_detach_pool* pool, size_t count );
+int runfs_detach_pool_free( struct runfs_detach_pool* pool );
+
+int runfs_detach_workers_init( struct runfs_detach_workers* workers, int num_threads );
+int runfs_detach_workers_start( struct runfs_detach_workers* workers );
+int runfs_detach_workers_stop( struct runfs_detach_workers* workers );
+int runfs_detach_workers_free( struct runfs_detach_workers* workers );
+
+int runfs_detach_job_init( struct runfs_detach_job* job, struct fskit_core* core, char const* fs_path, fskit_entry_set** children, int num_threads, int reason );
+int runfs_detach_job_run( struct runfs_detach_job* job );
+int runfs_detach_job_free( struct runfs_detach_job* job );
+
+int runfs_detach_get_reason( void );
+
+#endif
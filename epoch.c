@@ -0,0 +1,416 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "epoch.h"
+
+// Epoch-based reclamation.
+// Readers bracket their accesses to shared objects with runfs_epoch_enter() and runfs_epoch_exit().
+// Writers unpublish an object (so no new reader can find it), and then runfs_epoch_retire() it.
+// Retiring advances the global epoch; the object gets freed once every reader is either outside
+// a critical section, or entered one after the object was retired.
+
+// global epoch state
+struct runfs_epoch_domain {
+   
+   atomic_uint_fast64_t epoch;          // current epoch (starts at 1; 0 means "not active")
+   
+   struct runfs_epoch_record records[ RUNFS_EPOCH_MAX_THREADS ];
+   atomic_int num_records;              // high-water mark of claimed records
+   
+   atomic_int num_overflow;             // number of record-less threads in a critical section
+   
+   pthread_key_t record_key;            // releases a thread's record when it exits
+   
+   pthread_mutex_t retired_lock;        // governs retired
+   struct runfs_epoch_retired* retired;
+   atomic_size_t num_retired;
+   
+   pthread_mutex_t grace_lock;          // governs grace_cond
+   pthread_cond_t grace_cond;           // signaled when a reader leaves while someone waits out a grace period
+   atomic_int num_waiters;              // number of threads in runfs_epoch_synchronize()
+};
+
+static struct runfs_epoch_domain runfs_epoch;
+
+// this thread's record, if it has one
+static __thread struct runfs_epoch_record* runfs_epoch_self = NULL;
+
+// critical section nesting depth for this thread
+static __thread int runfs_epoch_depth = 0;
+
+// did this thread enter through the overflow counter?
+static __thread bool runfs_epoch_overflowed = false;
+
+// number of critical sections this thread has left, so it can help out with reclamation every so often
+static __thread uint64_t runfs_epoch_num_exits = 0;
+
+
+// give back a thread's record when it exits
+static void runfs_epoch_record_release( void* cls ) {
+   
+   struct runfs_epoch_record* rec = (struct runfs_epoch_record*)cls;
+   
+   atomic_store( &rec->active, 0 );
+   atomic_store( &rec->in_use, false );
+}
+
+
+// find this thread a record
+// return the record on success
+// return NULL if there are none left
+static struct runfs_epoch_record* runfs_epoch_record_claim(void) {
+   
+   for( int i = 0; i < RUNFS_EPOCH_MAX_THREADS; i++ ) {
+      
+      bool unused = false;
+      struct runfs_epoch_record* rec = &runfs_epoch.records[i];
+      
+      if( atomic_compare_exchange_strong( &rec->in_use, &unused, true ) ) {
+         
+         // raise the high-water mark
+         int num_records = atomic_load( &runfs_epoch.num_records );
+         while( num_records < i + 1 && !atomic_compare_exchange_weak( &runfs_epoch.num_records, &num_records, i + 1 ) );
+         
+         pthread_setspecific( runfs_epoch.record_key, rec );
+         return rec;
+      }
+   }
+   
+   return NULL;
+}
+
+
+// set up epoch-based reclamation
+// return 0 on success
+// return negative on failure to set up thread-local state or locks
+int runfs_epoch_init(void) {
+   
+   int rc = 0;
+   
+   memset( &runfs_epoch, 0, sizeof(struct runfs_epoch_domain) );
+   
+   atomic_init( &runfs_epoch.epoch, 1 );
+   atomic_init( &runfs_epoch.num_records, 0 );
+   atomic_init( &runfs_epoch.num_overflow, 0 );
+   atomic_init( &runfs_epoch.num_retired, 0 );
+   atomic_init( &runfs_epoch.num_waiters, 0 );
+   
+   for( int i = 0; i < RUNFS_EPOCH_MAX_THREADS; i++ ) {
+      
+      atomic_init( &runfs_epoch.records[i].in_use, false );
+      atomic_init( &runfs_epoch.records[i].active, 0 );
+   }
+   
+   rc = pthread_key_create( &runfs_epoch.record_key, runfs_epoch_record_release );
+   if( rc != 0 ) {
+      return -abs(rc);
+   }
+   
+   rc = pthread_mutex_init( &runfs_epoch.retired_lock, NULL );
+   if( rc != 0 ) {
+      
+      pthread_key_delete( runfs_epoch.record_key );
+      return -abs(rc);
+   }
+   
+   rc = pthread_mutex_init( &runfs_epoch.grace_lock, NULL );
+   if( rc != 0 ) {
+      
+      pthread_mutex_destroy( &runfs_epoch.retired_lock );
+      pthread_key_delete( runfs_epoch.record_key );
+      return -abs(rc);
+   }
+   
+   rc = pthread_cond_init( &runfs_epoch.grace_cond, NULL );
+   if( rc != 0 ) {
+      
+      pthread_mutex_destroy( &runfs_epoch.grace_lock );
+      pthread_mutex_destroy( &runfs_epoch.retired_lock );
+      pthread_key_delete( runfs_epoch.record_key );
+      return -abs(rc);
+   }
+   
+   return 0;
+}
+
+
+// free everything that's been retired, and tear down epoch state.
+// there must be no readers left.
+int runfs_epoch_shutdown(void) {
+   
+   struct runfs_epoch_retired* itr = runfs_epoch.retired;
+   struct runfs_epoch_retired* next = NULL;
+   
+   while( itr != NULL ) {
+      
+      next = itr->next;
+      
+      (*itr->free_func)( itr->ptr );
+      runfs_safe_free( itr );
+      
+      itr = next;
+   }
+   
+   runfs_epoch.retired = NULL;
+   atomic_store( &runfs_epoch.num_retired, 0 );
+   
+   pthread_cond_destroy( &runfs_epoch.grace_cond );
+   pthread_mutex_destroy( &runfs_epoch.grace_lock );
+   pthread_mutex_destroy( &runfs_epoch.retired_lock );
+   pthread_key_delete( runfs_epoch.record_key );
+   
+   return 0;
+}
+
+
+// enter a read-side critical section.  Objects reachable from here won't be freed until we exit.
+// critical sections nest.
+void runfs_epoch_enter(void) {
+   
+   runfs_epoch_depth++;
+   if( runfs_epoch_depth > 1 ) {
+      return;
+   }
+   
+   if( runfs_epoch_self == NULL ) {
+      runfs_epoch_self = runfs_epoch_record_claim();
+   }
+   
+   if( runfs_epoch_self == NULL ) {
+      
+      // out of records.  hold off reclamation altogether
+      atomic_fetch_add( &runfs_epoch.num_overflow, 1 );
+      runfs_epoch_overflowed = true;
+      return;
+   }
+   
+   atomic_store( &runfs_epoch_self->active, atomic_load( &runfs_epoch.epoch ) );
+   
+   // make sure the store is visible before any of our subsequent loads of shared pointers.
+   // otherwise a writer could unpublish, retire, and scan the records without seeing us.
+   atomic_thread_fence( memory_order_seq_cst );
+}
+
+
+// wake up anyone waiting out a grace period, since a reader just left
+static void runfs_epoch_wake_waiters(void) {
+   
+   if( atomic_load( &runfs_epoch.num_waiters ) > 0 ) {
+      
+      pthread_mutex_lock( &runfs_epoch.grace_lock );
+      pthread_cond_broadcast( &runfs_epoch.grace_cond );
+      pthread_mutex_unlock( &runfs_epoch.grace_lock );
+   }
+}
+
+
+// leave a read-side critical section 
+void runfs_epoch_exit(void) {
+   
+   runfs_epoch_depth--;
+   if( runfs_epoch_depth > 0 ) {
+      return;
+   }
+   
+   if( runfs_epoch_overflowed ) {
+      
+      atomic_fetch_sub( &runfs_epoch.num_overflow, 1 );
+      runfs_epoch_overflowed = false;
+      
+      runfs_epoch_wake_waiters();
+      return;
+   }
+   
+   // NOTE: seq_cst, so a waiter either sees us leave or we see it waiting
+   atomic_store( &runfs_epoch_self->active, 0 );
+   
+   runfs_epoch_wake_waiters();
+   
+   // don't let a trickle of retirements sit around forever
+   runfs_epoch_num_exits++;
+   if( runfs_epoch_num_exits % RUNFS_EPOCH_RECLAIM_BATCH == 0 && atomic_load( &runfs_epoch.num_retired ) > 0 ) {
+      runfs_epoch_reclaim();
+   }
+}
+
+
+// what's the oldest epoch any reader is in?
+// if ignore is not NULL, then that reader is left out.
+// return UINT64_MAX if there are no readers
+static uint64_t runfs_epoch_oldest_active( struct runfs_epoch_record* ignore ) {
+   
+   uint64_t oldest = UINT64_MAX;
+   int num_records = atomic_load( &runfs_epoch.num_records );
+   
+   if( atomic_load( &runfs_epoch.num_overflow ) > 0 ) {
+      
+      // can't tell
+      return 0;
+   }
+   
+   for( int i = 0; i < num_records; i++ ) {
+      
+      if( &runfs_epoch.records[i] == ignore ) {
+         continue;
+      }
+      
+      uint64_t active = atomic_load( &runfs_epoch.records[i].active );
+      if( active != 0 && active < oldest ) {
+         oldest = active;
+      }
+   }
+   
+   return oldest;
+}
+
+
+// free the retired objects that no reader can see anymore
+// return the number of objects freed
+int runfs_epoch_reclaim(void) {
+   
+   int num_freed = 0;
+   struct runfs_epoch_retired* freeable = NULL;
+   struct runfs_epoch_retired* next = NULL;
+   struct runfs_epoch_retired** itr = NULL;
+   
+   pthread_mutex_lock( &runfs_epoch.retired_lock );
+   
+   uint64_t oldest = runfs_epoch_oldest_active( NULL );
+   
+   // readers that entered at or before an object's retirement epoch may still see it
+   itr = &runfs_epoch.retired;
+   while( *itr != NULL ) {
+      
+      if( (*itr)->epoch < oldest ) {
+         
+         struct runfs_epoch_retired* r = *itr;
+         *itr = r->next;
+         
+         r->next = freeable;
+         freeable = r;
+         
+         atomic_fetch_sub( &runfs_epoch.num_retired, 1 );
+      }
+      else {
+         
+         itr = &(*itr)->next;
+      }
+   }
+   
+   pthread_mutex_unlock( &runfs_epoch.retired_lock );
+   
+   while( freeable != NULL ) {
+      
+      next = freeable->next;
+      
+      (*freeable->free_func)( freeable->ptr );
+      runfs_safe_free( freeable );
+      
+      freeable = next;
+      num_freed++;
+   }
+   
+   return num_freed;
+}
+
+
+// wait for a grace period: block until every reader (other than the caller) that entered at or before the given epoch has left.
+// sleeps until readers leave, rather than spinning.
+static void runfs_epoch_wait( uint64_t epoch ) {
+   
+   atomic_fetch_add( &runfs_epoch.num_waiters, 1 );
+   
+   pthread_mutex_lock( &runfs_epoch.grace_lock );
+   
+   // the caller is done with whatever it's waiting to free, so its own critical section (if any) doesn't count.
+   while( runfs_epoch_oldest_active( runfs_epoch_self ) <= epoch ) {
+      
+      // leaving readers wake us up (see runfs_epoch_wake_waiters()), but don't bet the free on it
+      struct timespec deadline;
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      
+      deadline.tv_nsec += RUNFS_EPOCH_GRACE_POLL_MS * 1000000L;
+      if( deadline.tv_nsec >= 1000000000L ) {
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000L;
+      }
+      
+      pthread_cond_timedwait( &runfs_epoch.grace_cond, &runfs_epoch.grace_lock, &deadline );
+   }
+   
+   pthread_mutex_unlock( &runfs_epoch.grace_lock );
+   
+   atomic_fetch_sub( &runfs_epoch.num_waiters, 1 );
+}
+
+
+// wait until every reader that could have seen something the caller already unpublished has left.
+// always succeeds
+int runfs_epoch_synchronize(void) {
+   
+   // NOTE: seq_cst, so this is ordered after the caller's unpublish
+   uint64_t epoch = atomic_fetch_add( &runfs_epoch.epoch, 1 );
+   
+   runfs_epoch_wait( epoch );
+   return 0;
+}
+
+
+// free an object once no reader can see it.  The caller must have already unpublished it.
+// if we can't allocate a record for it, wait for a grace period and free it right away.
+// always succeeds
+int runfs_epoch_retire( void* ptr, runfs_epoch_free_func_t free_func ) {
+   
+   bool reclaim = false;
+   struct runfs_epoch_retired* r = RUNFS_CALLOC( struct runfs_epoch_retired, 1 );
+   
+   // NOTE: seq_cst, so this is ordered after the caller unpublished ptr.
+   // readers that enter after this won't be able to find it.
+   uint64_t epoch = atomic_fetch_add( &runfs_epoch.epoch, 1 );
+   
+   if( r == NULL ) {
+      
+      // out of memory.  Wait out the readers instead.
+      runfs_epoch_wait( epoch );
+      
+      (*free_func)( ptr );
+      return 0;
+   }
+   
+   r->ptr = ptr;
+   r->free_func = free_func;
+   r->epoch = epoch;
+   
+   pthread_mutex_lock( &runfs_epoch.retired_lock );
+   
+   r->next = runfs_epoch.retired;
+   runfs_epoch.retired = r;
+   
+   reclaim = (atomic_fetch_add( &runfs_epoch.num_retired, 1 ) + 1 >= RUNFS_EPOCH_RECLAIM_BATCH);
+   
+   pthread_mutex_unlock( &runfs_epoch.retired_lock );
+   
+   if( reclaim ) {
+      runfs_epoch_reclaim();
+   }
+   
+   return 0;
+}
@@ -0,0 +1,68 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_EPOCH_H_
+#define _RUNFS_EPOCH_H_
+
+#include "os.h"
+#include "util.h"
+
+// most threads that can be inside an epoch at once with their own record.
+// threads beyond this share a slow-path counter that blocks all reclamation while any of them is active.
+#define RUNFS_EPOCH_MAX_THREADS         1024
+
+// try to reclaim retired objects once this many have piled up
+#define RUNFS_EPOCH_RECLAIM_BATCH       64
+
+// how long to sleep at most between checks while waiting out a grace period
+#define RUNFS_EPOCH_GRACE_POLL_MS       1
+
+// destructor for a retired object
+typedef void (*runfs_epoch_free_func_t)( void* ptr );
+
+// a thread's epoch record
+struct runfs_epoch_record {
+   
+   atomic_bool in_use;                  // is this record claimed by a thread?
+   atomic_uint_fast64_t active;         // epoch the thread entered at, or 0 if the thread is not in a critical section
+};
+
+// an object waiting to be freed
+struct runfs_epoch_retired {
+   
+   void* ptr;
+   runfs_epoch_free_func_t free_func;
+   uint64_t epoch;                      // epoch at which it was unpublished
+   
+   struct runfs_epoch_retired* next;
+};
+
+int runfs_epoch_init(void);
+int runfs_epoch_shutdown(void);
+
+void runfs_epoch_enter(void);
+void runfs_epoch_exit(void);
+
+int runfs_epoch_retire( void* ptr, runfs_epoch_free_func_t free_func );
+int runfs_epoch_reclaim(void);
+int runfs_epoch_synchronize(void);
+
+#endif
@@ -0,0 +1,479 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "events.h"
+
+#include <fuse_lowlevel.h>
+
+// set up the event stream 
+// return 0 on success 
+// return negative on failure to set up locks
+int runfs_events_init( struct runfs_events* events ) {
+   
+   int rc = 0;
+   
+   memset( events, 0, sizeof(struct runfs_events) );
+   
+   rc = pthread_mutex_init( &events->lock, NULL );
+   if( rc != 0 ) {
+      return -abs(rc);
+   }
+   
+   rc = pthread_cond_init( &events->cond, NULL );
+   if( rc != 0 ) {
+      
+      pthread_mutex_destroy( &events->lock );
+      return -abs(rc);
+   }
+   
+   for( int i = 0; i < RUNFS_EVENTS_RING_SIZE; i++ ) {
+      atomic_init( &events->ring[i], NULL );
+   }
+   
+   atomic_init( &events->head, 0 );
+   atomic_init( &events->num_readers, 0 );
+   atomic_init( &events->num_waiters, 0 );
+   atomic_init( &events->running, true );
+   
+   return 0;
+}
+
+// wake up everyone waiting on the event stream.
+// events must be locked 
+static void runfs_events_wake_locked( struct runfs_events* events ) {
+   
+   pthread_cond_broadcast( &events->cond );
+   
+   for( struct runfs_events_reader* reader = events->readers; reader != NULL; reader = reader->next_reader ) {
+      
+      if( reader->ph != NULL ) {
+         
+         fuse_notify_poll( reader->ph );
+         fuse_pollhandle_destroy( reader->ph );
+         reader->ph = NULL;
+         
+         atomic_fetch_sub( &events->num_waiters, 1 );
+      }
+   }
+}
+
+// stop the event stream, and wake up blocked readers so they see EOF
+// always succeeds 
+int runfs_events_stop( struct runfs_events* events ) {
+   
+   atomic_store( &events->running, false );
+   
+   pthread_mutex_lock( &events->lock );
+   runfs_events_wake_locked( events );
+   pthread_mutex_unlock( &events->lock );
+   
+   return 0;
+}
+
+// free the event stream.  There must be no readers left.
+// always succeeds 
+int runfs_events_free( struct runfs_events* events ) {
+   
+   for( int i = 0; i < RUNFS_EVENTS_RING_SIZE; i++ ) {
+      
+      struct runfs_event* ev = atomic_exchange( &events->ring[i], NULL );
+      runfs_safe_free( ev );
+   }
+   
+   pthread_cond_destroy( &events->cond );
+   pthread_mutex_destroy( &events->lock );
+   
+   return 0;
+}
+
+// name of an event type 
+static char const* runfs_events_type_name( int type ) {
+   
+   switch( type ) {
+      case RUNFS_EVENT_CREATE:
+         return "create";
+         
+      case RUNFS_EVENT_REAP:
+         return "reap";
+   }
+   
+   return "unknown";
+}
+
+// name of a reap reason 
+static char const* runfs_events_reason_name( int reason ) {
+   
+   switch( reason ) {
+      case RUNFS_EVENT_REASON_ORPHANED:
+         return "orphaned";
+         
+      case RUNFS_EVENT_REASON_RELEASED:
+         return "released";
+   }
+   
+   return "-";
+}
+
+// copy a path into an event line, escaping whitespace, control characters and backslashes as \ooo (like /proc/mounts)
+// return the number of bytes written 
+static size_t runfs_events_escape( char* out, char const* path ) {
+   
+   size_t len = 0;
+   
+   for( char const* p = path; *p != '\0'; p++ ) {
+      
+      unsigned char c = (unsigned char)*p;
+      
+      if( c <= ' ' || c == '\\' || c == 0x7f ) {
+         
+         len += sprintf( out + len, "\\%03o", c );
+      }
+      else {
+         
+         out[len] = c;
+         len++;
+      }
+   }
+   
+   return len;
+}
+
+// publish an event to everyone reading the event stream.
+// lock-free, unless a reader is blocked waiting for it.  Does nothing if there are no readers.
+// return 0 on success 
+// return -ENOMEM on OOM
+int runfs_events_publish( struct runfs_events* events, int type, int reason, pid_t pid, char const* path ) {
+   
+   if( atomic_load( &events->num_readers ) == 0 ) {
+      return 0;
+   }
+   
+   size_t max_len = strlen( path ) * 4 + 128;
+   struct runfs_event* ev = (struct runfs_event*)malloc( sizeof(struct runfs_event) + max_len );
+   struct runfs_event* old = NULL;
+   
+   if( ev == NULL ) {
+      return -ENOMEM;
+   }
+   
+   uint64_t seq = atomic_fetch_add( &events->head, 1 );
+   _Atomic(struct runfs_event*)* slot = &events->ring[ seq & (RUNFS_EVENTS_RING_SIZE - 1) ];
+   
+   ev->seq = seq;
+   ev->len = snprintf( ev->text, max_len, "%" PRIu64 " %s %d %s ", seq, runfs_events_type_name( type ), pid, runfs_events_reason_name( reason ) );
+   ev->len += runfs_events_escape( ev->text + ev->len, path );
+   ev->text[ ev->len ] = '\n';
+   ev->len++;
+   
+   // swap it in, unless a producer that's a whole ring ahead of us already has
+   old = atomic_load( slot );
+   do {
+      
+      if( old != NULL && old->seq > seq ) {
+         
+         // readers already consider this event lost
+         free( ev );
+         return 0;
+      }
+      
+   } while( !atomic_compare_exchange_weak( slot, &old, ev ) );
+   
+   if( old != NULL ) {
+      
+      // a reader may still be copying it 
+      runfs_epoch_retire( old, free );
+   }
+   
+   if( atomic_load( &events->num_waiters ) > 0 ) {
+      
+      pthread_mutex_lock( &events->lock );
+      runfs_events_wake_locked( events );
+      pthread_mutex_unlock( &events->lock );
+   }
+   
+   return 0;
+}
+
+// is there something for this reader to read?
+static bool runfs_events_ready( struct runfs_events* events, struct runfs_events_reader* reader ) {
+   
+   bool ready = false;
+   
+   runfs_epoch_enter();
+   
+   struct runfs_event* ev = atomic_load( &events->ring[ reader->next & (RUNFS_EVENTS_RING_SIZE - 1) ] );
+   
+   // either the next event, or a later one that overwrote it (so we'd report the overflow)
+   ready = (ev != NULL && ev->seq >= reader->next);
+   
+   runfs_epoch_exit();
+   
+   return ready;
+}
+
+// copy out as many whole events as fit into buf, without blocking.
+// if the reader fell more than a ring behind, it gets an "overflow $NUM_LOST" line, and skips ahead.
+// return the number of bytes copied (0 if there's nothing to read)
+static int runfs_events_read_ready( struct runfs_events* events, struct runfs_events_reader* reader, char* buf, size_t buflen ) {
+   
+   size_t off = 0;
+   
+   runfs_epoch_enter();
+   
+   while( off < buflen ) {
+      
+      struct runfs_event* ev = atomic_load( &events->ring[ reader->next & (RUNFS_EVENTS_RING_SIZE - 1) ] );
+      
+      if( ev == NULL || ev->seq < reader->next ) {
+         
+         // not published yet 
+         break;
+      }
+      
+      if( ev->seq > reader->next ) {
+         
+         // lapped.  skip to the oldest event still in the ring 
+         char line[64];
+         uint64_t head = atomic_load( &events->head );
+         uint64_t resume = (head > RUNFS_EVENTS_RING_SIZE ? head - RUNFS_EVENTS_RING_SIZE : 0);
+         
+         if( resume <= reader->next ) {
+            resume = reader->next + 1;
+         }
+         
+         int line_len = snprintf( line, sizeof(line), "overflow %" PRIu64 "\n", resume - reader->next );
+         if( off + line_len > buflen ) {
+            break;
+         }
+         
+         memcpy( buf + off, line, line_len );
+         off += line_len;
+         
+         reader->next = resume;
+         continue;
+      }
+      
+      if( off + ev->len > buflen ) {
+         
+         if( off == 0 ) {
+            
+            // the caller's buffer can't hold even one line.  truncate it.
+            memcpy( buf, ev->text, buflen - 1 );
+            buf[ buflen - 1 ] = '\n';
+            
+            off = buflen;
+            reader->next++;
+         }
+         
+         break;
+      }
+      
+      memcpy( buf + off, ev->text, ev->len );
+      off += ev->len;
+      reader->next++;
+   }
+   
+   runfs_epoch_exit();
+   
+   return (int)off;
+}
+
+// has the FUSE session we're serving a request for been told to exit?
+// libfuse (and runfs_session_main()) join their workers before runfs_events_stop() can run, and a blocked reader
+// can't be cancelled mid-request; so blocked readers have to notice on their own.
+static bool runfs_events_session_exited( void ) {
+   
+   struct fuse_context* ctx = fuse_get_context();
+   
+   if( ctx == NULL || ctx->fuse == NULL ) {
+      return false;
+   }
+   
+   return fuse_session_exited( fuse_get_session( ctx->fuse ) ) != 0;
+}
+
+// read events, blocking until there are some (unless nonblocking)
+// return the number of bytes read 
+// return 0 if the stream is shutting down, or the session is exiting (which stops the stream for every reader)
+// return -EAGAIN if nonblocking and there's nothing to read
+// return -EINTR if the reader was interrupted
+int runfs_events_read( struct runfs_events* events, struct runfs_events_reader* reader, char* buf, size_t buflen, bool nonblocking ) {
+   
+   int rc = 0;
+   
+   if( buflen == 0 ) {
+      return 0;
+   }
+   
+   rc = runfs_events_read_ready( events, reader, buf, buflen );
+   if( rc > 0 ) {
+      return rc;
+   }
+   
+   if( nonblocking ) {
+      return -EAGAIN;
+   }
+   
+   pthread_mutex_lock( &events->lock );
+   
+   // producers check this after publishing, so they'll wake us if they publish after we look
+   atomic_fetch_add( &events->num_waiters, 1 );
+   
+   while( atomic_load( &events->running ) ) {
+      
+      rc = runfs_events_read_ready( events, reader, buf, buflen );
+      if( rc > 0 ) {
+         break;
+      }
+      
+      if( fuse_interrupted() ) {
+         
+         rc = -EINTR;
+         break;
+      }
+      
+      if( runfs_events_session_exited() ) {
+         
+         // unmounting, or signaled.  Let the other readers go too, so the workers can be joined.
+         atomic_store( &events->running, false );
+         runfs_events_wake_locked( events );
+         
+         rc = 0;
+         break;
+      }
+      
+      struct timespec deadline;
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      
+      deadline.tv_nsec += RUNFS_EVENTS_WAIT_MS * 1000000L;
+      if( deadline.tv_nsec >= 1000000000L ) {
+         deadline.tv_sec++;
+         deadline.tv_nsec -= 1000000000L;
+      }
+      
+      pthread_cond_timedwait( &events->cond, &events->lock, &deadline );
+   }
+   
+   atomic_fetch_sub( &events->num_waiters, 1 );
+   pthread_mutex_unlock( &events->lock );
+   
+   return rc;
+}
+
+// poll the event stream 
+// sets *reventsp to POLLIN if there's something to read; otherwise, remembers ph to notify when there is
+void runfs_events_poll( struct runfs_events* events, struct runfs_events_reader* reader, struct fuse_pollhandle* ph, unsigned* reventsp ) {
+   
+   pthread_mutex_lock( &events->lock );
+   
+   // count ourselves as waiting before we look, so a producer that publishes after we look will notify us
+   if( reader->ph == NULL ) {
+      atomic_fetch_add( &events->num_waiters, 1 );
+   }
+   
+   if( runfs_events_ready( events, reader ) || !atomic_load( &events->running ) ) {
+      
+      *reventsp = POLLIN | POLLRDNORM;
+      
+      if( reader->ph == NULL ) {
+         atomic_fetch_sub( &events->num_waiters, 1 );
+      }
+      
+      if( ph != NULL ) {
+         fuse_pollhandle_destroy( ph );
+      }
+   }
+   else {
+      
+      *reventsp = 0;
+      
+      if( reader->ph != NULL ) {
+         fuse_pollhandle_destroy( reader->ph );
+         reader->ph = NULL;
+      }
+      
+      if( ph != NULL ) {
+         reader->ph = ph;
+      }
+      else {
+         atomic_fetch_sub( &events->num_waiters, 1 );
+      }
+   }
+   
+   pthread_mutex_unlock( &events->lock );
+}
+
+// start reading the event stream.  Readers see events published from now on.
+// return the new reader on success
+// return NULL on OOM
+struct runfs_events_reader* runfs_events_reader_new( struct runfs_events* events ) {
+   
+   struct runfs_events_reader* reader = RUNFS_CALLOC( struct runfs_events_reader, 1 );
+   if( reader == NULL ) {
+      return NULL;
+   }
+   
+   pthread_mutex_lock( &events->lock );
+   
+   // start formatting events before we pick our starting point, so we don't miss any
+   atomic_fetch_add( &events->num_readers, 1 );
+   reader->next = atomic_load( &events->head );
+   
+   reader->next_reader = events->readers;
+   if( events->readers != NULL ) {
+      events->readers->prev = reader;
+   }
+   
+   events->readers = reader;
+   
+   pthread_mutex_unlock( &events->lock );
+   
+   return reader;
+}
+
+// stop reading the event stream 
+void runfs_events_reader_free( struct runfs_events* events, struct runfs_events_reader* reader ) {
+   
+   pthread_mutex_lock( &events->lock );
+   
+   if( reader->prev != NULL ) {
+      reader->prev->next_reader = reader->next_reader;
+   }
+   else {
+      events->readers = reader->next_reader;
+   }
+   
+   if( reader->next_reader != NULL ) {
+      reader->next_reader->prev = reader->prev;
+   }
+   
+   if( reader->ph != NULL ) {
+      
+      fuse_pollhandle_destroy( reader->ph );
+      atomic_fetch_sub( &events->num_waiters, 1 );
+   }
+   
+   atomic_fetch_sub( &events->num_readers, 1 );
+   
+   pthread_mutex_unlock( &events->lock );
+   
+   runfs_safe_free( reader );
+}
@@ -0,0 +1,93 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_EVENTS_H_
+#define _RUNFS_EVENTS_H_
+
+#include "os.h"
+#include "util.h"
+#include "epoch.h"
+
+#include <fskit/fuse/fskit_fuse.h>
+
+// number of events kept for readers (must be a power of 2).  Readers that fall further behind than this lose events.
+#define RUNFS_EVENTS_RING_SIZE          4096
+
+// how long a blocked reader sleeps before re-checking for interruption or shutdown
+#define RUNFS_EVENTS_WAIT_MS            100
+
+// event types 
+#define RUNFS_EVENT_CREATE              1
+#define RUNFS_EVENT_REAP                2
+
+// why an entry was reaped 
+#define RUNFS_EVENT_REASON_NONE         0
+#define RUNFS_EVENT_REASON_ORPHANED     1       // its owner died
+#define RUNFS_EVENT_REASON_RELEASED     2       // its owner was released through a batch
+
+// one formatted event line 
+struct runfs_event {
+   
+   uint64_t seq;                // position in the stream 
+   size_t len;                  // length of text 
+   char text[];                 // "$SEQ $TYPE $PID $REASON $PATH\n"
+};
+
+// a process reading the event stream 
+struct runfs_events_reader {
+   
+   uint64_t next;                               // sequence number of the next event to read 
+   struct fuse_pollhandle* ph;                  // pending poll() to notify on the next event (guarded by the events lock)
+   
+   struct runfs_events_reader* prev;            // reader list (guarded by the events lock)
+   struct runfs_events_reader* next_reader;
+};
+
+// the event stream.
+// publishing is lock-free: producers claim a sequence number, and swap their event into its slot in the ring.
+// each reader has its own cursor into the ring.  A reader that gets lapped by producers is told how many events it missed.
+// replaced events are retired through the epoch, so readers can copy them out without locks.
+struct runfs_events {
+   
+   _Atomic(struct runfs_event*) ring[ RUNFS_EVENTS_RING_SIZE ];
+   atomic_uint_fast64_t head;                   // sequence number of the next event 
+   
+   atomic_int num_readers;                      // if 0, events are not even formatted 
+   atomic_int num_waiters;                      // readers blocked in read() or poll(), which producers need to wake 
+   atomic_bool running;
+   
+   pthread_mutex_t lock;                        // guards the reader list, and blocking 
+   pthread_cond_t cond;
+   struct runfs_events_reader* readers;
+};
+
+int runfs_events_init( struct runfs_events* events );
+int runfs_events_stop( struct runfs_events* events );
+int runfs_events_free( struct runfs_events* events );
+
+int runfs_events_publish( struct runfs_events* events, int type, int reason, pid_t pid, char const* path );
+
+struct runfs_events_reader* runfs_events_reader_new( struct runfs_events* events );
+void runfs_events_reader_free( struct runfs_events* events, struct runfs_events_reader* reader );
+int runfs_events_read( struct runfs_events* events, struct runfs_events_reader* reader, char* buf, size_t buflen, bool nonblocking );
+void runfs_events_poll( struct runfs_events* events, struct runfs_events_reader* reader, struct fuse_pollhandle* ph, unsigned* reventsp );
+
+#endif
@@ -0,0 +1,217 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "index.h"
+
+// mix an inode number, so sequential numbers spread across shards and buckets 
+static uint64_t runfs_index_hash( uint64_t file_id ) {
+   
+   file_id ^= file_id >> 33;
+   file_id *= 0xff51afd7ed558ccdULL;
+   file_id ^= file_id >> 33;
+   file_id *= 0xc4ceb9fe1a85ec53ULL;
+   file_id ^= file_id >> 33;
+   
+   return file_id;
+}
+
+// which shard holds this hash?
+static struct runfs_index_shard* runfs_index_get_shard( struct runfs_index* index, uint64_t hash ) {
+   
+   return &index->shards[ hash % RUNFS_INDEX_SHARDS ];
+}
+
+// which bucket in a shard holds this hash?
+static uint64_t runfs_index_bucket( struct runfs_index_shard* shard, uint64_t hash ) {
+   
+   return (hash / RUNFS_INDEX_SHARDS) & (shard->num_buckets - 1);
+}
+
+// set up an index 
+// return 0 on success 
+// return -ENOMEM on OOM
+int runfs_index_init( struct runfs_index* index ) {
+   
+   memset( index, 0, sizeof(struct runfs_index) );
+   
+   for( int i = 0; i < RUNFS_INDEX_SHARDS; i++ ) {
+      
+      struct runfs_index_shard* shard = &index->shards[i];
+      
+      shard->buckets = RUNFS_CALLOC( struct runfs_index_node*, RUNFS_INDEX_SHARD_MIN_BUCKETS );
+      if( shard->buckets == NULL ) {
+         
+         runfs_index_free( index );
+         return -ENOMEM;
+      }
+      
+      shard->num_buckets = RUNFS_INDEX_SHARD_MIN_BUCKETS;
+      pthread_rwlock_init( &shard->lock, NULL );
+   }
+   
+   return 0;
+}
+
+// free up an index.  The nodes belong to their inodes, so they're left alone.
+// always succeeds
+int runfs_index_free( struct runfs_index* index ) {
+   
+   for( int i = 0; i < RUNFS_INDEX_SHARDS; i++ ) {
+      
+      struct runfs_index_shard* shard = &index->shards[i];
+      
+      if( shard->buckets != NULL ) {
+         
+         runfs_safe_free( shard->buckets );
+         pthread_rwlock_destroy( &shard->lock );
+      }
+   }
+   
+   memset( index, 0, sizeof(struct runfs_index) );
+   return 0;
+}
+
+// double a shard's buckets, if we can.  If we can't, the shard just gets slower.
+// the caller must write-lock the shard 
+static void runfs_index_shard_grow( struct runfs_index_shard* shard ) {
+   
+   uint64_t new_num_buckets = shard->num_buckets * 2;
+   struct runfs_index_node** new_buckets = RUNFS_CALLOC( struct runfs_index_node*, new_num_buckets );
+   
+   if( new_buckets == NULL ) {
+      return;
+   }
+   
+   for( uint64_t i = 0; i < shard->num_buckets; i++ ) {
+      
+      struct runfs_index_node* node = shard->buckets[i];
+      
+      while( node != NULL ) {
+         
+         struct runfs_index_node* next = node->next;
+         uint64_t b = (runfs_index_hash( node->file_id ) / RUNFS_INDEX_SHARDS) & (new_num_buckets - 1);
+         
+         node->next = new_buckets[b];
+         new_buckets[b] = node;
+         
+         node = next;
+      }
+   }
+   
+   free( shard->buckets );
+   shard->buckets = new_buckets;
+   shard->num_buckets = new_num_buckets;
+}
+
+// index an entry by its inode number, using the given (caller-owned) node.
+// return 0 on success 
+// return -EEXIST if the inode number is already indexed
+int runfs_index_insert( struct runfs_index* index, struct runfs_index_node* node, uint64_t file_id, struct fskit_entry* fent ) {
+   
+   uint64_t hash = runfs_index_hash( file_id );
+   struct runfs_index_shard* shard = runfs_index_get_shard( index, hash );
+   
+   node->file_id = file_id;
+   node->fent = fent;
+   
+   pthread_rwlock_wrlock( &shard->lock );
+   
+   uint64_t b = runfs_index_bucket( shard, hash );
+   
+   for( struct runfs_index_node* cur = shard->buckets[b]; cur != NULL; cur = cur->next ) {
+      
+      if( cur->file_id == file_id ) {
+         
+         pthread_rwlock_unlock( &shard->lock );
+         node->fent = NULL;
+         return -EEXIST;
+      }
+   }
+   
+   node->next = shard->buckets[b];
+   shard->buckets[b] = node;
+   shard->num_nodes++;
+   
+   if( shard->num_nodes > shard->num_buckets * 2 ) {
+      runfs_index_shard_grow( shard );
+   }
+   
+   pthread_rwlock_unlock( &shard->lock );
+   return 0;
+}
+
+// un-index an entry.  Does nothing if the node was never inserted.
+void runfs_index_remove( struct runfs_index* index, struct runfs_index_node* node ) {
+   
+   if( node->fent == NULL ) {
+      return;
+   }
+   
+   uint64_t hash = runfs_index_hash( node->file_id );
+   struct runfs_index_shard* shard = runfs_index_get_shard( index, hash );
+   
+   pthread_rwlock_wrlock( &shard->lock );
+   
+   struct runfs_index_node** prev = &shard->buckets[ runfs_index_bucket( shard, hash ) ];
+   
+   while( *prev != NULL ) {
+      
+      if( *prev == node ) {
+         
+         *prev = node->next;
+         shard->num_nodes--;
+         break;
+      }
+      
+      prev = &(*prev)->next;
+   }
+   
+   pthread_rwlock_unlock( &shard->lock );
+   
+   node->fent = NULL;
+   node->next = NULL;
+}
+
+// find the entry with a given inode number.
+// the entry is only guaranteed to stay put while its parent is locked.
+// return the entry if found 
+// return NULL if not indexed
+struct fskit_entry* runfs_index_find( struct runfs_index* index, uint64_t file_id ) {
+   
+   struct fskit_entry* fent = NULL;
+   uint64_t hash = runfs_index_hash( file_id );
+   struct runfs_index_shard* shard = runfs_index_get_shard( index, hash );
+   
+   pthread_rwlock_rdlock( &shard->lock );
+   
+   for( struct runfs_index_node* cur = shard->buckets[ runfs_index_bucket( shard, hash ) ]; cur != NULL; cur = cur->next ) {
+      
+      if( cur->file_id == file_id ) {
+         
+         fent = cur->fent;
+         break;
+      }
+   }
+   
+   pthread_rwlock_unlock( &shard->lock );
+   
+   return fent;
+}
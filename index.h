@@ -0,0 +1,67 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_INDEX_H_
+#define _RUNFS_INDEX_H_
+
+#include "os.h"
+#include "util.h"
+
+#include <fskit/fskit.h>
+
+// number of independently-locked shards
+#define RUNFS_INDEX_SHARDS              64
+
+// initial number of buckets per shard (doubles as the shard fills up)
+#define RUNFS_INDEX_SHARD_MIN_BUCKETS   64
+
+// link in the index.  Embedded in each runfs inode, so indexing an entry doesn't allocate.
+struct runfs_index_node {
+   
+   uint64_t file_id;                    // fskit inode number
+   struct fskit_entry* fent;            // entry with this inode number
+   struct runfs_index_node* next;       // next node in the bucket
+};
+
+// one shard of the index 
+struct runfs_index_shard {
+   
+   pthread_rwlock_t lock;
+   struct runfs_index_node** buckets;
+   uint64_t num_buckets;                // always a power of 2
+   uint64_t num_nodes;
+};
+
+// index from fskit inode numbers to entries, so readdir can go straight from a dirent to its entry
+// instead of looking each one up by name.
+struct runfs_index {
+   
+   struct runfs_index_shard shards[ RUNFS_INDEX_SHARDS ];
+};
+
+int runfs_index_init( struct runfs_index* index );
+int runfs_index_free( struct runfs_index* index );
+
+int runfs_index_insert( struct runfs_index* index, struct runfs_index_node* node, uint64_t file_id, struct fskit_entry* fent );
+void runfs_index_remove( struct runfs_index* index, struct runfs_index_node* node );
+struct fskit_entry* runfs_index_find( struct runfs_index* index, uint64_t file_id );
+
+#endif
@@ -19,6 +19,7 @@
    <http://www.isc.org/downloads/software-support-policy/isc-license/>.
 */
 #include "inode.h"
+#include "probes.h"
 
 // set up a pidfile inode 
 // return 0 on success
@@ -44,28 +45,42 @@ int runfs_inode_init( struct runfs_inode* inode, pid_t pid, int verify_disciplin
    }
    
    inode->verify_discipline = verify_discipline;
+   atomic_init( &inode->deleted, false );
+   atomic_init( &inode->alive_ms, 0 );
+   atomic_init( &inode->access_ms, 0 );
+   
+   return 0;
+}
+
+// set up a runfs inode owned by a group of processes, instead of by one process.
+// takes over the caller's reference to owner.
+// always succeeds
+int runfs_inode_init_owned( struct runfs_inode* inode, struct runfs_owner* owner ) {
+   
+   memset( inode, 0, sizeof(struct runfs_inode) );
+   
+   inode->owner = owner;
+   atomic_init( &inode->deleted, false );
+   atomic_init( &inode->alive_ms, 0 );
+   atomic_init( &inode->access_ms, 0 );
    
    return 0;
 }
 
 
 // verify that a given process created the given file
+// binary paths are only copied out (into the thread's scratch space) if verify_discipline checks them.
 // return 0 if not equal 
 // return 1 if equal 
 // return negative on error
-int runfs_inode_is_created_by_proc( struct runfs_inode* inode, struct pstat* proc_stat, int verify_discipline ) {
+int runfs_inode_is_created_by_proc( struct runfs_inode* inode, struct pstat* proc_stat, int verify_discipline, struct runfs_scratch* scratch ) {
    
    struct stat sb;
    struct stat inode_sb;
-   char bin_path[PATH_MAX+1];
-   char inode_path[PATH_MAX+1];
    
    pstat_get_stat( proc_stat, &sb );
    pstat_get_stat( inode->ps, &inode_sb );
    
-   pstat_get_path( proc_stat, bin_path );
-   pstat_get_path( inode->ps, inode_path );
-   
    if( !pstat_is_running( proc_stat ) ) {
    
       runfs_debug("PID %d is not running\n", pstat_get_pid( proc_stat ) );
@@ -105,9 +120,18 @@ int runfs_inode_is_created_by_proc( struct runfs_inode* inode, struct pstat* pro
    
    if( verify_discipline & RUNFS_VERIFY_PATH ) {
        
-      if( pstat_is_deleted( proc_stat ) || strcmp(bin_path, inode_path) != 0 ) {
+      if( pstat_is_deleted( proc_stat ) ) {
          
-         runfs_debug("%d: Path mismatch: %s != %s\n", pstat_get_pid( inode->ps ), inode_path, bin_path );
+         runfs_debug("%d: binary is deleted\n", pstat_get_pid( inode->ps ) );
+         return 0;
+      }
+      
+      pstat_get_path( proc_stat, scratch->bin_path );
+      pstat_get_path( inode->ps, scratch->inode_path );
+      
+      if( strcmp( scratch->bin_path, scratch->inode_path ) != 0 ) {
+         
+         runfs_debug("%d: Path mismatch: %s != %s\n", pstat_get_pid( inode->ps ), scratch->inode_path, scratch->bin_path );
          return 0;
       }
    }
@@ -127,30 +151,37 @@ int runfs_inode_is_created_by_proc( struct runfs_inode* inode, struct pstat* pro
 
 // verify that an inode is still valid.
 // that is, there's a process with the given PID running, and it's an instance of the same program that created it.
+// if the inode is owned by a group instead, the group must still have a live member.
 // to speed this up, only check the hash of the process binary if the modtime has changed
 // return 1 if valid 
 // return 0 if not valid 
 // return negative on error
-int runfs_inode_is_valid( struct runfs_inode* inode ) {
+static int runfs_inode_check_valid( struct runfs_inode* inode ) {
    
    int rc = 0;
-   struct pstat* ps = pstat_new();
-   if( ps == NULL ) {
+   
+   if( inode->owner != NULL ) {
+      
+      // one probe for the whole group
+      return runfs_owner_is_alive( inode->owner );
+   }
+   
+   // reuse this thread's pstat and path buffers
+   struct runfs_scratch* scratch = runfs_scratch_get();
+   if( scratch == NULL ) {
       return -ENOMEM;
    }
    
    pid_t pid = pstat_get_pid( inode->ps );
    
-   rc = pstat( pid, ps, 0 );
+   rc = pstat( pid, scratch->ps, 0 );
    if( rc < 0 ) {
        
-      runfs_safe_free( ps );
       runfs_error("pstat(%d) rc = %d\n", pid, rc );
       return rc;
    }
    
-   rc = runfs_inode_is_created_by_proc( inode, ps, inode->verify_discipline );
-   runfs_safe_free( ps );
+   rc = runfs_inode_is_created_by_proc( inode, scratch->ps, inode->verify_discipline, scratch );
    
    if( rc < 0 ) {
        
@@ -161,12 +192,46 @@ int runfs_inode_is_valid( struct runfs_inode* inode ) {
    return rc;
 }
 
+// verify that an inode is still valid (see runfs_inode_check_valid()), between the validate__entry and validate__return probes
+// return 1 if valid 
+// return 0 if not valid 
+// return negative on error
+int runfs_inode_is_valid( struct runfs_inode* inode ) {
+   
+   RUNFS_PROBE1( validate__entry, runfs_inode_get_pid( inode ) );
+   
+   int rc = runfs_inode_check_valid( inode );
+   
+   RUNFS_PROBE2( validate__return, runfs_inode_get_pid( inode ), rc );
+   
+   return rc;
+}
+
 // free a pid inode
 int runfs_inode_free( struct runfs_inode* inode ) {
    
-   if( inode->contents != NULL ) {
+   char* contents = atomic_load( &inode->contents );
+   
+   if( inode->packed != NULL ) {
       
-      runfs_safe_free( inode->contents );
+      runfs_policy_uncharge( inode->policy, inode->contents_len );
+      runfs_packed_free( inode->packed, runfs_policy_get_free_func( inode->policy ) );
+      inode->packed = NULL;
+   }
+   
+   if( inode->shared != NULL ) {
+      
+      // clones may still be using the contents
+      runfs_policy_uncharge( inode->policy, inode->contents_len );
+      runfs_content_unref( inode->shared );
+      inode->shared = NULL;
+      atomic_store( &inode->contents, NULL );
+   }
+   else if( contents != NULL ) {
+      
+      runfs_policy_uncharge( inode->policy, inode->contents_len );
+      runfs_policy_free_contents( inode->policy, contents );
+      atomic_store( &inode->contents, NULL );
    }
    
    if( inode->ps != NULL ) {
@@ -174,7 +239,236 @@ int runfs_inode_free( struct runfs_inode* inode ) {
       runfs_safe_free( inode->ps );
    }
    
+   if( inode->owner != NULL ) {
+      
+      runfs_owner_unref( inode->owner );
+      inode->owner = NULL;
+   }
+   
    memset( inode, 0, sizeof(struct runfs_inode) );
    return 0;
 }
 
+
+
+// epoch destructor for a retired inode.
+// if it was reaped, this is when its memory is actually let go of, so this is when the reap's latency is recorded.
+static void runfs_inode_retired_free( void* ptr ) {
+   
+   struct runfs_inode* inode = (struct runfs_inode*)ptr;
+   struct runfs_reclaim* reclaim = inode->reclaim;
+   uint64_t dead_ns = inode->dead_ns;
+   uint64_t queued_ns = inode->queued_ns;
+   
+   runfs_inode_free( inode );
+   runfs_safe_free( inode );
+   
+   if( reclaim != NULL ) {
+      runfs_reclaim_record( reclaim, dead_ns, queued_ns );
+   }
+}
+
+
+// free an inode (and the inode structure itself) once no lock-free reader can see it.
+// the caller must have already removed it from its fskit entry.
+int runfs_inode_retire( struct runfs_inode* inode ) {
+   
+   return runfs_epoch_retire( inode, runfs_inode_retired_free );
+}
+
+// has this inode been marked as deleted?
+// safe to call without locking the entry, as long as the caller is in an epoch
+bool runfs_inode_is_deleted( struct runfs_inode* inode ) {
+   
+   return atomic_load_explicit( &inode->deleted, memory_order_acquire );
+}
+
+// try to claim the right to reap this inode's entry.
+// exactly one of any number of concurrent callers wins.
+// return true if the caller won, and must now either reap the entry or call runfs_inode_unmark_deleted()
+// return false if someone else already marked it
+// the first winner stamps the inode with when its owner was found dead; later winners (after a failed reap) keep that stamp.
+bool runfs_inode_mark_deleted( struct runfs_inode* inode ) {
+   
+   bool expected = false;
+   if( !atomic_compare_exchange_strong_explicit( &inode->deleted, &expected, true, memory_order_acq_rel, memory_order_acquire ) ) {
+      return false;
+   }
+   
+   if( inode->dead_ns == 0 ) {
+      inode->dead_ns = runfs_trace_now_ns();
+   }
+   
+   return true;
+}
+
+// give up the claim from runfs_inode_mark_deleted(), so someone can try again later
+void runfs_inode_unmark_deleted( struct runfs_inode* inode ) {
+   
+   atomic_store_explicit( &inode->deleted, false, memory_order_release );
+}
+
+
+// begin changing an inode's contents or size.
+// the caller must hold the entry's write lock.
+void runfs_inode_write_begin( struct runfs_inode* inode ) {
+   
+   unsigned int seq = atomic_load_explicit( &inode->seq, memory_order_relaxed );
+   
+   atomic_store_explicit( &inode->seq, seq + 1, memory_order_relaxed );
+   
+   // make the odd sequence number visible before any of our changes
+   atomic_thread_fence( memory_order_release );
+}
+
+
+// finish changing an inode's contents or size
+void runfs_inode_write_end( struct runfs_inode* inode ) {
+   
+   unsigned int seq = atomic_load_explicit( &inode->seq, memory_order_relaxed );
+   
+   atomic_store_explicit( &inode->seq, seq + 1, memory_order_release );
+}
+
+
+// swap in a new contents buffer.  Must be called between runfs_inode_write_begin() and runfs_inode_write_end().
+// return the old buffer, which the caller must retire with runfs_epoch_retire() (not free) once the write ends.
+char* runfs_inode_replace_contents( struct runfs_inode* inode, char* new_contents, size_t new_contents_len ) {
+   
+   char* old_contents = atomic_load_explicit( &inode->contents, memory_order_relaxed );
+   
+   atomic_store_explicit( &inode->contents, new_contents, memory_order_release );
+   inode->contents_len = new_contents_len;
+   
+   return old_contents;
+}
+
+
+// copy data out of a stable contents buffer
+static int runfs_inode_copy_out( char const* contents, off_t size, char* buf, size_t buflen, off_t offset ) {
+   
+   int num_read = 0;
+   
+   if( offset >= size || contents == NULL ) {
+      return 0;
+   }
+   
+   num_read = buflen;
+   
+   if( (unsigned)(offset + buflen) >= size ) {
+      
+      num_read = size - offset;
+      
+      if( num_read < 0 ) {
+         num_read = 0;
+      }
+   }
+   
+   if( num_read > 0 ) {
+      
+      memcpy( buf, contents + offset, num_read );
+   }
+   
+   return num_read;
+}
+
+
+// read an inode's data without locking its entry.
+// the caller must be inside an epoch (see runfs_epoch_enter()).
+// return the number of bytes read on success (0 on EOF)
+// return -EAGAIN if we kept racing writers, or the file is compressed, in which case the caller should lock the entry and use runfs_inode_read_locked()
+int runfs_inode_read_optimistic( struct runfs_inode* inode, char* buf, size_t buflen, off_t offset ) {
+   
+   for( int i = 0; i < RUNFS_READ_OPTIMISTIC_TRIES; i++ ) {
+      
+      unsigned int seq = atomic_load_explicit( &inode->seq, memory_order_acquire );
+      if( seq & 1 ) {
+         
+         // write in progress 
+         sched_yield();
+         continue;
+      }
+      
+      char* contents = atomic_load_explicit( &inode->contents, memory_order_acquire );
+      off_t size = inode->size;
+      
+      if( contents == NULL && offset < size ) {
+         
+         // compressed; only a writer can decompress it 
+         return -EAGAIN;
+      }
+      
+      // contents may be torn if a writer is in progress, but it won't be freed while we're in the epoch
+      int num_read = runfs_inode_copy_out( contents, size, buf, buflen, offset );
+      
+      atomic_thread_fence( memory_order_acquire );
+      
+      if( atomic_load_explicit( &inode->seq, memory_order_relaxed ) == seq ) {
+         
+         // consistent 
+         return num_read;
+      }
+   }
+   
+   return -EAGAIN;
+}
+
+
+// read an inode's data.  The caller must hold the entry's read or write lock, and the file must not be compressed (see runfs_compact_unpack()).
+// return the number of bytes read on success (0 on EOF)
+int runfs_inode_read_locked( struct runfs_inode* inode, char* buf, size_t buflen, off_t offset ) {
+   
+   return runfs_inode_copy_out( atomic_load( &inode->contents ), inode->size, buf, buflen, offset );
+}
+
+// verify that an inode is still valid, but trust a previous positive check if it's less than ttl_ms old.
+// the result is cached on the owner record: the group's record, or the inode itself if it's owned by one process.
+// negative results are never cached, since the entry gets reaped.
+// return 1 if valid 
+// return 0 if not valid 
+// return negative on error
+int runfs_inode_is_valid_cached( struct runfs_inode* inode, struct runfs_stale* stale, uint32_t ttl_ms ) {
+   
+   int rc = 0;
+   uint64_t now_ms = 0;
+   atomic_uint_fast64_t* alive_ms = (inode->owner != NULL ? &inode->owner->alive_ms : &inode->alive_ms);
+   
+   if( ttl_ms == 0 ) {
+      return runfs_inode_is_valid( inode );
+   }
+   
+   if( inode->owner != NULL && atomic_load( &inode->owner->dead ) ) {
+      
+      // e.g. released.  dead is forever, so don't wait out the TTL.
+      return 0;
+   }
+   
+   now_ms = runfs_stale_now_ms();
+   
+   uint64_t last_alive_ms = atomic_load_explicit( alive_ms, memory_order_relaxed );
+   if( last_alive_ms != 0 && now_ms - last_alive_ms < ttl_ms ) {
+      
+      atomic_fetch_add_explicit( &stale->hits, 1, memory_order_relaxed );
+      return 1;
+   }
+   
+   atomic_fetch_add_explicit( &stale->misses, 1, memory_order_relaxed );
+   
+   rc = runfs_inode_is_valid( inode );
+   if( rc == 1 ) {
+      atomic_store_explicit( alive_ms, now_ms, memory_order_relaxed );
+   }
+   
+   return rc;
+}
+
+// get the PID that owns an inode: the creating process, or the ID of the owning process group or session.
+// returns 0 for inodes owned by a cgroup
+pid_t runfs_inode_get_pid( struct runfs_inode* inode ) {
+   
+   if( inode->owner != NULL ) {
+      return inode->owner->id;
+   }
+   
+   return pstat_get_pid( inode->ps );
+}
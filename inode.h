@@ -26,6 +26,15 @@
 #include <pstat/libpstat.h>
 
 #include "util.h"
+#include "compact.h"
+#include "content.h"
+#include "epoch.h"
+#include "index.h"
+#include "owner.h"
+#include "policy.h"
+#include "reclaim.h"
+#include "scratch.h"
+#include "stale.h"
 
 #define RUNFS_PIDFILE_BUF_LEN   50
 
@@ -39,21 +48,64 @@
 
 #define RUNFS_VERIFY_DEFAULT    (RUNFS_VERIFY_INODE | RUNFS_VERIFY_MTIME | RUNFS_VERIFY_SIZE | RUNFS_VERIFY_STARTTIME)
 
+// a file's contents buffer is never smaller than this, so a run of small appends doesn't reallocate on every write
+#define RUNFS_CONTENTS_MIN_LEN          64
+
+// reads of at most this many bytes are done optimistically, without locking the entry
+#define RUNFS_READ_OPTIMISTIC_MAX       65536
+
+// how many times an optimistic read retries when it races a writer before falling back to locking the entry
+#define RUNFS_READ_OPTIMISTIC_TRIES     8
+
 // information for an inode
 struct runfs_inode {
    
-   struct pstat* ps;                                    // process owner status
+   struct pstat* ps;                                    // process owner status (NULL if owned by a group)
+   struct runfs_owner* owner;                           // group that owns this inode (NULL if owned by the creating process alone)
    
-   char* contents;                                      // contents of the file
+   // file data.  Writers hold the entry's write lock, and bracket their changes with runfs_inode_write_begin()/runfs_inode_write_end().
+   // Readers don't lock anything; they read inside an epoch and retry if seq changed underneath them.
+   // Replaced contents buffers are retired through the epoch, so a reader's buffer stays valid until it leaves.
+   _Atomic(char*) contents;                             // contents of the file
    off_t size;                                          // size of the file
    size_t contents_len;                                 // size of the contents buffer
+   atomic_uint seq;                                     // sequence counter; odd while a write is in progress
+   struct runfs_content* shared;                        // if non-NULL, contents is shared with clones and must be copied before it's changed.  Guarded by the entry's lock.
+   struct runfs_packed* packed;                         // if non-NULL, the file is compressed and contents is NULL (see compact.h).  Guarded by the entry's lock.
+   atomic_uint_fast64_t access_ms;                      // when the file was last read or written (runfs_stale_now_ms()), or 0 if never.  Only kept while compressing.
+   
+   // if true, then consider the associated fskit entry deleted.
+   // stat and readdir read this without locking the entry; whoever flips it first (runfs_inode_mark_deleted()) reaps the entry.
+   atomic_bool deleted;
+   uint64_t dead_ns;                                    // when the reaper first found the owner dead (runfs_trace_now_ns()), or 0.  Set by whoever wins runfs_inode_mark_deleted().
+   uint64_t queued_ns;                                  // when the entry was queued for unlinking (runfs_trace_now_ns()), or 0.  Set under the entry's write lock.
+   struct runfs_reclaim* reclaim;                       // where to record dead_ns and queued_ns once the inode is actually freed, or NULL.  Set when it's retired.
+   atomic_uint_fast64_t alive_ms;                       // when we last saw the creating process alive (runfs_stale_now_ms()), or 0 if never.  unused if owned by a group.
    
-   bool deleted;                                        // if true, then consider the associated fskit entry deleted
    int verify_discipline;                               // bit flags of RUNFS_VERIFY_* that control how strict we are in verifying the accessing process
+   
+   struct runfs_policy* policy;                         // profile this inode was created under, or NULL for the defaults.  Outlives the inode.
+   
+   struct runfs_index_node index_node;                  // link in the inode number index (runfs_state.index), so readdir can find our entry
 };
 
 int runfs_inode_init( struct runfs_inode* inode, pid_t pid, int verify_discipline );
+int runfs_inode_init_owned( struct runfs_inode* inode, struct runfs_owner* owner );
 int runfs_inode_free( struct runfs_inode* inode );
 int runfs_inode_is_valid( struct runfs_inode* inode );
+int runfs_inode_is_valid_cached( struct runfs_inode* inode, struct runfs_stale* stale, uint32_t ttl_ms );
+pid_t runfs_inode_get_pid( struct runfs_inode* inode );
+int runfs_inode_retire( struct runfs_inode* inode );
+
+bool runfs_inode_is_deleted( struct runfs_inode* inode );
+bool runfs_inode_mark_deleted( struct runfs_inode* inode );
+void runfs_inode_unmark_deleted( struct runfs_inode* inode );
+
+void runfs_inode_write_begin( struct runfs_inode* inode );
+void runfs_inode_write_end( struct runfs_inode* inode );
+char* runfs_inode_replace_contents( struct runfs_inode* inode, char* new_contents, size_t new_contents_len );
+
+int runfs_inode_read_optimistic( struct runfs_inode* inode, char* buf, size_t buflen, off_t offset );
+int runfs_inode_read_locked( struct runfs_inode* inode, char* buf, size_t buflen, off_t offset );
 
 #endif 
\ No newline at end of file
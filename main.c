@@ -0,0 +1,106 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "runfs.h"
+
+// run! 
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   struct fskit_fuse_state* state = NULL;
+   struct fskit_core* core = NULL;
+   struct runfs_state runfs;
+   struct runfs_opts opts;
+   
+   rc = runfs_opts_parse( &opts, &argc, argv );
+   if( rc != 0 ) {
+      runfs_opts_usage( argv[0] );
+      exit(1);
+   }
+   
+   state = fskit_fuse_state_new();
+   if( state == NULL ) {
+      exit(1);
+   }
+   
+   // setup runfs state 
+   rc = runfs_state_init( &runfs, &opts );
+   if( rc != 0 ) {
+      fprintf(stderr, "runfs_state_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // set up fskit state
+   rc = fskit_fuse_init( state, &runfs );
+   if( rc != 0 ) {
+      fprintf(stderr, "fskit_fuse_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // make sure the fs can access its methods through the VFS
+   fskit_fuse_setting_enable( state, FSKIT_FUSE_SET_FS_ACCESS );
+   
+   core = fskit_fuse_get_core( state );
+   
+   // plug core into runfs
+   runfs.core = core;
+   
+   rc = runfs_add_routes( &runfs );
+   if( rc != 0 ) {
+      fprintf(stderr, "runfs_add_routes rc = %d\n", rc );
+      exit(1);
+   }
+   
+   rc = runfs_start( &runfs );
+   if( rc != 0 ) {
+      fprintf(stderr, "runfs_start rc = %d\n", rc );
+      exit(1);
+   }
+   
+   // run 
+   // fskit handles everything but I/O on the event stream and stats file
+   struct fuse_operations opers = fskit_fuse_get_opers();
+   runfs_ctl_wrap_opers( &runfs, &opers );
+   
+   if( opts.checkpoint_path != NULL ) {
+      
+      // restore the last snapshot as soon as FUSE is up
+      runfs_checkpoint_wrap_opers( &runfs, &opers, opts.checkpoint_path );
+   }
+   
+   // (this is just fuse_main, unless a worker pool, larger I/O or caching was asked for)
+   rc = runfs_session_main( argc, argv, &opers, state, &opts.session );
+   
+   runfs_events_stop( &runfs.events );
+   runfs_stop( &runfs );
+   
+   // save what's left for the next instance
+   runfs_checkpoint_shutdown();
+   
+   // shutdown
+   fskit_fuse_shutdown( state, NULL );
+   runfs_safe_free( state );
+   
+   runfs_state_free( &runfs );
+   runfs_opts_free( &opts );
+   
+   return rc;
+}
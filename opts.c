@@ -0,0 +1,231 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "opts.h"
+#include "arena.h"
+#include "owner.h"
+
+// print runfs's own options 
+void runfs_opts_usage( char const* progname ) {
+   
+   fprintf(stderr, "Usage: %s [runfs options] [FUSE options] /path/to/mountpoint\n"
+                   "runfs options:\n"
+                   "   --owner=pid|pgrp|session|cgroup\n"
+                   "         Tie each new entry to the process that created it (the default),\n"
+                   "         or to its process group, session, or cgroup.\n"
+                   "   --cgroup-root=PATH\n"
+                   "         Where the cgroup v2 hierarchy is mounted (default: %s).\n"
+                   "   --stale-ttl=[PREFIX:]MS\n"
+                   "         Trust that an entry's owner is alive for up to MS milliseconds after\n"
+                   "         checking, instead of checking on every access (default: 0).\n"
+                   "         With PREFIX, only for paths under PREFIX.  May be repeated.\n"
+                   "   --policy=FILE\n"
+                   "         Load per-prefix profiles (verification, staleness, storage, quota,\n"
+                   "         write serialization) from FILE.\n"
+                   "   --checkpoint=PATH\n"
+                   "         Restore the tree from the snapshot at PATH (ideally on a tmpfs) at\n"
+                   "         startup, dropping entries whose owners died, and save it there at\n"
+                   "         shutdown and on SIGUSR2.\n"
+                   "   --trace=PATH\n"
+                   "         Record every handler call to PATH, for replaying with\n"
+                   "         tools/runfs_replay.\n"
+                   "   --hugepages=none|thp|hugetlb\n"
+                   "         Back files of 4MiB or more with transparent huge pages (the\n"
+                   "         default), with reserved hugetlbfs pages while there are any, or\n"
+                   "         with ordinary heap memory.\n"
+                   "   --compact-after=MS\n"
+                   "         Compress the contents of large files nobody has read or written\n"
+                   "         for MS milliseconds (needs LZ4).\n"
+                   "   --threads=N\n"
+                   "         Serve FUSE requests from worker threads of our own, instead of\n"
+                   "         libfuse's loop.  Start N, start more while all are busy, and\n"
+                   "         let the extras exit once more than N are idle.\n"
+                   "   --clone-fd\n"
+                   "         With --threads, give each worker its own /dev/fuse fd, so workers\n"
+                   "         don't contend for one request queue (Linux 4.2 and later).\n"
+                   "   --affinity\n"
+                   "         With --threads, pin each worker to its own CPU.\n"
+                   "   --max-io=BYTES\n"
+                   "         Ask the kernel for reads and writes of up to BYTES (at most %d).\n"
+                   "   --page-cache\n"
+                   "         Let the kernel cache file contents, and serve repeated reads of\n"
+                   "         unchanged files without asking runfs.\n",
+                   progname, RUNFS_CGROUP_ROOT_DEFAULT, RUNFS_SESSION_MAX_IO );
+}
+
+// parse runfs's options out of argv, removing them so FUSE doesn't see them.
+// return 0 on success, and update *argc 
+// return -EINVAL on an invalid option value
+// return -ENOMEM on OOM
+int runfs_opts_parse( struct runfs_opts* opts, int* argc, char** argv ) {
+   
+   int new_argc = 0;
+   
+   memset( opts, 0, sizeof(struct runfs_opts) );
+   
+   opts->owner_type = RUNFS_OWNER_PID;
+   opts->cgroup_root = RUNFS_CGROUP_ROOT_DEFAULT;
+   opts->huge_mode = RUNFS_ARENA_HUGE_THP;
+   
+   opts->stale_ttls = RUNFS_CALLOC( char const*, *argc + 1 );
+   if( opts->stale_ttls == NULL ) {
+      return -ENOMEM;
+   }
+   
+   for( int i = 0; i < *argc; i++ ) {
+      
+      if( i > 0 && strncmp( argv[i], "--owner=", strlen("--owner=") ) == 0 ) {
+         
+         opts->owner_type = runfs_owner_type_parse( argv[i] + strlen("--owner=") );
+         if( opts->owner_type < 0 ) {
+            
+            fprintf(stderr, "Invalid ownership mode '%s'\n", argv[i] + strlen("--owner=") );
+            return -EINVAL;
+         }
+         
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--cgroup-root=", strlen("--cgroup-root=") ) == 0 ) {
+         
+         opts->cgroup_root = argv[i] + strlen("--cgroup-root=");
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--stale-ttl=", strlen("--stale-ttl=") ) == 0 ) {
+         
+         opts->stale_ttls[ opts->num_stale_ttls ] = argv[i] + strlen("--stale-ttl=");
+         opts->num_stale_ttls++;
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--policy=", strlen("--policy=") ) == 0 ) {
+         
+         opts->policy_file = argv[i] + strlen("--policy=");
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--checkpoint=", strlen("--checkpoint=") ) == 0 ) {
+         
+         opts->checkpoint_path = argv[i] + strlen("--checkpoint=");
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--trace=", strlen("--trace=") ) == 0 ) {
+         
+         opts->trace_path = argv[i] + strlen("--trace=");
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--hugepages=", strlen("--hugepages=") ) == 0 ) {
+         
+         opts->huge_mode = runfs_arena_mode_parse( argv[i] + strlen("--hugepages=") );
+         if( opts->huge_mode < 0 ) {
+            
+            fprintf(stderr, "Invalid huge page mode '%s'\n", argv[i] + strlen("--hugepages=") );
+            return -EINVAL;
+         }
+         
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--compact-after=", strlen("--compact-after=") ) == 0 ) {
+         
+         char* end = NULL;
+         long long cold_ms = strtoll( argv[i] + strlen("--compact-after="), &end, 10 );
+         
+         if( *end != '\0' || cold_ms <= 0 ) {
+            
+            fprintf(stderr, "Invalid compaction delay '%s'\n", argv[i] + strlen("--compact-after=") );
+            return -EINVAL;
+         }
+         
+         opts->compact_after_ms = (uint64_t)cold_ms;
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--threads=", strlen("--threads=") ) == 0 ) {
+         
+         char* end = NULL;
+         long num_threads = strtol( argv[i] + strlen("--threads="), &end, 10 );
+         
+         if( *end != '\0' || num_threads <= 0 || num_threads > RUNFS_SESSION_MAX_WORKERS ) {
+            
+            fprintf(stderr, "Invalid thread count '%s'\n", argv[i] + strlen("--threads=") );
+            return -EINVAL;
+         }
+         
+         opts->session.num_threads = (int)num_threads;
+         continue;
+      }
+      
+      if( i > 0 && strcmp( argv[i], "--clone-fd" ) == 0 ) {
+         
+         opts->session.clone_fd = true;
+         continue;
+      }
+      
+      if( i > 0 && strcmp( argv[i], "--affinity" ) == 0 ) {
+         
+         opts->session.affinity = true;
+         continue;
+      }
+      
+      if( i > 0 && strcmp( argv[i], "--page-cache" ) == 0 ) {
+         
+         opts->session.page_cache = true;
+         continue;
+      }
+      
+      if( i > 0 && strncmp( argv[i], "--max-io=", strlen("--max-io=") ) == 0 ) {
+         
+         char* end = NULL;
+         long max_io = strtol( argv[i] + strlen("--max-io="), &end, 10 );
+         
+         if( *end != '\0' || max_io < 4096 ) {
+            
+            fprintf(stderr, "Invalid I/O size '%s'\n", argv[i] + strlen("--max-io=") );
+            return -EINVAL;
+         }
+         
+         opts->session.max_io = (size_t)max_io;
+         continue;
+      }
+      
+      argv[ new_argc ] = argv[i];
+      new_argc++;
+   }
+   
+   argv[ new_argc ] = NULL;
+   *argc = new_argc;
+   
+   return 0;
+}
+
+// free up parsed options 
+// always succeeds
+int runfs_opts_free( struct runfs_opts* opts ) {
+   
+   runfs_safe_free( opts->stale_ttls );
+   opts->num_stale_ttls = 0;
+   
+   return 0;
+}
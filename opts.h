@@ -0,0 +1,51 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_OPTS_H_
+#define _RUNFS_OPTS_H_
+
+#include "os.h"
+#include "util.h"
+#include "session.h"
+
+// runfs-specific command-line options.  Everything else is passed through to FUSE.
+struct runfs_opts {
+   
+   int owner_type;              // RUNFS_OWNER_*: what new entries' lifetimes are tied to (--owner=pid|pgrp|session|cgroup)
+   char const* cgroup_root;     // where cgroupfs (v2) is mounted (--cgroup-root=PATH); points into argv
+   
+   char const** stale_ttls;     // staleness budgets (--stale-ttl=[PREFIX:]MS), in order; point into argv
+   int num_stale_ttls;
+   
+   char const* policy_file;     // per-prefix profiles (--policy=FILE), or NULL; points into argv
+   char const* checkpoint_path; // snapshot to restore at startup and save at shutdown and on SIGUSR2 (--checkpoint=PATH), or NULL; points into argv
+   char const* trace_path;      // where to record a trace of every handler call (--trace=PATH), or NULL; points into argv
+   int huge_mode;               // RUNFS_ARENA_HUGE_*: what backs large files (--hugepages=none|thp|hugetlb)
+   uint64_t compact_after_ms;   // compress files nobody has touched for this long (--compact-after=MS), or 0 to never compress
+   
+   struct runfs_session_opts session;   // FUSE worker pool and kernel options (--threads, --clone-fd, --affinity, --max-io, --page-cache)
+};
+
+int runfs_opts_parse( struct runfs_opts* opts, int* argc, char** argv );
+int runfs_opts_free( struct runfs_opts* opts );
+void runfs_opts_usage( char const* progname );
+
+#endif
@@ -29,6 +29,10 @@
 #define __STDC_FORMAT_MACROS
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
 #endif
@@ -44,12 +48,15 @@
 #include <libgen.h>
 #include <regex.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -57,9 +64,13 @@
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
 
 #include <semaphore.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <utime.h>
 
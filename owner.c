@@ -0,0 +1,621 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "owner.h"
+#include "scratch.h"
+
+// hash an owner's identity
+static uint64_t runfs_owner_hash( int type, pid_t id, char const* cgroup ) {
+   
+   // FNV-1a 
+   uint64_t hash = 14695981039346656037ULL;
+   
+   hash = (hash ^ (uint64_t)type) * 1099511628211ULL;
+   hash = (hash ^ (uint64_t)id) * 1099511628211ULL;
+   
+   if( cgroup != NULL ) {
+      for( char const* p = cgroup; *p != '\0'; p++ ) {
+         hash = (hash ^ (uint64_t)(unsigned char)*p) * 1099511628211ULL;
+      }
+   }
+   
+   return hash;
+}
+
+// find a process's (v2) cgroup, by reading /proc/$PID/cgroup 
+// return 0 on success, and set *cgroup to a malloc'ed path relative to the cgroup root
+// return -ENOMEM on OOM
+// return -ENOTSUP if the process is not in a v2 cgroup 
+// return -errno on failure to read
+static int runfs_owner_read_cgroup( pid_t pid, char** cgroup ) {
+   
+   char proc_path[PATH_MAX+1];
+   char* line = NULL;
+   size_t line_len = 0;
+   int rc = -ENOTSUP;
+   
+   snprintf( proc_path, PATH_MAX, "/proc/%d/cgroup", pid );
+   
+   FILE* f = fopen( proc_path, "r" );
+   if( f == NULL ) {
+      return -errno;
+   }
+   
+   while( getline( &line, &line_len, f ) >= 0 ) {
+      
+      // the v2 hierarchy is the one line of the form "0::$PATH"
+      if( strncmp( line, "0::", 3 ) != 0 ) {
+         continue;
+      }
+      
+      line[ strcspn( line, "\n" ) ] = '\0';
+      
+      *cgroup = strdup( line + 3 );
+      if( *cgroup == NULL ) {
+         rc = -ENOMEM;
+      }
+      else {
+         rc = 0;
+      }
+      
+      break;
+   }
+   
+   runfs_safe_free( line );
+   fclose( f );
+   
+   return rc;
+}
+
+// read a small file relative to an open directory into buf, and NUL-terminate it.
+// return the number of bytes read on success 
+// return -errno on failure (-ENOENT or -ESRCH if the directory's process or cgroup is gone)
+static ssize_t runfs_owner_read_at( int dirfd, char const* name, char* buf, size_t buflen ) {
+   
+   ssize_t nr = 0;
+   
+   int fd = openat( dirfd, name, O_RDONLY | O_CLOEXEC );
+   if( fd < 0 ) {
+      return -errno;
+   }
+   
+   nr = read( fd, buf, buflen - 1 );
+   if( nr < 0 ) {
+      nr = -errno;
+   }
+   else {
+      buf[ nr ] = '\0';
+   }
+   
+   close( fd );
+   return nr;
+}
+
+// probe a session leader through its open /proc/$SID directory.
+// the directory stays bound to the process we opened it for, so a reused PID can't fool us.
+// return 1 if the leader is still running 
+// return 0 if it's gone (or a zombie)
+// return -errno on failure to read its status
+static int runfs_owner_session_probe( int dirfd ) {
+   
+   char buf[1024];
+   char* state = NULL;
+   
+   ssize_t nr = runfs_owner_read_at( dirfd, "stat", buf, sizeof(buf) );
+   if( nr == -ENOENT || nr == -ESRCH ) {
+      return 0;
+   }
+   
+   if( nr < 0 ) {
+      return (int)nr;
+   }
+   
+   // state follows the command name, which may itself contain ')'
+   state = strrchr( buf, ')' );
+   if( state == NULL || state[1] != ' ' ) {
+      return -EIO;
+   }
+   
+   return (state[2] == 'Z' || state[2] == 'X' || state[2] == 'x') ? 0 : 1;
+}
+
+// probe a cgroup through its open directory: is anything still running in it?
+// return 1 if so 
+// return 0 if not, or if the cgroup is gone
+// return -errno on failure to read cgroup.events
+static int runfs_owner_cgroup_probe( int dirfd ) {
+   
+   char buf[512];
+   char* populated = NULL;
+   
+   ssize_t nr = runfs_owner_read_at( dirfd, "cgroup.events", buf, sizeof(buf) );
+   if( nr == -ENOENT || nr == -ENODEV ) {
+      // cgroup was removed
+      return 0;
+   }
+   
+   if( nr < 0 ) {
+      return (int)nr;
+   }
+   
+   populated = strstr( buf, "populated " );
+   if( populated == NULL || (populated != buf && populated[-1] != '\n') ) {
+      return -EIO;
+   }
+   
+   return (atoi( populated + 10 ) != 0 ? 1 : 0);
+}
+
+// probe a cgroup: is anything still running in it?
+// return 1 if so 
+// return 0 if not, or if the cgroup is gone
+// return -errno on failure to read cgroup.events
+static int runfs_owner_cgroup_is_populated( char const* cgroup_root, char const* cgroup ) {
+   
+   char events_path[PATH_MAX+1];
+   char* line = NULL;
+   size_t line_len = 0;
+   int rc = -EIO;
+   
+   snprintf( events_path, PATH_MAX, "%s%s/cgroup.events", cgroup_root, cgroup );
+   
+   FILE* f = fopen( events_path, "r" );
+   if( f == NULL ) {
+      
+      if( errno == ENOENT ) {
+         // cgroup was removed
+         return 0;
+      }
+      
+      return -errno;
+   }
+   
+   while( getline( &line, &line_len, f ) >= 0 ) {
+      
+      if( strncmp( line, "populated ", 10 ) == 0 ) {
+         
+         rc = (atoi( line + 10 ) != 0 ? 1 : 0);
+         break;
+      }
+   }
+   
+   runfs_safe_free( line );
+   fclose( f );
+   
+   return rc;
+}
+
+// set up an owner table 
+// return 0 on success
+// return -ENOMEM on OOM
+int runfs_owner_table_init( struct runfs_owner_table* table, int type, char const* cgroup_root ) {
+   
+   memset( table, 0, sizeof(struct runfs_owner_table) );
+   
+   if( cgroup_root == NULL ) {
+      cgroup_root = RUNFS_CGROUP_ROOT_DEFAULT;
+   }
+   
+   table->cgroup_root = strdup( cgroup_root );
+   if( table->cgroup_root == NULL ) {
+      return -ENOMEM;
+   }
+   
+   table->type = type;
+   pthread_mutex_init( &table->lock, NULL );
+   
+   return 0;
+}
+
+// free an owner's memory 
+static void runfs_owner_free( struct runfs_owner* owner ) {
+   
+   if( owner->dirfd >= 0 ) {
+      close( owner->dirfd );
+   }
+   
+   runfs_safe_free( owner->cgroup );
+   runfs_safe_free( owner->leader );
+   runfs_safe_free( owner );
+}
+
+// free up an owner table.
+// inodes that still refer to its owners must already be gone.
+// always succeeds
+int runfs_owner_table_free( struct runfs_owner_table* table ) {
+   
+   for( int i = 0; i < RUNFS_OWNER_TABLE_BUCKETS; i++ ) {
+      
+      struct runfs_owner* owner = table->buckets[i];
+      while( owner != NULL ) {
+         
+         struct runfs_owner* next = owner->next;
+         runfs_owner_free( owner );
+         owner = next;
+      }
+      
+      table->buckets[i] = NULL;
+   }
+   
+   runfs_safe_free( table->cgroup_root );
+   pthread_mutex_destroy( &table->lock );
+   
+   return 0;
+}
+
+// unlink an owner from its hash bucket, if it's in it.
+// table must be locked
+static void runfs_owner_unlink( struct runfs_owner_table* table, struct runfs_owner* owner ) {
+   
+   struct runfs_owner** prev = &table->buckets[ owner->hash % RUNFS_OWNER_TABLE_BUCKETS ];
+   
+   while( *prev != NULL ) {
+      
+      if( *prev == owner ) {
+         *prev = owner->next;
+         owner->next = NULL;
+         return;
+      }
+      
+      prev = &(*prev)->next;
+   }
+}
+
+// make a new owner for a group 
+// return 0 on success, and set *ret_owner
+// return -ENOMEM on OOM
+// return -ESRCH if the session leader is already gone
+// return -ENOTSUP if the cgroup can't be probed (e.g. cgroupfs isn't mounted at the cgroup root)
+static int runfs_owner_new( struct runfs_owner_table* table, int type, pid_t id, char* cgroup, uint64_t hash, struct runfs_owner** ret_owner ) {
+   
+   int rc = 0;
+   struct runfs_owner* owner = RUNFS_CALLOC( struct runfs_owner, 1 );
+   
+   if( owner == NULL ) {
+      return -ENOMEM;
+   }
+   
+   owner->dirfd = -1;
+   
+   if( type == RUNFS_OWNER_SESSION ) {
+      
+      // hold the leader's /proc directory open, so probing it is one openat() and read() (and immune to PID reuse).
+      // open it before looking at the leader, so it can't refer to a newer process than the one we check.
+      char proc_path[64];
+      snprintf( proc_path, sizeof(proc_path), "/proc/%d", id );
+      
+      owner->dirfd = open( proc_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+      if( owner->dirfd < 0 ) {
+         
+         // out of descriptors?  fall back to pstat'ing the leader on each probe
+         runfs_debug("open(%s) errno = %d; probing session %d by PID\n", proc_path, errno, id );
+      }
+      
+      // remember who the leader is, so we notice if its PID gets reused
+      owner->leader = pstat_new();
+      if( owner->leader == NULL ) {
+         
+         runfs_owner_free( owner );
+         return -ENOMEM;
+      }
+      
+      rc = pstat( id, owner->leader, 0 );
+      if( rc != 0 || !pstat_is_running( owner->leader ) ) {
+         
+         runfs_owner_free( owner );
+         return -ESRCH;
+      }
+   }
+   
+   if( type == RUNFS_OWNER_CGROUP ) {
+      
+      // make sure we'll be able to probe it; otherwise it would look dead right away
+      char events_path[PATH_MAX+1];
+      snprintf( events_path, PATH_MAX, "%s%s/cgroup.events", table->cgroup_root, cgroup );
+      
+      if( access( events_path, R_OK ) != 0 ) {
+         
+         runfs_error("Cannot read %s, errno = %d\n", events_path, errno );
+         runfs_safe_free( owner );
+         return -ENOTSUP;
+      }
+      
+      // hold the cgroup directory open, so probing it doesn't walk the cgroup path each time
+      char* cgroup_path = events_path;
+      cgroup_path[ strlen( cgroup_path ) - strlen("/cgroup.events") ] = '\0';
+      
+      owner->dirfd = open( cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+      if( owner->dirfd < 0 ) {
+         runfs_debug("open(%s) errno = %d; probing cgroup by path\n", cgroup_path, errno );
+      }
+   }
+   
+   owner->type = type;
+   owner->id = id;
+   owner->cgroup = cgroup;
+   owner->hash = hash;
+   owner->refcount = 1;
+   owner->table = table;
+   atomic_init( &owner->dead, false );
+   atomic_init( &owner->alive_ms, 0 );
+   
+   *ret_owner = owner;
+   return 0;
+}
+
+// get a reference to the owner of the entries created by the given process, creating it if need be.
+// the caller must release it with runfs_owner_unref().
+// return 0 on success, and set *ret_owner 
+// return -ENOMEM on OOM 
+// return -EINVAL if the table is in per-PID mode (there are no owner records)
+// return -ENOTSUP if the process is not in a v2 cgroup
+// return -ESRCH if the process (or its session leader) is gone 
+// return -errno if we can't find the process's group
+int runfs_owner_get( struct runfs_owner_table* table, pid_t pid, struct runfs_owner** ret_owner ) {
+   
+   int rc = 0;
+   pid_t id = 0;
+   char* cgroup = NULL;
+   uint64_t hash = 0;
+   struct runfs_owner* owner = NULL;
+   
+   switch( table->type ) {
+      
+      case RUNFS_OWNER_PGRP:
+         
+         id = getpgid( pid );
+         if( id < 0 ) {
+            return -errno;
+         }
+         break;
+         
+      case RUNFS_OWNER_SESSION:
+         
+         id = getsid( pid );
+         if( id < 0 ) {
+            return -errno;
+         }
+         break;
+         
+      case RUNFS_OWNER_CGROUP:
+         
+         rc = runfs_owner_read_cgroup( pid, &cgroup );
+         if( rc != 0 ) {
+            return rc;
+         }
+         break;
+         
+      default:
+         
+         return -EINVAL;
+   }
+   
+   hash = runfs_owner_hash( table->type, id, cgroup );
+   
+   pthread_mutex_lock( &table->lock );
+   
+   struct runfs_owner** prev = &table->buckets[ hash % RUNFS_OWNER_TABLE_BUCKETS ];
+   
+   while( *prev != NULL ) {
+      
+      owner = *prev;
+      
+      if( owner->hash == hash && owner->type == table->type && owner->id == id && (cgroup == NULL || strcmp( owner->cgroup, cgroup ) == 0) ) {
+         
+         if( !atomic_load( &owner->dead ) ) {
+            
+            // found!
+            owner->refcount++;
+            
+            pthread_mutex_unlock( &table->lock );
+            
+            runfs_safe_free( cgroup );
+            *ret_owner = owner;
+            return 0;
+         }
+         
+         // dead, and its ID has since been reused by a new group.
+         // its inodes keep it alive, but new entries get a new record.
+         *prev = owner->next;
+         owner->next = NULL;
+         continue;
+      }
+      
+      prev = &owner->next;
+   }
+   
+   rc = runfs_owner_new( table, table->type, id, cgroup, hash, &owner );
+   if( rc != 0 ) {
+      
+      pthread_mutex_unlock( &table->lock );
+      runfs_safe_free( cgroup );
+      return rc;
+   }
+   
+   owner->next = table->buckets[ hash % RUNFS_OWNER_TABLE_BUCKETS ];
+   table->buckets[ hash % RUNFS_OWNER_TABLE_BUCKETS ] = owner;
+   
+   pthread_mutex_unlock( &table->lock );
+   
+   runfs_debug("New %s owner %d%s%s\n", runfs_owner_type_name( owner->type ), owner->id, (owner->cgroup != NULL ? " " : ""), (owner->cgroup != NULL ? owner->cgroup : "") );
+   
+   *ret_owner = owner;
+   return 0;
+}
+
+// release a reference to an owner, freeing it if this was the last one
+void runfs_owner_unref( struct runfs_owner* owner ) {
+   
+   struct runfs_owner_table* table = owner->table;
+   
+   pthread_mutex_lock( &table->lock );
+   
+   owner->refcount--;
+   if( owner->refcount > 0 ) {
+      
+      pthread_mutex_unlock( &table->lock );
+      return;
+   }
+   
+   runfs_owner_unlink( table, owner );
+   
+   pthread_mutex_unlock( &table->lock );
+   
+   runfs_owner_free( owner );
+}
+
+// is a group still alive?
+// this is one cheap probe for the whole group, no matter how many entries it owns:
+// * process groups: kill(-pgid, 0) succeeds as long as any member exists.
+// * sessions: the session leader is still running (same PID and start time).  A session outlives its
+//   leader only in odd cases (e.g. a leader that detached from its terminal and exited), which we treat as dead.
+// * cgroups: the cgroup's cgroup.events file says "populated 1".
+// once a group is seen dead, it stays dead, even if its ID gets reused.
+// NOTE: a process group ID that is reused between two probes will look alive; use sessions or cgroups if that matters.
+// return 1 if alive 
+// return 0 if dead 
+// return negative on error
+int runfs_owner_is_alive( struct runfs_owner* owner ) {
+   
+   int rc = 0;
+   
+   if( atomic_load( &owner->dead ) ) {
+      return 0;
+   }
+   
+   switch( owner->type ) {
+      
+      case RUNFS_OWNER_PGRP: {
+         
+         rc = kill( -owner->id, 0 );
+         if( rc == 0 || errno == EPERM ) {
+            rc = 1;
+         }
+         else if( errno == ESRCH ) {
+            rc = 0;
+         }
+         else {
+            rc = -errno;
+         }
+         
+         break;
+      }
+      
+      case RUNFS_OWNER_SESSION: {
+         
+         if( owner->dirfd >= 0 ) {
+            
+            rc = runfs_owner_session_probe( owner->dirfd );
+            if( rc < 0 ) {
+               return rc;
+            }
+            
+            break;
+         }
+         
+         struct runfs_scratch* scratch = runfs_scratch_get();
+         if( scratch == NULL ) {
+            return -ENOMEM;
+         }
+         
+         rc = pstat( owner->id, scratch->ps, 0 );
+         if( rc < 0 ) {
+            
+            runfs_error("pstat(%d) rc = %d\n", owner->id, rc );
+            return rc;
+         }
+         
+         if( pstat_is_running( scratch->ps ) && pstat_get_starttime( scratch->ps ) == pstat_get_starttime( owner->leader ) ) {
+            rc = 1;
+         }
+         else {
+            rc = 0;
+         }
+         
+         break;
+      }
+      
+      case RUNFS_OWNER_CGROUP: {
+         
+         if( owner->dirfd >= 0 ) {
+            rc = runfs_owner_cgroup_probe( owner->dirfd );
+         }
+         else {
+            rc = runfs_owner_cgroup_is_populated( owner->table->cgroup_root, owner->cgroup );
+         }
+         
+         break;
+      }
+      
+      default:
+         
+         return -EINVAL;
+   }
+   
+   if( rc == 0 ) {
+      
+      runfs_debug("%s owner %d%s%s is dead\n", runfs_owner_type_name( owner->type ), owner->id, (owner->cgroup != NULL ? " " : ""), (owner->cgroup != NULL ? owner->cgroup : "") );
+      atomic_store( &owner->dead, true );
+   }
+   
+   return rc;
+}
+
+// parse an ownership mode name 
+// return the RUNFS_OWNER_* value on success
+// return -EINVAL if the name is not recognized
+int runfs_owner_type_parse( char const* name ) {
+   
+   if( strcmp( name, "pid" ) == 0 ) {
+      return RUNFS_OWNER_PID;
+   }
+   else if( strcmp( name, "pgrp" ) == 0 ) {
+      return RUNFS_OWNER_PGRP;
+   }
+   else if( strcmp( name, "session" ) == 0 ) {
+      return RUNFS_OWNER_SESSION;
+   }
+   else if( strcmp( name, "cgroup" ) == 0 ) {
+      return RUNFS_OWNER_CGROUP;
+   }
+   
+   return -EINVAL;
+}
+
+// name of an ownership mode 
+char const* runfs_owner_type_name( int type ) {
+   
+   switch( type ) {
+      case RUNFS_OWNER_PID:
+         return "pid";
+      
+      case RUNFS_OWNER_PGRP:
+         return "pgrp";
+      
+      case RUNFS_OWNER_SESSION:
+         return "session";
+      
+      case RUNFS_OWNER_CGROUP:
+         return "cgroup";
+   }
+   
+   return "unknown";
+}
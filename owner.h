@@ -0,0 +1,82 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_OWNER_H_
+#define _RUNFS_OWNER_H_
+
+#include "os.h"
+#include "util.h"
+
+#include <pstat/libpstat.h>
+
+// what an entry's lifetime is tied to
+#define RUNFS_OWNER_PID         0       // the exact process that created it (the default)
+#define RUNFS_OWNER_PGRP        1       // the creator's process group
+#define RUNFS_OWNER_SESSION     2       // the creator's session
+#define RUNFS_OWNER_CGROUP      3       // the creator's (v2) cgroup
+
+#define RUNFS_OWNER_TABLE_BUCKETS       1024
+
+#define RUNFS_CGROUP_ROOT_DEFAULT       "/sys/fs/cgroup"
+
+struct runfs_owner_table;
+
+// a group of processes that share ownership of entries.
+// one of these is shared by every inode created by the group, so the group's liveness is probed once for all of them.
+struct runfs_owner {
+   
+   int type;                            // RUNFS_OWNER_*
+   pid_t id;                            // process group ID or session ID (0 for cgroups)
+   char* cgroup;                        // cgroup path, relative to the cgroup root (NULL if not a cgroup)
+   struct pstat* leader;                // session leader's status when we first saw the session (NULL if not a session)
+   int dirfd;                           // open /proc/$SID (sessions) or cgroup directory (cgroups), so probes don't resolve paths; -1 if none
+   uint64_t hash;                       // hash of (type, id, cgroup), for the owner table
+   
+   int refcount;                        // one per inode that refers to us.  guarded by the table lock.
+   atomic_bool dead;                    // set once we've seen the group die.  a dead group stays dead.
+   atomic_uint_fast64_t alive_ms;       // when we last saw the group alive (runfs_stale_now_ms()), or 0 if never
+   
+   struct runfs_owner_table* table;     // table we're in (or were in)
+   struct runfs_owner* next;            // next owner in our hash bucket
+};
+
+// table of live owners, so processes in the same group share one record
+struct runfs_owner_table {
+   
+   pthread_mutex_t lock;
+   struct runfs_owner* buckets[ RUNFS_OWNER_TABLE_BUCKETS ];
+   
+   int type;                            // ownership mode for new entries (RUNFS_OWNER_*)
+   char* cgroup_root;                   // where cgroupfs (v2) is mounted
+};
+
+int runfs_owner_table_init( struct runfs_owner_table* table, int type, char const* cgroup_root );
+int runfs_owner_table_free( struct runfs_owner_table* table );
+
+int runfs_owner_get( struct runfs_owner_table* table, pid_t pid, struct runfs_owner** owner );
+void runfs_owner_unref( struct runfs_owner* owner );
+
+int runfs_owner_is_alive( struct runfs_owner* owner );
+
+int runfs_owner_type_parse( char const* name );
+char const* runfs_owner_type_name( int type );
+
+#endif
@@ -0,0 +1,397 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "policy.h"
+#include "arena.h"
+#include "inode.h"
+
+// set up an empty policy set 
+// always succeeds 
+int runfs_policy_set_init( struct runfs_policy_set* set ) {
+   
+   memset( set, 0, sizeof(struct runfs_policy_set) );
+   return 0;
+}
+
+// free up a policy set 
+// always succeeds
+int runfs_policy_set_free( struct runfs_policy_set* set ) {
+   
+   for( int i = 0; i < set->num_policies; i++ ) {
+      
+      runfs_safe_free( set->policies[i].prefix );
+      pthread_mutex_destroy( &set->policies[i].write_lock );
+   }
+   
+   set->num_policies = 0;
+   return 0;
+}
+
+// parse a verify discipline: "default", "all", or a comma-separated list of inode,mtime,size,path,starttime
+// return the RUNFS_VERIFY_* bits on success 
+// return -EINVAL if not recognized
+static int runfs_policy_parse_verify( char* value ) {
+   
+   int discipline = 0;
+   char* saveptr = NULL;
+   
+   if( strcmp( value, "default" ) == 0 ) {
+      return RUNFS_VERIFY_DEFAULT;
+   }
+   
+   if( strcmp( value, "all" ) == 0 ) {
+      return RUNFS_VERIFY_ALL;
+   }
+   
+   for( char* tok = strtok_r( value, ",", &saveptr ); tok != NULL; tok = strtok_r( NULL, ",", &saveptr ) ) {
+      
+      if( strcmp( tok, "inode" ) == 0 ) {
+         discipline |= RUNFS_VERIFY_INODE;
+      }
+      else if( strcmp( tok, "mtime" ) == 0 ) {
+         discipline |= RUNFS_VERIFY_MTIME;
+      }
+      else if( strcmp( tok, "size" ) == 0 ) {
+         discipline |= RUNFS_VERIFY_SIZE;
+      }
+      else if( strcmp( tok, "path" ) == 0 ) {
+         discipline |= RUNFS_VERIFY_PATH;
+      }
+      else if( strcmp( tok, "starttime" ) == 0 ) {
+         discipline |= RUNFS_VERIFY_STARTTIME;
+      }
+      else if( strcmp( tok, "none" ) != 0 ) {
+         return -EINVAL;
+      }
+   }
+   
+   return discipline;
+}
+
+// parse a size, with an optional K, M or G suffix 
+// return 0 on success, and set *size 
+// return -EINVAL if malformed 
+static int runfs_policy_parse_size( char const* value, uint64_t* size ) {
+   
+   char* end = NULL;
+   unsigned long long num = strtoull( value, &end, 10 );
+   
+   if( end == value ) {
+      return -EINVAL;
+   }
+   
+   switch( *end ) {
+      case 'G':
+      case 'g':
+         num *= 1024;
+         // fall through
+      case 'M':
+      case 'm':
+         num *= 1024;
+         // fall through
+      case 'K':
+      case 'k':
+         num *= 1024;
+         end++;
+         break;
+   }
+   
+   if( *end != '\0' ) {
+      return -EINVAL;
+   }
+   
+   *size = num;
+   return 0;
+}
+
+// parse one "key=value" setting of a profile 
+// return 0 on success 
+// return -EINVAL if malformed
+static int runfs_policy_parse_setting( struct runfs_policy* policy, char* setting ) {
+   
+   int rc = 0;
+   char* value = strchr( setting, '=' );
+   
+   if( value == NULL ) {
+      return -EINVAL;
+   }
+   
+   *value = '\0';
+   value++;
+   
+   if( strcmp( setting, "verify" ) == 0 ) {
+      
+      rc = runfs_policy_parse_verify( value );
+      if( rc < 0 ) {
+         return rc;
+      }
+      
+      policy->verify_discipline = rc;
+   }
+   else if( strcmp( setting, "stale-ttl" ) == 0 ) {
+      
+      // plain milliseconds, like --stale-ttl.  No size suffixes.
+      char* end = NULL;
+      long long ttl_ms = strtoll( value, &end, 10 );
+      
+      if( *value == '\0' || *end != '\0' || ttl_ms < 0 || ttl_ms > UINT32_MAX ) {
+         return -EINVAL;
+      }
+      
+      policy->has_stale_ttl = true;
+      policy->stale_ttl_ms = ttl_ms;
+   }
+   else if( strcmp( setting, "storage" ) == 0 ) {
+      
+      if( strcmp( value, "heap" ) == 0 ) {
+         policy->storage = RUNFS_STORAGE_HEAP;
+      }
+      else if( strcmp( value, "scrub" ) == 0 ) {
+         policy->storage = RUNFS_STORAGE_SCRUB;
+      }
+      else {
+         return -EINVAL;
+      }
+   }
+   else if( strcmp( setting, "quota" ) == 0 ) {
+      
+      rc = runfs_policy_parse_size( value, &policy->quota_bytes );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   else if( strcmp( setting, "writes" ) == 0 ) {
+      
+      if( strcmp( value, "per-file" ) == 0 ) {
+         policy->serial_writes = false;
+      }
+      else if( strcmp( value, "serial" ) == 0 ) {
+         policy->serial_writes = true;
+      }
+      else {
+         return -EINVAL;
+      }
+   }
+   else {
+      return -EINVAL;
+   }
+   
+   return 0;
+}
+
+// order profiles by descending prefix length, so more specific routes get registered (and matched) first 
+static int runfs_policy_cmp( const void* a, const void* b ) {
+   
+   size_t a_len = strlen( ((struct runfs_policy const*)a)->prefix );
+   size_t b_len = strlen( ((struct runfs_policy const*)b)->prefix );
+   
+   return (a_len < b_len) - (a_len > b_len);
+}
+
+// load profiles from a policy file.  Each non-blank, non-comment line is a path prefix followed by settings:
+//   /run/pids   verify=inode,starttime stale-ttl=100 writes=per-file
+//   /run/keys   verify=all stale-ttl=0 storage=scrub quota=1M
+// unset settings get runfs's defaults.
+// return 0 on success 
+// return -EINVAL (and log the line) if the file is malformed 
+// return -E2BIG if it defines more than RUNFS_POLICY_MAX profiles
+// return -ENOMEM on OOM 
+// return -errno if the file can't be read
+int runfs_policy_set_load( struct runfs_policy_set* set, char const* path ) {
+   
+   int rc = 0;
+   char* line = NULL;
+   size_t line_len = 0;
+   int line_num = 0;
+   
+   FILE* f = fopen( path, "r" );
+   if( f == NULL ) {
+      return -errno;
+   }
+   
+   while( getline( &line, &line_len, f ) >= 0 ) {
+      
+      char* saveptr = NULL;
+      char* prefix = NULL;
+      
+      line_num++;
+      line[ strcspn( line, "#\n" ) ] = '\0';
+      
+      prefix = strtok_r( line, " \t", &saveptr );
+      if( prefix == NULL ) {
+         continue;
+      }
+      
+      if( set->num_policies >= RUNFS_POLICY_MAX ) {
+         
+         runfs_error("%s:%d: more than %d profiles\n", path, line_num, RUNFS_POLICY_MAX );
+         rc = -E2BIG;
+         break;
+      }
+      
+      // strip trailing '/'
+      size_t prefix_len = strlen( prefix );
+      while( prefix_len > 1 && prefix[ prefix_len - 1 ] == '/' ) {
+         
+         prefix[ prefix_len - 1 ] = '\0';
+         prefix_len--;
+      }
+      
+      if( prefix[0] != '/' || prefix_len < 2 || strncmp( prefix, "/.runfs", strlen("/.runfs") ) == 0 ) {
+         
+         runfs_error("%s:%d: invalid prefix '%s'\n", path, line_num, prefix );
+         rc = -EINVAL;
+         break;
+      }
+      
+      struct runfs_policy* policy = &set->policies[ set->num_policies ];
+      memset( policy, 0, sizeof(struct runfs_policy) );
+      
+      policy->verify_discipline = RUNFS_VERIFY_DEFAULT;
+      policy->storage = RUNFS_STORAGE_HEAP;
+      atomic_init( &policy->used_bytes, 0 );
+      
+      for( char* setting = strtok_r( NULL, " \t", &saveptr ); setting != NULL; setting = strtok_r( NULL, " \t", &saveptr ) ) {
+         
+         rc = runfs_policy_parse_setting( policy, setting );
+         if( rc != 0 ) {
+            
+            runfs_error("%s:%d: invalid setting '%s'\n", path, line_num, setting );
+            break;
+         }
+      }
+      
+      if( rc != 0 ) {
+         break;
+      }
+      
+      policy->prefix = strdup( prefix );
+      if( policy->prefix == NULL ) {
+         
+         rc = -ENOMEM;
+         break;
+      }
+      
+      set->num_policies++;
+   }
+   
+   runfs_safe_free( line );
+   fclose( f );
+   
+   if( rc != 0 ) {
+      
+      for( int i = 0; i < set->num_policies; i++ ) {
+         runfs_safe_free( set->policies[i].prefix );
+      }
+      
+      set->num_policies = 0;
+      return rc;
+   }
+   
+   qsort( set->policies, set->num_policies, sizeof(struct runfs_policy), runfs_policy_cmp );
+   
+   // profiles have stopped moving 
+   for( int i = 0; i < set->num_policies; i++ ) {
+      pthread_mutex_init( &set->policies[i].write_lock, NULL );
+   }
+   
+   return 0;
+}
+
+// find the profile whose prefix is the most specific one covering path.
+// profiles are kept longest prefix first, so the first match wins.
+// this is a few byte compares, instead of a regex match per profile.
+// return the profile, or NULL if path is under no prefix
+struct runfs_policy* runfs_policy_set_lookup( struct runfs_policy_set* set, char const* path ) {
+   
+   for( int i = 0; i < set->num_policies; i++ ) {
+      
+      struct runfs_policy* policy = &set->policies[i];
+      size_t prefix_len = strlen( policy->prefix );
+      
+      if( strncmp( path, policy->prefix, prefix_len ) == 0 && (path[ prefix_len ] == '\0' || path[ prefix_len ] == '/') ) {
+         return policy;
+      }
+   }
+   
+   return NULL;
+}
+
+// start a write or truncate of a file under a profile.  If the profile serializes writes, wait for the one in progress.
+// the caller must hold the file's entry write lock; profile locks are always taken after entry locks.
+void runfs_policy_write_begin( struct runfs_policy* policy ) {
+   
+   if( policy != NULL && policy->serial_writes ) {
+      pthread_mutex_lock( &policy->write_lock );
+   }
+}
+
+// finish a write or truncate started with runfs_policy_write_begin() 
+void runfs_policy_write_end( struct runfs_policy* policy ) {
+   
+   if( policy != NULL && policy->serial_writes ) {
+      pthread_mutex_unlock( &policy->write_lock );
+   }
+}
+
+// account for num_bytes more of file contents under a profile 
+// return 0 on success 
+// return -EDQUOT if that would put it over its quota
+int runfs_policy_charge( struct runfs_policy* policy, size_t num_bytes ) {
+   
+   if( policy == NULL ) {
+      return 0;
+   }
+   
+   uint64_t used = atomic_fetch_add( &policy->used_bytes, num_bytes ) + num_bytes;
+   
+   if( policy->quota_bytes > 0 && used > policy->quota_bytes ) {
+      
+      atomic_fetch_sub( &policy->used_bytes, num_bytes );
+      return -EDQUOT;
+   }
+   
+   return 0;
+}
+
+// account for num_bytes less of file contents under a profile 
+void runfs_policy_uncharge( struct runfs_policy* policy, size_t num_bytes ) {
+   
+   if( policy != NULL ) {
+      atomic_fetch_sub( &policy->used_bytes, num_bytes );
+   }
+}
+
+// how should a profile's contents buffers (from runfs_arena_alloc()) be freed?
+void (*runfs_policy_get_free_func( struct runfs_policy* policy ))( void* ) {
+   
+   if( policy != NULL && policy->storage == RUNFS_STORAGE_SCRUB ) {
+      return runfs_arena_scrub_free;
+   }
+   
+   return runfs_arena_free;
+}
+
+// free a contents buffer now, the way its profile says to 
+void runfs_policy_free_contents( struct runfs_policy* policy, char* contents ) {
+   
+   (*runfs_policy_get_free_func( policy ))( contents );
+}
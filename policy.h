@@ -0,0 +1,72 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_POLICY_H_
+#define _RUNFS_POLICY_H_
+
+#include "os.h"
+#include "util.h"
+
+// most profiles a policy file can define
+#define RUNFS_POLICY_MAX                16
+
+// where a profile keeps file contents 
+#define RUNFS_STORAGE_HEAP              0       // plain heap buffers 
+#define RUNFS_STORAGE_SCRUB             1       // heap buffers that are zeroed before they're freed (e.g. for key material)
+
+// a profile: how entries under a path prefix are verified, cached, stored and written
+struct runfs_policy {
+   
+   char* prefix;                        // path prefix (without a trailing '/')
+   
+   int verify_discipline;               // RUNFS_VERIFY_* bits for entries owned by a PID
+   bool has_stale_ttl;                  // if true, use stale_ttl_ms instead of --stale-ttl
+   uint32_t stale_ttl_ms;               // how long a positive validity check may be trusted
+   int storage;                         // RUNFS_STORAGE_*
+   uint64_t quota_bytes;                // most bytes of file contents the profile may hold (0 for no limit)
+   bool serial_writes;                  // if true, writes and truncates under the prefix take write_lock, so only one runs at a time 
+   pthread_mutex_t write_lock;          // taken inside the handlers, under the entry's write lock 
+   
+   atomic_uint_fast64_t used_bytes;     // bytes of file contents held by the profile's entries
+};
+
+// all profiles, from a policy file, longest prefix first
+struct runfs_policy_set {
+   
+   struct runfs_policy policies[ RUNFS_POLICY_MAX ];
+   int num_policies;
+};
+
+int runfs_policy_set_init( struct runfs_policy_set* set );
+int runfs_policy_set_load( struct runfs_policy_set* set, char const* path );
+int runfs_policy_set_free( struct runfs_policy_set* set );
+struct runfs_policy* runfs_policy_set_lookup( struct runfs_policy_set* set, char const* path );
+
+int runfs_policy_charge( struct runfs_policy* policy, size_t num_bytes );
+void runfs_policy_uncharge( struct runfs_policy* policy, size_t num_bytes );
+
+void runfs_policy_write_begin( struct runfs_policy* policy );
+void runfs_policy_write_end( struct runfs_policy* policy );
+
+void runfs_policy_free_contents( struct runfs_policy* policy, char* contents );
+void (*runfs_policy_get_free_func( struct runfs_policy* policy ))( void* );
+
+#endif
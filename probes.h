@@ -0,0 +1,62 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// USDT static tracepoints, for attaching bpftrace or perf to a running runfs without rebuilding it.
+// they compile to a nop each (plus their argument setup) when RUNFS_USDT is defined, and to nothing otherwise.
+// the Makefile defines RUNFS_USDT if <sys/sdt.h> is installed (from systemtap-sdt-dev); pass USDT=0 to leave them out.
+//
+// provider "runfs":
+//   handler__entry( op, path, pid )                    route handler called (op is RUNFS_TRACE_OP_*)
+//   handler__return( op, path, pid, rc )               route handler returned rc
+//   validate__entry( pid )                             about to check whether an inode's owner is alive
+//   validate__return( pid, verdict )                   verdict is 1 if alive, 0 if dead, negative on error
+//   wq__add( lane, depth, wreq )                       work queued; depth is the lane's depth after adding it
+//   work__begin( lane, depth, wreq )                   work callback about to run
+//   work__end( lane, wreq, rc, retry )                 work callback returned rc; retry is 1 if it asked to run again later
+//
+// list them with 'bpftrace -l "usdt:/path/to/runfs:*"'.  tools/bpftrace has examples.
+
+#ifndef _RUNFS_PROBES_H_
+#define _RUNFS_PROBES_H_
+
+#ifdef RUNFS_USDT
+
+#include <sys/sdt.h>
+
+#define RUNFS_PROBES_ENABLED                    1
+
+#define RUNFS_PROBE1( name, a )                 DTRACE_PROBE1( runfs, name, a )
+#define RUNFS_PROBE2( name, a, b )              DTRACE_PROBE2( runfs, name, a, b )
+#define RUNFS_PROBE3( name, a, b, c )           DTRACE_PROBE3( runfs, name, a, b, c )
+#define RUNFS_PROBE4( name, a, b, c, d )        DTRACE_PROBE4( runfs, name, a, b, c, d )
+
+#else
+
+#define RUNFS_PROBES_ENABLED                    0
+
+#define RUNFS_PROBE1( name, a )                 do {} while(0)
+#define RUNFS_PROBE2( name, a, b )              do {} while(0)
+#define RUNFS_PROBE3( name, a, b, c )           do {} while(0)
+#define RUNFS_PROBE4( name, a, b, c, d )        do {} while(0)
+
+#endif
+
+#endif
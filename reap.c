@@ -0,0 +1,283 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "reap.h"
+#include "runfs.h"
+
+// set up emergency reap state
+// always succeeds
+int runfs_emergency_init( struct runfs_emergency* emergency ) {
+
+   memset( emergency, 0, sizeof(struct runfs_emergency) );
+
+   atomic_init( &emergency->sweep_pending, false );
+   atomic_init( &emergency->num_sweeps, 0 );
+
+   pthread_mutex_init( &emergency->lock, NULL );
+   pthread_cond_init( &emergency->cond, NULL );
+   return 0;
+}
+
+
+// free up emergency reap state
+int runfs_emergency_free( struct runfs_emergency* emergency ) {
+
+   pthread_cond_destroy( &emergency->cond );
+   pthread_mutex_destroy( &emergency->lock );
+
+   memset( emergency, 0, sizeof(struct runfs_emergency) );
+   return 0;
+}
+
+
+// walk the filesystem breadth-first, listing each directory so runfs_readdir reaps the entries of dead processes.
+// look at no more than max_entries entries.
+// return the number of entries looked at on success
+// return -ENOMEM on OOM
+int runfs_sweep( struct runfs_state* runfs, int max_entries ) {
+
+   int rc = 0;
+   int num_seen = 0;
+
+   // queue of directories to list
+   char** dirs = NULL;
+   size_t num_dirs = 0;
+   size_t max_dirs = 0;
+   size_t next_dir = 0;
+
+   dirs = RUNFS_CALLOC( char*, 1 );
+   if( dirs == NULL ) {
+      return -ENOMEM;
+   }
+
+   dirs[0] = strdup( "/" );
+   if( dirs[0] == NULL ) {
+
+      runfs_safe_free( dirs );
+      return -ENOMEM;
+   }
+
+   num_dirs = 1;
+   max_dirs = 1;
+
+   while( next_dir < num_dirs && num_seen < max_entries ) {
+
+      char* dir_path = dirs[ next_dir ];
+      struct fskit_dir_entry** dirents = NULL;
+      uint64_t num_dirents = 0;
+
+      next_dir++;
+
+      struct fskit_dir_handle* dirh = fskit_opendir( runfs->core, dir_path, 0, 0, &rc );
+      if( dirh == NULL ) {
+
+         // probably reaped out from under us
+         runfs_debug("fskit_opendir('%s') rc = %d\n", dir_path, rc );
+         rc = 0;
+         continue;
+      }
+
+      // listing reaps dead children
+      dirents = fskit_listdir( runfs->core, dirh, &num_dirents, &rc );
+      fskit_closedir( runfs->core, dirh );
+
+      if( dirents == NULL ) {
+
+         runfs_debug("fskit_listdir('%s') rc = %d\n", dir_path, rc );
+         rc = 0;
+         continue;
+      }
+
+      for( uint64_t i = 0; i < num_dirents && dirents[i] != NULL; i++ ) {
+
+         num_seen++;
+
+         if( dirents[i]->type != FSKIT_ENTRY_TYPE_DIR || strcmp( dirents[i]->name, "." ) == 0 || strcmp( dirents[i]->name, ".." ) == 0 ) {
+            continue;
+         }
+
+         if( num_dirs >= max_dirs ) {
+
+            char** tmp = (char**)realloc( dirs, sizeof(char*) * max_dirs * 2 );
+            if( tmp == NULL ) {
+
+               rc = -ENOMEM;
+               break;
+            }
+
+            dirs = tmp;
+            max_dirs *= 2;
+         }
+
+         dirs[ num_dirs ] = fskit_fullpath( dir_path, dirents[i]->name, NULL );
+         if( dirs[ num_dirs ] == NULL ) {
+
+            rc = -ENOMEM;
+            break;
+         }
+
+         num_dirs++;
+      }
+
+      fskit_dir_entry_free_list( dirents );
+
+      if( rc != 0 ) {
+         break;
+      }
+   }
+
+   for( size_t i = 0; i < num_dirs; i++ ) {
+      runfs_safe_free( dirs[i] );
+   }
+
+   runfs_safe_free( dirs );
+
+   if( rc != 0 ) {
+      return rc;
+   }
+
+   return num_seen;
+}
+
+
+// deferred emergency sweep: look for orphaned entries, and queue them for unlinking
+static int runfs_emergency_sweep_cb( struct runfs_wreq* wreq, void* cls ) {
+
+   struct runfs_state* runfs = (struct runfs_state*)cls;
+   int rc = 0;
+
+   runfs_debug("EMERGENCY: out of memory; sweeping for orphaned entries\n");
+
+   rc = runfs_sweep( runfs, RUNFS_EMERGENCY_SWEEP_MAX_ENTRIES );
+   if( rc < 0 ) {
+      runfs_error("runfs_sweep rc = %d\n", rc );
+   }
+
+   atomic_store( &runfs->emergency.sweep_pending, false );
+
+   pthread_mutex_lock( &runfs->emergency.lock );
+
+   atomic_fetch_add( &runfs->emergency.num_sweeps, 1 );
+   pthread_cond_broadcast( &runfs->emergency.cond );
+
+   pthread_mutex_unlock( &runfs->emergency.lock );
+
+   return 0;
+}
+
+
+// we're out of memory, but the filesystem may be holding on to files whose creators have died.
+// queue a bounded sweep for them on the deferred unlink queue, unless one is already queued, and return at once.
+// callers usually hold an entry's write lock, and the sweep has to lock entries, so it must never run on the caller's thread.
+// to wait for the memory to come back, use runfs_emergency_reap_wait().
+// return 0 if a sweep is queued
+// return -ENOMEM if we couldn't even queue one
+// return -EAGAIN if the deferred unlink backlog is full
+int runfs_emergency_reap( struct runfs_state* runfs ) {
+
+   int rc = 0;
+   bool pending = false;
+   struct runfs_wreq* work = NULL;
+
+   if( !atomic_compare_exchange_strong( &runfs->emergency.sweep_pending, &pending, true ) ) {
+
+      // someone else's sweep counts for us too
+      return 0;
+   }
+
+   work = RUNFS_CALLOC( struct runfs_wreq, 1 );
+   if( work == NULL ) {
+
+      atomic_store( &runfs->emergency.sweep_pending, false );
+      return -ENOMEM;
+   }
+
+   runfs_wreq_init( work, runfs_emergency_sweep_cb, runfs );
+   runfs_wreq_set_lane( work, RUNFS_WQ_LANE_FAST );
+
+   rc = runfs_wq_add( runfs->deferred_unlink_wq, work );
+   if( rc != 0 ) {
+
+      runfs_safe_free( work );
+      atomic_store( &runfs->emergency.sweep_pending, false );
+      return rc;
+   }
+
+   return 0;
+}
+
+
+// we're out of memory: queue an emergency sweep (see runfs_emergency_reap()), and wait up to timeout_ms milliseconds for it
+// to finish and for the deferred unlink queue to drain, so the caller can retry its allocation once.
+// the sweep and the unlinks run on the queue's threads, so this is safe with an entry's write lock held; if one of them needs
+// the caller's entry, it just waits until the caller gives up and lets go.  (the sweep we wait for may be one that was
+// already running, which is no worse than one we queued ourselves.)
+// return 0 if the sweep finished and the queue drained in time
+// return -ETIMEDOUT if not
+// return -ENOMEM if we couldn't queue the sweep
+// return -EAGAIN if the deferred unlink backlog is full
+int runfs_emergency_reap_wait( struct runfs_state* runfs, int64_t timeout_ms ) {
+
+   int rc = 0;
+   uint64_t start_ms = runfs_stale_now_ms();
+   uint64_t elapsed_ms = 0;
+   uint64_t num_sweeps = atomic_load( &runfs->emergency.num_sweeps );
+   struct timespec deadline;
+
+   rc = runfs_emergency_reap( runfs );
+   if( rc != 0 ) {
+      return rc;
+   }
+
+   clock_gettime( CLOCK_REALTIME, &deadline );
+
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+   if( deadline.tv_nsec >= 1000000000L ) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+   }
+
+   pthread_mutex_lock( &runfs->emergency.lock );
+
+   while( atomic_load( &runfs->emergency.num_sweeps ) == num_sweeps ) {
+
+      if( pthread_cond_timedwait( &runfs->emergency.cond, &runfs->emergency.lock, &deadline ) == ETIMEDOUT ) {
+
+         rc = -ETIMEDOUT;
+         break;
+      }
+   }
+
+   pthread_mutex_unlock( &runfs->emergency.lock );
+
+   if( rc == 0 ) {
+
+      // the sweep only queued the unlinks
+      elapsed_ms = runfs_stale_now_ms() - start_ms;
+      rc = runfs_wq_flush( runfs->deferred_unlink_wq, (int64_t)elapsed_ms < timeout_ms ? timeout_ms - (int64_t)elapsed_ms : 0 );
+   }
+
+   // hand back whatever the unlinks retired that no reader can see anymore
+   runfs_epoch_reclaim();
+
+   return rc;
+}
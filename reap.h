@@ -0,0 +1,54 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_REAP_H_
+#define _RUNFS_REAP_H_
+
+#include "os.h"
+#include "util.h"
+
+// most entries an emergency sweep will look at before giving up
+#define RUNFS_EMERGENCY_SWEEP_MAX_ENTRIES       4096
+
+// longest a failed allocation waits for an emergency sweep and the unlinks it queues
+#define RUNFS_EMERGENCY_WAIT_MS                 1000
+
+struct runfs_state;
+
+// emergency reap state
+struct runfs_emergency {
+
+   // set while a sweep is queued or running, so a burst of failed allocations queues only one
+   atomic_bool sweep_pending;
+   atomic_uint_fast64_t num_sweeps;     // sweeps run so far
+   
+   pthread_mutex_t lock;                // governs cond 
+   pthread_cond_t cond;                 // broadcast when a sweep finishes 
+};
+
+int runfs_emergency_init( struct runfs_emergency* emergency );
+int runfs_emergency_free( struct runfs_emergency* emergency );
+
+int runfs_sweep( struct runfs_state* runfs, int max_entries );
+int runfs_emergency_reap( struct runfs_state* runfs );
+int runfs_emergency_reap_wait( struct runfs_state* runfs, int64_t timeout_ms );
+
+#endif
@@ -0,0 +1,154 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "reclaim.h"
+
+// set up an empty histogram 
+static void runfs_hist_init( struct runfs_hist* hist ) {
+   
+   for( int i = 0; i < RUNFS_HIST_NUM_BUCKETS; i++ ) {
+      atomic_init( &hist->buckets[i], 0 );
+   }
+   
+   atomic_init( &hist->count, 0 );
+   atomic_init( &hist->sum_ns, 0 );
+   atomic_init( &hist->max_ns, 0 );
+}
+
+// count one latency 
+static void runfs_hist_add( struct runfs_hist* hist, uint64_t ns ) {
+   
+   uint64_t us = ns / 1000;
+   int bucket = 0;
+   
+   if( us > 0 ) {
+      bucket = 64 - __builtin_clzll( us );
+   }
+   
+   if( bucket >= RUNFS_HIST_NUM_BUCKETS ) {
+      bucket = RUNFS_HIST_NUM_BUCKETS - 1;
+   }
+   
+   atomic_fetch_add_explicit( &hist->buckets[ bucket ], 1, memory_order_relaxed );
+   atomic_fetch_add_explicit( &hist->count, 1, memory_order_relaxed );
+   atomic_fetch_add_explicit( &hist->sum_ns, ns, memory_order_relaxed );
+   
+   uint64_t max_ns = atomic_load_explicit( &hist->max_ns, memory_order_relaxed );
+   while( ns > max_ns && !atomic_compare_exchange_weak_explicit( &hist->max_ns, &max_ns, ns, memory_order_relaxed, memory_order_relaxed ) );
+}
+
+// upper bound, in microseconds, of the bucket holding the given fraction (in percent) of the samples 
+static uint64_t runfs_hist_percentile_us( uint64_t* buckets, uint64_t count, int percent ) {
+   
+   uint64_t seen = 0;
+   uint64_t want = (count * percent + 99) / 100;
+   
+   for( int i = 0; i < RUNFS_HIST_NUM_BUCKETS; i++ ) {
+      
+      seen += buckets[i];
+      if( seen >= want ) {
+         return 1ULL << i;
+      }
+   }
+   
+   return 1ULL << (RUNFS_HIST_NUM_BUCKETS - 1);
+}
+
+// print a histogram as "name_* value" lines: count, sum, p50, p99, max, and cumulative buckets
+// ("name_le_us_N" is how many took under N microseconds), up to the last non-empty one 
+static void runfs_hist_report( struct runfs_hist* hist, FILE* f, char const* name ) {
+   
+   uint64_t buckets[ RUNFS_HIST_NUM_BUCKETS ];
+   uint64_t count = 0;
+   uint64_t cumulative = 0;
+   int last = -1;
+   
+   // the buckets may move while we read them; count what we saw 
+   for( int i = 0; i < RUNFS_HIST_NUM_BUCKETS; i++ ) {
+      
+      buckets[i] = atomic_load_explicit( &hist->buckets[i], memory_order_relaxed );
+      count += buckets[i];
+      
+      if( buckets[i] > 0 ) {
+         last = i;
+      }
+   }
+   
+   fprintf( f, "%s_count %" PRIu64 "\n", name, count );
+   fprintf( f, "%s_sum_us %" PRIu64 "\n", name, (uint64_t)atomic_load( &hist->sum_ns ) / 1000 );
+   fprintf( f, "%s_max_us %" PRIu64 "\n", name, (uint64_t)atomic_load( &hist->max_ns ) / 1000 );
+   
+   if( count == 0 ) {
+      return;
+   }
+   
+   fprintf( f, "%s_p50_us %" PRIu64 "\n", name, runfs_hist_percentile_us( buckets, count, 50 ) );
+   fprintf( f, "%s_p99_us %" PRIu64 "\n", name, runfs_hist_percentile_us( buckets, count, 99 ) );
+   
+   for( int i = 0; i <= last; i++ ) {
+      
+      cumulative += buckets[i];
+      fprintf( f, "%s_le_us_%" PRIu64 " %" PRIu64 "\n", name, (uint64_t)(1ULL << i), cumulative );
+   }
+}
+
+// set up reclaim latency tracking 
+// always succeeds
+int runfs_reclaim_init( struct runfs_reclaim* reclaim ) {
+   
+   memset( reclaim, 0, sizeof(struct runfs_reclaim) );
+   
+   runfs_hist_init( &reclaim->detect_to_queue );
+   runfs_hist_init( &reclaim->queue_to_free );
+   runfs_hist_init( &reclaim->detect_to_free );
+   
+   return 0;
+}
+
+// free up reclaim latency tracking 
+// always succeeds
+int runfs_reclaim_free( struct runfs_reclaim* reclaim ) {
+   
+   return 0;
+}
+
+// a reaped entry's inode has just been freed.  dead_ns and queued_ns are its stamps (runfs_trace_now_ns()) from when its owner 
+// was found dead and when it was queued for unlinking.  Entries that weren't reaped (or were reaped along with a parent) aren't stamped.
+void runfs_reclaim_record( struct runfs_reclaim* reclaim, uint64_t dead_ns, uint64_t queued_ns ) {
+   
+   uint64_t now_ns = runfs_trace_now_ns();
+   
+   if( dead_ns == 0 || queued_ns == 0 ) {
+      return;
+   }
+   
+   runfs_hist_add( &reclaim->detect_to_queue, queued_ns - dead_ns );
+   runfs_hist_add( &reclaim->queue_to_free, now_ns - queued_ns );
+   runfs_hist_add( &reclaim->detect_to_free, now_ns - dead_ns );
+}
+
+// print the reclaim latency histograms 
+void runfs_reclaim_report( struct runfs_reclaim* reclaim, FILE* f ) {
+   
+   runfs_hist_report( &reclaim->detect_to_queue, f, "reclaim_detect_to_queue" );
+   runfs_hist_report( &reclaim->queue_to_free, f, "reclaim_queue_to_free" );
+   runfs_hist_report( &reclaim->detect_to_free, f, "reclaim_detect_to_free" );
+}
@@ -0,0 +1,59 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// how long it takes, once an entry's owner has died, for the entry and its memory to actually be gone.
+// each reaped entry is stamped when its owner is found dead and when it's queued for unlinking;
+// when its inode is freed (after the epoch's grace period), the gaps between the stamps go into log2 histograms
+// (one bucket per power of two microseconds).  Large contents buffers are handed to the arena's reclaimer at that point,
+// which returns their memory later still; arena_pending_free_bytes shows how much it has yet to get to.
+
+#ifndef _RUNFS_RECLAIM_H_
+#define _RUNFS_RECLAIM_H_
+
+#include "os.h"
+#include "util.h"
+#include "trace.h"
+
+// bucket i counts latencies under 2^i microseconds (and at least 2^(i-1), for i > 0); the last one counts everything longer 
+#define RUNFS_HIST_NUM_BUCKETS          40
+
+struct runfs_hist {
+   
+   atomic_uint_fast64_t buckets[ RUNFS_HIST_NUM_BUCKETS ];
+   atomic_uint_fast64_t count;
+   atomic_uint_fast64_t sum_ns;
+   atomic_uint_fast64_t max_ns;
+};
+
+struct runfs_reclaim {
+   
+   struct runfs_hist detect_to_queue;   // owner found dead -> queued on the deferred unlink queue 
+   struct runfs_hist queue_to_free;     // queued -> inode freed, once no lock-free reader could still see it
+   struct runfs_hist detect_to_free;    // owner found dead -> inode freed 
+};
+
+int runfs_reclaim_init( struct runfs_reclaim* reclaim );
+int runfs_reclaim_free( struct runfs_reclaim* reclaim );
+
+void runfs_reclaim_record( struct runfs_reclaim* reclaim, uint64_t dead_ns, uint64_t queued_ns );
+void runfs_reclaim_report( struct runfs_reclaim* reclaim, FILE* f );
+
+#endif
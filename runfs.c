@@ -20,31 +20,94 @@
 */
 
 #include "runfs.h"
+#include "probes.h"
 
-// allocate a runfs inode structure.
+// PID that owns the entry this thread's create, mknod or mkdir handler last made, until its create event is published (0 if none)
+static __thread pid_t runfs_created_pid = 0;
+
+// publish the create event for the entry this thread's create, mknod or mkdir handler just made.
+// fskit links the entry in only after the handler returns, so whoever ran the operation calls this once it's done.
+// rc is the operation's result; nothing is published if it failed.
+void runfs_publish_create( struct runfs_state* runfs, char const* path, int rc ) {
+   
+   if( rc == 0 && runfs_created_pid != 0 ) {
+      runfs_events_publish( &runfs->events, RUNFS_EVENT_CREATE, RUNFS_EVENT_REASON_NONE, runfs_created_pid, path );
+   }
+   
+   runfs_created_pid = 0;
+}
+
+// allocate a runfs inode structure, under the given profile (NULL for the defaults).
 // return 0 on success, and set *inode_data 
 // return -ENOMEM on OOM
 // return negative on failure to initialize the inode
-static int runfs_make_inode( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, void** inode_data ) {
+static int runfs_make_inode( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, struct runfs_policy* policy, void** inode_data ) {
    
    int rc = 0;
-   pid_t calling_tid = fskit_fuse_get_pid();
+   pid_t calling_tid = runfs_ctl_get_owner();
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   struct runfs_owner* owner = NULL;
    struct runfs_inode* inode = RUNFS_CALLOC( struct runfs_inode, 1 );
    
    if( inode == NULL ) {
       return -ENOMEM;
    }
    
-   rc = runfs_inode_init( inode, calling_tid, RUNFS_VERIFY_DEFAULT );
+   if( runfs->owners.type != RUNFS_OWNER_PID ) {
+      
+      // tie this entry to the caller's group 
+      rc = runfs_owner_get( &runfs->owners, calling_tid, &owner );
+      if( rc == 0 ) {
+         
+         runfs_inode_init_owned( inode, owner );
+      }
+      else if( rc == -ENOMEM ) {
+         
+         free( inode );
+         return rc;
+      }
+      else {
+         
+         // no usable group (e.g. not in a v2 cgroup); fall back to the caller alone 
+         runfs_debug("runfs_owner_get(%d) rc = %d; owning by PID instead\n", calling_tid, rc );
+      }
+   }
+   
+   if( owner == NULL ) {
+      
+      rc = runfs_inode_init( inode, calling_tid, (policy != NULL ? policy->verify_discipline : RUNFS_VERIFY_DEFAULT) );
+      if( rc != 0 ) {
+         // phantom process?
+         free( inode );
+         return rc;
+      }
+   }
+   
+   inode->policy = policy;
+   
+   // let readdir find this entry from its inode number
+   rc = runfs_index_insert( &runfs->index, &inode->index_node, fskit_entry_get_file_id( fent ), fent );
    if( rc != 0 ) {
-      // phantom process?
-      free( inode );
-      return rc;
+      
+      // readdir will look it up by name instead
+      runfs_debug("runfs_index_insert(%" PRIX64 ") rc = %d\n", fskit_entry_get_file_id( fent ), rc );
    }
    
+   // published by runfs_publish_create(), once the entry is linked in
+   runfs_created_pid = runfs_inode_get_pid( inode );
+   
    *inode_data = (void*)inode;
    
-   return rc;
+   return 0;
+}
+
+// which profile should an entry created at this path get?
+// return NULL for the defaults
+static struct runfs_policy* runfs_policy_for( struct fskit_core* core, struct fskit_route_metadata* route_metadata ) {
+   
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   
+   return runfs_policy_set_lookup( &runfs->policies, fskit_route_metadata_get_path( route_metadata ) );
 }
 
 // create a runfs file 
@@ -55,7 +118,7 @@ int runfs_create( struct fskit_core* core, struct fskit_route_metadata* route_me
    
    runfs_debug("runfs_create(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
    
-   return runfs_make_inode( core, route_metadata, fent, mode, inode_data );
+   return runfs_make_inode( core, route_metadata, fent, mode, runfs_policy_for( core, route_metadata ), inode_data );
 }
 
 // create sockets, FIFOs, device files, etc.
@@ -66,7 +129,7 @@ int runfs_mknod( struct fskit_core* core, struct fskit_route_metadata* route_met
    
    runfs_debug("runfs_mknod(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
    
-   return runfs_make_inode( core, route_metadata, fent, mode, inode_data );
+   return runfs_make_inode( core, route_metadata, fent, mode, runfs_policy_for( core, route_metadata ), inode_data );
 }
 
 // create a directory 
@@ -77,68 +140,189 @@ int runfs_mkdir( struct fskit_core* core, struct fskit_route_metadata* route_met
    
    runfs_debug("runfs_mkdir(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
    
-   return runfs_make_inode( core, route_metadata, dent, mode, inode_data );
+   return runfs_make_inode( core, route_metadata, dent, mode, runfs_policy_for( core, route_metadata ), inode_data );
+}
+
+// grow an inode's contents buffer to new_contents_len bytes (or copy it into a same-sized one).
+// lock-free readers may still be copying out of the old buffer, so we copy it into a new one
+// and retire the old one through the epoch instead of realloc'ing it.
+// if the old buffer is shared with clones, we just let go of it instead.
+// if we're out of memory, have orphaned entries reaped, wait (briefly) for that, and try once more before failing.
+// the growth counts against the inode's profile's quota, if it has one.
+// only the first live_len bytes are carried over; the rest of the new buffer is left uninitialized,
+// so callers must zero whatever part of it they expose past the old size.
+// the caller must hold the entry's write lock.
+// return 0 on success
+// return -ENOMEM on OOM
+// return -EDQUOT if the profile's quota would be exceeded
+static int runfs_inode_grow( struct runfs_state* runfs, struct fskit_entry* fent, struct runfs_inode* inode, size_t new_contents_len, size_t live_len ) {
+   
+   int rc = 0;
+   char* old_contents = atomic_load( &inode->contents );
+   char* tmp = NULL;
+   
+   rc = runfs_policy_charge( inode->policy, new_contents_len - inode->contents_len );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   tmp = (char*)runfs_arena_alloc( new_contents_len );
+   if( tmp == NULL ) {
+      
+      // the files of dead processes may be hogging memory.  have them reaped on the deferred unlink queue's threads
+      // (we hold fent's lock, so we can't sweep here), and stall for a bit while they are.
+      rc = runfs_emergency_reap_wait( runfs, RUNFS_EMERGENCY_WAIT_MS );
+      if( rc != 0 ) {
+         runfs_debug("runfs_emergency_reap_wait rc = %d\n", rc );
+      }
+      
+      tmp = (char*)runfs_arena_alloc( new_contents_len );
+   }
+   
+   if( tmp == NULL ) {
+      
+      runfs_policy_uncharge( inode->policy, new_contents_len - inode->contents_len );
+      return -ENOMEM;
+   }
+   
+   if( old_contents != NULL ) {
+      memcpy( tmp, old_contents, live_len );
+   }
+   
+   runfs_inode_write_begin( inode );
+   old_contents = runfs_inode_replace_contents( inode, tmp, new_contents_len );
+   runfs_inode_write_end( inode );
+   
+   if( inode->shared != NULL ) {
+      
+      // the last clone out retires it
+      runfs_content_unref( inode->shared );
+      inode->shared = NULL;
+   }
+   else if( old_contents != NULL ) {
+      runfs_epoch_retire( old_contents, runfs_policy_get_free_func( inode->policy ) );
+   }
+   
+   return 0;
+}
+
+// give an inode contents of its own, if it shares them with clones, so it can change them.
+// if every clone has already let go, the inode just keeps the buffer.
+// only the first live_len bytes are carried over (see runfs_inode_grow()).
+// the caller must hold the entry's write lock.
+// return 0 on success
+// return -ENOMEM on OOM
+static int runfs_inode_unshare( struct runfs_state* runfs, struct fskit_entry* fent, struct runfs_inode* inode, size_t live_len ) {
+   
+   if( inode->shared == NULL ) {
+      return 0;
+   }
+   
+   if( !runfs_content_is_shared( inode->shared ) ) {
+      
+      runfs_content_disown( inode->shared );
+      inode->shared = NULL;
+      return 0;
+   }
+   
+   return runfs_inode_grow( runfs, fent, inode, inode->contents_len, live_len );
 }
 
 // read a file 
+// small reads don't lock the entry; they copy the data out optimistically, and retry if a write raced them.
+// compressed files are decompressed first, under the entry's write lock.
 // return the number of bytes read on success
 // return 0 on EOF 
+// return -ENOMEM if we couldn't decompress the file
 // return -ENOSYS if the inode is not initialize (should *never* happen)
 int runfs_read( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
    
    runfs_debug("runfs_read(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
    
-   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
-   int num_read = 0;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   struct runfs_inode* inode = NULL;
+   int num_read = -EAGAIN;
+   int rc = 0;
+   
+   runfs_epoch_enter();
+   
+   inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
    
    if( inode == NULL ) {
+      
+      runfs_epoch_exit();
       return -ENOSYS;
    }
    
-   if( offset >= inode->size ) {
-      return 0;
+   if( buflen <= RUNFS_READ_OPTIMISTIC_MAX ) {
+      
+      num_read = runfs_inode_read_optimistic( inode, buf, buflen, offset );
    }
    
-   // copy data out, if we have any 
-   if( inode->contents != NULL ) {
+   if( num_read == -EAGAIN ) {
       
-      num_read = buflen;
+      // big read, lots of writes, or a compressed file.  wait for the writers.
+      fskit_entry_rlock( fent );
       
-      if( (unsigned)(offset + buflen) >= inode->size ) {
+      inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+      if( inode != NULL && inode->packed != NULL ) {
          
-         num_read = inode->size - offset;
+         // decompressing it is a change, so it needs the write lock 
+         fskit_entry_unlock( fent );
+         fskit_entry_wlock( fent );
          
-         if( num_read < 0 ) {
-            num_read = 0;
+         inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+         if( inode != NULL ) {
+            
+            rc = runfs_compact_unpack( inode );
          }
       }
+      
+      if( inode == NULL ) {
+         
+         num_read = -ENOSYS;
+      }
+      else if( rc != 0 ) {
+         
+         num_read = rc;
+      }
+      else {
+         
+         num_read = runfs_inode_read_locked( inode, buf, buflen, offset );
+      }
+      
+      fskit_entry_unlock( fent );
    }
    
-   if( num_read > 0 ) {
-      
-      memcpy( buf, inode->contents + offset, num_read );
+   if( inode != NULL ) {
+      runfs_compact_touch( &runfs->compactor, inode );
    }
    
+   runfs_epoch_exit();
+   
    return num_read;
 }
 
-// write to a file 
-// return the number of bytes written, and expand the file in RAM if we write off the edge.
-// return -ENOSYS if for some reason we don't have an inode (should *never* happen)
+// write to a write-locked file's inode (see runfs_write())
+// return the number of bytes written 
 // return -ENOMEM on OOM
-int runfs_write( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
-   
-   runfs_debug("runfs_write(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
+static int runfs_write_inode( struct runfs_state* runfs, struct fskit_entry* fent, struct runfs_inode* inode, char* buf, size_t buflen, off_t offset ) {
    
-   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
-   size_t new_contents_len = inode->contents_len;
+   int rc = 0;
+   size_t new_contents_len = 0;
    
-   if( inode == NULL ) {
-      return -ENOSYS;
+   // a cold file may have been compressed 
+   rc = runfs_compact_unpack( inode );
+   if( rc != 0 ) {
+      return rc;
    }
    
-   if( new_contents_len == 0 ) {
-      new_contents_len = 1;
+   runfs_compact_touch( &runfs->compactor, inode );
+   
+   new_contents_len = inode->contents_len;
+   
+   if( new_contents_len < RUNFS_CONTENTS_MIN_LEN ) {
+      new_contents_len = RUNFS_CONTENTS_MIN_LEN;
    }
    
    // expand contents?
@@ -149,103 +333,445 @@ int runfs_write( struct fskit_core* core, struct fskit_route_metadata* route_met
    if( new_contents_len > inode->contents_len ) {
       
       // expand
-      char* tmp = (char*)realloc( inode->contents, new_contents_len );
-      
-      if( tmp == NULL ) {
-         return -ENOMEM;
+      rc = runfs_inode_grow( runfs, fent, inode, new_contents_len, inode->size );
+      if( rc != 0 ) {
+         return rc;
       }
+   }
+   else {
       
-      inode->contents = tmp;
-      
-      memset( inode->contents + inode->contents_len, 0, new_contents_len - inode->contents_len );
-      
-      inode->contents_len = new_contents_len;
+      // copy-on-write
+      rc = runfs_inode_unshare( runfs, fent, inode, inode->size );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   
+   runfs_inode_write_begin( inode );
+   
+   // writing past the end leaves a hole, which reads as zeros
+   if( (unsigned)offset > inode->size ) {
+      memset( atomic_load( &inode->contents ) + inode->size, 0, offset - inode->size );
    }
    
    // write in 
-   memcpy( inode->contents + offset, buf, buflen );
+   memcpy( atomic_load( &inode->contents ) + offset, buf, buflen );
    
    // expand size?
    if( (unsigned)(offset + buflen) > inode->size ) {
       inode->size = offset + buflen;
    }
    
+   runfs_inode_write_end( inode );
+   
    return buflen;
 }
 
+// write to a file 
+// return the number of bytes written, and expand the file in RAM if we write off the edge.
+// return -ENOSYS if for some reason we don't have an inode (should *never* happen)
+// return -ENOMEM on OOM
+// use under the FSKIT_INODE_SEQUENTIAL consistency discipline--the entry will be write-locked when we call this method.
+// profiles with writes=serial also hold their write lock, so that only one write or truncate under them runs at a time.
+int runfs_write( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
+   
+   runfs_debug("runfs_write(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
+   
+   int rc = 0;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   
+   if( inode == NULL ) {
+      return -ENOSYS;
+   }
+   
+   runfs_policy_write_begin( inode->policy );
+   
+   rc = runfs_write_inode( runfs, fent, inode, buf, buflen, offset );
+   
+   runfs_policy_write_end( inode->policy );
+   
+   return rc;
+}
+
+// truncate a write-locked file's inode (see runfs_truncate())
+// return 0 on success 
+// return -ENOMEM on OOM 
+static int runfs_truncate_inode( struct runfs_state* runfs, struct fskit_entry* fent, struct runfs_inode* inode, off_t new_size ) {
+   
+   int rc = 0;
+   size_t new_contents_len = 0;
+   size_t live_len = 0;
+   
+   // a cold file may have been compressed 
+   rc = runfs_compact_unpack( inode );
+   if( rc != 0 ) {
+      return rc;
+   }
+   
+   runfs_compact_touch( &runfs->compactor, inode );
+   
+   new_contents_len = inode->contents_len;
+   
+   // bytes that survive the truncate 
+   live_len = ((size_t)new_size < (size_t)inode->size ? (size_t)new_size : (size_t)inode->size);
+   
+   // expand?
+   if( (unsigned)new_size > inode->contents_len ) {
+      
+      if( new_contents_len < RUNFS_CONTENTS_MIN_LEN ) {
+         new_contents_len = RUNFS_CONTENTS_MIN_LEN;
+      }
+      
+      while( (unsigned)new_size > new_contents_len ) {
+         
+         new_contents_len *= 2;
+      }
+      
+      rc = runfs_inode_grow( runfs, fent, inode, new_contents_len, live_len );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   else {
+      
+      // copy-on-write.  Only the part that survives the truncate needs copying.
+      rc = runfs_inode_unshare( runfs, fent, inode, live_len );
+      if( rc != 0 ) {
+         return rc;
+      }
+   }
+   
+   runfs_inode_write_begin( inode );
+   
+   // the bytes past the old size are undefined; make them read as zeros
+   if( (unsigned)new_size > inode->size ) {
+      memset( atomic_load( &inode->contents ) + inode->size, 0, new_size - inode->size );
+   }
+   
+   // new size 
+   inode->size = new_size;
+   
+   runfs_inode_write_end( inode );
+   
+   return 0;
+}
+
 // truncate a file 
 // return 0 on success, and reset the size and RAM buffer 
 // return -ENOMEM on OOM 
 // return -ENOSYS if for some reason we don't have an inode (should *never* happen)
 // use under the FSKIT_INODE_SEQUENTIAL consistency discipline--the entry will be write-locked when we call this method.
+// profiles with writes=serial also hold their write lock (see runfs_write()).
 int runfs_truncate( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, off_t new_size, void* inode_data ) {
    
-   runfs_debug("runfs_truncate(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
+   runfs_debug("runfs_truncate(%s) from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
+   
+   int rc = 0;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   
+   if( inode == NULL ) {
+      return -ENOSYS;
+   }
+   
+   runfs_policy_write_begin( inode->policy );
+   
+   rc = runfs_truncate_inode( runfs, fent, inode, new_size );
+   
+   runfs_policy_write_end( inode->policy );
+   
+   return rc;
+}
+
+// give a write-locked file the given contents, dropping its old ones (see runfs_clone()).
+// takes over the caller's reference to shared, if not NULL.
+// return 0 on success
+// return -ENOMEM on OOM
+// return -EDQUOT if the file's profile's quota would be exceeded
+static int runfs_clone_into( struct fskit_entry* fent, struct runfs_content* shared, char* contents, size_t contents_len, off_t size, runfs_epoch_free_func_t free_func ) {
+   
+   int rc = 0;
+   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   char* old_contents = NULL;
+   struct runfs_content* old_shared = NULL;
+   size_t old_contents_len = 0;
+   
+   if( inode == NULL ) {
+      
+      rc = -ENOSYS;
+   }
+   else if( fskit_entry_get_type( fent ) != FSKIT_ENTRY_TYPE_FILE ) {
+      
+      rc = -EISDIR;
+   }
+   else {
+      
+      rc = runfs_policy_charge( inode->policy, contents_len );
+   }
+   
+   if( rc != 0 ) {
+      
+      if( shared != NULL ) {
+         runfs_content_unref( shared );
+      }
+      
+      return rc;
+   }
+   
+   if( shared != NULL && free_func != runfs_policy_get_free_func( inode->policy ) ) {
+      
+      // can't share; copy 
+      char* copy = (char*)runfs_arena_alloc( contents_len );
+      if( copy == NULL ) {
+         
+         runfs_policy_uncharge( inode->policy, contents_len );
+         runfs_content_unref( shared );
+         return -ENOMEM;
+      }
+      
+      memcpy( copy, contents, size );
+      
+      runfs_content_unref( shared );
+      shared = NULL;
+      contents = copy;
+   }
+   
+   old_shared = inode->shared;
+   old_contents_len = inode->contents_len;
+   
+   runfs_inode_write_begin( inode );
+   
+   old_contents = runfs_inode_replace_contents( inode, contents, contents_len );
+   inode->size = size;
+   inode->shared = shared;
+   
+   runfs_inode_write_end( inode );
+   
+   fskit_entry_set_size( fent, size );
+   
+   // drop the old contents 
+   runfs_policy_uncharge( inode->policy, old_contents_len );
+   
+   if( old_shared != NULL ) {
+      runfs_content_unref( old_shared );
+   }
+   else if( old_contents != NULL ) {
+      runfs_epoch_retire( old_contents, runfs_policy_get_free_func( inode->policy ) );
+   }
+   
+   return 0;
+}
+
+// make dst_path's contents a copy-on-write clone of src_path's.
+// the two files share src_path's contents buffer until either is written to or truncated.
+// dst_path's old contents are dropped, and its new size counts against its profile's quota.
+// files under profiles that free contents differently (see runfs_policy_get_free_func()) can't share a buffer, so they get a real copy.
+// neither entry may be locked by the caller; we never hold both locks at once.
+// return 0 on success
+// return -EINVAL if the paths are the same
+// return -EISDIR if either is a directory
+// return -ENOMEM on OOM
+// return -EDQUOT if dst_path's profile's quota would be exceeded
+// return other -errno if either path can't be resolved
+int runfs_clone( struct runfs_state* runfs, char const* src_path, char const* dst_path, uint64_t uid, uint64_t gid ) {
+   
+   int rc = 0;
+   struct fskit_entry* fent = NULL;
+   struct runfs_inode* inode = NULL;
+   struct runfs_content* shared = NULL;
+   char* contents = NULL;
+   size_t contents_len = 0;
+   off_t size = 0;
+   runfs_epoch_free_func_t free_func = NULL;
+   
+   if( strcmp( src_path, dst_path ) == 0 ) {
+      return -EINVAL;
+   }
+   
+   // share the source's buffer 
+   fent = fskit_entry_resolve_path( runfs->core, src_path, uid, gid, true, &rc );
+   if( fent == NULL ) {
+      return rc;
+   }
+   
+   if( fskit_entry_get_type( fent ) != FSKIT_ENTRY_TYPE_FILE ) {
+      
+      fskit_entry_unlock( fent );
+      return -EISDIR;
+   }
+   
+   inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
+   if( inode == NULL ) {
+      
+      fskit_entry_unlock( fent );
+      return -ENOSYS;
+   }
+   
+   // compressed contents can't be shared 
+   rc = runfs_compact_unpack( inode );
+   if( rc != 0 ) {
+      
+      fskit_entry_unlock( fent );
+      return rc;
+   }
+   
+   contents = atomic_load( &inode->contents );
+   contents_len = inode->contents_len;
+   size = inode->size;
+   free_func = runfs_policy_get_free_func( inode->policy );
+   
+   if( contents != NULL ) {
+      
+      if( inode->shared == NULL ) {
+         
+         inode->shared = runfs_content_new( contents, free_func );
+         if( inode->shared == NULL ) {
+            
+            fskit_entry_unlock( fent );
+            return -ENOMEM;
+         }
+      }
+      
+      shared = inode->shared;
+      runfs_content_ref( shared );
+   }
+   
+   fskit_entry_unlock( fent );
+   
+   // shared contents never change, so from here on we can read them without the source's lock 
+   fent = fskit_entry_resolve_path( runfs->core, dst_path, uid, gid, true, &rc );
+   if( fent == NULL ) {
+      
+      if( shared != NULL ) {
+         runfs_content_unref( shared );
+      }
+      
+      return rc;
+   }
+   
+   rc = runfs_clone_into( fent, shared, contents, contents_len, size, free_func );
+   
+   fskit_entry_unlock( fent );
+   
+   return rc;
+}
+
+// free a removed entry's inode, and count it as reclaimed.  If it was reaped, how long that took is recorded
+// once the epoch actually frees it.
+// the caller must have detached it from its entry.
+static void runfs_inode_reclaim( struct runfs_state* runfs, struct runfs_inode* inode ) {
+   
+   atomic_fetch_add( &runfs->bytes_reclaimed, inode->contents_len );
+   atomic_fetch_add( &runfs->entries_reclaimed, 1 );
+   
+   inode->reclaim = &runfs->reclaim;
+   
+   runfs_index_remove( &runfs->index, &inode->index_node );
+   
+   // lock-free readers may still be looking at it
+   runfs_inode_retire( inode );
+}
+
+// remove a file or directory 
+// if it's part of a reaped subtree, publish its reap event, unless runfs_reap_entry already did (i.e. it's the subtree's root).
+// return 0 on success, and free up the given inode_data
+int runfs_destroy( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, void* inode_data ) {
+   
+   runfs_debug("runfs_destroy('%s') from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
+   
+   struct runfs_inode* inode = (struct runfs_inode*)inode_data;
+   struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
+   int reason = runfs_detach_get_reason();
+   
+   if( inode != NULL ) {
+      
+      if( reason != RUNFS_EVENT_REASON_NONE && !runfs_inode_is_deleted( inode ) ) {
+         runfs_events_publish( &runfs->events, RUNFS_EVENT_REAP, reason, runfs_inode_get_pid( inode ), fskit_route_metadata_get_path( route_metadata ) );
+      }
+      
+      runfs_inode_reclaim( runfs, inode );
+   }
+   
+   return 0;
+}
+
+// reap an entry whose creator has died, by handing it off to the deferred-unlink queue.
+// the caller must be in an epoch, and must have won runfs_inode_mark_deleted() on the entry's inode.
+// this is the only place stat and readdir write-lock an entry, so only the winning reaper ever does.
+// if release_inode is true, the inode is detached from the entry and retired once the entry is queued.
+// publishes the entry's reap event once it's queued; its descendants' events are published as they are destroyed.
+// on failure, the inode is unmarked so a later access can try again.
+// return 0 on success
+// return -ENOENT if the inode got detached from the entry underneath us, or a removal of it is already queued
+// return -EAGAIN if the deferred-unlink backlog is full
+// return other -errno on failure to queue the entry
+static int runfs_reap_entry( struct runfs_state* runfs, char const* fs_path, struct fskit_entry* fent, struct runfs_inode* inode, bool release_inode ) {
+   
+   int rc = 0;
+   int reason = (runfs_ctl_is_released( inode ) ? RUNFS_EVENT_REASON_RELEASED : RUNFS_EVENT_REASON_ORPHANED);
+   pid_t pid = runfs_inode_get_pid( inode );
    
-   struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
-   size_t new_contents_len = inode->contents_len;
+   fskit_entry_wlock( fent );
    
-   if( inode == NULL ) {
-      return -ENOSYS;
+   if( (struct runfs_inode*)fskit_entry_get_user_data( fent ) != inode ) {
+      
+      // already released
+      fskit_entry_unlock( fent );
+      return -ENOENT;
    }
    
-   // expand?
-   if( (unsigned)new_size >= inode->contents_len ) {
-      
-      if( new_contents_len == 0 ) {
-         new_contents_len = 1;
-      }
-      
-      while( (unsigned)new_size > new_contents_len ) {
-         
-         new_contents_len *= 2;
-      }
-      
-      char* tmp = (char*)realloc( inode->contents, new_contents_len );
-      
-      if( tmp == NULL ) {
-         return -ENOMEM;
-      }
-      
-      inode->contents = tmp;
+   // stamp it before it's queued, since the queue may free it before we get to look again 
+   inode->queued_ns = runfs_trace_now_ns();
+   
+   rc = runfs_deferred_remove( runfs, fs_path, fent, reason );
+   
+   if( rc == -EEXIST ) {
       
-      memset( inode->contents + inode->contents_len, 0, new_contents_len - inode->contents_len );
+      // a removal of this inode is already queued.  It's as good as gone, so leave it marked
+      // deleted and let the pending request finish the job.  Never let -EEXIST reach the VFS.
+      inode->queued_ns = 0;
+      fskit_entry_unlock( fent );
+      return -ENOENT;
+   }
+   
+   if( rc == 0 && release_inode ) {
       
-      inode->contents_len = new_contents_len;
+      fskit_entry_set_user_data( fent, NULL );
+      runfs_inode_reclaim( runfs, inode );
    }
-   else {
+   else if( rc != 0 ) {
       
-      memset( inode->contents + new_size, 0, inode->contents_len - new_size );
+      inode->queued_ns = 0;
+      runfs_inode_unmark_deleted( inode );
    }
    
-   // new size 
-   inode->size = new_size;
+   fskit_entry_unlock( fent );
    
-   return 0;
+   if( rc == 0 ) {
+      runfs_events_publish( &runfs->events, RUNFS_EVENT_REAP, reason, pid, fs_path );
+   }
+   
+   return rc;
 }
 
-// remove a file or directory 
-// return 0 on success, and free up the given inode_data
-int runfs_destroy( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, void* inode_data ) {
-   
-   runfs_debug("runfs_destroy('%s') from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
-   
-   struct runfs_inode* inode = (struct runfs_inode*)inode_data;
+// how stale may the validity check on an entry be?
+// its profile's budget wins over --stale-ttl.
+static uint32_t runfs_inode_stale_ttl( struct runfs_state* runfs, struct runfs_inode* inode, char const* path ) {
    
-   if( inode != NULL ) {
-      runfs_inode_free( inode );
-      runfs_safe_free( inode );
+   if( inode->policy != NULL && inode->policy->has_stale_ttl ) {
+      return inode->policy->stale_ttl_ms;
    }
    
-   return 0;
+   return runfs_stale_get_ttl( &runfs->stale, path );
 }
 
 // stat an entry 
 // garbage-collect an entry (and its children) if the process that created it died.
+// live entries are checked without locking them: the inode is read inside an epoch, so it can't be freed underneath us.
 // return 0 on success 
 // return -ENOENT if the path does not exist
 // return -EIO if the inode is invalid 
-// needs per-inode sequential consistency 
 int runfs_stat( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, struct stat* sb ) {
    
    runfs_debug("runfs_stat('%s') from %d\n", fskit_route_metadata_get_path( route_metadata ), fskit_fuse_get_pid() );
@@ -253,32 +779,29 @@ int runfs_stat( struct fskit_core* core, struct fskit_route_metadata* route_meta
    int rc = 0;
    struct runfs_state* runfs = (struct runfs_state*)fskit_core_get_user_data( core );
    
-   fskit_entry_rlock( fent );
+   runfs_epoch_enter();
    
    struct runfs_inode* inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
    
    if( inode == NULL ) {
        
-      fskit_entry_unlock( fent );
+      runfs_epoch_exit();
       return -ENOENT;
    }
    
-   if( inode->deleted ) {
+   if( runfs_inode_is_deleted( inode ) ) {
        
-      fskit_entry_unlock( fent );
+      runfs_epoch_exit();
       runfs_debug("%s was deleted\n", fskit_route_metadata_get_path( route_metadata ));
       return -ENOENT;
    }
    
-   pid_t pid = pstat_get_pid( inode->ps );
+   pid_t pid = runfs_inode_get_pid( inode );
    
-   rc = runfs_inode_is_valid( inode );
+   rc = runfs_inode_is_valid_cached( inode, &runfs->stale, runfs_inode_stale_ttl( runfs, inode, fskit_route_metadata_get_path( route_metadata ) ) );
    if( rc < 0 ) {
       
-      char path[PATH_MAX+1];
-      pstat_get_path( inode->ps, path );
-      
-      runfs_error( "runfs_inode_is_valid(path=%s, pid=%d) rc = %d\n", path, pid, rc );
+      runfs_error( "runfs_inode_is_valid('%s', pid=%d) rc = %d\n", fskit_route_metadata_get_path( route_metadata ), pid, rc );
       
       // no longer valid
       rc = 0;
@@ -286,57 +809,65 @@ int runfs_stat( struct fskit_core* core, struct fskit_route_metadata* route_meta
    
    if( rc == 0 ) {
       
-      // no longer valid.  detach 
-      // upgrade to write-lock 
-      fskit_entry_unlock( fent );
-      fskit_entry_wlock( fent );
-      
-      inode = (struct runfs_inode*)fskit_entry_get_user_data( fent );
-      if( inode == NULL ) {
-          
-          fskit_entry_unlock( fent );
-          return -ENOENT;
-      }
-      
-      if( inode->deleted ) {
-          
-          // someone else raced us 
-          fskit_entry_unlock( fent );
-          return -ENOENT;
+      // no longer valid.  detach, unless someone else is already doing so
+      if( !runfs_inode_mark_deleted( inode ) ) {
+         
+         runfs_epoch_exit();
+         return -ENOENT;
       }
       
-      inode->deleted = true;
-      fskit_entry_set_user_data( fent, NULL );
-      
-      runfs_inode_free( inode );
-      runfs_safe_free( inode );
-      
       uint64_t inode_number = fskit_entry_get_file_id( fent );
-      rc = runfs_deferred_remove( runfs, fskit_route_metadata_get_path( route_metadata ), fent );
+      rc = runfs_reap_entry( runfs, fskit_route_metadata_get_path( route_metadata ), fent, inode, true );
       
-      if( rc != 0 ) {
-          runfs_error("runfs_deferred_remove('%s' (%" PRIX64 ") rc = %d\n", fskit_route_metadata_get_path( route_metadata ), inode_number, rc );
+      if( rc == 0 ) {
+         
+         runfs_debug("Detached '%s' because it is orphaned (PID %d)\n", fskit_route_metadata_get_path( route_metadata ), pid );
+         rc = -ENOENT;
       }
-      else {
-          runfs_debug("Detached '%s' because it is orphaned (PID %d)\n", fskit_route_metadata_get_path( route_metadata ), pid );
-          rc = -ENOENT;
+      else if( rc == -EAGAIN ) {
+         
+         // reap backlog is full.  it's still dead; we'll try again next time
+         runfs_debug("Deferred unlink backlog is full; will reap '%s' later\n", fskit_route_metadata_get_path( route_metadata ) );
+         rc = -ENOENT;
+      }
+      else if( rc != -ENOENT ) {
+         runfs_error("runfs_deferred_remove('%s' (%" PRIX64 ") rc = %d\n", fskit_route_metadata_get_path( route_metadata ), inode_number, rc );
       }
-      
-      fskit_entry_unlock( fent );
    }
    else {
        
-      fskit_entry_unlock( fent );
       runfs_debug("'%s' (created by %d) is still valid\n", fskit_route_metadata_get_path( route_metadata ), pid );
       rc = 0;
    }
    
+   runfs_epoch_exit();
+   
    return rc;
 }
 
+// how stale may the validity check on a directory's child be?
+// the child's profile's budget wins; otherwise, only builds the child's path if there are per-path budgets.
+static uint32_t runfs_child_stale_ttl( struct runfs_state* runfs, struct runfs_inode* inode, char const* dir_path, char const* name ) {
+   
+   char path[PATH_MAX+1];
+   size_t dir_len = strlen( dir_path );
+   
+   if( inode->policy != NULL && inode->policy->has_stale_ttl ) {
+      return inode->policy->stale_ttl_ms;
+   }
+   
+   if( runfs->stale.num_rules == 0 ) {
+      return runfs->stale.default_ttl_ms;
+   }
+   
+   snprintf( path, PATH_MAX, "%s%s%s", dir_path, (dir_len > 0 && dir_path[ dir_len - 1 ] == '/' ? "" : "/"), name );
+   
+   return runfs_stale_get_ttl( &runfs->stale, path );
+}
+
 // read a directory
 // stat each node in it, and remove ones whose creating process has died
-// we need concurrent per-inode locking (i.e. read-lock the directory)
+// the directory is read-locked by fskit, so its children stay put; the children themselves are only locked to reap them.
 int runfs_readdir( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, struct fskit_dir_entry** dirents, size_t num_dirents ) {
    
    runfs_debug("runfs_readdir(%s, %zu) from %d\n", fskit_route_metadata_get_path( route_metadata ), num_dirents, fskit_fuse_get_pid() );
@@ -354,6 +885,8 @@ int runfs_readdir( struct fskit_core* core, struct fskit_route_metadata* route_m
    
    int omitted_idx = 0;
    
+   runfs_epoch_enter();
+   
    for( unsigned int i = 0; i < num_dirents; i++ ) {
       
       // skip . and ..
@@ -361,104 +894,89 @@ int runfs_readdir( struct fskit_core* core, struct fskit_route_metadata* route_m
          continue;
       }
       
-      // find the associated fskit_entry
-      child = fskit_dir_find_by_name( fent, dirents[i]->name );
+      // find the associated fskit_entry.
+      // the index gets us there without a name lookup; only entries it doesn't know (e.g. the control directory) need one.
+      child = runfs_index_find( &runfs->index, dirents[i]->file_id );
+      if( child == NULL ) {
+         child = fskit_dir_find_by_name( fent, dirents[i]->name );
+      }
       
       if( child == NULL ) {
          // strange, shouldn't happen...
          continue;
       }
       
-      fskit_entry_rlock( child );
-      
       inode = (struct runfs_inode*)fskit_entry_get_user_data( child );
       
       if( inode == NULL ) {
          // skip
-         fskit_entry_unlock( child );
          continue;
       }
       
       // already marked for deletion?
-      if( inode->deleted ) {
+      if( runfs_inode_is_deleted( inode ) ) {
          // skip
-         fskit_entry_unlock( child );
-         
          omitted[ omitted_idx ] = i;
          omitted_idx++;
          continue;
       }
       
-      // is this file still valid?
-      int valid = runfs_inode_is_valid( inode );
+      // is this file still valid?  (not if we're releasing its owner)
+      int valid = (runfs_ctl_is_released( inode ) ? 0 : runfs_inode_is_valid_cached( inode, &runfs->stale, runfs_child_stale_ttl( runfs, inode, fskit_route_metadata_get_path( route_metadata ), dirents[i]->name ) ));
       
       if( valid < 0 ) {
          
-         char path[PATH_MAX+1];
-         pstat_get_path( inode->ps, path );
-         
-         runfs_error( "runfs_inode_is_valid(path=%s, pid=%d) rc = %d\n", path, pstat_get_pid( inode->ps ), valid );
+         runfs_error( "runfs_inode_is_valid('%s', pid=%d) rc = %d\n", dirents[i]->name, runfs_inode_get_pid( inode ), valid );
          
          valid = 0;
       }
       
-      fskit_entry_unlock( child );
-      
       if( valid == 0 ) {
          
          // not valid--creator has died.
-         // upgrade the lock to a write-lock, so we can garbage-collect 
-         fskit_entry_wlock( child );
-      
-         inode = (struct runfs_inode*)fskit_entry_get_user_data( child );
-      
-         if( inode == NULL ) {
-             
-             // no longer valid
-             omitted[ omitted_idx ] = i;
-             omitted_idx++;
-             fskit_entry_unlock( child );
-             continue;
-         }
+         // omit it, and garbage-collect it unless someone else is already doing so
+         omitted[ omitted_idx ] = i;
+         omitted_idx++;
          
-         if( inode->deleted ) {
-             // someone raced us 
-             fskit_entry_unlock( child );
-             
-             omitted[ omitted_idx ] = i;
-             omitted_idx++;
-             continue;
+         if( !runfs_inode_mark_deleted( inode ) ) {
+            // someone raced us 
+            continue;
          }
-      
-         // flag deleted
-         inode->deleted = true;
          
          uint64_t child_id = fskit_entry_get_file_id( child );
          char* child_fp = fskit_fullpath( fskit_route_metadata_get_path( route_metadata ), dirents[i]->name, NULL );
          if( child_fp == NULL ) {
              
-            fskit_entry_unlock( child );
+            runfs_inode_unmark_deleted( inode );
             rc = -ENOMEM;
             break;
          }
          
          // garbage-collect
-         rc = runfs_deferred_remove( runfs, child_fp, child );
-         fskit_entry_unlock( child );
+         rc = runfs_reap_entry( runfs, child_fp, child, inode, false );
          
-         if( rc != 0 ) {
+         if( rc == -EAGAIN ) {
+            
+            // reap backlog is full.  it's still dead, so leave it out; we'll try again next time
+            runfs_debug("Deferred unlink backlog is full; will reap '%s' later\n", child_fp );
+            rc = 0;
+         }
+         else if( rc == -ENOENT ) {
+            
+            // released underneath us
+            rc = 0;
+         }
+         else if( rc != 0 ) {
             
             runfs_error("runfs_deferred_remove('%s' (%" PRIX64 ")) rc = %d\n", child_fp, child_id, rc );
          }
          
          free( child_fp );
-         
-         // omit this child from the listing
-         omitted[ omitted_idx ] = i;
-         omitted_idx++;
       }
    }
    
+   runfs_epoch_exit();
+   
    for( int i = 0; i < omitted_idx; i++ ) {
       
       fskit_readdir_omit( dirents, omitted[i] );
@@ -469,126 +987,393 @@ int runfs_readdir( struct fskit_core* core, struct fskit_route_metadata* route_m
    return rc;
 }
 
-// run! 
-int main( int argc, char** argv ) {
+// traced versions of the handlers, registered in their place while tracing (see trace.h), or if built with USDT probes (see probes.h)
+static int runfs_create_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, void** inode_data, void** handle_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_CREATE, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_create( core, route_metadata, fent, mode, inode_data, handle_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_CREATE, fskit_route_metadata_get_path( route_metadata ), 0, 0, mode, rc, start_ns );
+   return rc;
+}
+
+static int runfs_mknod_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, mode_t mode, dev_t dev, void** inode_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_MKNOD, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_mknod( core, route_metadata, fent, mode, dev, inode_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_MKNOD, fskit_route_metadata_get_path( route_metadata ), 0, dev, mode, rc, start_ns );
+   return rc;
+}
+
+static int runfs_mkdir_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* dent, mode_t mode, void** inode_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_MKDIR, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_mkdir( core, route_metadata, dent, mode, inode_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_MKDIR, fskit_route_metadata_get_path( route_metadata ), 0, 0, mode, rc, start_ns );
+   return rc;
+}
+
+static int runfs_read_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_READ, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_read( core, route_metadata, fent, buf, buflen, offset, handle_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_READ, fskit_route_metadata_get_path( route_metadata ), offset, buflen, 0, rc, start_ns );
+   return rc;
+}
+
+static int runfs_write_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, char* buf, size_t buflen, off_t offset, void* handle_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_WRITE, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_write( core, route_metadata, fent, buf, buflen, offset, handle_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_WRITE, fskit_route_metadata_get_path( route_metadata ), offset, buflen, 0, rc, start_ns );
+   return rc;
+}
+
+static int runfs_truncate_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, off_t new_size, void* inode_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_TRUNC, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_truncate( core, route_metadata, fent, new_size, inode_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_TRUNC, fskit_route_metadata_get_path( route_metadata ), new_size, 0, 0, rc, start_ns );
+   return rc;
+}
+
+static int runfs_destroy_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, void* inode_data ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_DESTROY, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_destroy( core, route_metadata, fent, inode_data );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_DESTROY, fskit_route_metadata_get_path( route_metadata ), 0, 0, 0, rc, start_ns );
+   return rc;
+}
+
+static int runfs_stat_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, struct stat* sb ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_STAT, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_stat( core, route_metadata, fent, sb );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_STAT, fskit_route_metadata_get_path( route_metadata ), 0, 0, 0, rc, start_ns );
+   return rc;
+}
+
+static int runfs_readdir_traced( struct fskit_core* core, struct fskit_route_metadata* route_metadata, struct fskit_entry* fent, struct fskit_dir_entry** dirents, size_t num_dirents ) {
+   
+   uint64_t start_ns = runfs_trace_begin( RUNFS_TRACE_OP_READDIR, fskit_route_metadata_get_path( route_metadata ) );
+   int rc = runfs_readdir( core, route_metadata, fent, dirents, num_dirents );
+   
+   runfs_trace_end( RUNFS_TRACE_OP_READDIR, fskit_route_metadata_get_path( route_metadata ), 0, 0, num_dirents, rc, start_ns );
+   return rc;
+}
+
+// log the profiles.  They don't need routes of their own: new entries pick up their profile by prefix
+// (see runfs_policy_set_lookup()), and every other handler gets it from the inode, so requests don't pay for any extra
+// route matching.  writes=serial is a lock the write and truncate handlers take, under the entry's write lock.
+static void runfs_log_policies( struct runfs_state* runfs ) {
+   
+   for( int i = 0; i < runfs->policies.num_policies; i++ ) {
+      
+      struct runfs_policy* policy = &runfs->policies.policies[i];
+      
+      runfs_debug("profile '%s': verify=0x%x, storage=%d, quota=%" PRIu64 ", serial writes=%d\n", policy->prefix, policy->verify_discipline, policy->storage, policy->quota_bytes, policy->serial_writes );
+   }
+}
+
+// set up runfs's state from its options.  Doesn't touch fskit; the caller plugs in runfs->core afterwards.
+// return 0 on success 
+// return negative on error (which is logged)
+int runfs_state_init( struct runfs_state* runfs, struct runfs_opts* opts ) {
    
    int rc = 0;
-   int rh = 0;
-   struct fskit_fuse_state* state = NULL;
-   struct fskit_core* core = NULL;
-   struct runfs_state runfs;
    
-   state = fskit_fuse_state_new();
-   if( state == NULL ) {
-      exit(1);
+   memset( runfs, 0, sizeof(struct runfs_state) );
+   
+   rc = runfs_epoch_init();
+   if( rc != 0 ) {
+      runfs_error("runfs_epoch_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_arena_init( opts->huge_mode );
+   if( rc != 0 ) {
+      runfs_error("runfs_arena_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   // detach large dead subtrees with one thread per core
+   runfs->detach_threads = sysconf( _SC_NPROCESSORS_ONLN );
+   if( runfs->detach_threads < 1 ) {
+      runfs->detach_threads = 1;
+   }
+   
+   runfs->deferred_unlink_wq = runfs_wq_new();
+   if( runfs->deferred_unlink_wq == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rc = runfs_wq_init( runfs->deferred_unlink_wq, RUNFS_WQ_DEFAULT_MAX_BACKLOG );
+   if( rc != 0 ) {
+      runfs_error("runfs_wq_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_detach_pool_init( &runfs->detach_pool, runfs->detach_threads * RUNFS_DETACH_RESERVE_PER_THREAD );
+   if( rc != 0 ) {
+      runfs_error("runfs_detach_pool_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   // the work queue thread running a detach job is its first thread 
+   rc = runfs_detach_workers_init( &runfs->detach_workers, runfs->detach_threads - 1 );
+   if( rc != 0 ) {
+      runfs_error("runfs_detach_workers_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_emergency_init( &runfs->emergency );
+   if( rc != 0 ) {
+      runfs_error("runfs_emergency_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_owner_table_init( &runfs->owners, opts->owner_type, opts->cgroup_root );
+   if( rc != 0 ) {
+      runfs_error("runfs_owner_table_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_events_init( &runfs->events );
+   if( rc != 0 ) {
+      runfs_error("runfs_events_init rc = %d\n", rc );
+      return rc;
    }
    
-   // setup runfs state 
-   memset( &runfs, 0, sizeof(struct runfs_state) );
+   runfs_stale_init( &runfs->stale );
+   runfs_reclaim_init( &runfs->reclaim );
    
-   runfs.deferred_unlink_wq = runfs_wq_new();
-   if( runfs.deferred_unlink_wq == NULL ) {
-      exit(1);
+   for( int i = 0; i < opts->num_stale_ttls; i++ ) {
+      
+      rc = runfs_stale_add( &runfs->stale, opts->stale_ttls[i] );
+      if( rc != 0 ) {
+         runfs_error("Invalid --stale-ttl '%s'\n", opts->stale_ttls[i] );
+         return rc;
+      }
    }
    
-   rc = runfs_wq_init( runfs.deferred_unlink_wq );
+   rc = runfs_index_init( &runfs->index );
    if( rc != 0 ) {
-      fprintf(stderr, "runfs_wq_init rc = %d\n", rc );
-      exit(1);
+      runfs_error("runfs_index_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   runfs_policy_set_init( &runfs->policies );
+   
+   if( opts->policy_file != NULL ) {
+      
+      rc = runfs_policy_set_load( &runfs->policies, opts->policy_file );
+      if( rc != 0 ) {
+         runfs_error("runfs_policy_set_load('%s') rc = %d\n", opts->policy_file, rc );
+         return rc;
+      }
    }
    
-   // set up fskit state
-   rc = fskit_fuse_init( state, &runfs );
+   rc = runfs_compactor_init( &runfs->compactor, runfs, opts->compact_after_ms );
    if( rc != 0 ) {
-      fprintf(stderr, "fskit_fuse_init rc = %d\n", rc );
-      exit(1);
+      runfs_error("runfs_compactor_init rc = %d\n", rc );
+      return rc;
+   }
+   
+   if( opts->trace_path != NULL ) {
+      
+      rc = runfs_trace_open( opts->trace_path );
+      if( rc != 0 ) {
+         runfs_error("runfs_trace_open('%s') rc = %d\n", opts->trace_path, rc );
+         return rc;
+      }
    }
    
-   // make sure the fs can access its methods through the VFS
-   fskit_fuse_setting_enable( state, FSKIT_FUSE_SET_FS_ACCESS );
+   return 0;
+}
+
+// register runfs's handlers with runfs->core.
+// the control directory's go first, then each profile's, and then the ones for everything else (FSKIT_ROUTE_ANY).
+// while tracing (or if built with USDT probes), the traced versions of the handlers are registered instead.
+// return 0 on success 
+// return negative on failure to add a route (which is logged)
+int runfs_add_routes( struct runfs_state* runfs ) {
+   
+   int rc = 0;
+   int rh = 0;
+   struct fskit_core* core = runfs->core;
+   bool traced = (runfs_trace_is_enabled() || RUNFS_PROBES_ENABLED);
    
-   core = fskit_fuse_get_core( state );
+   // control directory handlers go first, so they take precedence over FSKIT_ROUTE_ANY
+   rc = runfs_ctl_add_routes( core );
+   if( rc != 0 ) {
+      runfs_error("runfs_ctl_add_routes rc = %d\n", rc );
+      return rc;
+   }
    
-   // plug core into runfs
-   runfs.core = core;
+   // profiles' handlers go next, most specific prefix first 
+   runfs_log_policies( runfs );
    
    // add handlers.  reads and writes must happen sequentially, since we seek and then perform I/O
    // NOTE: FSKIT_ROUTE_ANY matches any path, and is a macro for the regex "/([^/]+[/]*)+"
-   rh = fskit_route_create( core, FSKIT_ROUTE_ANY, runfs_create, FSKIT_CONCURRENT );
+   rh = fskit_route_create( core, FSKIT_ROUTE_ANY, (traced ? runfs_create_traced : runfs_create), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_create(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_create(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_mkdir( core, FSKIT_ROUTE_ANY, runfs_mkdir, FSKIT_CONCURRENT );
+   rh = fskit_route_mkdir( core, FSKIT_ROUTE_ANY, (traced ? runfs_mkdir_traced : runfs_mkdir), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_mkdir(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_mkdir(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_mknod( core, FSKIT_ROUTE_ANY, runfs_mknod, FSKIT_CONCURRENT );
+   rh = fskit_route_mknod( core, FSKIT_ROUTE_ANY, (traced ? runfs_mknod_traced : runfs_mknod), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_mknod(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_mknod(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_readdir( core, FSKIT_ROUTE_ANY, runfs_readdir, FSKIT_CONCURRENT );
+   rh = fskit_route_readdir( core, FSKIT_ROUTE_ANY, (traced ? runfs_readdir_traced : runfs_readdir), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_readdir(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_readdir(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_read( core, FSKIT_ROUTE_ANY, runfs_read, FSKIT_INODE_CONCURRENT );
+   // reads don't need the entry lock; see runfs_read()
+   rh = fskit_route_read( core, FSKIT_ROUTE_ANY, (traced ? runfs_read_traced : runfs_read), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_read(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_read(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_write( core, FSKIT_ROUTE_ANY, runfs_write, FSKIT_INODE_SEQUENTIAL );
+   rh = fskit_route_write( core, FSKIT_ROUTE_ANY, (traced ? runfs_write_traced : runfs_write), FSKIT_INODE_SEQUENTIAL );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_write(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_write(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_trunc( core, FSKIT_ROUTE_ANY, runfs_truncate, FSKIT_INODE_SEQUENTIAL );
+   rh = fskit_route_trunc( core, FSKIT_ROUTE_ANY, (traced ? runfs_truncate_traced : runfs_truncate), FSKIT_INODE_SEQUENTIAL );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_trunc(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_trunc(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
       
-   rh = fskit_route_destroy( core, FSKIT_ROUTE_ANY, runfs_destroy, FSKIT_CONCURRENT );
+   rh = fskit_route_destroy( core, FSKIT_ROUTE_ANY, (traced ? runfs_destroy_traced : runfs_destroy), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_detach(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_detach(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
-   rh = fskit_route_stat( core, FSKIT_ROUTE_ANY, runfs_stat, FSKIT_CONCURRENT );
+   rh = fskit_route_stat( core, FSKIT_ROUTE_ANY, (traced ? runfs_stat_traced : runfs_stat), FSKIT_CONCURRENT );
    if( rh < 0 ) {
-      fprintf(stderr, "fskit_route_stat(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
-      exit(1);
+      runfs_error("fskit_route_stat(%s) rc = %d\n", FSKIT_ROUTE_ANY, rh );
+      return rh;
    }
    
+   return 0;
+}
+
+// bring up the filesystem once the routes are in place: give the root to the user, make the control directory,
+// and start reaping in the background.
+// return 0 on success 
+// return negative on error (which is logged)
+int runfs_start( struct runfs_state* runfs ) {
+   
+   int rc = 0;
+   
    // set the root to be owned by the effective UID and GID of user
-   fskit_chown( core, "/", 0, 0, geteuid(), getegid() );
+   fskit_chown( runfs->core, "/", 0, 0, geteuid(), getegid() );
+   
+   // set up the control directory 
+   rc = runfs_ctl_init( runfs );
+   if( rc != 0 ) {
+      runfs_error("runfs_ctl_init rc = %d\n", rc );
+      return rc;
+   }
    
    // begin taking deferred requests 
-   rc = runfs_wq_start( runfs.deferred_unlink_wq );
+   rc = runfs_detach_workers_start( &runfs->detach_workers );
+   if( rc != 0 ) {
+      runfs_error("runfs_detach_workers_start rc = %d\n", rc );
+      return rc;
+   }
+   
+   rc = runfs_wq_start( runfs->deferred_unlink_wq );
    if( rc != 0 ) {
-      fprintf(stderr, "runfs_wq_start rc = %d\n", rc );
-      exit(1);
+      runfs_error("runfs_wq_start rc = %d\n", rc );
+      return rc;
    }
    
-   // run 
-   rc = fskit_fuse_main( state, argc, argv );
+   // begin compressing cold files, if asked to 
+   rc = runfs_compactor_start( &runfs->compactor );
+   if( rc != 0 ) {
+      runfs_error("runfs_compactor_start rc = %d\n", rc );
+      return rc;
+   }
    
-   // shutdown
-   fskit_fuse_shutdown( state, NULL );
-   runfs_safe_free( state );
+   return 0;
+}
+
+// stop runfs's background threads that walk the tree.  Call before fskit shuts down.
+// always succeeds
+int runfs_stop( struct runfs_state* runfs ) {
    
-   runfs_wq_stop( runfs.deferred_unlink_wq );
-   runfs_wq_free( runfs.deferred_unlink_wq );
-   runfs_safe_free( runfs.deferred_unlink_wq );
+   runfs_compactor_stop( &runfs->compactor );
    
-   return rc;
+   return 0;
 }
 
+// tear down runfs's state.  fskit must already be shut down, so no handlers are running and every inode has been destroyed.
+// always succeeds
+int runfs_state_free( struct runfs_state* runfs ) {
+   
+   runfs_trace_close();
+   
+   runfs_wq_stop( runfs->deferred_unlink_wq );
+   runfs_detach_workers_stop( &runfs->detach_workers );
+   
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      struct runfs_wq_stats wq_stats;
+      
+      runfs_wq_get_stats( runfs->deferred_unlink_wq, i, &wq_stats );
+      runfs_debug("deferred unlink lane %d: depth=%" PRIu64 " max_depth=%" PRIu64 " added=%" PRIu64 " completed=%" PRIu64 " retried=%" PRIu64 " coalesced=%" PRIu64 " rejected=%" PRIu64 " oldest_age_ms=%" PRIu64 " total_wait_ms=%" PRIu64 "\n",
+                  i, wq_stats.depth, wq_stats.max_depth, wq_stats.num_added, wq_stats.num_completed, wq_stats.num_retried, wq_stats.num_coalesced, wq_stats.num_rejected, wq_stats.oldest_age_ms, wq_stats.total_wait_ms );
+   }
+   runfs_wq_free( runfs->deferred_unlink_wq );
+   runfs_safe_free( runfs->deferred_unlink_wq );
+   
+   runfs_detach_workers_free( &runfs->detach_workers );
+   runfs_detach_pool_free( &runfs->detach_pool );
+   runfs_emergency_free( &runfs->emergency );
+   runfs_events_free( &runfs->events );
+   
+   runfs_debug("stale validity cache: hits=%" PRIu64 " misses=%" PRIu64 "\n", (uint64_t)atomic_load( &runfs->stale.hits ), (uint64_t)atomic_load( &runfs->stale.misses ) );
+   runfs_stale_free( &runfs->stale );
+   runfs_reclaim_free( &runfs->reclaim );
+   
+   runfs_debug("compactor: %" PRIu64 " files compressed, %" PRIu64 " decompressed in %" PRIu64 " ns\n",
+               (uint64_t)atomic_load( &runfs->compactor.num_packed ), (uint64_t)atomic_load( &runfs->compactor.num_unpacked ), (uint64_t)atomic_load( &runfs->compactor.unpack_ns ) );
+   
+   runfs_epoch_shutdown();
+   
+   // the last inodes (and their owner references) were freed by the epoch shutdown
+   runfs_owner_table_free( &runfs->owners );
+   runfs_arena_shutdown();
+   
+   for( int i = 0; i < runfs->policies.num_policies; i++ ) {
+      runfs_debug("profile '%s': %" PRIu64 " bytes still charged\n", runfs->policies.policies[i].prefix, (uint64_t)atomic_load( &runfs->policies.policies[i].used_bytes ) );
+   }
+   runfs_policy_set_free( &runfs->policies );
+   runfs_index_free( &runfs->index );
+   runfs_compactor_free( &runfs->compactor );
+   
+   return 0;
+}
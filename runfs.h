@@ -25,9 +25,25 @@
 #include "fskit/fskit.h"
 #include "fskit/fuse/fskit_fuse.h"
 
+#include "arena.h"
+#include "checkpoint.h"
+#include "compact.h"
+#include "content.h"
+#include "ctl.h"
 #include "deferred.h"
+#include "detach.h"
+#include "events.h"
+#include "index.h"
 #include "inode.h"
+#include "opts.h"
 #include "os.h"
+#include "owner.h"
+#include "policy.h"
+#include "reclaim.h"
+#include "reap.h"
+#include "session.h"
+#include "stale.h"
+#include "trace.h"
 #include "util.h"
 #include "wq.h"
 
@@ -35,6 +51,38 @@ struct runfs_state {
     
     struct fskit_core* core;
     struct runfs_wq* deferred_unlink_wq;
+    
+    int detach_threads;                         // number of threads to use to detach large garbage subtrees
+    struct runfs_detach_pool detach_pool;       // detach contexts held in reserve for when we're out of memory
+    struct runfs_detach_workers detach_workers; // helper threads for detaching large garbage subtrees
+    
+    struct runfs_emergency emergency;           // state for reaping orphans when we run out of memory
+    
+    struct runfs_owner_table owners;            // process groups, sessions and cgroups that own entries
+    
+    struct runfs_events events;                 // stream of create and reap events, read through /.runfs/events
+    
+    struct runfs_stale stale;                   // how long positive validity checks may be trusted
+    
+    struct runfs_policy_set policies;           // per-prefix profiles from --policy
+    
+    struct runfs_index index;                   // inode number to entry, for readdir
+    
+    struct runfs_compactor compactor;           // compresses cold files (--compact-after)
+    
+    atomic_uint_fast64_t bytes_reclaimed;       // total bytes of file contents freed by runfs_destroy
+    atomic_uint_fast64_t entries_reclaimed;     // total inodes freed by runfs_destroy
+    struct runfs_reclaim reclaim;               // how long reaped entries took to be freed, once their owners died
 };
 
+int runfs_state_init( struct runfs_state* runfs, struct runfs_opts* opts );
+int runfs_add_routes( struct runfs_state* runfs );
+int runfs_start( struct runfs_state* runfs );
+int runfs_stop( struct runfs_state* runfs );
+int runfs_state_free( struct runfs_state* runfs );
+
+int runfs_clone( struct runfs_state* runfs, char const* src_path, char const* dst_path, uint64_t uid, uint64_t gid );
+
+void runfs_publish_create( struct runfs_state* runfs, char const* path, int rc );
+
 #endif
\ No newline at end of file
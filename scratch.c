@@ -0,0 +1,79 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "scratch.h"
+
+// this thread's scratch space 
+static __thread struct runfs_scratch* runfs_scratch_self = NULL;
+
+// frees a thread's scratch space when it exits 
+static pthread_key_t runfs_scratch_key;
+static pthread_once_t runfs_scratch_key_once = PTHREAD_ONCE_INIT;
+static int runfs_scratch_key_rc = 0;
+
+// free a thread's scratch space 
+static void runfs_scratch_free( void* arg ) {
+   
+   struct runfs_scratch* scratch = (struct runfs_scratch*)arg;
+   
+   runfs_safe_free( scratch->ps );
+   runfs_safe_free( scratch );
+}
+
+// set up the key that frees scratch space at thread exit 
+static void runfs_scratch_key_init(void) {
+   
+   runfs_scratch_key_rc = -pthread_key_create( &runfs_scratch_key, runfs_scratch_free );
+}
+
+// get this thread's scratch space, allocating it on first use.
+// return a pointer to it on success 
+// return NULL on OOM
+struct runfs_scratch* runfs_scratch_get(void) {
+   
+   struct runfs_scratch* scratch = runfs_scratch_self;
+   
+   if( scratch != NULL ) {
+      return scratch;
+   }
+   
+   pthread_once( &runfs_scratch_key_once, runfs_scratch_key_init );
+   if( runfs_scratch_key_rc != 0 ) {
+      return NULL;
+   }
+   
+   scratch = RUNFS_CALLOC( struct runfs_scratch, 1 );
+   if( scratch == NULL ) {
+      return NULL;
+   }
+   
+   scratch->ps = pstat_new();
+   if( scratch->ps == NULL ) {
+      
+      runfs_safe_free( scratch );
+      return NULL;
+   }
+   
+   pthread_setspecific( runfs_scratch_key, scratch );
+   runfs_scratch_self = scratch;
+   
+   return scratch;
+}
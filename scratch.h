@@ -0,0 +1,41 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_SCRATCH_H_
+#define _RUNFS_SCRATCH_H_
+
+#include "os.h"
+#include "util.h"
+
+#include <pstat/libpstat.h>
+
+// per-thread scratch space for validating entries, so the validation path doesn't allocate.
+// each thread gets its own on first use; it's freed when the thread exits.
+struct runfs_scratch {
+   
+   struct pstat* ps;                    // status of the process being checked
+   char bin_path[PATH_MAX+1];           // its binary's path (RUNFS_VERIFY_PATH only)
+   char inode_path[PATH_MAX+1];         // the creating process's binary's path (RUNFS_VERIFY_PATH only)
+};
+
+struct runfs_scratch* runfs_scratch_get(void);
+
+#endif
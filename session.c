@@ -0,0 +1,530 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "session.h"
+
+#include <fuse_lowlevel.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#ifndef FUSE_DEV_IOC_CLONE
+#define FUSE_DEV_IOC_CLONE      _IOR(229, 0, uint32_t)
+#endif
+
+// a worker thread 
+struct runfs_session_worker {
+   
+   struct runfs_session* session;
+   int id;
+   
+   struct fuse_chan* ch;                // channel to read requests from and reply on (the session's, or a clone)
+   bool cloned;                         // if true, ch is ours to destroy
+   char* buf;                           // request buffer
+   
+   pthread_t thread;
+   
+   struct runfs_session_worker* prev;   // linkage in the session's list of workers
+   struct runfs_session_worker* next;
+};
+
+// a running session 
+struct runfs_session {
+   
+   struct fuse_session* se;
+   struct fuse_chan* master;            // the session's own channel 
+   size_t bufsize;
+   
+   bool clone_fd;                       // give new workers their own channel 
+   bool affinity;                       // pin new workers to CPUs
+   cpu_set_t cpus;                      // CPUs we may run on, from sched_getaffinity()
+   
+   pthread_mutex_t lock;                // guards the fields below 
+   struct runfs_session_worker* workers;        // all workers that haven't exited on their own
+   int num_workers;
+   int num_available;                   // workers waiting for a request 
+   int max_idle;                        // workers beyond this many idle ones exit
+   int next_id;
+   bool exiting;                        // if true, the worker list is frozen for teardown 
+   
+   sem_t finished;                      // posted by each worker that stops because the session ended 
+};
+
+// receive a request on a cloned channel.
+// libfuse's own channel code expects to belong to a session, which clones don't; so they get these instead.
+// return the request length on success 
+// return 0 if the filesystem was unmounted 
+// return -EINTR if interrupted, or the request was aborted before we read it; the caller checks whether the session exited before retrying
+// return -errno on error 
+static int runfs_session_chan_receive( struct fuse_chan** chp, char* buf, size_t size ) {
+   
+   ssize_t nr = read( fuse_chan_fd( *chp ), buf, size );
+   if( nr >= 0 ) {
+      return (int)nr;
+   }
+   
+   if( errno == EINTR || errno == EAGAIN || errno == ENOENT ) {
+      return -EINTR;
+   }
+   
+   if( errno == ENODEV ) {
+      
+      // unmounted 
+      return 0;
+   }
+   
+   return -errno;
+}
+
+// send a reply on a cloned channel 
+// return 0 on success 
+// return -errno on error 
+static int runfs_session_chan_send( struct fuse_chan* ch, const struct iovec iov[], size_t count ) {
+   
+   if( iov == NULL ) {
+      return 0;
+   }
+   
+   ssize_t nw = writev( fuse_chan_fd( ch ), iov, count );
+   if( nw < 0 ) {
+      
+      // ENOENT means the request was interrupted; that's fine 
+      return (errno == ENOENT ? 0 : -errno);
+   }
+   
+   return 0;
+}
+
+// close a cloned channel's fd 
+static void runfs_session_chan_destroy( struct fuse_chan* ch ) {
+   
+   close( fuse_chan_fd( ch ) );
+}
+
+static struct fuse_chan_ops runfs_session_chan_ops = {
+   .receive = runfs_session_chan_receive,
+   .send = runfs_session_chan_send,
+   .destroy = runfs_session_chan_destroy
+};
+
+// clone the session's /dev/fuse fd, so a worker gets its own request queue.
+// return the new channel on success 
+// return NULL if the kernel can't clone (older than 4.2), or we're out of fds or memory
+static struct fuse_chan* runfs_session_clone_chan( struct runfs_session* session ) {
+   
+   uint32_t master_fd = fuse_chan_fd( session->master );
+   
+   int fd = open( "/dev/fuse", O_RDWR | O_CLOEXEC );
+   if( fd < 0 ) {
+      
+      runfs_error("open(/dev/fuse) errno = %d\n", errno );
+      return NULL;
+   }
+   
+   if( ioctl( fd, FUSE_DEV_IOC_CLONE, &master_fd ) != 0 ) {
+      
+      runfs_error("ioctl(FUSE_DEV_IOC_CLONE) errno = %d\n", errno );
+      close( fd );
+      return NULL;
+   }
+   
+   struct fuse_chan* ch = fuse_chan_new( &runfs_session_chan_ops, fd, session->bufsize, NULL );
+   if( ch == NULL ) {
+      
+      close( fd );
+      return NULL;
+   }
+   
+   return ch;
+}
+
+// free a worker that has stopped 
+static void runfs_session_worker_free( struct runfs_session_worker* worker ) {
+   
+   if( worker->cloned ) {
+      fuse_chan_destroy( worker->ch );
+   }
+   
+   runfs_safe_free( worker->buf );
+   runfs_safe_free( worker );
+}
+
+// unlink a worker from its session's list 
+// session->lock must be held
+static void runfs_session_worker_unlink( struct runfs_session* session, struct runfs_session_worker* worker ) {
+   
+   if( worker->prev != NULL ) {
+      worker->prev->next = worker->next;
+   }
+   else {
+      session->workers = worker->next;
+   }
+   
+   if( worker->next != NULL ) {
+      worker->next->prev = worker->prev;
+   }
+   
+   worker->prev = NULL;
+   worker->next = NULL;
+}
+
+static int runfs_session_worker_start( struct runfs_session* session );
+
+// worker thread: receive and process requests until the session ends, or until there are too many idle workers.
+// like libfuse's multithreaded loop, the last worker to pick up a request starts another, so that handlers that
+// block (such as blocking reads of .runfs/events) can't take every worker with them.
+static void* runfs_session_worker_main( void* arg ) {
+   
+   struct runfs_session_worker* worker = (struct runfs_session_worker*)arg;
+   struct runfs_session* session = worker->session;
+   
+   while( !fuse_session_exited( session->se ) ) {
+      
+      struct fuse_buf fbuf;
+      struct fuse_chan* ch = worker->ch;
+      
+      memset( &fbuf, 0, sizeof(fbuf) );
+      fbuf.mem = worker->buf;
+      fbuf.size = session->bufsize;
+      
+      pthread_setcancelstate( PTHREAD_CANCEL_ENABLE, NULL );
+      int res = fuse_session_receive_buf( session->se, &fbuf, &ch );
+      pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL );
+      
+      if( res == -EINTR ) {
+         
+         // the loop condition checks whether we were interrupted because the session exited
+         continue;
+      }
+      
+      if( res <= 0 ) {
+         
+         if( res < 0 ) {
+            runfs_error("worker %d: fuse_session_receive_buf rc = %d\n", worker->id, res );
+         }
+         
+         fuse_session_exit( session->se );
+         break;
+      }
+      
+      pthread_mutex_lock( &session->lock );
+      
+      session->num_available--;
+      if( session->num_available == 0 && session->num_workers < RUNFS_SESSION_MAX_WORKERS && !session->exiting ) {
+         
+         // nobody is left to take the next request 
+         int rc = runfs_session_worker_start( session );
+         if( rc != 0 ) {
+            runfs_error("runfs_session_worker_start rc = %d\n", rc );
+         }
+      }
+      
+      pthread_mutex_unlock( &session->lock );
+      
+      fuse_session_process_buf( session->se, &fbuf, ch );
+      
+      pthread_mutex_lock( &session->lock );
+      
+      session->num_available++;
+      if( session->num_available > session->max_idle && !session->exiting ) {
+         
+         // surplus; nothing touches this worker or the session once it's off the list
+         runfs_session_worker_unlink( session, worker );
+         session->num_available--;
+         session->num_workers--;
+         
+         pthread_mutex_unlock( &session->lock );
+         
+         pthread_detach( pthread_self() );
+         runfs_session_worker_free( worker );
+         return NULL;
+      }
+      
+      pthread_mutex_unlock( &session->lock );
+   }
+   
+   sem_post( &session->finished );
+   return NULL;
+}
+
+// find the CPU to pin a worker to: the (id mod n)th of the n CPUs we're allowed to run on 
+// return the CPU number 
+// return -1 if there are none 
+static int runfs_session_worker_cpu( struct runfs_session* session, int id ) {
+   
+   int num_cpus = CPU_COUNT( &session->cpus );
+   int nth = 0;
+   
+   if( num_cpus <= 0 ) {
+      return -1;
+   }
+   
+   nth = id % num_cpus;
+   
+   for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ ) {
+      
+      if( !CPU_ISSET( cpu, &session->cpus ) ) {
+         continue;
+      }
+      
+      if( nth == 0 ) {
+         return cpu;
+      }
+      
+      nth--;
+   }
+   
+   return -1;
+}
+
+// start a worker, on its own channel if asked and possible, and add it to the session's list 
+// session->lock must be held
+// return 0 on success 
+// return -ENOMEM on OOM 
+// return -errno on failure to start the thread
+static int runfs_session_worker_start( struct runfs_session* session ) {
+   
+   int rc = 0;
+   int id = session->next_id;
+   
+   struct runfs_session_worker* worker = RUNFS_CALLOC( struct runfs_session_worker, 1 );
+   if( worker == NULL ) {
+      return -ENOMEM;
+   }
+   
+   worker->buf = (char*)malloc( session->bufsize );
+   if( worker->buf == NULL ) {
+      
+      runfs_safe_free( worker );
+      return -ENOMEM;
+   }
+   
+   worker->session = session;
+   worker->id = id;
+   worker->ch = session->master;
+   
+   if( session->clone_fd && id > 0 ) {
+      
+      struct fuse_chan* ch = runfs_session_clone_chan( session );
+      if( ch != NULL ) {
+         
+         worker->ch = ch;
+         worker->cloned = true;
+      }
+      else {
+         runfs_debug("worker %d shares the session's /dev/fuse fd\n", id );
+      }
+   }
+   
+   rc = pthread_create( &worker->thread, NULL, runfs_session_worker_main, worker );
+   if( rc != 0 ) {
+      
+      runfs_session_worker_free( worker );
+      return -rc;
+   }
+   
+   session->next_id++;
+   session->num_workers++;
+   session->num_available++;
+   
+   worker->next = session->workers;
+   if( session->workers != NULL ) {
+      session->workers->prev = worker;
+   }
+   session->workers = worker;
+   
+   if( session->affinity ) {
+      
+      int cpu = runfs_session_worker_cpu( session, id );
+      if( cpu >= 0 ) {
+         
+         cpu_set_t cpus;
+         
+         CPU_ZERO( &cpus );
+         CPU_SET( cpu, &cpus );
+         
+         rc = pthread_setaffinity_np( worker->thread, sizeof(cpus), &cpus );
+         if( rc != 0 ) {
+            runfs_error("pthread_setaffinity_np(worker %d) rc = %d\n", id, rc );
+         }
+      }
+   }
+   
+   return 0;
+}
+
+// add the FUSE options our own options imply to argv 
+// return a new, malloc'ed argv (whose strings are argv's, or static) on success 
+// return NULL on OOM
+static char** runfs_session_add_args( int* argc, char** argv, struct runfs_session_opts* opts, char* opt_buf, size_t opt_buf_len ) {
+   
+   size_t len = 0;
+   
+   char** new_argv = RUNFS_CALLOC( char*, *argc + 3 );
+   if( new_argv == NULL ) {
+      return NULL;
+   }
+   
+   memcpy( new_argv, argv, sizeof(char*) * (*argc) );
+   opt_buf[0] = '\0';
+   
+   if( opts->max_io > 0 ) {
+      
+      // libfuse 2 needs big_writes to send more than a page per write
+      len += snprintf( opt_buf + len, opt_buf_len - len, "big_writes,max_write=%zu,max_read=%zu,max_readahead=%zu,", opts->max_io, opts->max_io, opts->max_io );
+   }
+   
+   if( opts->page_cache ) {
+      
+      // keep file contents in the page cache across opens, unless the file's mtime or size changed since.
+      // a write or truncate bumps the mtime, and a reaped-and-recreated file has a new one.
+      len += snprintf( opt_buf + len, opt_buf_len - len, "auto_cache," );
+   }
+   
+   // drop the trailing comma 
+   if( len > 0 ) {
+      opt_buf[ len - 1 ] = '\0';
+   }
+   
+   new_argv[ *argc ] = (char*)"-o";
+   new_argv[ *argc + 1 ] = opt_buf;
+   new_argv[ *argc + 2 ] = NULL;
+   
+   *argc += 2;
+   return new_argv;
+}
+
+// mount and run the filesystem with our own pool of worker threads, instead of libfuse's loop.
+// we start opts->num_threads workers, start more while they're all busy, and let the surplus exit once more than
+// opts->num_threads are idle.  Workers can each get their own /dev/fuse fd (and so their own request queue), and be pinned to CPUs.
+// takes the same arguments as fuse_main().
+// return 0 on clean unmount 
+// return 1 on error
+int runfs_session_main( int argc, char** argv, struct fuse_operations* opers, void* user_data, struct runfs_session_opts* opts ) {
+   
+   int rc = 0;
+   char* mountpoint = NULL;
+   int multithreaded = 0;
+   char** fuse_argv = argv;
+   char fuse_opts[256];
+   struct runfs_session session;
+   
+   memset( &session, 0, sizeof(session) );
+   
+   if( opts->max_io > RUNFS_SESSION_MAX_IO ) {
+      
+      runfs_debug("Capping --max-io at %d bytes\n", RUNFS_SESSION_MAX_IO );
+      opts->max_io = RUNFS_SESSION_MAX_IO;
+   }
+   
+   if( opts->max_io > 0 || opts->page_cache ) {
+      
+      fuse_argv = runfs_session_add_args( &argc, argv, opts, fuse_opts, sizeof(fuse_opts) );
+      if( fuse_argv == NULL ) {
+         return 1;
+      }
+   }
+   
+   if( opts->num_threads <= 0 ) {
+      
+      // libfuse's own loop 
+      rc = fuse_main( argc, fuse_argv, opers, user_data );
+      
+      if( fuse_argv != argv ) {
+         free( fuse_argv );
+      }
+      
+      return rc;
+   }
+   
+   struct fuse* fuse = fuse_setup( argc, fuse_argv, opers, sizeof(struct fuse_operations), &mountpoint, &multithreaded, user_data );
+   
+   if( fuse_argv != argv ) {
+      free( fuse_argv );
+   }
+   
+   if( fuse == NULL ) {
+      return 1;
+   }
+   
+   session.se = fuse_get_session( fuse );
+   session.master = fuse_session_next_chan( session.se, NULL );
+   session.bufsize = fuse_chan_bufsize( session.master );
+   session.clone_fd = opts->clone_fd;
+   session.affinity = opts->affinity;
+   session.max_idle = opts->num_threads;
+   
+   pthread_mutex_init( &session.lock, NULL );
+   sem_init( &session.finished, 0, 0 );
+   
+   if( opts->affinity && sched_getaffinity( 0, sizeof(session.cpus), &session.cpus ) != 0 ) {
+      
+      runfs_error("sched_getaffinity errno = %d\n", errno );
+      session.affinity = false;
+   }
+   
+   pthread_mutex_lock( &session.lock );
+   
+   for( int i = 0; i < opts->num_threads; i++ ) {
+      
+      rc = runfs_session_worker_start( &session );
+      if( rc != 0 ) {
+         
+         runfs_error("runfs_session_worker_start(%d) rc = %d\n", i, rc );
+         fuse_session_exit( session.se );
+         break;
+      }
+   }
+   
+   pthread_mutex_unlock( &session.lock );
+   
+   // wait for a signal (handled by libfuse, which exits the session) or for a worker to notice the unmount 
+   while( !fuse_session_exited( session.se ) ) {
+      sem_wait( &session.finished );
+   }
+   
+   // freeze the worker list: no more start, and none leave on their own.
+   // workers blocked reading requests won't notice on their own.
+   pthread_mutex_lock( &session.lock );
+   
+   session.exiting = true;
+   
+   for( struct runfs_session_worker* worker = session.workers; worker != NULL; worker = worker->next ) {
+      pthread_cancel( worker->thread );
+   }
+   
+   pthread_mutex_unlock( &session.lock );
+   
+   while( session.workers != NULL ) {
+      
+      struct runfs_session_worker* worker = session.workers;
+      session.workers = worker->next;
+      
+      pthread_join( worker->thread, NULL );
+      runfs_session_worker_free( worker );
+   }
+   
+   pthread_mutex_destroy( &session.lock );
+   sem_destroy( &session.finished );
+   
+   fuse_teardown( fuse, mountpoint );
+   
+   return (rc == 0 ? 0 : 1);
+}
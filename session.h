@@ -0,0 +1,48 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_SESSION_H_
+#define _RUNFS_SESSION_H_
+
+#include "os.h"
+#include "util.h"
+
+#include "fskit/fuse/fskit_fuse.h"
+
+// largest request payload libfuse 2 can take: its channel buffers are 128KiB plus a page for the header 
+#define RUNFS_SESSION_MAX_IO            131072
+
+// most worker threads a session will run at once
+#define RUNFS_SESSION_MAX_WORKERS       1024
+
+// how to run the FUSE session.  With no threads, runfs uses libfuse's own loop.
+struct runfs_session_opts {
+   
+   int num_threads;                     // worker threads to start, and to keep idle (--threads=N), or 0 for libfuse's default loop
+   bool clone_fd;                       // give each worker its own /dev/fuse fd, cloned from the session's (--clone-fd)
+   bool affinity;                       // pin worker i to the ith CPU we may run on (mod their number) (--affinity)
+   size_t max_io;                       // largest read and write to ask the kernel for (--max-io=BYTES), or 0 for the default
+   bool page_cache;                     // serve repeated reads of unchanged files from the kernel's page cache (--page-cache)
+};
+
+int runfs_session_main( int argc, char** argv, struct fuse_operations* opers, void* user_data, struct runfs_session_opts* opts );
+
+#endif
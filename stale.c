@@ -0,0 +1,135 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "stale.h"
+
+// set up staleness budgets (none, to start)
+// always succeeds
+int runfs_stale_init( struct runfs_stale* stale ) {
+   
+   memset( stale, 0, sizeof(struct runfs_stale) );
+   
+   atomic_init( &stale->hits, 0 );
+   atomic_init( &stale->misses, 0 );
+   
+   return 0;
+}
+
+// free up staleness budgets 
+// always succeeds
+int runfs_stale_free( struct runfs_stale* stale ) {
+   
+   for( int i = 0; i < stale->num_rules; i++ ) {
+      runfs_safe_free( stale->rules[i].prefix );
+   }
+   
+   runfs_safe_free( stale->rules );
+   stale->num_rules = 0;
+   
+   return 0;
+}
+
+// add a staleness budget.  spec is either "$MS" (the default for the mount), or "$PREFIX:$MS" (for paths under $PREFIX)
+// return 0 on success 
+// return -EINVAL if spec is malformed 
+// return -ENOMEM on OOM
+int runfs_stale_add( struct runfs_stale* stale, char const* spec ) {
+   
+   char* end = NULL;
+   char const* ttl_str = spec;
+   char const* sep = strrchr( spec, ':' );
+   
+   if( sep != NULL ) {
+      ttl_str = sep + 1;
+   }
+   
+   long ttl_ms = strtol( ttl_str, &end, 10 );
+   if( *ttl_str == '\0' || *end != '\0' || ttl_ms < 0 || ttl_ms > UINT32_MAX ) {
+      return -EINVAL;
+   }
+   
+   if( sep == NULL ) {
+      
+      stale->default_ttl_ms = ttl_ms;
+      return 0;
+   }
+   
+   if( spec[0] != '/' ) {
+      return -EINVAL;
+   }
+   
+   struct runfs_stale_rule* tmp = (struct runfs_stale_rule*)realloc( stale->rules, sizeof(struct runfs_stale_rule) * (stale->num_rules + 1) );
+   if( tmp == NULL ) {
+      return -ENOMEM;
+   }
+   
+   stale->rules = tmp;
+   
+   struct runfs_stale_rule* rule = &stale->rules[ stale->num_rules ];
+   
+   rule->prefix = strndup( spec, sep - spec );
+   if( rule->prefix == NULL ) {
+      return -ENOMEM;
+   }
+   
+   rule->prefix_len = sep - spec;
+   rule->ttl_ms = ttl_ms;
+   
+   stale->num_rules++;
+   return 0;
+}
+
+// how stale may a positive validity check on the given path be?
+// return the TTL in milliseconds (0 to always revalidate)
+uint32_t runfs_stale_get_ttl( struct runfs_stale* stale, char const* path ) {
+   
+   uint32_t ttl_ms = stale->default_ttl_ms;
+   size_t best_len = 0;
+   
+   for( int i = 0; i < stale->num_rules; i++ ) {
+      
+      struct runfs_stale_rule* rule = &stale->rules[i];
+      
+      if( rule->prefix_len < best_len || strncmp( path, rule->prefix, rule->prefix_len ) != 0 ) {
+         continue;
+      }
+      
+      // match whole path components only
+      if( path[ rule->prefix_len ] != '\0' && path[ rule->prefix_len ] != '/' && rule->prefix[ rule->prefix_len - 1 ] != '/' ) {
+         continue;
+      }
+      
+      best_len = rule->prefix_len;
+      ttl_ms = rule->ttl_ms;
+   }
+   
+   return ttl_ms;
+}
+
+// current time in milliseconds, from a clock that is cheap to read and never jumps 
+// (CLOCK_MONOTONIC_COARSE, which is only as precise as the scheduler tick)
+uint64_t runfs_stale_now_ms( void ) {
+   
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+   
+   return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
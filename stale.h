@@ -0,0 +1,55 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_STALE_H_
+#define _RUNFS_STALE_H_
+
+#include "os.h"
+#include "util.h"
+
+// how stale a positive validity check may get before it's redone.
+// a per-mount default, plus per-path-prefix overrides (longest prefix wins).
+struct runfs_stale_rule {
+   
+   char* prefix;
+   size_t prefix_len;
+   uint32_t ttl_ms;
+};
+
+struct runfs_stale {
+   
+   uint32_t default_ttl_ms;                     // 0 means always revalidate 
+   
+   struct runfs_stale_rule* rules;
+   int num_rules;
+   
+   atomic_uint_fast64_t hits;                   // validity checks answered from the cache 
+   atomic_uint_fast64_t misses;                 // validity checks that had to probe the owner (with a nonzero TTL)
+};
+
+int runfs_stale_init( struct runfs_stale* stale );
+int runfs_stale_free( struct runfs_stale* stale );
+int runfs_stale_add( struct runfs_stale* stale, char const* spec );
+
+uint32_t runfs_stale_get_ttl( struct runfs_stale* stale, char const* path );
+uint64_t runfs_stale_now_ms( void );
+
+#endif
@@ -0,0 +1,39 @@
+#!/usr/bin/python
+
+# Measure how fast a log-style writer can append to a file.
+# Appends records of each size to a fresh file, one write per record, and
+# reads the file back to check it.  Run it once with runfs's defaults and
+# once with --max-io (or --page-cache) to compare.
+#
+# usage: bench_append.py /path/to/dir [num appends]
+
+import sys
+import os
+import time
+
+dir_path = sys.argv[1]
+num_appends = 100000
+
+if len(sys.argv) > 2:
+    num_appends = int(sys.argv[2])
+
+for record_len in [1, 100, 4096]:
+    path = os.path.join(dir_path, "append-%d" % record_len)
+    record = "x" * (record_len - 1) + "\n"
+
+    fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC | os.O_APPEND, 0644)
+
+    start = time.time()
+    for i in xrange(0, num_appends):
+        os.write(fd, record)
+
+    elapsed = time.time() - start
+    os.close(fd)
+
+    size = os.stat(path).st_size
+    if size != record_len * num_appends:
+        print "%d-byte appends: expected %d bytes, got %d" % (record_len, record_len * num_appends, size)
+        sys.exit(1)
+
+    print "%d-byte appends: %d in %.3f seconds (%.0f appends/sec, %.1f MB/sec)" % (record_len, num_appends, elapsed, num_appends / elapsed, size / elapsed / 1e6)
+    os.unlink(path)
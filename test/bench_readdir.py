@@ -0,0 +1,37 @@
+#!/usr/bin/python
+
+# Measure how long it takes to list a large directory.
+# Creates the files, then lists the directory several times.  Every listing
+# checks every file, so keep this process alive until it's done.
+#
+# usage: bench_readdir.py /path/to/dir [num files] [num listings]
+
+import sys
+import os
+import time
+
+dir_path = sys.argv[1]
+num_files = 100000
+num_listings = 5
+
+if len(sys.argv) > 2:
+    num_files = int(sys.argv[2])
+
+if len(sys.argv) > 3:
+    num_listings = int(sys.argv[3])
+
+start = time.time()
+for i in xrange(0, num_files):
+    fd = open(os.path.join(dir_path, "entry-%d" % i), "w")
+    fd.close()
+
+print "created %d files in %.2f seconds" % (num_files, time.time() - start)
+
+for i in xrange(0, num_listings):
+    start = time.time()
+    names = os.listdir(dir_path)
+    elapsed = time.time() - start
+    print "listing %d: %d entries in %.3f seconds (%.0f entries/sec)" % (i, len(names), elapsed, len(names) / elapsed)
+
+for i in xrange(0, num_files):
+    os.unlink(os.path.join(dir_path, "entry-%d" % i))
@@ -0,0 +1,51 @@
+#!/usr/bin/python
+
+# Measure sequential write and read throughput on one large file.
+# Writes the file in 1MiB chunks, reads it back twice, then removes it.  Run
+# it against runfs started with --hugepages=none and with --hugepages=thp (or
+# hugetlb) to compare.
+#
+# usage: bench_seqio.py /path/to/dir [file size in MiB]
+
+import sys
+import os
+import time
+
+dir_path = sys.argv[1]
+size_mb = 1024
+
+if len(sys.argv) > 2:
+    size_mb = int(sys.argv[2])
+
+chunk = "x" * (1024 * 1024)
+path = os.path.join(dir_path, "seqio")
+
+fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0644)
+
+start = time.time()
+for i in xrange(0, size_mb):
+    os.write(fd, chunk)
+
+elapsed = time.time() - start
+os.close(fd)
+
+print "write: %d MiB in %.3f seconds (%.1f MiB/sec)" % (size_mb, elapsed, size_mb / elapsed)
+
+for i in xrange(0, 2):
+    fd = os.open(path, os.O_RDONLY)
+
+    start = time.time()
+    num_read = 0
+    while True:
+        buf = os.read(fd, len(chunk))
+        if len(buf) == 0:
+            break
+
+        num_read += len(buf)
+
+    elapsed = time.time() - start
+    os.close(fd)
+
+    print "read %d: %d MiB in %.3f seconds (%.1f MiB/sec)" % (i, num_read / (1024 * 1024), elapsed, num_read / (1024.0 * 1024.0) / elapsed)
+
+os.unlink(path)
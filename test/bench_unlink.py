@@ -0,0 +1,43 @@
+#!/usr/bin/python
+
+# Measure how long it takes to remove large files.
+# Creates a number of large files, then unlinks them one by one and reports the
+# slowest and average unlink.  Freeing (and scrubbing) the contents happens in
+# the background, so unlinks should be fast regardless of the file size.
+#
+# usage: bench_unlink.py /path/to/dir [number of files] [file size in MiB]
+
+import sys
+import os
+import time
+
+dir_path = sys.argv[1]
+num_files = 8
+size_mb = 256
+
+if len(sys.argv) > 2:
+    num_files = int(sys.argv[2])
+
+if len(sys.argv) > 3:
+    size_mb = int(sys.argv[3])
+
+chunk = "x" * (1024 * 1024)
+paths = []
+
+for i in xrange(0, num_files):
+    path = os.path.join(dir_path, "unlink-%d" % i)
+    fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0644)
+
+    for j in xrange(0, size_mb):
+        os.write(fd, chunk)
+
+    os.close(fd)
+    paths.append(path)
+
+times = []
+for path in paths:
+    start = time.time()
+    os.unlink(path)
+    times.append(time.time() - start)
+
+print "unlink: %d files of %d MiB, slowest %.3f ms, average %.3f ms" % (num_files, size_mb, max(times) * 1000, sum(times) / len(times) * 1000)
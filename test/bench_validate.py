@@ -0,0 +1,63 @@
+#!/usr/bin/python
+
+# Measure how many validations per second runfs can do.
+# Creates some files, then stat()s them in a loop for a while.  Run runfs
+# without --stale-ttl (or with --stale-ttl=0), so that every stat() checks
+# the creating process.  Compare the results before and after a change to
+# the validation path.
+#
+# usage: bench_validate.py /path/to/dir [num files] [seconds] [num threads]
+
+import sys
+import os
+import time
+import threading
+
+dir_path = sys.argv[1]
+num_files = 64
+duration = 5.0
+num_threads = 1
+
+if len(sys.argv) > 2:
+    num_files = int(sys.argv[2])
+
+if len(sys.argv) > 3:
+    duration = float(sys.argv[3])
+
+if len(sys.argv) > 4:
+    num_threads = int(sys.argv[4])
+
+paths = []
+for i in xrange(0, num_files):
+    path = os.path.join(dir_path, "validate-%d" % i)
+    fd = open(path, "w")
+    fd.write("%d\n" % os.getpid())
+    fd.close()
+    paths.append(path)
+
+counts = [0] * num_threads
+
+def stat_loop(idx):
+    count = 0
+    deadline = time.time() + duration
+    while time.time() < deadline:
+        for path in paths:
+            os.stat(path)
+        count += len(paths)
+
+    counts[idx] = count
+
+threads = []
+for i in xrange(0, num_threads):
+    t = threading.Thread(target=stat_loop, args=(i,))
+    threads.append(t)
+    t.start()
+
+for t in threads:
+    t.join()
+
+total = sum(counts)
+print "%d validations in %.1f seconds (%d threads): %.0f/sec" % (total, duration, num_threads, total / duration)
+
+for path in paths:
+    os.unlink(path)
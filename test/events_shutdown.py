@@ -0,0 +1,83 @@
+#!/usr/bin/python
+
+# Check that runfs shuts down while a reader is blocked on its event stream, with
+# libfuse's loop and with runfs's own workers: block a reader on .runfs/events,
+# signal runfs to unmount, and check that runfs exits and the reader sees EOF.
+#
+# usage: events_shutdown.py /path/to/runfs /path/to/mountpoint
+
+import sys
+import os
+import time
+import signal
+import threading
+import subprocess
+
+runfs_path = sys.argv[1]
+mountpoint = sys.argv[2]
+
+def run( extra_args ):
+
+    name = " ".join( extra_args ) or "libfuse loop"
+    runfs = subprocess.Popen( [runfs_path, "-f"] + extra_args + [mountpoint] )
+
+    deadline = time.time() + 10
+    while not os.path.ismount( mountpoint ):
+        if time.time() > deadline:
+            print("FAIL (%s): runfs did not mount" % name)
+            runfs.kill()
+            return 1
+
+        time.sleep(0.1)
+
+    result = {}
+
+    def reader():
+        fd = os.open( os.path.join( mountpoint, ".runfs/events" ), os.O_RDONLY )
+        try:
+            result["data"] = os.read( fd, 65536 )
+        except OSError as e:
+            result["errno"] = e.errno
+
+        os.close( fd )
+
+    t = threading.Thread( target=reader )
+    t.daemon = True
+    t.start()
+
+    # let it block
+    time.sleep(1)
+    if not t.is_alive():
+        print("FAIL (%s): reader didn't block: %s" % (name, result))
+        runfs.kill()
+        subprocess.call( ["fusermount", "-u", "-z", mountpoint] )
+        return 1
+
+    # what ^C or systemd would do
+    runfs.send_signal( signal.SIGTERM )
+
+    deadline = time.time() + 10
+    while runfs.poll() is None and time.time() < deadline:
+        time.sleep(0.1)
+
+    if runfs.poll() is None:
+        print("FAIL (%s): runfs hung on shutdown with a blocked reader" % name)
+        runfs.kill()
+        runfs.wait()
+        subprocess.call( ["fusermount", "-u", "-z", mountpoint] )
+        return 1
+
+    t.join(5)
+    if t.is_alive():
+        print("FAIL (%s): reader is still blocked after runfs exited" % name)
+        return 1
+
+    print("OK (%s): runfs exited; reader got %s" % (name, result))
+    return 0
+
+rc = 0
+rc |= run( [] )
+rc |= run( ["--threads=2"] )
+rc |= run( ["--threads=2", "--clone-fd"] )
+
+sys.exit(rc)
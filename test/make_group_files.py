@@ -0,0 +1,34 @@
+#!/usr/bin/python
+
+# Make files from several short-lived children of one process group, and wait.
+# Run runfs with --owner=pgrp: the files should outlive the children, and
+# disappear once this process (the group leader) exits.
+#
+# usage: make_group_files.py /path/to/dir [num children]
+
+import sys
+import os
+import time
+
+dir_path = sys.argv[1]
+num_children = 16
+
+if len(sys.argv) > 2:
+    num_children = int(sys.argv[2])
+
+os.setpgid(0, 0)
+
+for i in xrange(0, num_children):
+    pid = os.fork()
+    if pid == 0:
+        fd = open(os.path.join(dir_path, "child-%d" % i), "w")
+        fd.write("%d\n" % os.getpid())
+        fd.close()
+        os._exit(0)
+
+    os.waitpid(pid, 0)
+
+print "%d files written by exited children; ls %s should still show them until we die..." % (num_children, dir_path)
+
+while True:
+    time.sleep(1)
@@ -0,0 +1,639 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// stress runfs's reaping: fork thousands of creator processes, create files and directories on their behalf
+// against runfs's handlers on an in-process fskit core, kill most of them at random points (including while their
+// files are being written and their directories listed), and check that every dead creator's entries get reaped,
+// that no live creator's entries do, and that every inode created is freed by the end.
+//
+// usage: runfs_stress [runfs options] [creators [threads [kill percent [fault rate]]]]
+//
+// a fault rate of N makes roughly one in N of runfs's allocations fail while a creator's operations run
+// (0, the default, injects no faults).  Build with 'make ASAN=1' to have LeakSanitizer check for leaks at exit.
+// exits 0 if every check passed, and 1 otherwise.
+
+#include "runfs.h"
+
+#include <sys/wait.h>
+
+#define STRESS_FILES_PER_CREATOR        8
+#define STRESS_MAX_WRITE_LEN            (256 * 1024)
+#define STRESS_WRITE_CHUNK_LEN          4096
+#define STRESS_REAP_ROUNDS              100
+#define STRESS_FLUSH_TIMEOUT_MS         1000
+
+// one process that owns entries 
+struct stress_creator {
+   
+   pid_t pid;
+   bool doomed;                         // will be killed before the end 
+   atomic_bool started;                 // pid is set 
+   atomic_bool dead;                    // killed, and waited for 
+   
+   // entries successfully created.  Only the creator's worker touches these until the workers are done.
+   char* paths[ STRESS_FILES_PER_CREATOR + 1 ];
+   int num_paths;
+};
+
+static struct runfs_state runfs;
+static struct stress_creator* creators = NULL;
+static int num_creators = 1000;
+static int num_threads = 8;
+static int kill_percent = 90;
+static unsigned int fault_rate = 0;
+
+static int creator_pipe[2] = { -1, -1 };    // creators block reading this until we exit 
+
+static atomic_int next_creator;
+static atomic_bool workers_done;
+static atomic_uint_fast64_t num_created;
+static atomic_uint_fast64_t num_faults;
+static atomic_uint_fast64_t num_failed_ops;
+
+// fault injection: runfs's allocations are routed through these (see the Makefile's --wrap flags)
+static __thread bool stress_faults_enabled = false;
+static __thread unsigned int stress_fault_seed = 0;
+
+void* __real_malloc( size_t len );
+void* __real_calloc( size_t nmemb, size_t len );
+void* __real_realloc( void* ptr, size_t len );
+char* __real_strdup( char const* str );
+
+// should this allocation fail?
+static bool stress_fault( void ) {
+   
+   if( !stress_faults_enabled || fault_rate == 0 ) {
+      return false;
+   }
+   
+   if( (unsigned int)rand_r( &stress_fault_seed ) % fault_rate != 0 ) {
+      return false;
+   }
+   
+   atomic_fetch_add( &num_faults, 1 );
+   return true;
+}
+
+void* __wrap_malloc( size_t len ) {
+   
+   if( stress_fault() ) {
+      return NULL;
+   }
+   
+   return __real_malloc( len );
+}
+
+void* __wrap_calloc( size_t nmemb, size_t len ) {
+   
+   if( stress_fault() ) {
+      return NULL;
+   }
+   
+   return __real_calloc( nmemb, len );
+}
+
+void* __wrap_realloc( void* ptr, size_t len ) {
+   
+   if( stress_fault() ) {
+      return NULL;
+   }
+   
+   return __real_realloc( ptr, len );
+}
+
+char* __wrap_strdup( char const* str ) {
+   
+   if( stress_fault() ) {
+      return NULL;
+   }
+   
+   return __real_strdup( str );
+}
+
+// remember an entry a creator made 
+static void stress_creator_add_path( struct stress_creator* creator, char const* path ) {
+   
+   char* path_dup = __real_strdup( path );
+   if( path_dup == NULL ) {
+      
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+   }
+   
+   creator->paths[ creator->num_paths ] = path_dup;
+   creator->num_paths++;
+   
+   atomic_fetch_add( &num_created, 1 );
+}
+
+// list a directory, which reaps the entries of dead creators in it 
+static int stress_listdir( char const* path ) {
+   
+   int rc = 0;
+   uint64_t num_dirents = 0;
+   
+   struct fskit_dir_handle* dh = fskit_opendir( runfs.core, path, 0, 0, &rc );
+   if( dh == NULL ) {
+      return rc;
+   }
+   
+   struct fskit_dir_entry** dirents = fskit_listdir( runfs.core, dh, &num_dirents, &rc );
+   if( dirents != NULL ) {
+      fskit_dir_entry_free_list( dirents );
+   }
+   
+   fskit_closedir( runfs.core, dh );
+   return rc;
+}
+
+// create and fill one file in small writes, so creators get killed mid-write 
+// return 0 on success
+// return -errno on failure
+static int stress_write_file( struct stress_creator* creator, char const* path, char const* buf, size_t len ) {
+   
+   int rc = 0;
+   
+   struct fskit_file_handle* fh = fskit_create( runfs.core, path, 0, 0, 0644, &rc );
+   if( fh == NULL ) {
+      return rc;
+   }
+   
+   // it exists now, so it has to be reaped, however the writes go
+   stress_creator_add_path( creator, path );
+   
+   for( size_t off = 0; off < len; off += STRESS_WRITE_CHUNK_LEN ) {
+      
+      ssize_t nw = fskit_write( runfs.core, fh, buf, STRESS_WRITE_CHUNK_LEN, off );
+      if( nw < 0 ) {
+         
+         rc = (int)nw;
+         break;
+      }
+   }
+   
+   fskit_close( runfs.core, fh );
+   return rc;
+}
+
+// make a creator's entries: a directory of files, listed now and then 
+static void stress_creator_run( struct stress_creator* creator, int idx, char const* buf, unsigned int* seed ) {
+   
+   int rc = 0;
+   char dir_path[ PATH_MAX ];
+   char file_path[ PATH_MAX ];
+   
+   snprintf( dir_path, PATH_MAX, "/c%d", idx );
+   
+   runfs_ctl_set_owner( creator->pid );
+   stress_faults_enabled = true;
+   
+   rc = fskit_mkdir( runfs.core, dir_path, 0755, 0, 0 );
+   if( rc != 0 ) {
+      
+      // killed already, or an injected fault 
+      atomic_fetch_add( &num_failed_ops, 1 );
+      
+      stress_faults_enabled = false;
+      runfs_ctl_set_owner( 0 );
+      return;
+   }
+   
+   stress_creator_add_path( creator, dir_path );
+   
+   for( int i = 0; i < STRESS_FILES_PER_CREATOR; i++ ) {
+      
+      snprintf( file_path, PATH_MAX, "%s/f%d", dir_path, i );
+      
+      rc = stress_write_file( creator, file_path, buf, (rand_r( seed ) % STRESS_MAX_WRITE_LEN) + 1 );
+      if( rc != 0 ) {
+         atomic_fetch_add( &num_failed_ops, 1 );
+      }
+      
+      if( rand_r( seed ) % 4 == 0 ) {
+         stress_listdir( dir_path );
+      }
+      
+      if( rand_r( seed ) % 16 == 0 ) {
+         stress_listdir( "/" );
+      }
+   }
+   
+   stress_faults_enabled = false;
+   runfs_ctl_set_owner( 0 );
+}
+
+// worker thread: start creators, and make their entries 
+static void* stress_worker_main( void* arg ) {
+   
+   unsigned int seed = (unsigned int)(uintptr_t)arg;
+   char* buf = (char*)__real_malloc( STRESS_MAX_WRITE_LEN + STRESS_WRITE_CHUNK_LEN );
+   
+   if( buf == NULL ) {
+      
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+   }
+   
+   memset( buf, 'x', STRESS_MAX_WRITE_LEN + STRESS_WRITE_CHUNK_LEN );
+   stress_fault_seed = seed;
+   
+   while( true ) {
+      
+      int idx = atomic_fetch_add( &next_creator, 1 );
+      if( idx >= num_creators ) {
+         break;
+      }
+      
+      struct stress_creator* creator = &creators[idx];
+      
+      pid_t pid = fork();
+      if( pid < 0 ) {
+         
+         fprintf(stderr, "fork: %s\n", strerror( errno ) );
+         exit(1);
+      }
+      
+      if( pid == 0 ) {
+         
+         // creator: live until killed, or until we exit and the last write end closes.
+         // (PR_SET_PDEATHSIG would fire as soon as this worker thread exits, not the process.)
+         char c = 0;
+         
+         close( creator_pipe[1] );
+         while( read( creator_pipe[0], &c, 1 ) < 0 && errno == EINTR ) {
+            continue;
+         }
+         
+         _exit(0);
+      }
+      
+      creator->pid = pid;
+      atomic_store( &creator->started, true );
+      
+      stress_creator_run( creator, idx, buf, &seed );
+   }
+   
+   free( buf );
+   return NULL;
+}
+
+// kill a creator, and wait for it to go away 
+static void stress_kill( struct stress_creator* creator ) {
+   
+   bool dead = false;
+   
+   if( !atomic_compare_exchange_strong( &creator->dead, &dead, true ) ) {
+      return;
+   }
+   
+   kill( creator->pid, SIGKILL );
+   waitpid( creator->pid, NULL, 0 );
+}
+
+// killer thread: kill doomed creators at random points while the workers run 
+static void* stress_killer_main( void* arg ) {
+   
+   unsigned int seed = (unsigned int)(uintptr_t)arg;
+   
+   while( !atomic_load( &workers_done ) ) {
+      
+      int started = atomic_load( &next_creator );
+      if( started > num_creators ) {
+         started = num_creators;
+      }
+      
+      if( started > 0 ) {
+         
+         struct stress_creator* creator = &creators[ rand_r( &seed ) % started ];
+         
+         if( creator->doomed && atomic_load( &creator->started ) ) {
+            stress_kill( creator );
+         }
+      }
+      
+      usleep( rand_r( &seed ) % 200 );
+   }
+   
+   return NULL;
+}
+
+// does an entry exist?  Looks it up in fskit directly, so runfs doesn't get a chance to reap it.
+static bool stress_exists( char const* path ) {
+   
+   int rc = 0;
+   
+   struct fskit_entry* fent = fskit_entry_resolve_path( runfs.core, path, 0, 0, false, &rc );
+   if( fent == NULL ) {
+      return false;
+   }
+   
+   fskit_entry_unlock( fent );
+   return true;
+}
+
+// count the entries of dead (or, if live is set, live) creators that still exist 
+static uint64_t stress_count_existing( bool live ) {
+   
+   uint64_t count = 0;
+   
+   for( int i = 0; i < num_creators; i++ ) {
+      
+      if( atomic_load( &creators[i].dead ) == live ) {
+         continue;
+      }
+      
+      for( int j = 0; j < creators[i].num_paths; j++ ) {
+         
+         if( stress_exists( creators[i].paths[j] ) ) {
+            count++;
+         }
+      }
+   }
+   
+   return count;
+}
+
+// sweep and drain the deferred unlink queue until every dead creator's entries are gone, or we give up 
+// return how many dead creators' entries are left 
+static uint64_t stress_reap( void ) {
+   
+   uint64_t left = 0;
+   
+   for( int i = 0; i < STRESS_REAP_ROUNDS; i++ ) {
+      
+      runfs_sweep( &runfs, INT_MAX );
+      runfs_wq_flush( runfs.deferred_unlink_wq, STRESS_FLUSH_TIMEOUT_MS );
+      
+      left = stress_count_existing( false );
+      if( left == 0 ) {
+         break;
+      }
+      
+      // some may be waiting out a retry backoff 
+      usleep( 10000 );
+   }
+   
+   return left;
+}
+
+// reap everything the dead creators left behind, and report how fast it went 
+// return how many dead creators' entries are left 
+static uint64_t stress_reap_timed( char const* phase ) {
+   
+   uint64_t entries_before = atomic_load( &runfs.entries_reclaimed );
+   uint64_t bytes_before = atomic_load( &runfs.bytes_reclaimed );
+   uint64_t start_ns = runfs_trace_now_ns();
+   
+   uint64_t left = stress_reap();
+   
+   double elapsed = (double)(runfs_trace_now_ns() - start_ns) / 1e9;
+   uint64_t entries = atomic_load( &runfs.entries_reclaimed ) - entries_before;
+   uint64_t bytes = atomic_load( &runfs.bytes_reclaimed ) - bytes_before;
+   
+   printf("%s: reaped %" PRIu64 " entries (%.1f MiB) in %.3f seconds: %.0f entries/sec, %.1f MiB/sec\n",
+          phase, entries, (double)bytes / (1024.0 * 1024.0), elapsed, entries / elapsed, (double)bytes / (1024.0 * 1024.0) / elapsed );
+   
+   return left;
+}
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   int failures = 0;
+   struct runfs_opts opts;
+   pthread_t* workers = NULL;
+   pthread_t killer;
+   
+   rc = runfs_opts_parse( &opts, &argc, argv );
+   if( rc != 0 || argc > 5 ) {
+      
+      fprintf(stderr, "Usage: %s [runfs options] [creators [threads [kill percent [fault rate]]]]\n", argv[0] );
+      runfs_opts_usage( argv[0] );
+      exit(1);
+   }
+   
+   if( argc > 1 ) {
+      num_creators = atoi( argv[1] );
+   }
+   
+   if( argc > 2 ) {
+      num_threads = atoi( argv[2] );
+   }
+   
+   if( argc > 3 ) {
+      kill_percent = atoi( argv[3] );
+   }
+   
+   if( argc > 4 ) {
+      fault_rate = (unsigned int)atoi( argv[4] );
+   }
+   
+   if( num_creators < 1 || num_threads < 1 || kill_percent < 0 || kill_percent > 100 ) {
+      
+      fprintf(stderr, "Invalid arguments\n");
+      exit(1);
+   }
+   
+   // don't trace the stress test 
+   opts.trace_path = NULL;
+   
+   creators = RUNFS_CALLOC( struct stress_creator, num_creators );
+   workers = RUNFS_CALLOC( pthread_t, num_threads );
+   if( creators == NULL || workers == NULL ) {
+      exit(1);
+   }
+   
+   if( pipe( creator_pipe ) != 0 ) {
+      
+      fprintf(stderr, "pipe: %s\n", strerror( errno ) );
+      exit(1);
+   }
+   
+   srand( getpid() );
+   
+   for( int i = 0; i < num_creators; i++ ) {
+      
+      creators[i].doomed = (rand() % 100 < kill_percent);
+   }
+   
+   // set up runfs on a bare fskit core 
+   rc = fskit_library_init();
+   if( rc != 0 ) {
+      fprintf(stderr, "fskit_library_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   rc = runfs_state_init( &runfs, &opts );
+   if( rc != 0 ) {
+      fprintf(stderr, "runfs_state_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   struct fskit_core* core = fskit_core_new();
+   if( core == NULL ) {
+      exit(1);
+   }
+   
+   rc = fskit_core_init( core, &runfs );
+   if( rc != 0 ) {
+      fprintf(stderr, "fskit_core_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   runfs.core = core;
+   
+   rc = runfs_add_routes( &runfs );
+   if( rc != 0 ) {
+      exit(1);
+   }
+   
+   rc = runfs_start( &runfs );
+   if( rc != 0 ) {
+      exit(1);
+   }
+   
+   // go!
+   printf("%d creators, %d threads, killing %d%%, fault rate %u\n", num_creators, num_threads, kill_percent, fault_rate );
+   
+   uint64_t start_ns = runfs_trace_now_ns();
+   
+   for( int i = 0; i < num_threads; i++ ) {
+      
+      rc = pthread_create( &workers[i], NULL, stress_worker_main, (void*)(uintptr_t)(rand() + 1) );
+      if( rc != 0 ) {
+         fprintf(stderr, "pthread_create rc = %d\n", rc );
+         exit(1);
+      }
+   }
+   
+   rc = pthread_create( &killer, NULL, stress_killer_main, (void*)(uintptr_t)(rand() + 1) );
+   if( rc != 0 ) {
+      fprintf(stderr, "pthread_create rc = %d\n", rc );
+      exit(1);
+   }
+   
+   for( int i = 0; i < num_threads; i++ ) {
+      pthread_join( workers[i], NULL );
+   }
+   
+   atomic_store( &workers_done, true );
+   pthread_join( killer, NULL );
+   
+   printf("created %" PRIu64 " entries in %.3f seconds; %" PRIu64 " operations failed, %" PRIu64 " faults injected\n",
+          (uint64_t)atomic_load( &num_created ), (double)(runfs_trace_now_ns() - start_ns) / 1e9,
+          (uint64_t)atomic_load( &num_failed_ops ), (uint64_t)atomic_load( &num_faults ) );
+   
+   // kill the rest of the doomed, and check that only their entries go away 
+   for( int i = 0; i < num_creators; i++ ) {
+      
+      if( creators[i].doomed ) {
+         stress_kill( &creators[i] );
+      }
+   }
+   
+   uint64_t left = stress_reap_timed( "dead creators" );
+   if( left > 0 ) {
+      
+      printf("FAIL: %" PRIu64 " entries of dead creators were not reaped\n", left );
+      failures++;
+   }
+   
+   uint64_t live = 0;
+   uint64_t live_paths = 0;
+   
+   for( int i = 0; i < num_creators; i++ ) {
+      
+      if( atomic_load( &creators[i].dead ) ) {
+         continue;
+      }
+      
+      // a creator that died on its own would make its entries fair game
+      pid_t pid = waitpid( creators[i].pid, NULL, WNOHANG );
+      if( pid != 0 ) {
+         
+         printf("FAIL: live creator %d (PID %d) is not alive (waitpid rc = %d)\n", i, (int)creators[i].pid, (int)pid );
+         failures++;
+         
+         atomic_store( &creators[i].dead, true );
+         continue;
+      }
+      
+      live_paths += creators[i].num_paths;
+   }
+   
+   live = stress_count_existing( true );
+   if( live != live_paths ) {
+      
+      printf("FAIL: %" PRIu64 " of %" PRIu64 " entries of live creators were reaped\n", live_paths - live, live_paths );
+      failures++;
+   }
+   
+   // now kill everyone; every inode we made should be freed 
+   for( int i = 0; i < num_creators; i++ ) {
+      stress_kill( &creators[i] );
+   }
+   
+   left = stress_reap_timed( "all creators" );
+   if( left > 0 ) {
+      
+      printf("FAIL: %" PRIu64 " entries of dead creators were not reaped\n", left );
+      failures++;
+   }
+   
+   uint64_t reclaimed = atomic_load( &runfs.entries_reclaimed );
+   uint64_t created = atomic_load( &num_created );
+   
+   if( reclaimed < created ) {
+      
+      printf("FAIL: created %" PRIu64 " entries, but only freed %" PRIu64 "\n", created, reclaimed );
+      failures++;
+   }
+   
+   // clean up 
+   runfs_stop( &runfs );
+   
+   fskit_detach_all( core, "/" );
+   fskit_core_destroy( core, NULL );
+   free( core );
+   
+   runfs_state_free( &runfs );
+   runfs_opts_free( &opts );
+   fskit_library_shutdown();
+   
+   for( int i = 0; i < num_creators; i++ ) {
+      
+      for( int j = 0; j < creators[i].num_paths; j++ ) {
+         free( creators[i].paths[j] );
+      }
+   }
+   
+   free( creators );
+   free( workers );
+   
+   if( failures > 0 ) {
+      
+      printf("%d checks failed\n", failures );
+      return 1;
+   }
+   
+   printf("all checks passed\n");
+   return 0;
+}
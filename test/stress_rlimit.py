@@ -0,0 +1,159 @@
+#!/usr/bin/python
+
+# Run runfs with a capped address space, fill it with files and directories
+# from processes that then die, and check that all of their entries get reaped.
+#
+# usage: stress_rlimit.py /path/to/runfs /path/to/mountpoint [address space MB] [num creators]
+
+import sys
+import os
+import time
+import errno
+import resource
+import subprocess
+
+runfs_path = sys.argv[1]
+mountpoint = sys.argv[2]
+as_limit_mb = 256
+num_creators = 16
+
+if len(sys.argv) > 3:
+    as_limit_mb = int(sys.argv[3])
+
+if len(sys.argv) > 4:
+    num_creators = int(sys.argv[4])
+
+def read_stats():
+    stats = {}
+    with open( os.path.join( mountpoint, ".runfs/stats" ) ) as f:
+        for line in f:
+            parts = line.split()
+            if len(parts) == 2:
+                stats[parts[0]] = int(parts[1])
+
+    return stats
+
+def reap_pending( stats ):
+    # deferred unlinks queued or reserved, or contents waiting to be freed
+    pending = {}
+    for name, value in stats.items():
+        if value > 0 and ((name.startswith("wq") and (name.endswith("_depth") or name.endswith("_reserved")) and not name.endswith("_max_depth")) or name == "arena_pending_free_bytes"):
+            pending[name] = value
+
+    return pending
+
+def limit_as():
+    limit = as_limit_mb * 1024 * 1024
+    resource.setrlimit( resource.RLIMIT_AS, (limit, limit) )
+
+def creator( idx ):
+    # fill a directory tree until runfs runs out of memory
+    root = os.path.join( mountpoint, "creator-%d" % idx )
+    os.mkdir( root, 0o755 )
+
+    data = "x" * 65536
+    count = 0
+    try:
+        for i in range(0, 1000):
+            d = os.path.join( root, "dir-%d" % i )
+            os.mkdir( d, 0o755 )
+
+            for j in range(0, 100):
+                fd = open( os.path.join( d, "file-%d" % j ), "w" )
+                fd.write( data )
+                fd.close()
+                count += 1
+
+    except (IOError, OSError) as e:
+        if e.errno not in [errno.ENOMEM, errno.ENOSPC, errno.EIO]:
+            raise
+
+    print("creator %d: wrote %d files" % (idx, count))
+    os._exit(0)
+
+runfs = subprocess.Popen( [runfs_path, "-f", mountpoint], preexec_fn=limit_as )
+
+deadline = time.time() + 10
+while not os.path.ismount( mountpoint ):
+    if time.time() > deadline:
+        print("runfs did not mount")
+        runfs.kill()
+        sys.exit(1)
+
+    time.sleep(0.1)
+
+pids = []
+for i in range(0, num_creators):
+    pid = os.fork()
+    if pid == 0:
+        creator( i )
+
+    pids.append( pid )
+
+for pid in pids:
+    os.waitpid( pid, 0 )
+
+print("all creators exited; waiting for runfs to reap their files...")
+
+# listing the root reaps the dead creators' directories
+start = time.time()
+deadline = start + 120
+remaining = os.listdir( mountpoint )
+while len(remaining) > 0 and time.time() < deadline:
+    time.sleep(0.5)
+    remaining = os.listdir( mountpoint )
+
+if len(remaining) > 0:
+    print("FAIL: %d entries left after %d seconds: %s" % (len(remaining), time.time() - start, remaining))
+    rc = 1
+else:
+    print("OK: reaped everything in %.2f seconds" % (time.time() - start))
+    rc = 0
+
+# the entries being gone from the listing isn't enough: the reaper has to actually finish detaching and freeing them
+if rc == 0:
+    stats = read_stats()
+    pending = reap_pending( stats )
+    while len(pending) > 0 and time.time() < deadline:
+        time.sleep(0.5)
+        stats = read_stats()
+        pending = reap_pending( stats )
+
+    if len(pending) > 0:
+        print("FAIL: reaping did not finish after %d seconds: %s" % (time.time() - start, pending))
+        rc = 1
+    elif stats["entries_reclaimed"] < num_creators:
+        print("FAIL: only %d of %d creators' entries were reclaimed" % (stats["entries_reclaimed"], num_creators))
+        rc = 1
+    else:
+        print("OK: reaping finished in %.2f seconds (%d entries, %d bytes)" % (time.time() - start, stats["entries_reclaimed"], stats["bytes_reclaimed"]))
+
+# once the reaper has caught up, the memory should be usable again
+if rc == 0:
+    data = "y" * (as_limit_mb * 1024 * 1024 // 4)
+    deadline = time.time() + 60
+    wrote = False
+    while not wrote and time.time() < deadline:
+        try:
+            fd = open( os.path.join( mountpoint, "after" ), "w" )
+            fd.write( data )
+            fd.close()
+            wrote = True
+        except (IOError, OSError) as e:
+            time.sleep(0.5)
+
+    if not wrote:
+        print("FAIL: memory was not reclaimed")
+        rc = 1
+    else:
+        print("OK: memory was reclaimed in %.2f seconds" % (time.time() - start))
+        os.unlink( os.path.join( mountpoint, "after" ) )
+
+if runfs.poll() is not None:
+    print("FAIL: runfs exited with %s" % runfs.returncode)
+    rc = 1
+
+subprocess.call( ["fusermount", "-u", mountpoint] )
+runfs.wait()
+
+sys.exit(rc)
@@ -0,0 +1,32 @@
+#!/usr/bin/python
+
+# Follow runfs's event stream, and print each create and reap as it happens.
+# Run make_pidfile.py in the mount and kill it to see its pidfile get reaped.
+#
+# usage: watch_events.py /path/to/mountpoint
+
+import sys
+import os
+import select
+
+events_path = os.path.join(sys.argv[1], ".runfs/events")
+
+fd = os.open(events_path, os.O_RDONLY | os.O_NONBLOCK)
+
+p = select.poll()
+p.register(fd, select.POLLIN)
+
+while True:
+    p.poll()
+
+    try:
+        data = os.read(fd, 65536)
+    except OSError:
+        continue
+
+    for line in data.splitlines():
+        fields = line.split(" ", 4)
+        if fields[0] == "overflow":
+            print "missed %s events" % fields[1]
+        else:
+            print "#%s: %s %s (PID %s, %s)" % (fields[0], fields[1], fields[4], fields[2], fields[3])
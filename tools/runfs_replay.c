@@ -0,0 +1,460 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+// replay a runfs trace (recorded with --trace=PATH) against runfs's handlers on an in-process fskit core,
+// without mounting anything, and report throughput and latency per operation.
+//
+// usage: runfs_replay [runfs options] /path/to/trace
+//
+// runfs options (e.g. --stale-ttl, --policy) configure the replayed filesystem, so the same trace can be run
+// against different configurations and builds.  Operations are replayed one at a time, in the order they started.
+// every entry is owned by the replayer, so nothing gets reaped unless the trace removes it.
+
+#include "runfs.h"
+
+// one path from the trace 
+struct replay_path {
+   
+   uint64_t path_id;
+   char* path;
+   struct fskit_file_handle* fh;        // open handle for reads and writes, or NULL
+   
+   struct replay_path* next;
+};
+
+#define REPLAY_PATH_BUCKETS     65536
+
+// latencies of one kind of operation 
+struct replay_op_stats {
+   
+   uint64_t* latencies_ns;
+   uint64_t num_ops;
+   uint64_t num_errors;                 // replayed calls that failed 
+   uint64_t recorded_ns;                // total latency in the trace 
+};
+
+static char const* replay_op_names[ RUNFS_TRACE_NUM_OPS ] = {
+   "path", "create", "mknod", "mkdir", "read", "write", "trunc", "destroy", "stat", "readdir"
+};
+
+static struct replay_path* replay_paths[ REPLAY_PATH_BUCKETS ];
+
+// find a path by ID 
+static struct replay_path* replay_path_find( uint64_t path_id ) {
+   
+   for( struct replay_path* p = replay_paths[ path_id % REPLAY_PATH_BUCKETS ]; p != NULL; p = p->next ) {
+      
+      if( p->path_id == path_id ) {
+         return p;
+      }
+   }
+   
+   return NULL;
+}
+
+// remember a path.  Each thread writes the paths it uses, so we'll see most of them more than once.
+// return 0 on success 
+// return -ENOMEM on OOM
+static int replay_path_add( uint64_t path_id, char const* path, size_t path_len ) {
+   
+   if( replay_path_find( path_id ) != NULL ) {
+      return 0;
+   }
+   
+   struct replay_path* p = RUNFS_CALLOC( struct replay_path, 1 );
+   if( p == NULL ) {
+      return -ENOMEM;
+   }
+   
+   p->path = strndup( path, path_len );
+   if( p->path == NULL ) {
+      
+      free( p );
+      return -ENOMEM;
+   }
+   
+   p->path_id = path_id;
+   p->next = replay_paths[ path_id % REPLAY_PATH_BUCKETS ];
+   replay_paths[ path_id % REPLAY_PATH_BUCKETS ] = p;
+   
+   return 0;
+}
+
+// order records by when they started 
+static int replay_record_cmp( const void* a, const void* b ) {
+   
+   struct runfs_trace_record const* ra = *(struct runfs_trace_record const**)a;
+   struct runfs_trace_record const* rb = *(struct runfs_trace_record const**)b;
+   
+   return (ra->start_ns > rb->start_ns) - (ra->start_ns < rb->start_ns);
+}
+
+static int replay_u64_cmp( const void* a, const void* b ) {
+   
+   uint64_t ua = *(uint64_t const*)a;
+   uint64_t ub = *(uint64_t const*)b;
+   
+   return (ua > ub) - (ua < ub);
+}
+
+// get an open handle to a path, for reading and writing 
+static struct fskit_file_handle* replay_get_handle( struct fskit_core* core, struct replay_path* p, int* rc ) {
+   
+   if( p->fh == NULL ) {
+      p->fh = fskit_open( core, p->path, 0, 0, O_RDWR, 0644, rc );
+   }
+   
+   return p->fh;
+}
+
+// close a path's handle, if it's open 
+static void replay_put_handle( struct fskit_core* core, struct replay_path* p ) {
+   
+   if( p->fh != NULL ) {
+      
+      fskit_close( core, p->fh );
+      p->fh = NULL;
+   }
+}
+
+// replay one operation 
+// return what fskit returned 
+static int replay_op( struct fskit_core* core, struct runfs_trace_record* rec, struct replay_path* p, char* buf ) {
+   
+   int rc = 0;
+   struct stat sb;
+   
+   switch( rec->op ) {
+      
+      case RUNFS_TRACE_OP_CREATE: {
+         
+         struct fskit_file_handle* fh = fskit_create( core, p->path, 0, 0, rec->mode & 07777, &rc );
+         if( fh != NULL ) {
+            fskit_close( core, fh );
+         }
+         
+         break;
+      }
+      
+      case RUNFS_TRACE_OP_MKNOD:
+         
+         rc = fskit_mknod( core, p->path, rec->mode, rec->len, 0, 0 );
+         break;
+         
+      case RUNFS_TRACE_OP_MKDIR:
+         
+         rc = fskit_mkdir( core, p->path, rec->mode & 07777, 0, 0 );
+         break;
+         
+      case RUNFS_TRACE_OP_READ: {
+         
+         struct fskit_file_handle* fh = replay_get_handle( core, p, &rc );
+         if( fh != NULL ) {
+            rc = fskit_read( core, fh, buf, rec->len, rec->offset );
+         }
+         
+         break;
+      }
+      
+      case RUNFS_TRACE_OP_WRITE: {
+         
+         struct fskit_file_handle* fh = replay_get_handle( core, p, &rc );
+         if( fh != NULL ) {
+            rc = fskit_write( core, fh, buf, rec->len, rec->offset );
+         }
+         
+         break;
+      }
+      
+      case RUNFS_TRACE_OP_TRUNC:
+         
+         rc = fskit_trunc( core, p->path, 0, 0, rec->offset );
+         break;
+         
+      case RUNFS_TRACE_OP_DESTROY:
+         
+         replay_put_handle( core, p );
+         
+         rc = fskit_unlink( core, p->path, 0, 0 );
+         if( rc == -EISDIR ) {
+            rc = fskit_rmdir( core, p->path, 0, 0 );
+         }
+         
+         break;
+         
+      case RUNFS_TRACE_OP_STAT:
+         
+         rc = fskit_stat( core, p->path, 0, 0, &sb );
+         break;
+         
+      case RUNFS_TRACE_OP_READDIR: {
+         
+         uint64_t num_dirents = 0;
+         struct fskit_dir_handle* dh = fskit_opendir( core, p->path, 0, 0, &rc );
+         if( dh != NULL ) {
+            
+            struct fskit_dir_entry** dirents = fskit_listdir( core, dh, &num_dirents, &rc );
+            if( dirents != NULL ) {
+               fskit_dir_entry_free_list( dirents );
+            }
+            
+            fskit_closedir( core, dh );
+         }
+         
+         break;
+      }
+   }
+   
+   return rc;
+}
+
+// print one operation's statistics 
+static void replay_report_op( char const* name, struct replay_op_stats* stats ) {
+   
+   uint64_t total_ns = 0;
+   
+   if( stats->num_ops == 0 ) {
+      return;
+   }
+   
+   qsort( stats->latencies_ns, stats->num_ops, sizeof(uint64_t), replay_u64_cmp );
+   
+   for( uint64_t i = 0; i < stats->num_ops; i++ ) {
+      total_ns += stats->latencies_ns[i];
+   }
+   
+   printf("%-8s %10" PRIu64 " %8" PRIu64 " %10.2f %10.2f %10.2f %10.2f %12.2f\n",
+          name, stats->num_ops, stats->num_errors,
+          (double)total_ns / stats->num_ops / 1000.0,
+          (double)stats->latencies_ns[ stats->num_ops / 2 ] / 1000.0,
+          (double)stats->latencies_ns[ (stats->num_ops * 99) / 100 ] / 1000.0,
+          (double)stats->latencies_ns[ stats->num_ops - 1 ] / 1000.0,
+          (double)stats->recorded_ns / stats->num_ops / 1000.0 );
+}
+
+int main( int argc, char** argv ) {
+   
+   int rc = 0;
+   struct stat sb;
+   struct runfs_opts opts;
+   struct runfs_state runfs;
+   struct replay_op_stats stats[ RUNFS_TRACE_NUM_OPS ];
+   struct runfs_trace_record** ops = NULL;
+   uint64_t num_ops = 0;
+   uint64_t max_len = 0;
+   
+   rc = runfs_opts_parse( &opts, &argc, argv );
+   if( rc != 0 || argc != 2 ) {
+      
+      fprintf(stderr, "Usage: %s [runfs options] /path/to/trace\n", argv[0] );
+      runfs_opts_usage( argv[0] );
+      exit(1);
+   }
+   
+   // don't trace the replay
+   opts.trace_path = NULL;
+   
+   int fd = open( argv[1], O_RDONLY );
+   if( fd < 0 || fstat( fd, &sb ) != 0 ) {
+      
+      fprintf(stderr, "Failed to open '%s': %s\n", argv[1], strerror( errno ) );
+      exit(1);
+   }
+   
+   char* trace = (char*)mmap( NULL, sb.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+   close( fd );
+   
+   struct runfs_trace_header* header = (struct runfs_trace_header*)trace;
+   
+   if( trace == MAP_FAILED || (size_t)sb.st_size < sizeof(*header) || header->magic != RUNFS_TRACE_MAGIC || header->version != RUNFS_TRACE_VERSION ) {
+      
+      fprintf(stderr, "'%s' is not a runfs trace\n", argv[1] );
+      exit(1);
+   }
+   
+   // index the trace 
+   ops = RUNFS_CALLOC( struct runfs_trace_record*, sb.st_size / sizeof(struct runfs_trace_record) + 1 );
+   if( ops == NULL ) {
+      exit(1);
+   }
+   
+   for( size_t off = sizeof(*header); off + sizeof(struct runfs_trace_record) <= (size_t)sb.st_size; ) {
+      
+      struct runfs_trace_record* rec = (struct runfs_trace_record*)(trace + off);
+      
+      if( rec->op == RUNFS_TRACE_OP_PATH ) {
+         
+         if( off + RUNFS_TRACE_PATH_RECORD_LEN( rec->path_len ) > (size_t)sb.st_size ) {
+            break;
+         }
+         
+         if( replay_path_add( rec->path_id, (char const*)(rec + 1), rec->path_len ) != 0 ) {
+            exit(1);
+         }
+         
+         off += RUNFS_TRACE_PATH_RECORD_LEN( rec->path_len );
+         continue;
+      }
+      
+      if( rec->op < RUNFS_TRACE_NUM_OPS ) {
+         
+         ops[ num_ops ] = rec;
+         num_ops++;
+         
+         if( (rec->op == RUNFS_TRACE_OP_READ || rec->op == RUNFS_TRACE_OP_WRITE) && rec->len > max_len ) {
+            max_len = rec->len;
+         }
+      }
+      
+      off += sizeof(struct runfs_trace_record);
+   }
+   
+   qsort( ops, num_ops, sizeof(struct runfs_trace_record*), replay_record_cmp );
+   
+   memset( stats, 0, sizeof(stats) );
+   for( int i = 0; i < RUNFS_TRACE_NUM_OPS; i++ ) {
+      
+      stats[i].latencies_ns = RUNFS_CALLOC( uint64_t, num_ops + 1 );
+      if( stats[i].latencies_ns == NULL ) {
+         exit(1);
+      }
+   }
+   
+   char* buf = (char*)malloc( max_len + 1 );
+   if( buf == NULL ) {
+      exit(1);
+   }
+   
+   memset( buf, 'x', max_len + 1 );
+   
+   // set up runfs on a bare fskit core 
+   rc = fskit_library_init();
+   if( rc != 0 ) {
+      fprintf(stderr, "fskit_library_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   rc = runfs_state_init( &runfs, &opts );
+   if( rc != 0 ) {
+      fprintf(stderr, "runfs_state_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   struct fskit_core* core = fskit_core_new();
+   if( core == NULL ) {
+      exit(1);
+   }
+   
+   rc = fskit_core_init( core, &runfs );
+   if( rc != 0 ) {
+      fprintf(stderr, "fskit_core_init rc = %d\n", rc );
+      exit(1);
+   }
+   
+   runfs.core = core;
+   
+   rc = runfs_add_routes( &runfs );
+   if( rc != 0 ) {
+      exit(1);
+   }
+   
+   rc = runfs_start( &runfs );
+   if( rc != 0 ) {
+      exit(1);
+   }
+   
+   // we own everything we create; there's no FUSE caller
+   runfs_ctl_set_owner( getpid() );
+   
+   // go!
+   uint64_t start_ns = runfs_trace_now_ns();
+   
+   for( uint64_t i = 0; i < num_ops; i++ ) {
+      
+      struct runfs_trace_record* rec = ops[i];
+      struct replay_path* p = replay_path_find( rec->path_id );
+      
+      if( p == NULL ) {
+         continue;
+      }
+      
+      uint64_t op_start_ns = runfs_trace_now_ns();
+      
+      rc = replay_op( core, rec, p, buf );
+      
+      struct replay_op_stats* op_stats = &stats[ rec->op ];
+      
+      op_stats->latencies_ns[ op_stats->num_ops ] = runfs_trace_now_ns() - op_start_ns;
+      op_stats->num_ops++;
+      op_stats->recorded_ns += rec->latency_ns;
+      
+      // only count it as an error if it didn't fail the same way when recorded 
+      if( rc < 0 && rec->rc >= 0 ) {
+         op_stats->num_errors++;
+      }
+   }
+   
+   uint64_t elapsed_ns = runfs_trace_now_ns() - start_ns;
+   
+   printf("%" PRIu64 " operations in %.3f seconds: %.0f ops/sec\n\n", num_ops, (double)elapsed_ns / 1e9, num_ops / ((double)elapsed_ns / 1e9) );
+   printf("%-8s %10s %8s %10s %10s %10s %10s %12s\n", "op", "count", "errors", "mean(us)", "p50(us)", "p99(us)", "max(us)", "traced(us)" );
+   
+   for( int i = 1; i < RUNFS_TRACE_NUM_OPS; i++ ) {
+      replay_report_op( replay_op_names[i], &stats[i] );
+   }
+   
+   // clean up 
+   for( int i = 0; i < REPLAY_PATH_BUCKETS; i++ ) {
+      
+      struct replay_path* p = replay_paths[i];
+      while( p != NULL ) {
+         
+         struct replay_path* next = p->next;
+         
+         replay_put_handle( core, p );
+         free( p->path );
+         free( p );
+         
+         p = next;
+      }
+   }
+   
+   runfs_ctl_set_owner( 0 );
+   runfs_stop( &runfs );
+   
+   fskit_detach_all( core, "/" );
+   fskit_core_destroy( core, NULL );
+   free( core );
+   
+   runfs_state_free( &runfs );
+   runfs_opts_free( &opts );
+   fskit_library_shutdown();
+   
+   for( int i = 0; i < RUNFS_TRACE_NUM_OPS; i++ ) {
+      free( stats[i].latencies_ns );
+   }
+   
+   free( buf );
+   free( ops );
+   munmap( trace, sb.st_size );
+   
+   return 0;
+}
@@ -0,0 +1,318 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#include "trace.h"
+#include "probes.h"
+
+#include <fskit/fuse/fskit_fuse.h>
+
+// a thread's trace buffer 
+struct runfs_trace_buf {
+   
+   char data[ RUNFS_TRACE_BUF_LEN ];
+   size_t len;
+   
+   uint64_t paths[ RUNFS_TRACE_PATH_CACHE ];    // path IDs this thread has written (direct-mapped)
+   
+   struct runfs_trace_buf* prev;
+   struct runfs_trace_buf* next;
+};
+
+// the trace 
+struct runfs_trace {
+   
+   int fd;                              // trace file, opened O_APPEND
+   pthread_key_t buf_key;               // flushes and frees a thread's buffer when it exits
+   
+   pthread_mutex_t lock;                // guards bufs
+   struct runfs_trace_buf* bufs;        // every thread's buffer, so we can flush them when we stop
+};
+
+static struct runfs_trace runfs_trace;
+
+// set while tracing.  Checked by every handler, so it's a plain load when tracing is off.
+static atomic_bool runfs_trace_enabled = false;
+
+// this thread's buffer 
+static __thread struct runfs_trace_buf* runfs_trace_self = NULL;
+
+// append a thread's buffered records to the trace file, and empty the buffer 
+static void runfs_trace_flush( struct runfs_trace_buf* buf ) {
+   
+   size_t off = 0;
+   
+   while( off < buf->len ) {
+      
+      ssize_t nw = write( runfs_trace.fd, buf->data + off, buf->len - off );
+      if( nw < 0 ) {
+         
+         if( errno == EINTR ) {
+            continue;
+         }
+         
+         runfs_error("write(trace) errno = %d; dropping %zu bytes of trace\n", errno, buf->len - off );
+         break;
+      }
+      
+      off += nw;
+   }
+   
+   buf->len = 0;
+}
+
+// flush and free a thread's buffer when it exits
+static void runfs_trace_buf_free( void* arg ) {
+   
+   struct runfs_trace_buf* buf = (struct runfs_trace_buf*)arg;
+   
+   pthread_mutex_lock( &runfs_trace.lock );
+   
+   runfs_trace_flush( buf );
+   
+   if( buf->prev != NULL ) {
+      buf->prev->next = buf->next;
+   }
+   else {
+      runfs_trace.bufs = buf->next;
+   }
+   
+   if( buf->next != NULL ) {
+      buf->next->prev = buf->prev;
+   }
+   
+   pthread_mutex_unlock( &runfs_trace.lock );
+   
+   free( buf );
+}
+
+// get this thread's buffer, making it if need be 
+// return NULL on OOM
+static struct runfs_trace_buf* runfs_trace_get_buf( void ) {
+   
+   struct runfs_trace_buf* buf = runfs_trace_self;
+   
+   if( buf != NULL ) {
+      return buf;
+   }
+   
+   buf = RUNFS_CALLOC( struct runfs_trace_buf, 1 );
+   if( buf == NULL ) {
+      return NULL;
+   }
+   
+   pthread_mutex_lock( &runfs_trace.lock );
+   
+   buf->next = runfs_trace.bufs;
+   if( runfs_trace.bufs != NULL ) {
+      runfs_trace.bufs->prev = buf;
+   }
+   
+   runfs_trace.bufs = buf;
+   
+   pthread_mutex_unlock( &runfs_trace.lock );
+   
+   pthread_setspecific( runfs_trace.buf_key, buf );
+   runfs_trace_self = buf;
+   
+   return buf;
+}
+
+// start tracing every handler call to the given file 
+// return 0 on success 
+// return -errno on failure to create the file
+int runfs_trace_open( char const* path ) {
+   
+   int rc = 0;
+   struct runfs_trace_header header;
+   
+   memset( &runfs_trace, 0, sizeof(struct runfs_trace) );
+   
+   runfs_trace.fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600 );
+   if( runfs_trace.fd < 0 ) {
+      return -errno;
+   }
+   
+   memset( &header, 0, sizeof(header) );
+   header.magic = RUNFS_TRACE_MAGIC;
+   header.version = RUNFS_TRACE_VERSION;
+   header.start_ns = runfs_trace_now_ns();
+   
+   if( write( runfs_trace.fd, &header, sizeof(header) ) != sizeof(header) ) {
+      
+      rc = -EIO;
+      close( runfs_trace.fd );
+      return rc;
+   }
+   
+   rc = pthread_key_create( &runfs_trace.buf_key, runfs_trace_buf_free );
+   if( rc != 0 ) {
+      
+      close( runfs_trace.fd );
+      return -rc;
+   }
+   
+   pthread_mutex_init( &runfs_trace.lock, NULL );
+   atomic_store( &runfs_trace_enabled, true );
+   
+   return 0;
+}
+
+// stop tracing, and flush every thread's buffer.
+// handlers must no longer be running.
+// always succeeds
+int runfs_trace_close( void ) {
+   
+   if( !atomic_load( &runfs_trace_enabled ) ) {
+      return 0;
+   }
+   
+   atomic_store( &runfs_trace_enabled, false );
+   
+   pthread_mutex_lock( &runfs_trace.lock );
+   
+   struct runfs_trace_buf* buf = runfs_trace.bufs;
+   while( buf != NULL ) {
+      
+      struct runfs_trace_buf* next = buf->next;
+      
+      runfs_trace_flush( buf );
+      free( buf );
+      
+      buf = next;
+   }
+   
+   runfs_trace.bufs = NULL;
+   
+   pthread_mutex_unlock( &runfs_trace.lock );
+   
+   // threads that are still around must not free their (now-freed) buffers
+   pthread_key_delete( runfs_trace.buf_key );
+   runfs_trace_self = NULL;
+   
+   close( runfs_trace.fd );
+   pthread_mutex_destroy( &runfs_trace.lock );
+   
+   return 0;
+}
+
+// are we tracing?
+bool runfs_trace_is_enabled( void ) {
+   
+   return atomic_load_explicit( &runfs_trace_enabled, memory_order_relaxed );
+}
+
+// CLOCK_MONOTONIC time, in nanoseconds 
+uint64_t runfs_trace_now_ns( void ) {
+   
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   
+   return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// hash a path into its ID (64-bit FNV-1a) 
+uint64_t runfs_trace_path_id( char const* path ) {
+   
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   
+   for( ; *path != '\0'; path++ ) {
+      
+      hash ^= (unsigned char)*path;
+      hash *= 0x100000001b3ULL;
+   }
+   
+   return hash;
+}
+
+// note the start of a handler call, for the trace and for the handler__entry probe.
+// return the time, or 0 if we're not tracing
+uint64_t runfs_trace_begin( int op, char const* path ) {
+   
+   RUNFS_PROBE3( handler__entry, op, path, fskit_fuse_get_pid() );
+   
+   if( !runfs_trace_is_enabled() ) {
+      return 0;
+   }
+   
+   return runfs_trace_now_ns();
+}
+
+// record a handler call that began at start_ns (from runfs_trace_begin()), and fire the handler__return probe.
+// does nothing else if start_ns is 0.
+void runfs_trace_end( int op, char const* path, uint64_t offset, uint64_t len, uint32_t mode, int rc, uint64_t start_ns ) {
+   
+   RUNFS_PROBE4( handler__return, op, path, fskit_fuse_get_pid(), rc );
+   
+   if( start_ns == 0 || !runfs_trace_is_enabled() ) {
+      return;
+   }
+   
+   uint64_t end_ns = runfs_trace_now_ns();
+   struct runfs_trace_record* rec = NULL;
+   size_t path_len = strlen( path );
+   uint64_t path_id = runfs_trace_path_id( path );
+   
+   struct runfs_trace_buf* buf = runfs_trace_get_buf();
+   if( buf == NULL ) {
+      return;
+   }
+   
+   // make sure there's room for a path and the record 
+   if( buf->len + RUNFS_TRACE_PATH_RECORD_LEN( path_len ) + sizeof(struct runfs_trace_record) > RUNFS_TRACE_BUF_LEN ) {
+      
+      runfs_trace_flush( buf );
+      
+      if( RUNFS_TRACE_PATH_RECORD_LEN( path_len ) + sizeof(struct runfs_trace_record) > RUNFS_TRACE_BUF_LEN ) {
+         return;
+      }
+   }
+   
+   if( buf->paths[ path_id % RUNFS_TRACE_PATH_CACHE ] != path_id ) {
+      
+      // first time this thread has seen this path (lately)
+      rec = (struct runfs_trace_record*)(buf->data + buf->len);
+      memset( rec, 0, RUNFS_TRACE_PATH_RECORD_LEN( path_len ) );
+      
+      rec->op = RUNFS_TRACE_OP_PATH;
+      rec->path_len = path_len;
+      rec->path_id = path_id;
+      memcpy( rec + 1, path, path_len );
+      
+      buf->len += RUNFS_TRACE_PATH_RECORD_LEN( path_len );
+      buf->paths[ path_id % RUNFS_TRACE_PATH_CACHE ] = path_id;
+   }
+   
+   rec = (struct runfs_trace_record*)(buf->data + buf->len);
+   
+   rec->op = op;
+   rec->reserved = 0;
+   rec->path_len = 0;
+   rec->rc = rc;
+   rec->pid = fskit_fuse_get_pid();
+   rec->mode = mode;
+   rec->path_id = path_id;
+   rec->offset = offset;
+   rec->len = len;
+   rec->start_ns = start_ns;
+   rec->latency_ns = end_ns - start_ns;
+   
+   buf->len += sizeof(struct runfs_trace_record);
+}
@@ -0,0 +1,90 @@
+/*
+   runfs: a self-cleaning filesystem for runtime state.
+   Copyright (C) 2015  Jude Nelson
+
+   This program is dual-licensed: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License version 3 or later as 
+   published by the Free Software Foundation. For the terms of this 
+   license, see LICENSE.LGPLv3+ or <http://www.gnu.org/licenses/>.
+
+   You are free to use this program under the terms of the GNU General
+   Public License, but WITHOUT ANY WARRANTY; without even the implied 
+   warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   See the GNU General Public License for more details.
+
+   Alternatively, you are free to use this program under the terms of the 
+   Internet Software Consortium License, but WITHOUT ANY WARRANTY; without
+   even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+   For the terms of this license, see LICENSE.ISC or 
+   <http://www.isc.org/downloads/software-support-policy/isc-license/>.
+*/
+
+#ifndef _RUNFS_TRACE_H_
+#define _RUNFS_TRACE_H_
+
+#include "os.h"
+#include "util.h"
+
+// trace file format.  A header, followed by records.  Each thread buffers its own records and appends them
+// to the file a buffer at a time, so records are only in order within a thread; sort by start_ns to replay.
+// a path is written once per thread (as a RUNFS_TRACE_OP_PATH record followed by the path, padded to 
+// RUNFS_TRACE_ALIGN bytes) before the first record that refers to it by path_id.
+#define RUNFS_TRACE_MAGIC               0x52465431      // "RFT1"
+#define RUNFS_TRACE_VERSION             1
+#define RUNFS_TRACE_ALIGN               8
+
+#define RUNFS_TRACE_OP_PATH             0
+#define RUNFS_TRACE_OP_CREATE           1
+#define RUNFS_TRACE_OP_MKNOD            2
+#define RUNFS_TRACE_OP_MKDIR            3
+#define RUNFS_TRACE_OP_READ             4
+#define RUNFS_TRACE_OP_WRITE            5
+#define RUNFS_TRACE_OP_TRUNC            6
+#define RUNFS_TRACE_OP_DESTROY          7
+#define RUNFS_TRACE_OP_STAT             8
+#define RUNFS_TRACE_OP_READDIR          9
+
+#define RUNFS_TRACE_NUM_OPS             10
+
+// size of each thread's buffer 
+#define RUNFS_TRACE_BUF_LEN             65536
+
+// number of path IDs each thread remembers having written
+#define RUNFS_TRACE_PATH_CACHE          1024
+
+struct runfs_trace_header {
+   
+   uint32_t magic;
+   uint32_t version;
+   uint64_t start_ns;                   // CLOCK_MONOTONIC time when tracing started
+};
+
+struct runfs_trace_record {
+   
+   uint8_t op;                          // RUNFS_TRACE_OP_*
+   uint8_t reserved;
+   uint16_t path_len;                   // length of the path that follows (RUNFS_TRACE_OP_PATH only)
+   int32_t rc;                          // what the handler returned
+   int32_t pid;                         // calling process
+   uint32_t mode;                       // mode (creates), or number of entries (readdir)
+   uint64_t path_id;                    // hash of the path
+   uint64_t offset;                     // offset (reads and writes) or new size (truncates)
+   uint64_t len;                        // number of bytes requested (reads and writes)
+   uint64_t start_ns;                   // CLOCK_MONOTONIC time when the handler was called
+   uint64_t latency_ns;                 // how long the handler took
+};
+
+#define RUNFS_TRACE_PATH_RECORD_LEN( path_len ) \
+   ((sizeof(struct runfs_trace_record) + (path_len) + RUNFS_TRACE_ALIGN - 1) & ~((uint64_t)RUNFS_TRACE_ALIGN - 1))
+
+int runfs_trace_open( char const* path );
+int runfs_trace_close( void );
+bool runfs_trace_is_enabled( void );
+
+uint64_t runfs_trace_now_ns( void );
+uint64_t runfs_trace_path_id( char const* path );
+
+uint64_t runfs_trace_begin( int op, char const* path );
+void runfs_trace_end( int op, char const* path, uint64_t offset, uint64_t len, uint32_t mode, int rc, uint64_t start_ns );
+
+#endif
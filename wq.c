@@ -20,35 +20,223 @@
 */
 
 #include "wq.h"
+#include "probes.h"
 
-// work queue main method
+// is a < b?
+static bool runfs_timespec_before( struct timespec const* a, struct timespec const* b ) {
+   
+   return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+
+// advance a timespec by a number of milliseconds
+static void runfs_timespec_add_ms( struct timespec* ts, int64_t ms ) {
+   
+   ts->tv_sec += ms / 1000;
+   ts->tv_nsec += (ms % 1000) * 1000000L;
+   
+   if( ts->tv_nsec >= 1000000000L ) {
+      
+      ts->tv_sec++;
+      ts->tv_nsec -= 1000000000L;
+   }
+}
+
+
+// milliseconds from a to b (0 if b is before a)
+static uint64_t runfs_timespec_diff_ms( struct timespec const* a, struct timespec const* b ) {
+   
+   int64_t ms = (int64_t)(b->tv_sec - a->tv_sec) * 1000 + (b->tv_nsec - a->tv_nsec) / 1000000L;
+   
+   if( ms < 0 ) {
+      return 0;
+   }
+   
+   return (uint64_t)ms;
+}
+
+
+// wait for work to be posted to a lane, or for the lane's earliest delayed request to come due.
+// return 0 on success (including timeouts)
+// return negative on fatal error
+static int runfs_wq_lane_wait_work( struct runfs_wq_lane* lane ) {
+   
+   int rc = 0;
+   bool have_deadline = false;
+   struct timespec deadline;
+   
+   memset( &deadline, 0, sizeof(struct timespec) );
+   
+   pthread_mutex_lock( &lane->wq->work_lock );
+   
+   for( struct runfs_wreq* itr = lane->delayed; itr != NULL; itr = itr->next ) {
+      
+      if( !have_deadline || runfs_timespec_before( &itr->not_before, &deadline ) ) {
+         
+         deadline = itr->not_before;
+         have_deadline = true;
+      }
+   }
+   
+   pthread_mutex_unlock( &lane->wq->work_lock );
+   
+   // is there work?
+   rc = sem_trywait( &lane->work_sem );
+   if( rc == 0 ) {
+      return 0;
+   }
+   
+   rc = -errno;
+   if( rc != -EAGAIN ) {
+      
+      // some other fatal error 
+      runfs_error("FATAL: sem_trywait rc = %d\n", rc );
+      return rc;
+   }
+   
+   // wait for work
+   if( have_deadline ) {
+      
+      rc = sem_timedwait( &lane->work_sem, &deadline );
+      if( rc != 0 && errno != ETIMEDOUT && errno != EINTR ) {
+         
+         rc = -errno;
+         runfs_error("FATAL: sem_timedwait rc = %d\n", rc );
+         return rc;
+      }
+   }
+   else {
+      
+      sem_wait( &lane->work_sem );
+   }
+   
+   return 0;
+}
+
+
+// move a lane's delayed requests that have come due onto its work list
+// NOTE: the queue's work_lock must be held
+static void runfs_wq_lane_promote_delayed( struct runfs_wq_lane* lane ) {
+   
+   struct timespec now;
+   struct runfs_wreq* itr = lane->delayed;
+   struct runfs_wreq* still_delayed = NULL;
+   struct runfs_wreq* next = NULL;
+   
+   clock_gettime( CLOCK_REALTIME, &now );
+   
+   while( itr != NULL ) {
+      
+      next = itr->next;
+      itr->next = NULL;
+      
+      if( runfs_timespec_before( &now, &itr->not_before ) ) {
+         
+         // not yet
+         itr->next = still_delayed;
+         still_delayed = itr;
+      }
+      else if( lane->work == NULL ) {
+         
+         lane->work = itr;
+         lane->tail = itr;
+      }
+      else {
+         
+         lane->tail->next = itr;
+         lane->tail = itr;
+      }
+      
+      itr = next;
+   }
+   
+   lane->delayed = still_delayed;
+}
+
+
+// which bucket of the pending-key set a key goes in (Fibonacci hashing, since inode numbers are sequential)
+static uint64_t runfs_wq_key_bucket( struct runfs_wq* wq, uint64_t key ) {
+   
+   return ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (wq->num_key_buckets - 1);
+}
+
+
+// remember that a request with a key is pending 
+// NOTE: the queue's work_lock must be held
+static void runfs_wq_key_insert( struct runfs_wq* wq, struct runfs_wreq* wreq ) {
+   
+   if( wreq->key == 0 ) {
+      return;
+   }
+   
+   uint64_t bucket = runfs_wq_key_bucket( wq, wreq->key );
+   
+   wreq->key_next = wq->keys[ bucket ];
+   wq->keys[ bucket ] = wreq;
+}
+
+
+// forget a pending request, now that it's running (or being freed)
+// NOTE: the queue's work_lock must be held
+static void runfs_wq_key_remove( struct runfs_wq* wq, struct runfs_wreq* wreq ) {
+   
+   if( wreq->key == 0 ) {
+      return;
+   }
+   
+   for( struct runfs_wreq** itr = &wq->keys[ runfs_wq_key_bucket( wq, wreq->key ) ]; *itr != NULL; itr = &(*itr)->key_next ) {
+      
+      if( *itr == wreq ) {
+         
+         *itr = wreq->key_next;
+         break;
+      }
+   }
+   
+   wreq->key_next = NULL;
+}
+
+
+// is there a pending request with the given key in any lane?
+// NOTE: the queue's work_lock must be held
+static bool runfs_wq_has_key( struct runfs_wq* wq, uint64_t key ) {
+   
+   for( struct runfs_wreq* itr = wq->keys[ runfs_wq_key_bucket( wq, key ) ]; itr != NULL; itr = itr->key_next ) {
+      
+      if( itr->key == key ) {
+         return true;
+      }
+   }
+   
+   return false;
+}
+
+
+// work queue lane main method
 static void* runfs_wq_main( void* cls ) {
    
-   struct runfs_wq* wq = (struct runfs_wq*)cls;
+   struct runfs_wq_lane* lane = (struct runfs_wq_lane*)cls;
+   struct runfs_wq* wq = lane->wq;
    
    struct runfs_wreq* work_itr = NULL;
-   struct runfs_wreq* next = NULL;
+   struct timespec now;
    
    int rc = 0;
+   
+   if( lane->id == RUNFS_WQ_LANE_BACKGROUND ) {
+      
+      // stay out of the way of the FUSE threads and the fast lane
+      rc = setpriority( PRIO_PROCESS, syscall( SYS_gettid ), RUNFS_WQ_BACKGROUND_NICE );
+      if( rc != 0 ) {
+         runfs_debug("setpriority errno = %d\n", -errno );
+      }
+   }
 
    while( wq->running ) {
 
-      // is there work?
-      rc = sem_trywait( &wq->work_sem );
+      rc = runfs_wq_lane_wait_work( lane );
       if( rc != 0 ) {
-         
-         rc = -errno;
-         if( rc == -EAGAIN ) {
-            
-            // wait for work
-            sem_wait( &wq->work_sem );
-         }
-         else {
-            
-            // some other fatal error 
-            runfs_error("FATAL: sem_trywait rc = %d\n", rc );
-            break;
-         }
+         break;
       }
       
       // cancelled?
@@ -56,21 +244,40 @@ static void* runfs_wq_main( void* cls ) {
          break;
       }
 
-      // exchange buffers--we have work to do
       pthread_mutex_lock( &wq->work_lock );
-
-      work_itr = wq->work;
-      wq->work = NULL;
-      wq->tail = NULL;
       
-      pthread_mutex_unlock( &wq->work_lock );
-
-      // safe to use work buffer (we'll clear it out in the process)
-      while( work_itr != NULL ) {
+      runfs_wq_lane_promote_delayed( lane );
+      
+      // do all the work that's ready, one request at a time, so later requests can be coalesced with pending ones
+      while( lane->work != NULL && wq->running ) {
+         
+         work_itr = lane->work;
+         lane->work = work_itr->next;
+         work_itr->next = NULL;
+         
+         if( lane->work == NULL ) {
+            lane->tail = NULL;
+         }
+         
+         // running requests aren't pending; a new one for the same key may be needed after this one looked
+         runfs_wq_key_remove( wq, work_itr );
+         
+         lane->busy = true;
+         
+         clock_gettime( CLOCK_MONOTONIC, &now );
+         lane->stats.total_wait_ms += runfs_timespec_diff_ms( &work_itr->enqueued, &now );
+         
+         uint64_t depth = lane->stats.depth;
+         
+         pthread_mutex_unlock( &wq->work_lock );
 
          // carry out work
          runfs_debug("begin work %p\n", work_itr->work_data);
+         RUNFS_PROBE3( work__begin, lane->id, depth, work_itr );
+         
          rc = (*work_itr->work)( work_itr, work_itr->work_data );
+         
+         RUNFS_PROBE4( work__end, lane->id, work_itr, rc, (int)work_itr->retry );
          runfs_debug("end work %p\n", work_itr->work_data);
          
          if( rc != 0 ) {
@@ -78,14 +285,38 @@ static void* runfs_wq_main( void* cls ) {
             runfs_error("work %p rc = %d\n", work_itr->work, rc );
          }
          
+         pthread_mutex_lock( &wq->work_lock );
          
-         next = work_itr->next;
-        
-         runfs_wreq_free( work_itr );
-         runfs_safe_free( work_itr );
+         lane->busy = false;
          
-         work_itr = next;
+         if( work_itr->retry ) {
+            
+            // callback wants to run again later
+            work_itr->retry = false;
+            
+            work_itr->next = lane->delayed;
+            lane->delayed = work_itr;
+            
+            runfs_wq_key_insert( wq, work_itr );
+            
+            clock_gettime( CLOCK_MONOTONIC, &work_itr->enqueued );
+            lane->stats.num_retried++;
+         }
+         else {
+            
+            lane->stats.depth--;
+            lane->stats.num_completed++;
+            wq->backlog--;
+            
+            runfs_wreq_free( work_itr );
+            runfs_safe_free( work_itr );
+         }
       }
+      
+      // caught up 
+      pthread_cond_broadcast( &lane->idle_cond );
+      
+      pthread_mutex_unlock( &wq->work_lock );
    }
 
    return NULL;
@@ -99,10 +330,11 @@ struct runfs_wq* runfs_wq_new() {
 
 
 // set up a work queue, but don't start it.
+// it will hold at most max_backlog pending requests (0 means RUNFS_WQ_DEFAULT_MAX_BACKLOG)
 // return 0 on success
 // return negative on failure:
 // * -ENOMEM if OOM
-int runfs_wq_init( struct runfs_wq* wq ) {
+int runfs_wq_init( struct runfs_wq* wq, uint64_t max_backlog ) {
 
    int rc = 0;
 
@@ -114,7 +346,51 @@ int runfs_wq_init( struct runfs_wq* wq ) {
       return -abs(rc);
    }
    
-   sem_init( &wq->work_sem, 0, 0 );
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      wq->lanes[i].wq = wq;
+      wq->lanes[i].id = i;
+      
+      rc = pthread_cond_init( &wq->lanes[i].idle_cond, NULL );
+      if( rc != 0 ) {
+         
+         for( int j = 0; j < i; j++ ) {
+            
+            pthread_cond_destroy( &wq->lanes[j].idle_cond );
+            sem_destroy( &wq->lanes[j].work_sem );
+         }
+         
+         pthread_mutex_destroy( &wq->work_lock );
+         return -abs(rc);
+      }
+      
+      sem_init( &wq->lanes[i].work_sem, 0, 0 );
+   }
+   
+   if( max_backlog == 0 ) {
+      max_backlog = RUNFS_WQ_DEFAULT_MAX_BACKLOG;
+   }
+   
+   wq->max_backlog = max_backlog;
+   
+   // enough buckets that a full backlog averages at most RUNFS_WQ_KEYS_PER_BUCKET per bucket
+   wq->num_key_buckets = 1;
+   while( wq->num_key_buckets * RUNFS_WQ_KEYS_PER_BUCKET < max_backlog ) {
+      wq->num_key_buckets *= 2;
+   }
+   
+   wq->keys = RUNFS_CALLOC( struct runfs_wreq*, wq->num_key_buckets );
+   if( wq->keys == NULL ) {
+      
+      for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+         
+         pthread_cond_destroy( &wq->lanes[i].idle_cond );
+         sem_destroy( &wq->lanes[i].work_sem );
+      }
+      
+      pthread_mutex_destroy( &wq->work_lock );
+      return -ENOMEM;
+   }
    
    return rc;
 }
@@ -138,15 +414,19 @@ int runfs_wq_start( struct runfs_wq* wq ) {
 
    wq->running = true;
 
-   rc = pthread_create( &wq->thread, &attrs, runfs_wq_main, wq );
-   if( rc != 0 ) {
-
-      wq->running = false;
-
-      rc = -errno;
-      runfs_error("pthread_create errno = %d\n", rc );
-
-      return rc;
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      rc = pthread_create( &wq->lanes[i].thread, &attrs, runfs_wq_main, &wq->lanes[i] );
+      if( rc != 0 ) {
+         
+         rc = -abs(rc);
+         runfs_error("pthread_create rc = %d\n", rc );
+         
+         runfs_wq_stop( wq );
+         return rc;
+      }
+      
+      wq->lanes[i].started = true;
    }
 
    return 0;
@@ -164,12 +444,100 @@ int runfs_wq_stop( struct runfs_wq* wq ) {
 
    wq->running = false;
 
-   // wake up the work queue so it cancels
-   sem_post( &wq->work_sem );
-   pthread_cancel( wq->thread );
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      if( !wq->lanes[i].started ) {
+         continue;
+      }
+      
+      // wake up the work queue so it cancels
+      sem_post( &wq->lanes[i].work_sem );
+      pthread_cancel( wq->lanes[i].thread );
+
+      pthread_join( wq->lanes[i].thread, NULL );
+      
+      wq->lanes[i].started = false;
+   }
+
+   return 0;
+}
+
+
+// wait for the work queue to finish all of the work that's ready to run (but not delayed work) in all lanes.
+// give up after timeout_ms milliseconds.
+// return 0 on success
+// return -ETIMEDOUT if the queue didn't drain in time
+int runfs_wq_flush( struct runfs_wq* wq, int64_t timeout_ms ) {
+   
+   int rc = 0;
+   struct timespec deadline;
+   
+   clock_gettime( CLOCK_REALTIME, &deadline );
+   runfs_timespec_add_ms( &deadline, timeout_ms );
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES && rc == 0; i++ ) {
+      
+      struct runfs_wq_lane* lane = &wq->lanes[i];
+      
+      while( wq->running && (lane->work != NULL || lane->busy) ) {
+         
+         rc = pthread_cond_timedwait( &lane->idle_cond, &wq->work_lock, &deadline );
+         if( rc == ETIMEDOUT ) {
+            
+            rc = -ETIMEDOUT;
+            break;
+         }
+         
+         rc = 0;
+      }
+   }
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
+   return rc;
+}
 
-   pthread_join( wq->thread, NULL );
 
+// get a snapshot of a lane's statistics
+// return 0 on success
+// return -EINVAL if the lane is invalid
+int runfs_wq_get_stats( struct runfs_wq* wq, int lane_id, struct runfs_wq_stats* stats ) {
+   
+   struct timespec now;
+   struct timespec const* oldest = NULL;
+   
+   if( lane_id < 0 || lane_id >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   struct runfs_wq_lane* lane = &wq->lanes[ lane_id ];
+   
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   *stats = lane->stats;
+   
+   // work list is in FIFO order 
+   if( lane->work != NULL ) {
+      oldest = &lane->work->enqueued;
+   }
+   
+   for( struct runfs_wreq* itr = lane->delayed; itr != NULL; itr = itr->next ) {
+      
+      if( oldest == NULL || runfs_timespec_before( &itr->enqueued, oldest ) ) {
+         oldest = &itr->enqueued;
+      }
+   }
+   
+   if( oldest != NULL ) {
+      stats->oldest_age_ms = runfs_timespec_diff_ms( oldest, &now );
+   }
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
    return 0;
 }
 
@@ -203,17 +571,26 @@ int runfs_wq_free( struct runfs_wq* wq ) {
    }
 
    // free all
-   runfs_wq_queue_free( wq->work );
+   for( int i = 0; i < RUNFS_WQ_NUM_LANES; i++ ) {
+      
+      runfs_wq_queue_free( wq->lanes[i].work );
+      runfs_wq_queue_free( wq->lanes[i].delayed );
+      
+      pthread_cond_destroy( &wq->lanes[i].idle_cond );
+      sem_destroy( &wq->lanes[i].work_sem );
+   }
 
    pthread_mutex_destroy( &wq->work_lock );
-   sem_destroy( &wq->work_sem );
+   
+   // the requests in it are gone 
+   runfs_safe_free( wq->keys );
 
    memset( wq, 0, sizeof(struct runfs_wq) );
 
    return 0;
 }
 
-// create a work request
+// create a work request.  It goes in the fast lane by default.
 // always succeeds
 int runfs_wreq_init( struct runfs_wreq* wreq, runfs_wq_func_t work, void* work_data ) {
 
@@ -221,6 +598,30 @@ int runfs_wreq_init( struct runfs_wreq* wreq, runfs_wq_func_t work, void* work_d
 
    wreq->work = work;
    wreq->work_data = work_data;
+   wreq->lane = RUNFS_WQ_LANE_FAST;
+   return 0;
+}
+
+// put a work request into a lane
+// return 0 on success
+// return -EINVAL if the lane is invalid
+int runfs_wreq_set_lane( struct runfs_wreq* wreq, int lane ) {
+   
+   if( lane < 0 || lane >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   wreq->lane = lane;
+   return 0;
+}
+
+// identify what a work request works on, so duplicate requests get coalesced.
+// the key must outlive the request: use an identifier that is not reused while the request
+// can still be pending (e.g. an inode number), not an address.  0 means "no key".
+// always succeeds
+int runfs_wreq_set_key( struct runfs_wreq* wreq, uint64_t key ) {
+   
+   wreq->key = key;
    return 0;
 }
 
@@ -231,30 +632,172 @@ int runfs_wreq_free( struct runfs_wreq* wreq ) {
    return 0;
 }
 
-// enqueue work.  The work queue takes onwership of the wreq, so it must be malloc'ed
+// ask the work queue to run this request again after delay_ms milliseconds, instead of freeing it.
+// only call this from within the request's callback.
 // always succeeds
+int runfs_wreq_retry( struct runfs_wreq* wreq, int64_t delay_ms ) {
+   
+   clock_gettime( CLOCK_REALTIME, &wreq->not_before );
+   runfs_timespec_add_ms( &wreq->not_before, delay_ms );
+   
+   wreq->retry = true;
+   return 0;
+}
+
+// reserve room in the backlog for a request we're about to make in the given lane, if there is room and
+// no request for the same key (if not 0) is already pending.  Refusals are counted against the given lane.
+// if the request turns out to belong in another lane, move the reservation there with runfs_wq_reserve_move().
+// use this when preparing the request has side-effects that can't be undone if runfs_wq_add fails.
+// NOTE: the caller must make sure no one else reserves for the same key concurrently.
+// return 0 on success; the caller must either runfs_wq_add() a request with the same key, or runfs_wq_unreserve()
+// return -EEXIST if a request with the same key is pending
+// return -EAGAIN if the backlog is full
+int runfs_wq_reserve( struct runfs_wq* wq, int lane, uint64_t key ) {
+   
+   int rc = 0;
+   
+   if( lane < 0 || lane >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   if( key != 0 && runfs_wq_has_key( wq, key ) ) {
+      
+      wq->lanes[ lane ].stats.num_coalesced++;
+      rc = -EEXIST;
+   }
+   else if( wq->backlog >= wq->max_backlog ) {
+      
+      wq->lanes[ lane ].stats.num_rejected++;
+      rc = -EAGAIN;
+   }
+   else {
+      
+      wq->backlog++;
+      wq->lanes[ lane ].stats.reserved++;
+   }
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
+   return rc;
+}
+
+// give back a reservation made in a lane with runfs_wq_reserve
+// return 0 on success
+// return -EINVAL if the lane is invalid
+int runfs_wq_unreserve( struct runfs_wq* wq, int lane ) {
+   
+   if( lane < 0 || lane >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   wq->backlog--;
+   wq->lanes[ lane ].stats.reserved--;
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
+   return 0;
+}
+
+// move a reservation made with runfs_wq_reserve from one lane to another, once the caller knows where the request belongs.
+// the backlog slot stays reserved.
+// return 0 on success
+// return -EINVAL if a lane is invalid
+int runfs_wq_reserve_move( struct runfs_wq* wq, int from_lane, int to_lane ) {
+   
+   if( from_lane < 0 || from_lane >= RUNFS_WQ_NUM_LANES || to_lane < 0 || to_lane >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   if( from_lane == to_lane ) {
+      return 0;
+   }
+   
+   pthread_mutex_lock( &wq->work_lock );
+   
+   wq->lanes[ from_lane ].stats.reserved--;
+   wq->lanes[ to_lane ].stats.reserved++;
+   
+   pthread_mutex_unlock( &wq->work_lock );
+   
+   return 0;
+}
+
+// enqueue work.  The work queue takes onwership of the wreq, so it must be malloc'ed
+// If wreq->reserved is set, the caller has already reserved room for it with runfs_wq_reserve, in wreq's lane.
+// return 0 on success 
+// return -EEXIST if a request with the same key is already pending (the caller keeps ownership of wreq)
+// return -EAGAIN if the backlog is full (the caller keeps ownership of wreq)
+// return -EINVAL if the wreq's lane is invalid
 int runfs_wq_add( struct runfs_wq* wq, struct runfs_wreq* wreq ) {
 
    int rc = 0;
+   
+   if( wreq->lane < 0 || wreq->lane >= RUNFS_WQ_NUM_LANES ) {
+      return -EINVAL;
+   }
+   
+   struct runfs_wq_lane* lane = &wq->lanes[ wreq->lane ];
+   uint64_t depth = 0;
 
    pthread_mutex_lock( &wq->work_lock );
    
-   if( wq->work == NULL ) {
-      // head
-      wq->work = wreq;
-      wq->tail = wreq;
+   if( !wreq->reserved && wreq->key != 0 && runfs_wq_has_key( wq, wreq->key ) ) {
+      
+      lane->stats.num_coalesced++;
+      rc = -EEXIST;
+   }
+   else if( !wreq->reserved && wq->backlog >= wq->max_backlog ) {
+      
+      lane->stats.num_rejected++;
+      rc = -EAGAIN;
    }
    else {
-      // append 
-      wq->tail->next = wreq;
-      wq->tail = wreq;
+      
+      if( !wreq->reserved ) {
+         wq->backlog++;
+      }
+      else {
+         lane->stats.reserved--;
+      }
+      
+      clock_gettime( CLOCK_MONOTONIC, &wreq->enqueued );
+      wreq->next = NULL;
+      
+      if( lane->work == NULL ) {
+         // head
+         lane->work = wreq;
+         lane->tail = wreq;
+      }
+      else {
+         // append 
+         lane->tail->next = wreq;
+         lane->tail = wreq;
+      }
+      
+      runfs_wq_key_insert( wq, wreq );
+      
+      lane->stats.depth++;
+      lane->stats.num_added++;
+      
+      if( lane->stats.depth > lane->stats.max_depth ) {
+         lane->stats.max_depth = lane->stats.depth;
+      }
+      
+      depth = lane->stats.depth;
    }
    
    pthread_mutex_unlock( &wq->work_lock );
 
    if( rc == 0 ) {
+      
+      RUNFS_PROBE3( wq__add, lane->id, depth, wreq );
+      
       // have work
-      sem_post( &wq->work_sem );
+      sem_post( &lane->work_sem );
    }
    
    return rc;
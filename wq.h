@@ -25,6 +25,21 @@
 #include "os.h"
 #include "util.h"
 
+// work queue lanes, in priority order.  Each lane has its own worker thread, so work in a
+// lower-priority lane never holds up work in a higher-priority one.
+#define RUNFS_WQ_LANE_FAST              0       // small, latency-sensitive work
+#define RUNFS_WQ_LANE_BACKGROUND        1       // big, slow work (runs at a lower CPU priority)
+#define RUNFS_WQ_NUM_LANES              2
+
+// default bound on the number of pending requests in a work queue (across all lanes)
+#define RUNFS_WQ_DEFAULT_MAX_BACKLOG    65536
+
+// pending requests per bucket of the pending-key set, at most, when the backlog is full
+#define RUNFS_WQ_KEYS_PER_BUCKET        4
+
+// niceness of the background lane's worker thread
+#define RUNFS_WQ_BACKGROUND_NICE        10
+
 struct runfs_wreq;
 
 // runfs workqueue callback type
@@ -40,37 +55,100 @@ struct runfs_wreq {
    void* work_data;
    
    struct runfs_wreq* next;     // pointer to next work element
+   
+   bool retry;                  // if true, the callback asked to be run again at not_before
+   struct timespec not_before;  // earliest time (CLOCK_REALTIME) to run this request
+   
+   int lane;                    // which lane to run in (RUNFS_WQ_LANE_*)
+   uint64_t key;                // if not 0, identifies the thing this request works on.  Requests with the same key are coalesced.
+   struct runfs_wreq* key_next; // next pending request in the same bucket of the queue's pending-key set 
+   bool reserved;               // if true, a slot in the backlog was already reserved for this request
+   struct timespec enqueued;    // when this request was added (CLOCK_MONOTONIC)
 };
 
-// runfs workqueue
-struct runfs_wq {
+// work queue lane statistics
+struct runfs_wq_stats {
+   
+   uint64_t depth;              // number of pending requests (including delayed ones)
+   uint64_t reserved;           // number of backlog slots reserved for requests not yet added
+   uint64_t max_depth;          // largest depth seen
+   uint64_t num_added;          // number of requests accepted
+   uint64_t num_completed;      // number of requests finished
+   uint64_t num_retried;        // number of times a request asked to be run again
+   uint64_t num_coalesced;      // number of requests dropped because an identical one was pending
+   uint64_t num_rejected;       // number of requests dropped because the backlog was full
+   uint64_t oldest_age_ms;      // age of the oldest pending request
+   uint64_t total_wait_ms;      // total time completed requests spent waiting to start
+};
+
+// a work queue lane
+struct runfs_wq_lane {
+   
+   struct runfs_wq* wq;         // queue we belong to
+   int id;                      // RUNFS_WQ_LANE_*
    
    // worker thread
    pthread_t thread;
-
-   // is the thread running?
-   volatile bool running;
-
+   bool started;
+   
    // things to do
    struct runfs_wreq* work;
    struct runfs_wreq* tail;
-
-   // lock governing access to work
-   pthread_mutex_t work_lock;
-
+   
+   // things to do later (unordered)
+   struct runfs_wreq* delayed;
+   
+   // is the worker in the middle of a request?
+   bool busy;
+   
+   // signaled when the worker runs out of work (governed by the queue's work_lock)
+   pthread_cond_t idle_cond;
+   
    // semaphore to signal the availability of work
    sem_t work_sem;
+   
+   // statistics (governed by the queue's work_lock)
+   struct runfs_wq_stats stats;
+};
+
+// runfs workqueue
+struct runfs_wq {
+   
+   // are the threads running?
+   volatile bool running;
+   
+   struct runfs_wq_lane lanes[ RUNFS_WQ_NUM_LANES ];
+   
+   // lock governing access to work in all lanes
+   pthread_mutex_t work_lock;
+   
+   // backlog bound, and how much of it is in use (governed by work_lock)
+   uint64_t max_backlog;
+   uint64_t backlog;
+   
+   // pending requests with keys (in a work or delayed list), hashed by key, so coalescing doesn't scan the backlog (governed by work_lock)
+   struct runfs_wreq** keys;
+   uint64_t num_key_buckets;    // always a power of 2
 };
 
 struct runfs_wq* runfs_wq_new();
-int runfs_wq_init( struct runfs_wq* wq );
+int runfs_wq_init( struct runfs_wq* wq, uint64_t max_backlog );
 int runfs_wq_start( struct runfs_wq* wq );
 int runfs_wq_stop( struct runfs_wq* wq );
 int runfs_wq_free( struct runfs_wq* wq );
+int runfs_wq_flush( struct runfs_wq* wq, int64_t timeout_ms );
+int runfs_wq_get_stats( struct runfs_wq* wq, int lane, struct runfs_wq_stats* stats );
 
 int runfs_wreq_init( struct runfs_wreq* wreq, runfs_wq_func_t work, void* work_data );
+int runfs_wreq_set_lane( struct runfs_wreq* wreq, int lane );
+int runfs_wreq_set_key( struct runfs_wreq* wreq, uint64_t key );
 int runfs_wreq_free( struct runfs_wreq* wreq );
 
+int runfs_wreq_retry( struct runfs_wreq* wreq, int64_t delay_ms );
+
+int runfs_wq_reserve( struct runfs_wq* wq, int lane, uint64_t key );
+int runfs_wq_unreserve( struct runfs_wq* wq, int lane );
+int runfs_wq_reserve_move( struct runfs_wq* wq, int from_lane, int to_lane );
 int runfs_wq_add( struct runfs_wq* wq, struct runfs_wreq* wreq );
 
 #endif